@@ -0,0 +1,262 @@
+#include "benchmark.h"
+
+#include <fmt/core.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+
+namespace
+{
+	// Metrics where lower is better, the only ones compared against the baseline. The draw and triangle counts
+	// describe the workload, a change there means the runs aren't comparable.
+	bool isComparedMetric(const std::string& name)
+	{
+		return name.ends_with("_ms") || name.ends_with("_mb");
+	}
+
+	bool isWorkloadMetric(const std::string& name)
+	{
+		return name.starts_with("draws") || name.starts_with("triangles");
+	}
+
+	// Workload metrics are averages, written with four decimals. They match when they round to the same value at
+	// that precision, or differ by less than a hundredth of a percent.
+	bool isSameWorkload(double value, double baselineValue)
+	{
+		if (std::round(value * 1e4) == std::round(baselineValue * 1e4))
+		{
+			return true;
+		}
+
+		return std::abs(value - baselineValue) <= 1e-4 * std::max(std::abs(value), std::abs(baselineValue));
+	}
+}
+
+FrameTimeStats computeFrameTimeStats(std::vector<double>& values)
+{
+	FrameTimeStats stats;
+
+	if (values.empty())
+	{
+		return stats;
+	}
+
+	std::sort(values.begin(), values.end());
+
+	auto percentile = [&values](double p)
+	{
+		size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+
+		return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+	};
+
+	stats.average = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+	stats.p50 = percentile(50.0);
+	stats.p95 = percentile(95.0);
+	stats.p99 = percentile(99.0);
+
+	return stats;
+}
+
+BenchmarkMetrics BenchmarkReport::computeMetrics() const
+{
+	std::vector<double> cpuTimes;
+	std::vector<double> gpuTimes;
+	double drawCount = 0.0;
+	double triangleCount = 0.0;
+	uint64_t peakDeviceMemory = 0;
+
+	for (const FrameSample& sample : samples)
+	{
+		cpuTimes.push_back(sample.cpuTime);
+		if (sample.gpuTime.has_value())
+		{
+			gpuTimes.push_back(sample.gpuTime.value());
+		}
+
+		drawCount += sample.drawCount;
+		triangleCount += (double)sample.triangleCount;
+		peakDeviceMemory = std::max(peakDeviceMemory, sample.deviceMemory);
+	}
+
+	FrameTimeStats cpu = computeFrameTimeStats(cpuTimes);
+	FrameTimeStats gpu = computeFrameTimeStats(gpuTimes);
+	double frameCount = (double)std::max<size_t>(samples.size(), 1);
+
+	return {
+		{ "frames", (double)samples.size() },
+		{ "cpu_avg_ms", cpu.average },
+		{ "cpu_p50_ms", cpu.p50 },
+		{ "cpu_p95_ms", cpu.p95 },
+		{ "cpu_p99_ms", cpu.p99 },
+		{ "gpu_avg_ms", gpu.average },
+		{ "gpu_p50_ms", gpu.p50 },
+		{ "gpu_p95_ms", gpu.p95 },
+		{ "gpu_p99_ms", gpu.p99 },
+		{ "draws_per_frame", drawCount / frameCount },
+		{ "triangles_per_frame", triangleCount / frameCount },
+		{ "device_memory_peak_mb", peakDeviceMemory / (1024.0 * 1024.0) }
+	};
+}
+
+bool BenchmarkReport::writeCsv(const std::filesystem::path& path) const
+{
+	std::ofstream file(path);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to write benchmark CSV \"{}\".", path.string());
+
+		return false;
+	}
+
+	file << "frame,cpu_ms,gpu_ms,draws,triangles,device_memory_mb\n";
+
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		const FrameSample& sample = samples[i];
+
+		// Left empty when the timestamps of the frame weren't resolved.
+		std::string gpuTime = sample.gpuTime.has_value() ? fmt::format("{:.4f}", sample.gpuTime.value()) : "";
+
+		file << fmt::format("{},{:.4f},{},{},{},{:.2f}\n", i, sample.cpuTime, gpuTime, sample.drawCount, sample.triangleCount, sample.deviceMemory / (1024.0 * 1024.0));
+	}
+
+	return true;
+}
+
+bool BenchmarkReport::writeJson(const std::filesystem::path& path, const std::string& scene, const BenchmarkMetrics& metrics) const
+{
+	std::ofstream file(path);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to write benchmark JSON \"{}\".", path.string());
+
+		return false;
+	}
+
+	// The scene path is only escaped for backslashes and quotes, it's informative and never read back.
+	std::string escapedScene;
+
+	for (char c : scene)
+	{
+		if (c == '\\' || c == '"')
+		{
+			escapedScene += '\\';
+		}
+
+		escapedScene += c;
+	}
+
+	file << "{\n";
+	file << fmt::format("\t\"scene\": \"{}\",\n", escapedScene);
+	file << "\t\"metrics\": {\n";
+
+	for (size_t i = 0; i < metrics.size(); i++)
+	{
+		file << fmt::format("\t\t\"{}\": {:.4f}{}\n", metrics[i].first, metrics[i].second, i + 1 < metrics.size() ? "," : "");
+	}
+
+	file << "\t}\n";
+	file << "}\n";
+
+	return true;
+}
+
+std::optional<BenchmarkMetrics> loadBaseline(const std::filesystem::path& path)
+{
+	std::ifstream file(path);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to open benchmark baseline \"{}\".", path.string());
+
+		return {};
+	}
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+
+	std::string text = buffer.str();
+	size_t metricsStart = text.find("\"metrics\"");
+
+	if (metricsStart == std::string::npos || (metricsStart = text.find('{', metricsStart)) == std::string::npos)
+	{
+		fmt::println("Benchmark baseline \"{}\" has no metrics.", path.string());
+
+		return {};
+	}
+
+	size_t metricsEnd = text.find('}', metricsStart);
+	BenchmarkMetrics metrics;
+
+	// Only what writeJson produces is understood: "name": number pairs, without nesting.
+	for (size_t position = text.find('"', metricsStart); position < metricsEnd; position = text.find('"', position))
+	{
+		size_t nameEnd = text.find('"', position + 1);
+		size_t colon = text.find(':', nameEnd);
+
+		if (nameEnd == std::string::npos || colon == std::string::npos || colon > metricsEnd)
+		{
+			break;
+		}
+
+		std::string name = text.substr(position + 1, nameEnd - position - 1);
+		const char* valueStart = text.c_str() + colon + 1;
+		char* valueEnd = nullptr;
+		double value = std::strtod(valueStart, &valueEnd);
+
+		if (valueEnd == valueStart)
+		{
+			fmt::println("Benchmark baseline \"{}\" has an invalid value for \"{}\".", path.string(), name);
+
+			return {};
+		}
+
+		metrics.emplace_back(name, value);
+
+		position = valueEnd - text.c_str();
+	}
+
+	return metrics;
+}
+
+bool compareWithBaseline(const BenchmarkMetrics& metrics, const BenchmarkMetrics& baseline, double thresholdPercent)
+{
+	bool passed = true;
+
+	fmt::println("{:<24} {:>12} {:>12} {:>9}", "Metric", "Baseline", "Current", "Change");
+
+	for (const auto& [name, value] : metrics)
+	{
+		auto baselineMetric = std::find_if(baseline.begin(), baseline.end(), [&name](const auto& metric) { return metric.first == name; });
+
+		if (baselineMetric == baseline.end())
+		{
+			continue;
+		}
+
+		double baselineValue = baselineMetric->second;
+		double change = baselineValue != 0.0 ? (value - baselineValue) / baselineValue * 100.0 : 0.0;
+		const char* verdict = "";
+
+		if (isComparedMetric(name) && change > thresholdPercent)
+		{
+			verdict = "REGRESSION";
+			passed = false;
+		}
+		else if (isWorkloadMetric(name) && !isSameWorkload(value, baselineValue))
+		{
+			verdict = "workload differs";
+		}
+
+		fmt::println("{:<24} {:>12.4f} {:>12.4f} {:>+8.2f}% {}", name, baselineValue, value, change, verdict);
+	}
+
+	return passed;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <filesystem>
+
+struct FrameSample
+{
+	// In milliseconds. The GPU time of a frame is only known once its timestamps are resolved, frames in flight later,
+	// and is missing for the last frames of the run.
+	double cpuTime;
+	std::optional<double> gpuTime;
+
+	uint32_t drawCount;
+	uint64_t triangleCount;
+
+	// Usage of the device local heaps, in bytes.
+	uint64_t deviceMemory;
+};
+
+struct FrameTimeStats
+{
+	double average = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+// Nearest-rank percentiles, the values are sorted in place.
+FrameTimeStats computeFrameTimeStats(std::vector<double>& values);
+
+// Metrics are kept in insertion order, so reports of different runs line up.
+using BenchmarkMetrics = std::vector<std::pair<std::string, double>>;
+
+class BenchmarkReport
+{
+public:
+	void addFrame(const FrameSample& sample) { samples.push_back(sample); }
+
+	void setGpuTime(size_t frame, double gpuTime) { samples[frame].gpuTime = gpuTime; }
+
+	size_t getFrameCount() const { return samples.size(); }
+
+	BenchmarkMetrics computeMetrics() const;
+
+	// One row per measured frame.
+	bool writeCsv(const std::filesystem::path& path) const;
+
+	// The summary metrics, as a flat "metrics" object.
+	bool writeJson(const std::filesystem::path& path, const std::string& scene, const BenchmarkMetrics& metrics) const;
+
+private:
+	std::vector<FrameSample> samples;
+};
+
+// Reads back the "metrics" object of a report written by writeJson.
+std::optional<BenchmarkMetrics> loadBaseline(const std::filesystem::path& path);
+
+// Compares the timing and memory metrics, where lower is better. Returns false when one of them got worse than the baseline
+// by more than the threshold, in percent.
+bool compareWithBaseline(const BenchmarkMetrics& metrics, const BenchmarkMetrics& baseline, double thresholdPercent);
@@ -0,0 +1,325 @@
+// Vulkan Renderer benchmark.
+//
+// Runs the engine over a fixed number of frames, optionally replaying a recorded flythrough in lockstep or rendering a
+// captured frame, and reports CPU and GPU frame times, draw and triangle counts and device memory usage. With a baseline
+// report, the run fails when a timing or memory metric regressed past the threshold. With --micro, it times the CPU hot paths of the engine instead,
+// without creating a window or a Vulkan device.
+
+#define VMA_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../core/engine.h"
+
+#include "benchmark.h"
+#include "micro.h"
+
+namespace
+{
+	// Returned when the run itself succeeded but regressed against the baseline.
+	constexpr int EXIT_REGRESSION = 2;
+
+	struct BenchmarkOptions
+	{
+		std::string scenePath = "assets/basicmesh.glb";
+		std::string worldManifestPath = WORLD_MANIFEST_PATH;
+		std::string replayPath;
+		std::string capturePath;
+
+		std::string animatedModelPath;
+		uint32_t crowdSize = 100;
+
+		// Zero leaves the particles disabled.
+		float particleRate = 0.0f;
+		bool sortedParticles = false;
+
+		// Zero measures until the replay is finished.
+		uint32_t frames = 1000;
+		uint32_t warmupFrames = 100;
+
+		bool headless = false;
+		bool validation = false;
+
+		std::string csvPath;
+		std::string jsonPath;
+		std::string baselinePath;
+		double threshold = 5.0;
+
+		bool micro = false;
+		std::vector<uint32_t> microSizes = { 1024, 65536, 1048576 };
+		double microTime = 0.5;
+	};
+
+	void printUsage()
+	{
+		fmt::println("Usage: Benchmark [options]");
+		fmt::println("  --scene <path>      glTF scene loaded up front, all of its meshes are drawn (default: assets/basicmesh.glb).");
+		fmt::println("  --world <path>      World manifest streamed around the camera (default: {}).", WORLD_MANIFEST_PATH);
+		fmt::println("  --replay <path>     Input recording replayed in lockstep once the warmup is done.");
+		fmt::println("  --capture <path>    Frame capture rendered on every frame instead of the scene.");
+		fmt::println("  --animated <path>   Skinned and animated glTF model, spawned as a crowd.");
+		fmt::println("  --crowd <count>     Instances of the animated model (default: 100).");
+		fmt::println("  --particles <rate>  GPU particles emitted per second, 0 to disable them (default: 0).");
+		fmt::println("  --sorted-particles  Alpha blended particles, sorted on the GPU, instead of additive ones.");
+		fmt::println("  --frames <count>    Measured frames, 0 to measure until the replay is finished (default: 1000).");
+		fmt::println("  --warmup <count>    Frames rendered before measuring (default: 100).");
+		fmt::println("  --headless          Hidden window, no interface and no vsync.");
+		fmt::println("  --validation        Keep the validation layers enabled.");
+		fmt::println("  --csv <path>        Per-frame samples.");
+		fmt::println("  --json <path>       Summary metrics.");
+		fmt::println("  --baseline <path>   Summary of a previous run to compare against.");
+		fmt::println("  --threshold <pct>   Allowed regression of the timing and memory metrics (default: 5).");
+		fmt::println("  --micro             Times the CPU hot paths on synthetic data instead, without a Vulkan device.");
+		fmt::println("  --micro-sizes <list> Mesh sizes of the micro benchmarks, in vertices (default: 1024,65536,1048576).");
+		fmt::println("  --micro-time <s>    Minimum time of each micro benchmark, in seconds (default: 0.5).");
+		fmt::println("Exits with {} when a metric regressed past the threshold.", EXIT_REGRESSION);
+	}
+
+	std::vector<uint32_t> parseSizes(const std::string& list)
+	{
+		std::vector<uint32_t> sizes;
+		size_t start = 0;
+
+		while (start <= list.size())
+		{
+			size_t end = std::min(list.find(',', start), list.size());
+
+			sizes.push_back((uint32_t)std::stoul(list.substr(start, end - start)));
+
+			start = end + 1;
+		}
+
+		return sizes;
+	}
+
+	BenchmarkOptions parseOptions(int argc, char* argv[])
+	{
+		BenchmarkOptions options;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string argument = argv[i];
+
+			// Every option but the flags takes one value.
+			auto value = [&]() -> const char*
+			{
+				if (i + 1 >= argc)
+				{
+					throw std::invalid_argument(fmt::format("Missing value for {}.", argument));
+				}
+
+				return argv[++i];
+			};
+
+			if (argument == "--scene") { options.scenePath = value(); }
+			else if (argument == "--world") { options.worldManifestPath = value(); }
+			else if (argument == "--replay") { options.replayPath = value(); }
+			else if (argument == "--capture") { options.capturePath = value(); }
+			else if (argument == "--animated") { options.animatedModelPath = value(); }
+			else if (argument == "--crowd") { options.crowdSize = (uint32_t)std::stoul(value()); }
+			else if (argument == "--particles") { options.particleRate = std::stof(value()); }
+			else if (argument == "--sorted-particles") { options.sortedParticles = true; }
+			else if (argument == "--frames") { options.frames = (uint32_t)std::stoul(value()); }
+			else if (argument == "--warmup") { options.warmupFrames = (uint32_t)std::stoul(value()); }
+			else if (argument == "--headless") { options.headless = true; }
+			else if (argument == "--validation") { options.validation = true; }
+			else if (argument == "--csv") { options.csvPath = value(); }
+			else if (argument == "--json") { options.jsonPath = value(); }
+			else if (argument == "--baseline") { options.baselinePath = value(); }
+			else if (argument == "--threshold") { options.threshold = std::stod(value()); }
+			else if (argument == "--micro") { options.micro = true; }
+			else if (argument == "--micro-sizes") { options.microSizes = parseSizes(value()); }
+			else if (argument == "--micro-time") { options.microTime = std::stod(value()); }
+			else
+			{
+				throw std::invalid_argument(fmt::format("Unknown option {}.", argument));
+			}
+		}
+
+		if (options.frames == 0 && options.replayPath.empty())
+		{
+			throw std::invalid_argument("Measuring until the end of the replay needs --replay.");
+		}
+
+		return options;
+	}
+
+	uint64_t getDeviceMemoryUsage(const Engine& engine)
+	{
+		uint64_t usage = 0;
+
+		for (const MemoryHeapStats& heap : engine.memoryManager.getHeapStats())
+		{
+			if (heap.deviceLocal)
+			{
+				usage += heap.usage;
+			}
+		}
+
+		return usage;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+
+	try
+	{
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+
+		printUsage();
+
+		return EXIT_FAILURE;
+	}
+
+	if (options.micro)
+	{
+		runMicroBenchmarks(options.microSizes, options.microTime);
+
+		return EXIT_SUCCESS;
+	}
+
+	Engine engine;
+	BenchmarkReport report;
+
+	// What the reports are named after.
+	const std::string& workload = options.capturePath.empty() ? options.scenePath : options.capturePath;
+
+	engine.settings.scenePath = options.scenePath;
+	engine.settings.worldManifestPath = options.worldManifestPath;
+	engine.settings.frameCapturePath = options.capturePath;
+	engine.settings.animatedModelPath = options.animatedModelPath;
+	engine.settings.crowdSize = options.crowdSize;
+	engine.particlesEnabled = options.particleRate > 0.0f;
+	engine.particleEmitter.rate = options.particleRate;
+	engine.sortParticles = options.sortedParticles;
+	engine.settings.sceneMesh = -1;
+	engine.settings.visibleWindow = !options.headless;
+	engine.settings.vsync = !options.headless;
+	engine.settings.showInterface = !options.headless;
+	engine.useValidationLayers = options.validation;
+
+	try
+	{
+		engine.initialize();
+
+		for (uint32_t i = 0; i < options.warmupFrames && !glfwWindowShouldClose(engine.window); i++)
+		{
+			engine.runFrame();
+		}
+
+		if (!options.replayPath.empty() && !engine.inputSystem.startReplay(options.replayPath, true))
+		{
+			throw std::runtime_error("Failed to start the benchmark replay!");
+		}
+
+		fmt::println("Benchmarking \"{}\"...", workload);
+
+		// Sample of each measured frame, by frame number. GPU times are resolved frames in flight after their frame was
+		// recorded, and go to the sample of that frame. The ones of the warmup frames aren't measured.
+		std::unordered_map<uint32_t, size_t> measuredFrames;
+		uint32_t resolvedGpuFrame = engine.gpuFrameTimeFrame;
+
+		while (!glfwWindowShouldClose(engine.window))
+		{
+			if (options.frames > 0 ? report.getFrameCount() >= options.frames : engine.inputSystem.isReplayFinished())
+			{
+				break;
+			}
+
+			uint32_t frameNumber = engine.frameCount;
+
+			auto start = std::chrono::steady_clock::now();
+
+			engine.runFrame();
+
+			auto end = std::chrono::steady_clock::now();
+
+			FrameSample sample;
+
+			sample.cpuTime = std::chrono::duration<double, std::milli>(end - start).count();
+			sample.drawCount = engine.frameStats.drawCount;
+			sample.triangleCount = engine.frameStats.triangleCount;
+			sample.deviceMemory = getDeviceMemoryUsage(engine);
+
+			// A frame skipped by a resize or a minimized window records nothing: its CPU time and counters aren't a frame's.
+			if (engine.frameCount != frameNumber)
+			{
+				measuredFrames[frameNumber] = report.getFrameCount();
+
+				report.addFrame(sample);
+			}
+
+			// Stays on the last resolved frame when the timestamps of this one weren't ready.
+			if (engine.gpuFrameTimeFrame != resolvedGpuFrame)
+			{
+				resolvedGpuFrame = engine.gpuFrameTimeFrame;
+
+				auto measuredFrame = measuredFrames.find(resolvedGpuFrame);
+
+				if (measuredFrame != measuredFrames.end())
+				{
+					report.setGpuTime(measuredFrame->second, engine.gpuFrameTime);
+					measuredFrames.erase(measuredFrame);
+				}
+			}
+		}
+
+		engine.cleanUp();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	BenchmarkMetrics metrics = report.computeMetrics();
+
+	for (const auto& [name, value] : metrics)
+	{
+		fmt::println("{:<24} {:>12.4f}", name, value);
+	}
+
+	if (!options.csvPath.empty() && !report.writeCsv(options.csvPath))
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (!options.jsonPath.empty() && !report.writeJson(options.jsonPath, workload, metrics))
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (!options.baselinePath.empty())
+	{
+		std::optional<BenchmarkMetrics> baseline = loadBaseline(options.baselinePath);
+
+		if (!baseline.has_value())
+		{
+			return EXIT_FAILURE;
+		}
+
+		if (!compareWithBaseline(metrics, baseline.value(), options.threshold))
+		{
+			fmt::println("Regressed by more than {:.1f}% against \"{}\".", options.threshold, options.baselinePath);
+
+			return EXIT_REGRESSION;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,526 @@
+#include "micro.h"
+
+#include <fmt/core.h>
+
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <numeric>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../core/loader.h"
+#include "../core/geometry.h"
+#include "../core/culling.h"
+#include "../core/structures.h"
+#include "../core/animation.h"
+#include "../core/downsample.h"
+
+namespace
+{
+	struct Throughput
+	{
+		uint64_t items = 0;
+		uint64_t vertices = 0;
+	};
+
+	std::string formatRate(double perSecond)
+	{
+		if (perSecond >= 1e9) { return fmt::format("{:.2f} G/s", perSecond / 1e9); }
+		if (perSecond >= 1e6) { return fmt::format("{:.2f} M/s", perSecond / 1e6); }
+		if (perSecond >= 1e3) { return fmt::format("{:.2f} K/s", perSecond / 1e3); }
+
+		return fmt::format("{:.2f} /s", perSecond);
+	}
+
+	// Runs the function until the time is up, after one discarded warmup run. The result of the function is
+	// accumulated, which also keeps the compiler from optimizing the work away.
+	template<typename Function>
+	void measure(const char* name, uint32_t meshSize, double minSeconds, Function&& function)
+	{
+		function();
+
+		Throughput total;
+		uint64_t iterations = 0;
+		double elapsed = 0.0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		do
+		{
+			Throughput throughput = function();
+
+			total.items += throughput.items;
+			total.vertices += throughput.vertices;
+			iterations++;
+
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		while (elapsed < minSeconds);
+
+		fmt::println("{:<24} {:>10} {:>12.4f} {:>14} {:>14}", name, meshSize, elapsed / iterations * 1000.0,
+			formatRate(total.items / elapsed), total.vertices > 0 ? formatRate(total.vertices / elapsed) : "-");
+	}
+
+	// A binary glTF holding one square grid mesh of about vertexCount vertices, with positions, normals and UVs.
+	std::vector<std::byte> createSyntheticGLB(uint32_t vertexCount)
+	{
+		uint32_t side = std::max(2u, (uint32_t)std::ceil(std::sqrt((double)vertexCount)));
+		uint32_t gridVertexCount = side * side;
+		uint32_t indexCount = (side - 1) * (side - 1) * 6;
+
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec2> uvs;
+		std::vector<uint32_t> indices;
+
+		positions.reserve(gridVertexCount);
+		normals.reserve(gridVertexCount);
+		uvs.reserve(gridVertexCount);
+		indices.reserve(indexCount);
+
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				glm::vec2 uv{ (float)x / (side - 1), (float)y / (side - 1) };
+
+				positions.emplace_back(uv.x * 2.0f - 1.0f, std::sin(uv.x * 10.0f) * std::cos(uv.y * 10.0f) * 0.1f, uv.y * 2.0f - 1.0f);
+				normals.emplace_back(0.0f, 1.0f, 0.0f);
+				uvs.push_back(uv);
+			}
+		}
+
+		for (uint32_t y = 0; y + 1 < side; y++)
+		{
+			for (uint32_t x = 0; x + 1 < side; x++)
+			{
+				uint32_t corner = y * side + x;
+
+				indices.insert(indices.end(), { corner, corner + side, corner + 1, corner + 1, corner + side, corner + side + 1 });
+			}
+		}
+
+		// Every view is a multiple of four bytes long, so they stay aligned back to back.
+		size_t positionsSize = positions.size() * sizeof(glm::vec3);
+		size_t normalsSize = normals.size() * sizeof(glm::vec3);
+		size_t uvsSize = uvs.size() * sizeof(glm::vec2);
+		size_t indicesSize = indices.size() * sizeof(uint32_t);
+		size_t binarySize = positionsSize + normalsSize + uvsSize + indicesSize;
+
+		std::string json = fmt::format(
+			"{{\"asset\":{{\"version\":\"2.0\"}},"
+			"\"buffers\":[{{\"byteLength\":{}}}],"
+			"\"bufferViews\":["
+			"{{\"buffer\":0,\"byteOffset\":0,\"byteLength\":{}}},"
+			"{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{}}},"
+			"{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{}}},"
+			"{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{}}}],"
+			"\"accessors\":["
+			"{{\"bufferView\":0,\"componentType\":5126,\"count\":{},\"type\":\"VEC3\",\"min\":[-1,-1,-1],\"max\":[1,1,1]}},"
+			"{{\"bufferView\":1,\"componentType\":5126,\"count\":{},\"type\":\"VEC3\"}},"
+			"{{\"bufferView\":2,\"componentType\":5126,\"count\":{},\"type\":\"VEC2\"}},"
+			"{{\"bufferView\":3,\"componentType\":5125,\"count\":{},\"type\":\"SCALAR\"}}],"
+			"\"meshes\":[{{\"name\":\"grid\",\"primitives\":[{{\"attributes\":{{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2}},\"indices\":3}}]}}]}}",
+			binarySize,
+			positionsSize,
+			positionsSize, normalsSize,
+			positionsSize + normalsSize, uvsSize,
+			positionsSize + normalsSize + uvsSize, indicesSize,
+			positions.size(), normals.size(), uvs.size(), indices.size());
+
+		// The JSON chunk is padded with spaces, as the specification asks.
+		json.resize((json.size() + 3) & ~(size_t)3, ' ');
+
+		std::vector<std::byte> glb(12 + 8 + json.size() + 8 + binarySize);
+		std::byte* cursor = glb.data();
+
+		auto write = [&cursor](const void* data, size_t size)
+		{
+			memcpy(cursor, data, size);
+			cursor += size;
+		};
+
+		auto writeWord = [&write](uint32_t word)
+		{
+			write(&word, sizeof(word));
+		};
+
+		writeWord(0x46546C67); // "glTF".
+		writeWord(2);
+		writeWord((uint32_t)glb.size());
+
+		writeWord((uint32_t)json.size());
+		writeWord(0x4E4F534A); // "JSON".
+		write(json.data(), json.size());
+
+		writeWord((uint32_t)binarySize);
+		writeWord(0x004E4942); // "BIN".
+		write(positions.data(), positionsSize);
+		write(normals.data(), normalsSize);
+		write(uvs.data(), uvsSize);
+		write(indices.data(), indicesSize);
+
+		return glb;
+	}
+
+	// Returns the converted mesh, for the benchmarks working on mesh data.
+	std::optional<MeshData> benchmarkGLTFConversion(uint32_t meshSize, double minSeconds)
+	{
+		std::vector<std::byte> glb = createSyntheticGLB(meshSize);
+
+		auto data = fastgltf::GltfDataBuffer::FromBytes(glb.data(), glb.size());
+
+		if (data.error() != fastgltf::Error::None)
+		{
+			fmt::println("Failed to create the synthetic glTF data buffer.");
+
+			return {};
+		}
+
+		// Parsed once, only the conversion of the accessors into vertices is timed.
+		fastgltf::Parser parser;
+		auto asset = parser.loadGltfBinary(data.get(), {}, fastgltf::Options::None);
+
+		if (asset.error() != fastgltf::Error::None)
+		{
+			fmt::println("Failed to parse the synthetic glTF: {}.", fastgltf::getErrorMessage(asset.error()));
+
+			return {};
+		}
+
+		measure("glTF conversion", meshSize, minSeconds, [&]()
+		{
+			std::vector<MeshData> meshes = convertGLTFMeshes(asset.get());
+
+			return Throughput{ meshes[0].indices.size() / 3, meshes[0].vertices.size() };
+		});
+
+		return std::move(convertGLTFMeshes(asset.get())[0]);
+	}
+
+	void benchmarkGeometryPacking(const MeshData& mesh, uint32_t meshSize, double minSeconds)
+	{
+		std::vector<std::byte> staging(mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(uint32_t));
+
+		measure("Geometry packing", meshSize, minSeconds, [&]()
+		{
+			packMeshGeometry(mesh.vertices, mesh.indices, staging.data());
+
+			return Throughput{ staging.size(), mesh.vertices.size() };
+		});
+	}
+
+	void benchmarkDeletionQueue(uint32_t meshSize, double minSeconds)
+	{
+		TimelineDeletionQueue deletionQueue;
+		uint64_t counter = 0;
+		uint64_t value = 2; // Past the collection lag, so it never wraps around.
+
+		// Deletors are keyed on the value of the frame that retired them, and collected two frames later, as the engine does.
+		measure("Deletion queue collect", meshSize, minSeconds, [&]()
+		{
+			for (uint32_t i = 0; i < meshSize; i++)
+			{
+				deletionQueue.pushFunction(value + i / 64, [&counter, i]() { counter += i; });
+
+				if (i % 64 == 63)
+				{
+					deletionQueue.collect(value + i / 64 - 2);
+				}
+			}
+
+			value += meshSize / 64 + 1;
+
+			deletionQueue.collect(value);
+
+			return Throughput{ meshSize, 0 };
+		});
+
+		if (counter == 0 && meshSize > 1)
+		{
+			fmt::println("The deletion queue didn't run its deletors.");
+		}
+	}
+
+	void benchmarkDescriptorLayouts(uint32_t meshSize, double minSeconds)
+	{
+		constexpr VkDescriptorType types[] = {
+			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+		};
+
+		// What DescriptorLayoutBuilder::build does before the cache would create a layout on a miss.
+		DescriptorLayoutBuilder builder;
+		std::unordered_map<std::string, uint32_t> cache;
+
+		measure("Descriptor layouts", meshSize, minSeconds, [&]()
+		{
+			for (uint32_t i = 0; i < meshSize; i++)
+			{
+				builder.clear();
+
+				for (uint32_t binding = 0; binding <= i % 8; binding++)
+				{
+					builder.addBinding(binding, types[(i + binding) % 4]);
+				}
+
+				for (VkDescriptorSetLayoutBinding& binding : builder.bindings)
+				{
+					binding.stageFlags |= VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+				}
+
+				cache.try_emplace(LayoutCache::getDescriptorSetLayoutKey(builder.bindings), i);
+			}
+
+			return Throughput{ meshSize, 0 };
+		});
+	}
+
+	void benchmarkOffsetAllocator(uint32_t meshSize, double minSeconds)
+	{
+		std::mt19937 random(42);
+		std::uniform_int_distribution<uint32_t> sizeDistribution(1, 256);
+
+		std::vector<uint32_t> sizes(meshSize);
+		std::vector<uint32_t> releaseOrder(meshSize);
+
+		std::generate(sizes.begin(), sizes.end(), [&]() { return sizeDistribution(random); });
+		std::iota(releaseOrder.begin(), releaseOrder.end(), 0);
+		std::shuffle(releaseOrder.begin(), releaseOrder.end(), random);
+
+		OffsetAllocator allocator;
+		std::vector<OffsetAllocation> allocations(meshSize);
+
+		allocator.initialize(std::accumulate(sizes.begin(), sizes.end(), 0u));
+
+		// Allocations in order and releases in a random order, which exercises the merging of free neighbours.
+		measure("Offset allocator", meshSize, minSeconds, [&]()
+		{
+			for (uint32_t i = 0; i < meshSize; i++)
+			{
+				allocations[i] = allocator.allocate(sizes[i]);
+			}
+
+			for (uint32_t i : releaseOrder)
+			{
+				if (allocations[i].node != INVALID_OFFSET_NODE)
+				{
+					allocator.free(allocations[i]);
+				}
+			}
+
+			return Throughput{ meshSize, 0 };
+		});
+	}
+
+	void benchmarkFrustumCulling(uint32_t meshSize, double minSeconds)
+	{
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> positionDistribution(-500.0f, 500.0f);
+		std::uniform_real_distribution<float> radiusDistribution(1.0f, 10.0f);
+
+		std::vector<glm::vec4> spheres(meshSize);
+		std::vector<uint32_t> visibleIndices(meshSize);
+
+		for (glm::vec4& sphere : spheres)
+		{
+			sphere = glm::vec4{ positionDistribution(random), positionDistribution(random), positionDistribution(random), radiusDistribution(random) };
+		}
+
+		// The camera of the engine, at the origin.
+		glm::mat4 view = glm::lookAt(glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+		glm::mat4 projection = glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 10000.0f, 0.1f);
+
+		projection[1][1] *= -1;
+
+		Frustum frustum = extractFrustum(projection * view);
+		uint64_t visibleCount = 0;
+
+		measure("Frustum culling", meshSize, minSeconds, [&]()
+		{
+			visibleCount += cullSpheres(frustum, spheres, visibleIndices.data());
+
+			return Throughput{ meshSize, 0 };
+		});
+
+		if (visibleCount == 0)
+		{
+			fmt::println("No sphere passed the frustum culling.");
+		}
+	}
+
+	void benchmarkAnimationSampling(uint32_t meshSize, double minSeconds)
+	{
+		constexpr uint32_t jointCount = 64;
+		constexpr uint32_t keyframeCount = 30;
+
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> unitDistribution(-1.0f, 1.0f);
+
+		// A binary tree of joints, each with a rotation and a translation channel.
+		Skeleton skeleton;
+		AnimationClip& clip = skeleton.clips.emplace_back();
+
+		clip.duration = 1.0f;
+
+		for (uint32_t joint = 0; joint < jointCount; joint++)
+		{
+			skeleton.parents.push_back(joint == 0 ? -1 : (int32_t)(joint - 1) / 2);
+			skeleton.restPose.push_back(NodePose{});
+			skeleton.jointNodes.push_back(joint);
+			skeleton.inverseBindMatrices.push_back(glm::mat4{ 1.0f });
+
+			for (AnimationPath path : { AnimationPath::Rotation, AnimationPath::Translation })
+			{
+				AnimationChannel& channel = clip.channels.emplace_back();
+
+				channel.node = joint;
+				channel.path = path;
+
+				for (uint32_t keyframe = 0; keyframe < keyframeCount; keyframe++)
+				{
+					glm::vec4 value{ unitDistribution(random), unitDistribution(random), unitDistribution(random), path == AnimationPath::Rotation ? 1.0f : 0.0f };
+
+					channel.times.push_back((float)keyframe / (keyframeCount - 1));
+					channel.values.push_back(path == AnimationPath::Rotation ? glm::normalize(value) : value);
+				}
+			}
+		}
+
+		// Items are joints, as many as the mesh has vertices.
+		uint32_t instanceCount = std::max(1u, meshSize / jointCount);
+
+		std::vector<AnimatedInstance> instances(instanceCount);
+		std::vector<glm::mat4> palettes((size_t)instanceCount * jointCount);
+
+		for (uint32_t i = 0; i < instanceCount; i++)
+		{
+			instances[i].skeleton = &skeleton;
+			instances[i].paletteOffset = i * jointCount;
+		}
+
+		AnimationSampler sampler;
+
+		sampler.initialize();
+
+		float time = 0.0f;
+
+		measure("Animation sampling", meshSize, minSeconds, [&]()
+		{
+			time = std::fmod(time + 0.0167f, clip.duration);
+
+			for (AnimatedInstance& instance : instances)
+			{
+				instance.time = time;
+			}
+
+			sampler.sample(instances, palettes.data());
+
+			return Throughput{ (uint64_t)instanceCount * jointCount, 0 };
+		});
+
+		sampler.cleanUp();
+	}
+
+	void benchmarkDepthPyramid(uint32_t meshSize, double minSeconds)
+	{
+		// A 16:9 depth image of about meshSize texels, its pyramid is built with a min reduction as the engine does.
+		uint32_t width = std::max(64u, (uint32_t)std::sqrt(meshSize * 16.0 / 9.0));
+		VkExtent2D depthExtent{ width, width * 9 / 16 };
+		VkExtent2D pyramidExtent = getDepthPyramidExtent(depthExtent);
+
+		std::mt19937 random(42);
+		std::uniform_real_distribution<float> depthDistribution(0.0f, 1.0f);
+
+		std::vector<float> depth((size_t)depthExtent.width * depthExtent.height);
+
+		std::generate(depth.begin(), depth.end(), [&]() { return depthDistribution(random); });
+
+		std::vector<std::vector<float>> mips;
+
+		measure("Depth pyramid", meshSize, minSeconds, [&]()
+		{
+			mips = emulateDownsample(depth, depthExtent, pyramidExtent, DOWNSAMPLE_MAX_MIPS, DownsampleReduction::Min);
+
+			return Throughput{ depth.size(), 0 };
+		});
+
+		// Every level against a plain min reduction: the footprint of each first level texel, then 2x2 texels of the level
+		// above, clamped where an axis is down to a single texel.
+		std::vector<float> expected;
+		glm::ivec2 previousSize{ depthExtent.width, depthExtent.height };
+
+		for (uint32_t mip = 0; mip < mips.size(); mip++)
+		{
+			glm::ivec2 size = glm::max(glm::ivec2{ pyramidExtent.width, pyramidExtent.height } >> (int)mip, glm::ivec2{ 1 });
+			std::vector<float> level((size_t)size.x * size.y);
+
+			for (int y = 0; y < size.y; y++)
+			{
+				for (int x = 0; x < size.x; x++)
+				{
+					glm::ivec2 begin = mip == 0 ? glm::ivec2{ x, y } * previousSize / size : glm::ivec2{ x, y } * 2;
+					glm::ivec2 end = mip == 0 ? (glm::ivec2{ x + 1, y + 1 } * previousSize + size - 1) / size : glm::min(begin + 2, previousSize);
+					const std::vector<float>& above = mip == 0 ? depth : expected;
+					float value = above[(size_t)begin.y * previousSize.x + begin.x];
+
+					for (int aboveY = begin.y; aboveY < end.y; aboveY++)
+					{
+						for (int aboveX = begin.x; aboveX < end.x; aboveX++)
+						{
+							value = std::min(value, above[(size_t)aboveY * previousSize.x + aboveX]);
+						}
+					}
+
+					level[(size_t)y * size.x + x] = value;
+				}
+			}
+
+			size_t mismatches = 0;
+
+			for (size_t i = 0; i < level.size(); i++)
+			{
+				mismatches += level[i] != mips[mip][i];
+			}
+
+			if (mismatches > 0)
+			{
+				fmt::println("Level {} of the depth pyramid differs from a min reduction at {} of its {} texels.", mip, mismatches, level.size());
+			}
+
+			expected = std::move(level);
+			previousSize = size;
+		}
+	}
+}
+
+void runMicroBenchmarks(std::span<const uint32_t> meshSizes, double minSeconds)
+{
+	fmt::println("{:<24} {:>10} {:>12} {:>14} {:>14}", "Benchmark", "Size", "ms/run", "Items", "Vertices");
+
+	for (uint32_t meshSize : meshSizes)
+	{
+		std::optional<MeshData> mesh = benchmarkGLTFConversion(meshSize, minSeconds);
+
+		if (mesh.has_value())
+		{
+			benchmarkGeometryPacking(mesh.value(), meshSize, minSeconds);
+		}
+
+		benchmarkDeletionQueue(meshSize, minSeconds);
+		benchmarkDescriptorLayouts(meshSize, minSeconds);
+		benchmarkOffsetAllocator(meshSize, minSeconds);
+		benchmarkFrustumCulling(meshSize, minSeconds);
+		benchmarkAnimationSampling(meshSize, minSeconds);
+		benchmarkDepthPyramid(meshSize, minSeconds);
+	}
+}
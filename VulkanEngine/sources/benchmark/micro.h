@@ -0,0 +1,17 @@
+#pragma once
+
+#include <span>
+#include <cstdint>
+
+// Times the CPU hot paths of the engine in isolation, on synthetic data, without creating any Vulkan object:
+//  - the glTF accessor conversion of the loader, on a grid mesh of each size (items are triangles),
+//  - the packing of mesh geometry into a staging buffer (items are bytes),
+//  - timeline deletion queue pushes and collections (items are deletors),
+//  - the descriptor set layout builder and its cache key bookkeeping (items are layouts),
+//  - geometry arena allocations and releases with the offset allocator (items are allocations),
+//  - sphere frustum culling (items are spheres),
+//  - joint palette sampling of animated instances on the animation sampler's workers (items are joints),
+//  - the depth pyramid reduction of downsample.comp, emulated on a 16:9 depth image and checked level by level against a
+//    plain min reduction (items are depth texels).
+// Each benchmark runs once per mesh size, for at least the given time, and reports its throughput in items and vertices per second.
+void runMicroBenchmarks(std::span<const uint32_t> meshSizes, double minSeconds);
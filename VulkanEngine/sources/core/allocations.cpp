@@ -0,0 +1,299 @@
+#include "allocations.h"
+
+const char* memoryCategoryName(MemoryCategory category)
+{
+	switch (category)
+	{
+	case MemoryCategory::Mesh: return "Mesh";
+	case MemoryCategory::Texture: return "Texture";
+	case MemoryCategory::RenderTarget: return "Render Target";
+	case MemoryCategory::Staging: return "Staging";
+	case MemoryCategory::Readback: return "Readback";
+	case MemoryCategory::Lighting: return "Lighting";
+	default: return "Unknown";
+	}
+}
+
+VmaAllocationCreateInfo allocationCreateInfo(MemoryCategory category, VmaAllocationCreateFlags flags)
+{
+	VmaAllocationCreateInfo info = {};
+
+	info.usage = VMA_MEMORY_USAGE_AUTO;
+	info.flags = flags;
+
+	if (category == MemoryCategory::Staging)
+	{
+		info.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	}
+	else if (category == MemoryCategory::Readback)
+	{
+		// Read back by the CPU, so it should be cached rather than write-combined.
+		info.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	}
+	else
+	{
+		info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+	}
+
+	// Render targets are large and recreated as a whole, they get their own memory block.
+	if (category == MemoryCategory::RenderTarget)
+	{
+		info.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+	}
+
+	return info;
+}
+
+void MemoryManager::initialize(VkDevice device, VmaAllocator allocator)
+{
+	this->device = device;
+	this->allocator = allocator;
+}
+
+void MemoryManager::cleanUp()
+{
+	// Expected to be called once the device is idle, so the pass in progress can be finished right away.
+	if (passInProgress)
+	{
+		endPass();
+	}
+
+	if (defragmentationContext != VK_NULL_HANDLE)
+	{
+		vmaEndDefragmentation(allocator, defragmentationContext, nullptr);
+
+		defragmentationContext = VK_NULL_HANDLE;
+	}
+
+	movableBuffers.clear();
+}
+
+void MemoryManager::track(VmaAllocation allocation, MemoryCategory category)
+{
+	VmaAllocationInfo allocationInfo;
+
+	vmaGetAllocationInfo(allocator, allocation, &allocationInfo);
+	vmaSetAllocationName(allocator, allocation, memoryCategoryName(category));
+
+	categories[allocation] = category;
+	categoryStats[(uint32_t)category].bytes += allocationInfo.size;
+	categoryStats[(uint32_t)category].allocations++;
+}
+
+void MemoryManager::untrack(VmaAllocation allocation)
+{
+	auto it = categories.find(allocation);
+
+	if (it == categories.end())
+	{
+		return;
+	}
+
+	VmaAllocationInfo allocationInfo;
+
+	vmaGetAllocationInfo(allocator, allocation, &allocationInfo);
+
+	categoryStats[(uint32_t)it->second].bytes -= allocationInfo.size;
+	categoryStats[(uint32_t)it->second].allocations--;
+
+	categories.erase(it);
+	movableBuffers.erase(allocation);
+}
+
+void MemoryManager::registerMovableBuffer(AllocatedBuffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceAddress* deviceAddress, std::span<const uint32_t> queueFamilies)
+{
+	movableBuffers[buffer->allocation] = { buffer, size, usage, deviceAddress, { queueFamilies.begin(), queueFamilies.end() } };
+}
+
+std::vector<MemoryHeapStats> MemoryManager::getHeapStats() const
+{
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+
+	// Without VK_EXT_memory_budget, VMA estimates the budget as 80% of the heap size.
+	vmaGetHeapBudgets(allocator, budgets);
+
+	std::vector<MemoryHeapStats> heapStats(memoryProperties->memoryHeapCount);
+
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+	{
+		heapStats[i].budget = budgets[i].budget;
+		heapStats[i].usage = budgets[i].usage;
+		heapStats[i].deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	}
+
+	return heapStats;
+}
+
+void MemoryManager::startDefragmentation(VkDeviceSize maxBytesPerPass)
+{
+	if (defragmentationContext != VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	VmaDefragmentationInfo defragmentationInfo = {};
+
+	defragmentationInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+	defragmentationInfo.maxBytesPerPass = maxBytesPerPass;
+
+	VK_CHECK(vmaBeginDefragmentation(allocator, &defragmentationInfo, &defragmentationContext));
+
+	defragmentedBytes = 0;
+	defragmentedAllocations = 0;
+}
+
+bool MemoryManager::updateDefragmentation(VkCommandBuffer cmd, uint64_t retireValue, uint64_t completedValue)
+{
+	if (defragmentationContext == VK_NULL_HANDLE)
+	{
+		return false;
+	}
+
+	if (passInProgress)
+	{
+		// Frames recorded before the copy may still read the old buffers.
+		if (completedValue < passRetireValue)
+		{
+			return false;
+		}
+
+		endPass();
+
+		if (defragmentationContext == VK_NULL_HANDLE)
+		{
+			return false;
+		}
+	}
+
+	// VK_SUCCESS means there's nothing left to move.
+	if (vmaBeginDefragmentationPass(allocator, defragmentationContext, &defragmentationPass) == VK_SUCCESS)
+	{
+		vmaEndDefragmentation(allocator, defragmentationContext, nullptr);
+
+		defragmentationContext = VK_NULL_HANDLE;
+
+		return false;
+	}
+
+	std::vector<VkBufferMemoryBarrier2> bufferMemoryBarriers;
+
+	for (uint32_t i = 0; i < defragmentationPass.moveCount; i++)
+	{
+		VmaDefragmentationMove& move = defragmentationPass.pMoves[i];
+		auto it = movableBuffers.find(move.srcAllocation);
+
+		// Images and staging buffers aren't referenced in a way we can patch, so they stay where they are.
+		if (it == movableBuffers.end())
+		{
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+
+			continue;
+		}
+
+		MovableBuffer& movableBuffer = it->second;
+
+		VkBufferCreateInfo bufferCreateInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		VkBuffer newBuffer;
+
+		bufferCreateInfo.size = movableBuffer.size;
+		bufferCreateInfo.usage = movableBuffer.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		if (movableBuffer.queueFamilies.size() > 1)
+		{
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferCreateInfo.queueFamilyIndexCount = (uint32_t)movableBuffer.queueFamilies.size();
+			bufferCreateInfo.pQueueFamilyIndices = movableBuffer.queueFamilies.data();
+		}
+
+		if (vkCreateBuffer(device, &bufferCreateInfo, nullptr, &newBuffer) != VK_SUCCESS)
+		{
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+
+			continue;
+		}
+
+		VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, newBuffer));
+
+		VkBufferCopy bufferCopy{ 0, 0, movableBuffer.size };
+
+		vkCmdCopyBuffer(cmd, movableBuffer.buffer->buffer, newBuffer, 1, &bufferCopy);
+
+		VkBufferMemoryBarrier2 bufferMemoryBarrier = { .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+
+		bufferMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+		bufferMemoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		bufferMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		bufferMemoryBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferMemoryBarrier.buffer = newBuffer;
+		bufferMemoryBarrier.size = VK_WHOLE_SIZE;
+
+		bufferMemoryBarriers.push_back(bufferMemoryBarrier);
+
+		// From this frame on the new buffer is used, the old one is only kept alive for the frames already in flight.
+		retiredBuffers.push_back(movableBuffer.buffer->buffer);
+
+		movableBuffer.buffer->buffer = newBuffer;
+
+		if (movableBuffer.deviceAddress)
+		{
+			VkBufferDeviceAddressInfo deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newBuffer };
+
+			*movableBuffer.deviceAddress = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+		}
+
+		defragmentedBytes += movableBuffer.size;
+		defragmentedAllocations++;
+	}
+
+	if (!bufferMemoryBarriers.empty())
+	{
+		VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+		dependencyInfo.bufferMemoryBarrierCount = (uint32_t)bufferMemoryBarriers.size();
+		dependencyInfo.pBufferMemoryBarriers = bufferMemoryBarriers.data();
+
+		vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+	}
+
+	passInProgress = true;
+	passRetireValue = retireValue;
+
+	return !retiredBuffers.empty();
+}
+
+void MemoryManager::endPass()
+{
+	for (VkBuffer buffer : retiredBuffers)
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+	}
+
+	retiredBuffers.clear();
+
+	// The source allocations now point to the memory the new buffers are bound to.
+	VkResult result = vmaEndDefragmentationPass(allocator, defragmentationContext, &defragmentationPass);
+
+	for (uint32_t i = 0; i < defragmentationPass.moveCount; i++)
+	{
+		auto it = movableBuffers.find(defragmentationPass.pMoves[i].srcAllocation);
+
+		if (it != movableBuffers.end())
+		{
+			vmaGetAllocationInfo(allocator, it->first, &it->second.buffer->allocationInfo);
+		}
+	}
+
+	passInProgress = false;
+
+	if (result == VK_SUCCESS)
+	{
+		vmaEndDefragmentation(allocator, defragmentationContext, nullptr);
+
+		defragmentationContext = VK_NULL_HANDLE;
+	}
+}
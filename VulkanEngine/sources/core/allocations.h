@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vkma/vk_mem_alloc.h>
+
+#include <span>
+#include <array>
+#include <vector>
+#include <unordered_map>
+
+#include "structures.h"
+
+// Every allocation is tagged with the kind of resource it backs, so the memory dashboard can break usage down.
+enum class MemoryCategory : uint32_t
+{
+	Mesh,
+	Texture,
+	RenderTarget,
+	Staging,
+	Readback,
+	Lighting,
+	Count
+};
+
+const char* memoryCategoryName(MemoryCategory category);
+
+// Allocation parameters for a category. Staging and readback memory are host visible and persistently mapped, the rest prefers device local memory.
+VmaAllocationCreateInfo allocationCreateInfo(MemoryCategory category, VmaAllocationCreateFlags flags = 0);
+
+struct MemoryCategoryStats
+{
+	VkDeviceSize bytes = 0;
+	uint32_t allocations = 0;
+};
+
+struct MemoryHeapStats
+{
+	VkDeviceSize budget;
+	VkDeviceSize usage;
+	bool deviceLocal;
+};
+
+// Tracks the allocations of each category and moves buffers around to defragment device memory, a few per frame.
+class MemoryManager
+{
+public:
+	void initialize(VkDevice device, VmaAllocator allocator);
+	void cleanUp();
+
+	void track(VmaAllocation allocation, MemoryCategory category);
+	void untrack(VmaAllocation allocation);
+
+	// Registers a buffer the defragmentation is allowed to move. Its handle and device address are patched in place,
+	// so both have to stay at the same address until the buffer is destroyed. A buffer shared by several queue families
+	// is recreated with concurrent sharing between them.
+	void registerMovableBuffer(AllocatedBuffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceAddress* deviceAddress = nullptr, std::span<const uint32_t> queueFamilies = {});
+
+	const MemoryCategoryStats& getCategoryStats(MemoryCategory category) const { return categoryStats[(uint32_t)category]; }
+	std::vector<MemoryHeapStats> getHeapStats() const;
+
+	void startDefragmentation(VkDeviceSize maxBytesPerPass);
+	bool isDefragmenting() const { return defragmentationContext != VK_NULL_HANDLE; }
+
+	// Called once per frame while recording the graphics command buffer. Moved buffers are copied in that command buffer,
+	// and the old ones are only released once the graphics timeline (completedValue) reaches retireValue, the value
+	// signaled by the submission of cmd. Returns true when buffers were moved by this call.
+	bool updateDefragmentation(VkCommandBuffer cmd, uint64_t retireValue, uint64_t completedValue);
+
+	VkDeviceSize defragmentedBytes = 0;
+	uint32_t defragmentedAllocations = 0;
+
+private:
+	struct MovableBuffer
+	{
+		AllocatedBuffer* buffer;
+		VkDeviceSize size;
+		VkBufferUsageFlags usage;
+		VkDeviceAddress* deviceAddress;
+		std::vector<uint32_t> queueFamilies;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VmaAllocator allocator = VK_NULL_HANDLE;
+
+	std::array<MemoryCategoryStats, (size_t)MemoryCategory::Count> categoryStats;
+	std::unordered_map<VmaAllocation, MemoryCategory> categories;
+	std::unordered_map<VmaAllocation, MovableBuffer> movableBuffers;
+
+	VmaDefragmentationContext defragmentationContext = VK_NULL_HANDLE;
+	VmaDefragmentationPassMoveInfo defragmentationPass{};
+	bool passInProgress = false;
+	uint64_t passRetireValue = 0;
+
+	// Buffers replaced by the current pass, destroyed when it ends.
+	std::vector<VkBuffer> retiredBuffers;
+
+	void endPass();
+};
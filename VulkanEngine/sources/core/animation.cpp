@@ -0,0 +1,280 @@
+#include "animation.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SIMD 1
+#include <emmintrin.h>
+#else
+#define ANIMATION_SIMD 0
+#endif
+
+namespace
+{
+#if ANIMATION_SIMD
+	// Dot product of all four lanes, broadcast to every lane. Only needs SSE2.
+	__m128 dot4(__m128 a, __m128 b)
+	{
+		__m128 product = _mm_mul_ps(a, b);
+		__m128 sums = _mm_add_ps(product, _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		return _mm_add_ps(sums, _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+#endif
+
+	glm::mat4 composeNodeMatrix(const NodePose& pose)
+	{
+		glm::quat rotation = glm::quat::wxyz(pose.rotation.w, pose.rotation.x, pose.rotation.y, pose.rotation.z);
+		glm::mat4 matrix = glm::mat4_cast(rotation);
+
+		matrix[0] *= pose.scale.x;
+		matrix[1] *= pose.scale.y;
+		matrix[2] *= pose.scale.z;
+		matrix[3] = glm::vec4{ glm::vec3{ pose.translation }, 1.0f };
+
+		return matrix;
+	}
+
+	// Reused by every call on the same thread, so sampling doesn't allocate once the largest skeleton was seen.
+	thread_local std::vector<NodePose> poseScratch;
+	thread_local std::vector<glm::mat4> nodeMatrixScratch;
+}
+
+glm::vec4 interpolateKeyframes(const glm::vec4& from, const glm::vec4& to, float t, bool rotation)
+{
+#if ANIMATION_SIMD
+	__m128 a = _mm_loadu_ps(&from.x);
+	__m128 b = _mm_loadu_ps(&to.x);
+
+	// q and -q are the same rotation, the one closest to the first keyframe is taken by flipping the sign bits.
+	if (rotation)
+	{
+		b = _mm_xor_ps(b, _mm_and_ps(dot4(a, b), _mm_set1_ps(-0.0f)));
+	}
+
+	__m128 result = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+
+	if (rotation)
+	{
+		result = _mm_div_ps(result, _mm_sqrt_ps(dot4(result, result)));
+	}
+
+	glm::vec4 value;
+
+	_mm_storeu_ps(&value.x, result);
+
+	return value;
+#else
+	glm::vec4 target = rotation && glm::dot(from, to) < 0.0f ? -to : to;
+	glm::vec4 value = from + (target - from) * t;
+
+	return rotation ? glm::normalize(value) : value;
+#endif
+}
+
+glm::vec4 sampleChannel(const AnimationChannel& channel, float time)
+{
+	if (time <= channel.times.front())
+	{
+		return channel.values.front();
+	}
+
+	if (time >= channel.times.back())
+	{
+		return channel.values.back();
+	}
+
+	// First keyframe after the time, there's always one before it.
+	size_t next = std::upper_bound(channel.times.begin(), channel.times.end(), time) - channel.times.begin();
+	size_t previous = next - 1;
+
+	if (channel.step)
+	{
+		return channel.values[previous];
+	}
+
+	float t = (time - channel.times[previous]) / (channel.times[next] - channel.times[previous]);
+
+	return interpolateKeyframes(channel.values[previous], channel.values[next], t, channel.path == AnimationPath::Rotation);
+}
+
+void sampleAnimation(const AnimatedInstance& instance, std::span<NodePose> pose, std::span<glm::mat4> nodeMatrices, glm::mat4* palette)
+{
+	const Skeleton& skeleton = *instance.skeleton;
+
+	std::copy(skeleton.restPose.begin(), skeleton.restPose.end(), pose.begin());
+
+	if (instance.clip < skeleton.clips.size())
+	{
+		for (const AnimationChannel& channel : skeleton.clips[instance.clip].channels)
+		{
+			glm::vec4 value = sampleChannel(channel, instance.time);
+
+			switch (channel.path)
+			{
+			case AnimationPath::Translation: pose[channel.node].translation = value; break;
+			case AnimationPath::Rotation: pose[channel.node].rotation = value; break;
+			case AnimationPath::Scale: pose[channel.node].scale = value; break;
+			}
+		}
+	}
+
+	// Parents come first, so their matrices are always ready. The world matrix is folded into the roots.
+	for (size_t node = 0; node < skeleton.parents.size(); node++)
+	{
+		int32_t parent = skeleton.parents[node];
+
+		nodeMatrices[node] = (parent < 0 ? instance.worldMatrix : nodeMatrices[parent]) * composeNodeMatrix(pose[node]);
+	}
+
+	for (size_t joint = 0; joint < skeleton.jointNodes.size(); joint++)
+	{
+		palette[joint] = nodeMatrices[skeleton.jointNodes[joint]] * skeleton.inverseBindMatrices[joint];
+	}
+}
+
+void AnimationSampler::initialize(uint32_t workerCount)
+{
+	if (workerCount == 0)
+	{
+		// The calling thread samples too, and other workers (pipelines, streaming) share the remaining cores.
+		workerCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+	}
+
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&AnimationSampler::work, this);
+	}
+}
+
+void AnimationSampler::cleanUp()
+{
+	{
+		std::scoped_lock lock(mutex);
+
+		stopping = true;
+	}
+
+	workCondition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	workers.clear();
+}
+
+void AnimationSampler::sample(std::span<const AnimatedInstance> instances, glm::mat4* palettes)
+{
+	uint32_t count = (uint32_t)((instances.size() + BATCH_SIZE - 1) / BATCH_SIZE);
+	uint64_t callGeneration;
+
+	{
+		std::scoped_lock lock(mutex);
+
+		this->instances = instances;
+		this->palettes = palettes;
+
+		batchCount = count;
+		finishedBatches = 0;
+		callGeneration = ++generation;
+		nextBatch = callGeneration << 32;
+	}
+
+	// A single batch isn't worth waking anyone up.
+	if (count > 1)
+	{
+		workCondition.notify_all();
+	}
+
+	uint32_t sampledBatches = sampleBatches(callGeneration, instances, palettes, count);
+
+	std::unique_lock lock(mutex);
+
+	finishedBatches += sampledBatches;
+
+	doneCondition.wait(lock, [this]() { return finishedBatches == batchCount; });
+}
+
+void AnimationSampler::work()
+{
+	uint64_t seenGeneration = 0;
+
+	while (true)
+	{
+		std::span<const AnimatedInstance> batchInstances;
+		glm::mat4* batchPalettes;
+		uint32_t count;
+
+		{
+			std::unique_lock lock(mutex);
+
+			workCondition.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			seenGeneration = generation;
+			batchInstances = instances;
+			batchPalettes = palettes;
+			count = batchCount;
+		}
+
+		// Batches are only taken while the counter is still on seenGeneration, so the caller waits for every one counted here.
+		uint32_t sampledBatches = sampleBatches(seenGeneration, batchInstances, batchPalettes, count);
+
+		if (sampledBatches > 0)
+		{
+			std::scoped_lock lock(mutex);
+
+			finishedBatches += sampledBatches;
+
+			if (finishedBatches == batchCount)
+			{
+				doneCondition.notify_all();
+			}
+		}
+	}
+}
+
+uint32_t AnimationSampler::sampleBatches(uint64_t batchGeneration, std::span<const AnimatedInstance> batchInstances, glm::mat4* batchPalettes, uint32_t count)
+{
+	uint32_t sampledBatches = 0;
+	uint64_t counter = nextBatch.load();
+
+	while ((counter >> 32) == (uint32_t)batchGeneration && (uint32_t)counter < count)
+	{
+		// A plain increment could take a batch of the next call, once this one is over.
+		if (!nextBatch.compare_exchange_weak(counter, counter + 1))
+		{
+			continue;
+		}
+
+		uint32_t batch = (uint32_t)counter;
+		size_t end = std::min<size_t>((size_t)(batch + 1) * BATCH_SIZE, batchInstances.size());
+
+		for (size_t i = (size_t)batch * BATCH_SIZE; i < end; i++)
+		{
+			const AnimatedInstance& instance = batchInstances[i];
+			size_t nodeCount = instance.skeleton->parents.size();
+
+			if (poseScratch.size() < nodeCount)
+			{
+				poseScratch.resize(nodeCount);
+				nodeMatrixScratch.resize(nodeCount);
+			}
+
+			sampleAnimation(instance, poseScratch, nodeMatrixScratch, batchPalettes + instance.paletteOffset);
+		}
+
+		sampledBatches++;
+		counter = nextBatch.load();
+	}
+
+	return sampledBatches;
+}
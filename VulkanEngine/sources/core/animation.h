@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+// Capacity of the per-frame joint palette buffer, in matrices, shared by every animated instance.
+constexpr uint32_t MAX_JOINT_PALETTE_MATRICES = 1 << 16;
+
+enum class AnimationPath : uint8_t
+{
+	Translation,
+	Rotation,
+	Scale
+};
+
+// Keyframes of one property of a skeleton node. Every value is a vec4 (translations and scales have a zero w), so
+// keyframes are interpolated four lanes at a time.
+struct AnimationChannel
+{
+	uint32_t node;
+	AnimationPath path;
+
+	// Step keyframes hold their value until the next one, the others are interpolated linearly.
+	bool step = false;
+
+	std::vector<float> times;
+	std::vector<glm::vec4> values;
+};
+
+struct AnimationClip
+{
+	std::string name;
+	float duration = 0.0f;
+
+	std::vector<AnimationChannel> channels;
+};
+
+// Local transform of a skeleton node.
+struct NodePose
+{
+	glm::vec4 translation{ 0.0f };
+	glm::vec4 rotation{ 0.0f, 0.0f, 0.0f, 1.0f }; // Quaternion, as x, y, z, w.
+	glm::vec4 scale{ 1.0f, 1.0f, 1.0f, 0.0f };
+};
+
+// The joints of a skin, along with the nodes between them and the root, ordered so that parents come before children.
+// Palettes have one matrix per joint, in the order of the skin, which is the order vertices refer to them in.
+struct Skeleton
+{
+	std::string name;
+
+	std::vector<int32_t> parents; // -1 for the roots.
+	std::vector<NodePose> restPose;
+
+	std::vector<uint32_t> jointNodes;
+	std::vector<glm::mat4> inverseBindMatrices;
+
+	std::vector<AnimationClip> clips;
+};
+
+// An animated character: a skeleton playing one of its clips, placed in the world.
+struct AnimatedInstance
+{
+	const Skeleton* skeleton = nullptr;
+
+	// Clip played, none (the rest pose) when out of range.
+	uint32_t clip = 0;
+	float time = 0.0f;
+
+	glm::mat4 worldMatrix{ 1.0f };
+
+	// First matrix of the instance in the palette buffer.
+	uint32_t paletteOffset = 0;
+};
+
+// Up to four joints influencing a vertex, as indices of the skin's joints, and their weights.
+struct VertexSkin
+{
+	glm::u16vec4 joints{ 0 };
+	glm::vec4 weights{ 1.0f, 0.0f, 0.0f, 0.0f };
+};
+
+// Bind pose vertex of a skinned mesh, as read by the skinning pass. Has to match skinning.comp.
+struct GPUSkinnedVertex
+{
+	glm::vec3 position;
+	uint32_t joints01; // Joints 0 and 1, 16 bits each.
+	glm::vec3 normal;
+	uint32_t joints23; // Joints 2 and 3.
+	glm::vec4 weights;
+};
+
+struct SkinningPushConstants
+{
+	VkDeviceAddress sourceBufferAddress;
+	VkDeviceAddress vertexBufferAddress;
+	VkDeviceAddress paletteBufferAddress;
+
+	uint32_t vertexOffset; // Of the output, in the geometry arena.
+	uint32_t vertexCount;
+	uint32_t paletteOffset;
+	uint32_t padding;
+};
+
+// Interpolates between two keyframes. Rotations go the short way around and are normalized again (nlerp), which is
+// close enough to a slerp for keyframes as close as the ones of an animation.
+glm::vec4 interpolateKeyframes(const glm::vec4& from, const glm::vec4& to, float t, bool rotation);
+
+glm::vec4 sampleChannel(const AnimationChannel& channel, float time);
+
+// Writes the palette of an instance: for each joint, the world matrix of the instance times the animated transform
+// of the joint times its inverse bind matrix. The pose and node matrix spans are scratch space, sized for the skeleton.
+void sampleAnimation(const AnimatedInstance& instance, std::span<NodePose> pose, std::span<glm::mat4> nodeMatrices, glm::mat4* palette);
+
+// Samples the palettes of the animated instances on worker threads. Instances are handed out in batches, taken by the
+// workers and by the calling thread alike, so a frame's worth of sampling is spread over every core.
+class AnimationSampler
+{
+public:
+	void initialize(uint32_t workerCount = 0);
+	void cleanUp();
+
+	// Writes the palette of every instance at its paletteOffset. Returns once all of them are written.
+	void sample(std::span<const AnimatedInstance> instances, glm::mat4* palettes);
+
+private:
+	static constexpr uint32_t BATCH_SIZE = 8;
+
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	bool stopping = false;
+
+	// Work of the current call, published under the mutex before the workers are woken up. Workers copy it under the
+	// mutex too, since a worker still finishing one call may overlap the next.
+	uint64_t generation = 0;
+	std::span<const AnimatedInstance> instances;
+	glm::mat4* palettes = nullptr;
+	uint32_t batchCount = 0;
+	uint32_t finishedBatches = 0;
+
+	// The low half of the generation in the high half, and the next batch in the low one. A worker only takes batches
+	// of the generation it was woken up for.
+	std::atomic<uint64_t> nextBatch = 0;
+
+	std::vector<std::thread> workers;
+
+	void work();
+
+	// Samples batches of the given generation until none is left, and returns how many it sampled.
+	uint32_t sampleBatches(uint64_t batchGeneration, std::span<const AnimatedInstance> batchInstances, glm::mat4* batchPalettes, uint32_t count);
+};
@@ -0,0 +1,137 @@
+#include "capture.h"
+
+#include <fmt/core.h>
+
+#include <fstream>
+#include <cstring>
+
+namespace
+{
+	constexpr uint32_t CAPTURE_MAGIC = 0x43464B56; // "VKFC".
+	constexpr uint32_t CAPTURE_VERSION = 2;
+
+	struct CaptureHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+
+		VkExtent2D windowExtent;
+		float renderScale;
+
+		char backgroundEffect[32];
+		ComputePushConstants backgroundPushConstants;
+
+		uint32_t useUpscalePass;
+		float upscaleSharpness;
+
+		glm::mat4 viewMatrix;
+		glm::mat4 projectionMatrix;
+
+		uint64_t lightCount;
+		uint64_t drawCount;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+	};
+}
+
+bool writeFrameCapture(const std::filesystem::path& path, const FrameCapture& capture)
+{
+	CaptureHeader header{};
+
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	header.windowExtent = capture.windowExtent;
+	header.renderScale = capture.renderScale;
+	header.backgroundPushConstants = capture.backgroundPushConstants;
+	header.useUpscalePass = capture.useUpscalePass;
+	header.upscaleSharpness = capture.upscaleSharpness;
+	header.viewMatrix = capture.viewMatrix;
+	header.projectionMatrix = capture.projectionMatrix;
+	header.lightCount = capture.lights.size();
+	header.drawCount = capture.draws.size();
+	header.vertexCount = capture.vertices.size();
+	header.indexCount = capture.indices.size();
+
+	strncpy(header.backgroundEffect, capture.backgroundEffect.c_str(), sizeof(header.backgroundEffect) - 1);
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to write frame capture \"{}\".", path.string());
+
+		return false;
+	}
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)capture.lights.data(), capture.lights.size() * sizeof(GPULight));
+	file.write((const char*)capture.draws.data(), capture.draws.size() * sizeof(CapturedDraw));
+	file.write((const char*)capture.vertices.data(), capture.vertices.size() * sizeof(Vertex));
+	file.write((const char*)capture.indices.data(), capture.indices.size() * sizeof(uint32_t));
+
+	fmt::println("Captured {} draws, {} vertices and {} indices into \"{}\".", capture.draws.size(), capture.vertices.size(), capture.indices.size(), path.string());
+
+	return true;
+}
+
+std::optional<FrameCapture> readFrameCapture(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	CaptureHeader header{};
+
+	if (!file.is_open() || !file.read((char*)&header, sizeof(header)) || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION)
+	{
+		fmt::println("Failed to read frame capture \"{}\".", path.string());
+
+		return {};
+	}
+
+	FrameCapture capture;
+
+	header.backgroundEffect[sizeof(header.backgroundEffect) - 1] = '\0';
+
+	capture.windowExtent = header.windowExtent;
+	capture.renderScale = header.renderScale;
+	capture.backgroundEffect = header.backgroundEffect;
+	capture.backgroundPushConstants = header.backgroundPushConstants;
+	capture.useUpscalePass = header.useUpscalePass != 0;
+	capture.upscaleSharpness = header.upscaleSharpness;
+	capture.viewMatrix = header.viewMatrix;
+	capture.projectionMatrix = header.projectionMatrix;
+
+	capture.lights.resize(header.lightCount);
+	capture.draws.resize(header.drawCount);
+	capture.vertices.resize(header.vertexCount);
+	capture.indices.resize(header.indexCount);
+
+	file.read((char*)capture.lights.data(), capture.lights.size() * sizeof(GPULight));
+	file.read((char*)capture.draws.data(), capture.draws.size() * sizeof(CapturedDraw));
+	file.read((char*)capture.vertices.data(), capture.vertices.size() * sizeof(Vertex));
+	file.read((char*)capture.indices.data(), capture.indices.size() * sizeof(uint32_t));
+
+	if (!file)
+	{
+		fmt::println("Frame capture \"{}\" is truncated.", path.string());
+
+		return {};
+	}
+
+	return capture;
+}
+
+void FrameCaptureBuilder::addDraw(const GPUMeshBuffers& meshBuffers, uint32_t firstIndex, uint32_t indexCount)
+{
+	auto [it, inserted] = rangeIndices.try_emplace(meshBuffers.vertices.offset, (uint32_t)copyRanges.size());
+
+	if (inserted)
+	{
+		copyRanges.push_back({ meshBuffers, totalVertices, totalIndices });
+
+		totalVertices += meshBuffers.vertices.size;
+		totalIndices += meshBuffers.indices.size;
+	}
+
+	const CopyRange& range = copyRanges[it->second];
+
+	capture.draws.push_back({ indexCount, range.indexBase + firstIndex, (int32_t)range.vertexBase });
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <unordered_map>
+
+#include "structures.h"
+#include "lighting.h"
+
+// An indexed draw of the mesh pipeline, relative to the geometry of the capture.
+struct CapturedDraw
+{
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+};
+
+// Everything a frame depends on: the state selecting its pipelines, their push constants, its draws and the geometry
+// they read, copied out of the geometry arena and packed back to back.
+struct FrameCapture
+{
+	VkExtent2D windowExtent;
+	float renderScale = 1.0f;
+
+	std::string backgroundEffect;
+	ComputePushConstants backgroundPushConstants;
+
+	bool useUpscalePass = false;
+	float upscaleSharpness = 0.0f;
+
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+
+	std::vector<GPULight> lights;
+	std::vector<CapturedDraw> draws;
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+bool writeFrameCapture(const std::filesystem::path& path, const FrameCapture& capture);
+std::optional<FrameCapture> readFrameCapture(const std::filesystem::path& path);
+
+// Collects the draws of a frame while it's recorded. Each mesh drawn gets one range of vertices and one of indices
+// in the capture, copyRanges lists where they come from in the geometry arena.
+class FrameCaptureBuilder
+{
+public:
+	struct CopyRange
+	{
+		GPUMeshBuffers source;
+
+		uint32_t vertexBase;
+		uint32_t indexBase;
+	};
+
+	// The first index is relative to the mesh's index range.
+	void addDraw(const GPUMeshBuffers& meshBuffers, uint32_t firstIndex, uint32_t indexCount);
+
+	FrameCapture capture;
+	std::vector<CopyRange> copyRanges;
+
+	uint32_t totalVertices = 0;
+	uint32_t totalIndices = 0;
+
+private:
+	// Keyed by the vertex offset, which no two live meshes share.
+	std::unordered_map<uint32_t, uint32_t> rangeIndices;
+};
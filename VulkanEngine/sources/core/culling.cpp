@@ -0,0 +1,56 @@
+#include "culling.h"
+
+Frustum extractFrustum(const glm::mat4& viewProjection)
+{
+	// Rows of the matrix, glm matrices being stored by columns.
+	glm::vec4 rows[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4{ viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i] };
+	}
+
+	Frustum frustum;
+
+	frustum.planes[0] = rows[3] + rows[0]; // Left.
+	frustum.planes[1] = rows[3] - rows[0]; // Right.
+	frustum.planes[2] = rows[3] + rows[1]; // Bottom.
+	frustum.planes[3] = rows[3] - rows[1]; // Top.
+	frustum.planes[4] = rows[2];           // Near, or far with a reversed depth.
+	frustum.planes[5] = rows[3] - rows[2]; // Far, or near with a reversed depth.
+
+	// Normalized, so plane distances can be compared against radii.
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3{ plane });
+	}
+
+	return frustum;
+}
+
+bool isSphereVisible(const Frustum& frustum, const glm::vec4& sphere)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3{ plane }, glm::vec3{ sphere }) + plane.w < -sphere.w)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t cullSpheres(const Frustum& frustum, std::span<const glm::vec4> spheres, uint32_t* visibleIndices)
+{
+	uint32_t visibleCount = 0;
+
+	for (uint32_t i = 0; i < (uint32_t)spheres.size(); i++)
+	{
+		// Written unconditionally and kept by advancing the count, so the loop has no unpredictable branch.
+		visibleIndices[visibleCount] = i;
+		visibleCount += isSphereVisible(frustum, spheres[i]) ? 1 : 0;
+	}
+
+	return visibleCount;
+}
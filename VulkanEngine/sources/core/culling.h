@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <array>
+#include <cstdint>
+
+// The six planes of a view frustum, as (normal, distance) with the normals pointing inside.
+struct Frustum
+{
+	std::array<glm::vec4, 6> planes;
+};
+
+// Extracts the planes of a projection * view matrix, with a Vulkan clip space depth (0 to w). A reversed depth range
+// only swaps the near and far planes, so it works for both.
+Frustum extractFrustum(const glm::mat4& viewProjection);
+
+// The sphere is a center (xyz) and a radius (w).
+bool isSphereVisible(const Frustum& frustum, const glm::vec4& sphere);
+
+// Writes the indices of the visible spheres into visibleIndices, which must hold as many entries as there are spheres,
+// and returns how many are visible.
+uint32_t cullSpheres(const Frustum& frustum, std::span<const glm::vec4> spheres, uint32_t* visibleIndices);
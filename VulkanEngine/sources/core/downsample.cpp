@@ -0,0 +1,178 @@
+#include "downsample.h"
+
+#include <bit>
+#include <algorithm>
+
+DownsampleDispatch getDownsampleDispatch(VkExtent2D destinationExtent, uint32_t mipCount)
+{
+	DownsampleDispatch dispatch;
+
+	dispatch.groupCount.width = (destinationExtent.width + DOWNSAMPLE_TILE_SIZE - 1) / DOWNSAMPLE_TILE_SIZE;
+	dispatch.groupCount.height = (destinationExtent.height + DOWNSAMPLE_TILE_SIZE - 1) / DOWNSAMPLE_TILE_SIZE;
+
+	uint32_t chainLength = (uint32_t)std::bit_width(std::max({ destinationExtent.width, destinationExtent.height, 1u }));
+
+	dispatch.mipCount = std::min({ mipCount, chainLength, DOWNSAMPLE_MAX_MIPS });
+
+	// Past this many workgroups, the texels they leave don't fit the ones the last workgroup reduces.
+	if (dispatch.groupCount.width > DOWNSAMPLE_MAX_WORKGROUPS || dispatch.groupCount.height > DOWNSAMPLE_MAX_WORKGROUPS)
+	{
+		dispatch.mipCount = std::min(dispatch.mipCount, DOWNSAMPLE_WORKGROUP_MIPS);
+	}
+
+	return dispatch;
+}
+
+VkExtent2D getDepthPyramidExtent(VkExtent2D depthExtent)
+{
+	// The power of two strictly below, so that even power of two extents are halved at least once.
+	return
+	{
+		std::max(std::bit_floor(std::max(depthExtent.width, 2u) - 1), 1u),
+		std::max(std::bit_floor(std::max(depthExtent.height, 2u) - 1), 1u)
+	};
+}
+
+std::vector<std::vector<float>> emulateDownsample(std::span<const float> source, VkExtent2D sourceExtent, VkExtent2D destinationExtent, uint32_t mipCount, DownsampleReduction reduction)
+{
+	DownsampleDispatch dispatch = getDownsampleDispatch(destinationExtent, mipCount);
+
+	glm::ivec2 sourceSize{ sourceExtent.width, sourceExtent.height };
+	glm::ivec2 destinationSize{ destinationExtent.width, destinationExtent.height };
+	glm::ivec2 groupCount{ dispatch.groupCount.width, dispatch.groupCount.height };
+
+	auto getMipSize = [&](uint32_t mip)
+	{
+		return glm::max(destinationSize >> (int)mip, glm::ivec2{ 1 });
+	};
+
+	std::vector<std::vector<float>> mips(dispatch.mipCount);
+
+	for (uint32_t mip = 0; mip < dispatch.mipCount; mip++)
+	{
+		glm::ivec2 size = getMipSize(mip);
+
+		mips[mip].resize((size_t)size.x * size.y);
+	}
+
+	auto reduce = [reduction](float a, float b, float c, float d)
+	{
+		switch (reduction)
+		{
+		case DownsampleReduction::Min:
+			return std::min({ a, b, c, d });
+		case DownsampleReduction::Max:
+			return std::max({ a, b, c, d });
+		default:
+			return (a + b + c + d) * 0.25f;
+		}
+	};
+
+	auto storeMip = [&](uint32_t mip, glm::ivec2 texel, float value)
+	{
+		glm::ivec2 size = mip < dispatch.mipCount ? getMipSize(mip) : glm::ivec2{ 0 };
+
+		if (texel.x < size.x && texel.y < size.y)
+		{
+			mips[mip][(size_t)texel.y * size.x + texel.x] = value;
+		}
+	};
+
+	auto loadSource = [&](glm::ivec2 texel)
+	{
+		texel = glm::min(texel, destinationSize - 1);
+
+		glm::ivec2 begin = texel * sourceSize / destinationSize;
+		glm::ivec2 end = glm::max(((texel + 1) * sourceSize + destinationSize - 1) / destinationSize, begin + 1);
+
+		float value = source[(size_t)begin.y * sourceSize.x + begin.x];
+		float sum = 0.0f;
+
+		for (int y = begin.y; y < end.y; y++)
+		{
+			for (int x = begin.x; x < end.x; x++)
+			{
+				float sourceTexel = source[(size_t)y * sourceSize.x + x];
+
+				value = reduction == DownsampleReduction::Min ? std::min(value, sourceTexel) : std::max(value, sourceTexel);
+				sum += sourceTexel;
+			}
+		}
+
+		return reduction == DownsampleReduction::Average ? sum / ((end.x - begin.x) * (end.y - begin.y)) : value;
+	};
+
+	std::vector<float> workgroupTexels((size_t)DOWNSAMPLE_MAX_WORKGROUPS * DOWNSAMPLE_MAX_WORKGROUPS);
+
+	auto loadWorkgroupTexel = [&](glm::ivec2 texel)
+	{
+		texel = glm::min(texel, glm::min(getMipSize(DOWNSAMPLE_WORKGROUP_MIPS - 1), groupCount) - 1);
+
+		return workgroupTexels[(size_t)texel.y * DOWNSAMPLE_MAX_WORKGROUPS + texel.x];
+	};
+
+	// The invocations of a workgroup, run one level at a time: each level only reads the one above it.
+	auto downsampleTile = [&](uint32_t firstMip, glm::ivec2 tileIndex, bool fromSource)
+	{
+		float tile[16][16];
+
+		for (int y = 0; y < 16; y++)
+		{
+			for (int x = 0; x < 16; x++)
+			{
+				glm::ivec2 texel = tileIndex * 16 + glm::ivec2{ x, y };
+				float quad[4];
+
+				for (int i = 0; i < 4; i++)
+				{
+					glm::ivec2 quadTexel = texel * 2 + glm::ivec2{ i & 1, i >> 1 };
+
+					quad[i] = fromSource ? loadSource(quadTexel) : reduce(
+						loadWorkgroupTexel(quadTexel * 2),
+						loadWorkgroupTexel(quadTexel * 2 + glm::ivec2{ 1, 0 }),
+						loadWorkgroupTexel(quadTexel * 2 + glm::ivec2{ 0, 1 }),
+						loadWorkgroupTexel(quadTexel * 2 + glm::ivec2{ 1, 1 }));
+
+					storeMip(firstMip, quadTexel, quad[i]);
+				}
+
+				tile[y][x] = reduce(quad[0], quad[1], quad[2], quad[3]);
+
+				storeMip(firstMip + 1, texel, tile[y][x]);
+			}
+		}
+
+		for (uint32_t level = 2; level < DOWNSAMPLE_WORKGROUP_MIPS; level++)
+		{
+			int size = 32 >> level;
+
+			for (int y = 0; y < size; y++)
+			{
+				for (int x = 0; x < size; x++)
+				{
+					// Going in increasing order only overwrites texels that were already read.
+					tile[y][x] = reduce(tile[y * 2][x * 2], tile[y * 2][x * 2 + 1], tile[y * 2 + 1][x * 2], tile[y * 2 + 1][x * 2 + 1]);
+
+					storeMip(firstMip + level, tileIndex * size + glm::ivec2{ x, y }, tile[y][x]);
+				}
+			}
+		}
+
+		return tile[0][0];
+	};
+
+	for (int y = 0; y < groupCount.y; y++)
+	{
+		for (int x = 0; x < groupCount.x; x++)
+		{
+			workgroupTexels[(size_t)y * DOWNSAMPLE_MAX_WORKGROUPS + x] = downsampleTile(0, glm::ivec2{ x, y }, true);
+		}
+	}
+
+	if (dispatch.mipCount > DOWNSAMPLE_WORKGROUP_MIPS)
+	{
+		downsampleTile(DOWNSAMPLE_WORKGROUP_MIPS, glm::ivec2{ 0 }, false);
+	}
+
+	return mips;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Single pass downsampler: one dispatch writes a whole mip chain. A workgroup reduces a tile of 32x32 texels of the first
+// level down to a single texel through shared memory, which covers the first DOWNSAMPLE_WORKGROUP_MIPS levels. The last
+// workgroup to finish, found with an atomic counter, reduces the texels left by every workgroup into the remaining levels.
+// Has to match downsample.comp.
+constexpr uint32_t DOWNSAMPLE_MAX_MIPS = 12;
+constexpr uint32_t DOWNSAMPLE_WORKGROUP_MIPS = 6;
+constexpr uint32_t DOWNSAMPLE_TILE_SIZE = 1u << (DOWNSAMPLE_WORKGROUP_MIPS - 1);
+
+// The last workgroup reduces at most this many workgroups per axis, larger chains stop after the levels of the tiles.
+constexpr uint32_t DOWNSAMPLE_MAX_WORKGROUPS = 1u << (DOWNSAMPLE_MAX_MIPS - DOWNSAMPLE_WORKGROUP_MIPS);
+
+enum class DownsampleReduction : uint32_t
+{
+	Average,
+	Min,
+	Max
+};
+
+// The atomic counter of the last workgroup, and the texel left by each workgroup.
+struct GPUDownsampleData
+{
+	uint32_t counter;
+	uint32_t padding[3];
+	glm::vec4 texels[DOWNSAMPLE_MAX_WORKGROUPS * DOWNSAMPLE_MAX_WORKGROUPS];
+};
+
+struct DownsamplePushConstants
+{
+	VkDeviceAddress dataBufferAddress;
+
+	glm::ivec2 sourceSize;
+	glm::ivec2 destinationSize;
+
+	uint32_t mipCount;
+	uint32_t reduction;
+};
+
+struct DownsampleDispatch
+{
+	VkExtent2D groupCount;
+	uint32_t mipCount;
+};
+
+// Workgroups writing the given number of levels below the source, the first one being destinationExtent. The number of
+// levels is clamped to the chain of the destination, and to what a single dispatch can write.
+DownsampleDispatch getDownsampleDispatch(VkExtent2D destinationExtent, uint32_t mipCount);
+
+// First level of a depth pyramid built from a depth image of the given extent: the power of two below it, on each axis.
+// Every level after it is exactly half the previous one, so each texel covers whole texels of the level above.
+VkExtent2D getDepthPyramidExtent(VkExtent2D depthExtent);
+
+// Runs downsample.comp on the CPU for a single channel image, with the same split into workgroup tiles and the same last
+// workgroup pass, so the layout of the shader can be checked against a plain reduction of every level. The source and
+// the returned levels are stored row by row, the levels having the extents the shader writes.
+std::vector<std::vector<float>> emulateDownsample(std::span<const float> source, VkExtent2D sourceExtent, VkExtent2D destinationExtent, uint32_t mipCount, DownsampleReduction reduction);
@@ -12,9 +12,23 @@ void Engine::initialize()
 
 	engineReference = this;
 
+	// A replayed capture is rendered at the resolution it was captured at.
+	if (!settings.frameCapturePath.empty())
+	{
+		replayedCapture = readFrameCapture(settings.frameCapturePath);
+
+		if (!replayedCapture.has_value())
+		{
+			throw std::runtime_error("Failed to read the frame capture!");
+		}
+
+		windowExtent = replayedCapture->windowExtent;
+	}
+
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_VISIBLE, settings.visibleWindow);
 
 	window = glfwCreateWindow(windowExtent.width, windowExtent.height, "Vulkan Engine", nullptr, nullptr);
 
@@ -22,6 +36,8 @@ void Engine::initialize()
 	glfwSetWindowUserPointer(window, this);
 
 	glfwSetKeyCallback(window, windowKeyCallback);
+	glfwSetMouseButtonCallback(window, windowMouseButtonCallback);
+	glfwSetCursorPosCallback(window, windowCursorPositionCallback);
 	glfwSetFramebufferSizeCallback(window, windowFramebufferSizeCallback);
 
 	initializeVulkan();
@@ -29,9 +45,20 @@ void Engine::initialize()
 	initializeCommandStructures();
 	initializeSyncStructures();
 	initializeDescriptors();
+	initializeGeometryArena();
+	initializeLighting();
+	initializeShadows();
+	initializeVisibilityBuffer();
+	initializeDownsample();
 	initializePipelines();
 	initializeImgui();
 	initalizeDefaultData();
+	initializeAnimation();
+	initializeParticles();
+
+	shaderManager.startWatching();
+
+	inputSystem.initialize(CameraState{});
 
 	isInitialized = true;
 }
@@ -40,52 +67,326 @@ void Engine::run()
 {
 	while (!glfwWindowShouldClose(window))
 	{
-		float currTime = static_cast<float>(glfwGetTime());
+		runFrame();
+	}
+}
+
+void Engine::runFrame()
+{
+	if (requestedFramesInFlight != framesInFlight)
+	{
+		setFramesInFlight(requestedFramesInFlight);
+	}
+
+	// In low-latency mode we block on the previous frames before sampling the inputs, so the frame is recorded
+	// with the freshest inputs possible and submitted right away.
+	if (lowLatencyMode && !stopRendering && !resizeRequested)
+	{
+		waitForFrame();
+	}
+
+	sampleInputs();
+	processInputs(deltaTime);
+
+	if (stopRendering)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		return;
+	}
+
+	// A minimized window is left alone until it's restored.
+	if (resizeRequested && !resizeSwapchain())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		return;
+	}
+
+	// A replayed capture already holds the geometry of its frame.
+	if (!replayedCapture.has_value())
+	{
+		worldStreamer.update(cameraPosition, cameraForward);
+	}
+
+	ImGui_ImplVulkan_NewFrame();
+	ImGui_ImplGlfw_NewFrame();
+
+	ImGui::NewFrame();
+
+	if (settings.showInterface)
+	{
+		buildInterface();
+	}
+
+	ImGui::Render();
+
+	render(deltaTime);
+}
 
-		deltaTime = currTime - lastFrame;
-		lastFrame = currTime;
+void Engine::buildInterface()
+{
+	if (ImGui::Begin("Background"))
+	{
+		ComputeEffect& selectedComputeEffect = backgroundEffects[currentBackgroundEffect];
 
-		glfwPollEvents();
+		ImGui::BeginDisabled(dynamicResolution);
+		ImGui::SliderFloat("Render Scale", &renderScale, resolutionController.minScale, resolutionController.maxScale);
+		ImGui::EndDisabled();
 
-		if (stopRendering)
+		if (ImGui::Checkbox("Dynamic Resolution", &dynamicResolution))
 		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			resolutionController.reset();
+		}
 
-			continue;
+		ImGui::InputFloat("Target Frame Time (ms)", &resolutionController.targetFrameTime);
+		ImGui::Text("GPU Frame Time: %.2f ms", gpuFrameTime);
+
+		ImGui::Checkbox("EASU + RCAS Upscale", &useUpscalePass);
+		ImGui::SliderFloat("Sharpness (stops)", &upscaleSharpness, 0.0f, 2.0f);
+
+		ImGui::BeginDisabled(!asyncComputeSupported);
+		ImGui::Checkbox("Async Compute", &useAsyncCompute);
+		ImGui::EndDisabled();
+
+		ImGui::Text("Selected Effect: %s", selectedComputeEffect.name);
+		
+		ImGui::SliderInt("Effect Index", &currentBackgroundEffect, 0, (int)backgroundEffects.size() - 1);
+
+		ImGui::InputFloat4("Data 1", (float*)&selectedComputeEffect.pushConstants.data1);
+		ImGui::InputFloat4("Data 2", (float*)&selectedComputeEffect.pushConstants.data2);
+		ImGui::InputFloat4("Data 3", (float*)&selectedComputeEffect.pushConstants.data3);
+		ImGui::InputFloat4("Data 4", (float*)&selectedComputeEffect.pushConstants.data4);
+
+		ImGui::Checkbox("Lazy Background", &lazyBackground);
+		ImGui::Checkbox("Animated", &selectedComputeEffect.animated);
+
+		ImGui::BeginDisabled(!selectedComputeEffect.animated);
+		ImGui::SliderInt("Update Interval", (int*)&selectedComputeEffect.updateInterval, 1, 60);
+		ImGui::EndDisabled();
+
+		ImGui::Text("Background Dispatches: %u", backgroundDispatches);
+	}
+
+	ImGui::End();
+
+	// Geometry passes of the frame, and the counters of the last one.
+	if (ImGui::Begin("Rendering"))
+	{
+		ImGui::Checkbox("Frustum Culling", &frustumCulling);
+		ImGui::Text("Draws: %u, %u culled, %llu triangles", frameStats.drawCount, frameStats.culledCount, (unsigned long long)frameStats.triangleCount);
+
+		ImGui::BeginDisabled(!visibilityBufferSupported);
+		ImGui::Checkbox("Visibility Buffer", &useVisibilityBuffer);
+		ImGui::EndDisabled();
+
+		if (useVisibilityBuffer && visibilityBufferSupported)
+		{
+			if (frameStats.visibilityDrawOverflow)
+			{
+				ImGui::Text("Visibility Draws: over %u, drawn forward", MAX_VISIBILITY_DRAWS);
+			}
+			else
+			{
+				ImGui::Text("Visibility Draws: %u / %u", frameStats.visibilityDrawCount, MAX_VISIBILITY_DRAWS);
+			}
 		}
 
-		if (resizeRequested)
+		const char* depthPrepassModes[] = { "Off", "On", "Automatic" };
+		int depthPrepassModeIndex = (int)depthPrepassMode;
+
+		if (ImGui::Combo("Depth Pre-pass", &depthPrepassModeIndex, depthPrepassModes, overdrawQuerySupported ? 3 : 2))
 		{
-			resizeSwapchain();
+			depthPrepassMode = (DepthPrepassMode)depthPrepassModeIndex;
+			depthPrepassController.reset();
 		}
 
-		ImGui_ImplVulkan_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
+		if (overdrawQuerySupported)
+		{
+			ImGui::Text("Overdraw: %.2f (filtered %.2f), pre-pass %s", overdraw, depthPrepassController.filteredOverdraw, depthPrepassActive ? "on" : "off");
+		}
 
-		ImGui::NewFrame();
+		ImGui::BeginDisabled(!downsampleSupported);
+		ImGui::Checkbox("Depth Pyramid", &buildDepthPyramid);
+		ImGui::EndDisabled();
 
-		if (ImGui::Begin("Background"))
+		if (buildDepthPyramid && downsampleSupported)
 		{
-			ComputeEffect& selectedComputeEffect = backgroundEffects[currentBackgroundEffect];
+			ImGui::Text("Depth Pyramid: %ux%u, %u levels", depthPyramidExtent.width, depthPyramidExtent.height, depthPyramidMipCount);
+		}
+	}
+
+	ImGui::End();
 
-			ImGui::SliderFloat("Render Scale", &renderScale, 0.25f, 1.0f);
+	if (ImGui::Begin("Lighting"))
+	{
+		ImGui::SliderInt("Light Count", &lightCount, 0, (int)MAX_LIGHTS);
+		ImGui::Checkbox("Animate Lights", &animateLights);
+		ImGui::ColorEdit3("Ambient", (float*)&ambientLight);
+		ImGui::Text("Clusters: %ux%ux%u, up to %u lights each", CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, MAX_LIGHTS_PER_CLUSTER);
+
+		ImGui::SeparatorText("Sun");
+		ImGui::SliderFloat("Azimuth", &sunAzimuth, -180.0f, 180.0f);
+		ImGui::SliderFloat("Elevation", &sunElevation, 5.0f, 90.0f);
+		ImGui::ColorEdit3("Sun Color", (float*)&sunColor);
+		ImGui::SliderFloat("Sun Intensity", &sunIntensity, 0.0f, 4.0f);
+
+		ImGui::SliderFloat("Shadow Distance", &shadowDistance, 10.0f, 1000.0f);
+		ImGui::SliderFloat("Split Lambda", &shadowCascadeSplitLambda, 0.0f, 1.0f);
+		ImGui::SliderFloat("Caster Distance", &shadowCasterDistance, 0.0f, 1000.0f);
+		ImGui::SliderFloat("Normal Offset (texels)", &shadowNormalOffset, 0.0f, 4.0f);
+		ImGui::Checkbox("Cache Static Shadows", &cacheStaticShadows);
+
+		ImGui::Text("Cascade Renders: %u this frame, %u total", frameStats.shadowCascadeRenders, staticShadowCascadeRenders);
+		ImGui::Text("Shadow Draws: %u, %zu dynamic casters", frameStats.shadowDrawCount, dynamicMeshes.size());
+	}
 
-			ImGui::Text("Selected Effect: %s", selectedComputeEffect.name);
-			
-			ImGui::SliderInt("Effect Index", &currentBackgroundEffect, 0, (int)backgroundEffects.size() - 1);
+	ImGui::End();
+
+	if (!animatedInstances.empty())
+	{
+		if (ImGui::Begin("Animation"))
+		{
+			ImGui::Checkbox("Animate Crowd", &animateCrowd);
+			ImGui::SliderFloat("Speed", &animationSpeed, 0.0f, 4.0f);
 
-			ImGui::InputFloat4("Data 1", (float*)&selectedComputeEffect.pushConstants.data1);
-			ImGui::InputFloat4("Data 2", (float*)&selectedComputeEffect.pushConstants.data2);
-			ImGui::InputFloat4("Data 3", (float*)&selectedComputeEffect.pushConstants.data3);
-			ImGui::InputFloat4("Data 4", (float*)&selectedComputeEffect.pushConstants.data4);
+			ImGui::Text("Instances: %zu animated, %zu skinned meshes", animatedInstances.size(), skinnedInstances.size());
+			ImGui::Text("Palette Sampling: %.3f ms", animationSampleTime);
+			ImGui::Text("Skinned Vertices: %u", frameStats.skinnedVertexCount);
 		}
 
 		ImGui::End();
+	}
+
+	if (ImGui::Begin("Particles"))
+	{
+		ImGui::Checkbox("Enabled", &particlesEnabled);
+		ImGui::Checkbox("Sorted Alpha Blending", &sortParticles);
+
+		ImGui::SliderFloat("Emission Rate", &particleEmitter.rate, 0.0f, 1000000.0f, "%.0f /s");
+		ImGui::DragFloatRange2("Lifetime", &particleEmitter.minLifetime, &particleEmitter.maxLifetime, 0.05f, 0.1f, 20.0f, "%.1f s");
+		ImGui::DragFloat3("Emitter Position", &particleEmitter.position.x, 0.1f);
+		ImGui::SliderFloat("Emitter Radius", &particleEmitter.radius, 0.0f, 10.0f);
+		ImGui::DragFloat3("Velocity", &particleEmitter.velocity.x, 0.1f);
+		ImGui::SliderFloat("Velocity Jitter", &particleEmitter.velocityJitter, 0.0f, 20.0f);
+		ImGui::DragFloat3("Gravity", &particleGravity.x, 0.1f);
+		ImGui::SliderFloat("Drag", &particleDrag, 0.0f, 2.0f);
+		ImGui::SliderFloat("Size", &particleSize, 0.005f, 0.5f);
+
+		// The alive count stays on the GPU, past the capacity the emission waits for particles to die.
+		ImGui::Text("Capacity: %u particles", MAX_PARTICLES);
+	}
+
+	ImGui::End();
+
+	if (ImGui::Begin("Frame Pacing"))
+	{
+		int requestedFrames = (int)requestedFramesInFlight;
+
+		if (ImGui::SliderInt("Frames In Flight", &requestedFrames, 1, (int)MAX_FRAMES_IN_FLIGHT))
+		{
+			requestedFramesInFlight = (uint32_t)requestedFrames;
+		}
+
+		ImGui::Checkbox("Low Latency Mode", &lowLatencyMode);
+
+		ImGui::Text("Present Wait: %s", presentWaitSupported ? "supported" : "unsupported");
+		ImGui::Text("Input Latency: %.2f ms (%s)", inputLatency, inputLatencyIncludesPresent ? "input to present" : "input to GPU completion");
+	}
+
+	ImGui::End();
+
+	if (ImGui::Begin("Frame Capture"))
+	{
+		ImGui::BeginDisabled(replayedCapture.has_value() || frameCaptureRequested);
+
+		if (ImGui::Button("Capture Frame"))
+		{
+			frameCaptureRequested = true;
+		}
+
+		ImGui::EndDisabled();
+
+		if (replayedCapture.has_value())
+		{
+			ImGui::TextUnformatted("Replaying a capture.");
+		}
+		else
+		{
+			ImGui::Text("Written to %s, for the benchmark to replay.", FRAME_CAPTURE_PATH);
+		}
+	}
+
+	ImGui::End();
 
-		ImGui::Render();
+	drawMemoryDashboard();
 
-		render(deltaTime);
+	if (ImGui::Begin("Camera"))
+	{
+		ImGui::Text("Position: %.2f, %.2f, %.2f", cameraPosition.x, cameraPosition.y, cameraPosition.z);
+		ImGui::Text("Simulation: %.0f ticks per second, %u dropped events", inputSystem.getTickRate(), inputSystem.droppedEvents);
+		ImGui::TextUnformatted("WASD + QE to move, hold the right mouse button to look around.");
+
+		ImGui::BeginDisabled(inputSystem.isReplaying());
+
+		if (!inputSystem.isRecording() ? ImGui::Button("Record") : ImGui::Button("Stop Recording"))
+		{
+			if (inputSystem.isRecording())
+			{
+				inputSystem.stopRecording(INPUT_RECORDING_PATH);
+			}
+			else
+			{
+				inputSystem.startRecording();
+			}
+		}
+
+		ImGui::EndDisabled();
+
+		ImGui::SameLine();
+
+		if (!inputSystem.isReplaying() ? ImGui::Button("Replay") : ImGui::Button("Stop Replay"))
+		{
+			if (inputSystem.isReplaying())
+			{
+				inputSystem.stopReplay();
+			}
+			else
+			{
+				inputSystem.startReplay(INPUT_RECORDING_PATH, replayLockstep);
+			}
+		}
+
+		ImGui::SameLine();
+
+		ImGui::Checkbox("Lockstep", &replayLockstep);
+
+		if (inputSystem.isReplaying())
+		{
+			ImGui::Text("Replay: %s", inputSystem.isReplayFinished() ? "finished" : "running");
+		}
+	}
+
+	ImGui::End();
+
+	if (ImGui::Begin("Streaming"))
+	{
+		uint32_t cellCounts[5] = {};
+
+		for (const WorldCell& cell : worldStreamer.getCells())
+		{
+			cellCounts[(uint32_t)cell.state]++;
+		}
+
+		ImGui::Text("Cells: %u resident, %u parsed, %u requested, %u unloaded, %u failed", cellCounts[(uint32_t)CellState::Resident], cellCounts[(uint32_t)CellState::Parsed],
+			cellCounts[(uint32_t)CellState::Requested], cellCounts[(uint32_t)CellState::Unloaded], cellCounts[(uint32_t)CellState::Failed]);
+		ImGui::Text("Resident: %.2f / %.2f MB", worldStreamer.residentBytes / (1024.0 * 1024.0), worldStreamer.budget / (1024.0 * 1024.0));
+
+		ImGui::SliderFloat("Load Radius", &worldStreamer.loadRadius, 0.0f, worldStreamer.unloadRadius);
+		ImGui::SliderFloat("Unload Radius", &worldStreamer.unloadRadius, worldStreamer.loadRadius, 1000.0f);
 	}
+
+	ImGui::End();
 }
 
 void Engine::cleanUp()
@@ -94,22 +395,28 @@ void Engine::cleanUp()
 	{
 		vkDeviceWaitIdle(device);
 
-		for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+		inputSystem.cleanUp();
+		shaderManager.cleanUp();
+		memoryManager.cleanUp();
+		worldStreamer.cleanUp();
+
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 		{
 			vkDestroyCommandPool(device, frames[i].commandPool, nullptr);
+			vkDestroyCommandPool(device, frames[i].computeCommandPool, nullptr);
 
-			vkDestroyFence(device, frames[i].renderFence, nullptr);
 			vkDestroySemaphore(device, frames[i].renderSemaphore, nullptr);
 			vkDestroySemaphore(device, frames[i].swapchainSemaphore, nullptr);
+			vkDestroyQueryPool(device, frames[i].timestampQueryPool, nullptr);
 
-			frames[i].deletionQueue.flush();
+			if (frames[i].occlusionQueryPool != VK_NULL_HANDLE)
+			{
+				vkDestroyQueryPool(device, frames[i].occlusionQueryPool, nullptr);
+			}
 		}
 
-		for (auto& mesh : testMeshes)
-		{
-			destroyBuffer(mesh->meshBuffers.vertexBuffer);
-			destroyBuffer(mesh->meshBuffers.indexBuffer);
-		}
+		graphicsDeletionQueue.flush();
+		transferDeletionQueue.flush();
 
 		mainDeletionQueue.flush();
 
@@ -127,12 +434,42 @@ void Engine::cleanUp()
 	engineReference = nullptr;
 }
 
-void Engine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
+void Engine::setFramesInFlight(uint32_t count)
+{
+	count = std::clamp(count, 1u, MAX_FRAMES_IN_FLIGHT);
+
+	// Every slot of the frame ring has to be idle before resizing it, otherwise an in-flight frame would be remapped
+	// to another slot by frameCount % framesInFlight. Frames complete in order, so waiting for the last one is enough.
+	waitForGraphicsTimeline(graphicsTimelineValue);
+
+	collectRetiredResources();
+
+	framesInFlight = count;
+	requestedFramesInFlight = count;
+	frameWaited = false;
+}
+
+uint64_t Engine::submitTransfer(std::function<void(VkCommandBuffer cmd)>&& function)
 {
-	VK_CHECK(vkResetFences(device, 1, &immFence));
-	VK_CHECK(vkResetCommandBuffer(immCommandBuffer, 0));
+	// Recycles the command buffers of the uploads the transfer queue is done with.
+	collectRetiredResources();
+
+	VkCommandBuffer cmd;
+
+	if (freeTransferCommandBuffers.empty())
+	{
+		VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkeUtils::commandBufferAllocateInfo(transferCommandPool, 1);
+
+		VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &cmd));
+	}
+	else
+	{
+		cmd = freeTransferCommandBuffers.back();
+
+		freeTransferCommandBuffers.pop_back();
+	}
 
-	VkCommandBuffer cmd = immCommandBuffer;
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
 
 	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
@@ -142,679 +479,3436 @@ void Engine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function
 
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
+	uint64_t value = ++transferTimelineValue;
+
+	// The copy of a defragmentation pass would overwrite the upload if it ran after it.
 	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
-	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, nullptr, nullptr);
+	VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_COPY_BIT, geometryRelocationValue);
+	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(transferTimeline, VK_PIPELINE_STAGE_2_COPY_BIT, value);
+	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, &waitSemaphoreSubmitInfo, &signalSemaphoreSubmitInfo);
 
-	VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submitInfo, immFence));
+	VK_CHECK(vkQueueSubmit2(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+	transferDeletionQueue.pushFunction(value, [this, cmd]()
+	{
+		freeTransferCommandBuffers.push_back(cmd);
+	});
 
-	VK_CHECK(vkWaitForFences(device, 1, &immFence, true, UINT64_MAX));
+	return value;
 }
 
 GPUMeshBuffers Engine::uploadMesh(std::span<Vertex> vertices, std::span<uint32_t> indices)
 {
-	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-	const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
-
 	GPUMeshBuffers newSurface;
 
-	newSurface.vertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-	VkBufferDeviceAddressInfo deviceAdressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer };
+	if (!tryUploadMesh(vertices, indices, newSurface))
+	{
+		throw std::runtime_error("Failed to allocate the mesh in the geometry arena!");
+	}
 
-	newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(device, &deviceAdressInfo);
-	newSurface.indexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	return newSurface;
+}
 
-	AllocatedBuffer stagingBuffer = createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-	void* mappedData = stagingBuffer.allocationInfo.pMappedData;
+bool Engine::tryUploadMesh(std::span<Vertex> vertices, std::span<uint32_t> indices, GPUMeshBuffers& newSurface)
+{
+	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
+	const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
 
-	//vmaMapMemory(allocator, stagingBuffer.allocation, &mappedData);
+	if (!geometryArena.allocate((uint32_t)vertices.size(), (uint32_t)indices.size(), newSurface))
+	{
+		return false;
+	}
 
-	memcpy(mappedData, vertices.data(), vertexBufferSize); // Copy vertex buffer.
-	memcpy((char*)mappedData + vertexBufferSize, indices.data(), indexBufferSize); // Copy index buffer.
+	AllocatedBuffer stagingBuffer = createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::Staging);
 
-	//vmaUnmapMemory(allocator, stagingBuffer.allocation);
+	packMeshGeometry(vertices, indices, stagingBuffer.allocationInfo.pMappedData);
 
-	immediateSubmit([&](VkCommandBuffer cmd)
+	uint64_t uploadValue = submitTransfer([&](VkCommandBuffer cmd)
 	{
 		VkBufferCopy vertexBufferCopy{ 0 };
 
-		vertexBufferCopy.dstOffset = 0;
+		vertexBufferCopy.dstOffset = newSurface.vertices.offset * sizeof(Vertex);
 		vertexBufferCopy.srcOffset = 0;
 		vertexBufferCopy.size = vertexBufferSize;
 
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, newSurface.vertexBuffer.buffer, 1, &vertexBufferCopy);
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryArena.vertexBuffer.buffer, 1, &vertexBufferCopy);
 
 		VkBufferCopy indexBufferCopy{ 0 };
 
-		indexBufferCopy.dstOffset = 0;
+		indexBufferCopy.dstOffset = newSurface.indices.offset * sizeof(uint32_t);
 		indexBufferCopy.srcOffset = vertexBufferSize;
 		indexBufferCopy.size = indexBufferSize;
 
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, newSurface.indexBuffer.buffer, 1, &indexBufferCopy);
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryArena.indexBuffer.buffer, 1, &indexBufferCopy);
 	});
 
-	destroyBuffer(stagingBuffer);
+	// The mesh can be drawn right away, the graphics queue waits for the upload. Only the staging buffer has to outlive it.
+	transferDeletionQueue.pushFunction(uploadValue, [this, stagingBuffer]()
+	{
+		destroyBuffer(stagingBuffer);
+	});
 
-	return newSurface;
+	return true;
 }
 
-void Engine::render(float deltaTime)
+void Engine::registerMeshBuffers(GPUMeshBuffers& meshBuffers)
 {
-	VK_CHECK(vkWaitForFences(device, 1, &getCurrentFrame().renderFence, true, UINT64_MAX));
-	VK_CHECK(vkResetFences(device, 1, &getCurrentFrame().renderFence));
+	geometryArena.registerMesh(&meshBuffers);
+}
 
-	// Request image from the swapchain.
-	uint32_t swapchainImageIndex;
-	VkResult acquireNextImageResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, getCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex);
+void Engine::freeMeshBuffers(GPUMeshBuffers& meshBuffers)
+{
+	geometryArena.unregisterMesh(&meshBuffers);
 
-	if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR)
+	graphicsDeletionQueue.pushFunction(getFrameTimelineValue(), [this, meshBuffers]()
 	{
-		resizeRequested = true;
-		return;
-	}
-
-	drawExtent.width = (uint32_t)(std::min(swapchainExtent.width, drawImage.imageExtent2D.width) * renderScale);
-	drawExtent.height = (uint32_t)(std::min(swapchainExtent.height, drawImage.imageExtent2D.height) * renderScale);
-
-	VkCommandBuffer cmd = getCurrentFrame().mainCommandBuffer;
-
-	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+		geometryArena.free(meshBuffers);
+	});
+}
 
-	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+void Engine::sampleInputs()
+{
+	glfwPollEvents();
 
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+	float currTime = static_cast<float>(glfwGetTime());
 
-	// Make the swapchain image into writeable mode before rendering.
-	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	deltaTime = currTime - lastFrame;
+	lastFrame = currTime;
 
-	renderInBackground(deltaTime, cmd);
+	inputTime = glfwGetTime();
+}
 
-	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	vkeUtils::transitionImageLayout(cmd, depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+void Engine::waitForFrame()
+{
+	if (frameWaited)
+	{
+		return;
+	}
 
-	renderGeometry(deltaTime, cmd);
+	Frame& frame = getCurrentFrame();
 
-	// Transition the draw image and the swapchain image into their correct transfer layouts.
-	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	waitForGraphicsTimeline(frame.timelineValue);
 
-	// Execute a copy from the draw image into the swapchain image.
-	vkeUtils::copyImageToImage(cmd, drawImage.image, swapchainImages[swapchainImageIndex], drawExtent, swapchainExtent);
+	bool waitForPresent = lowLatencyMode && presentWaitSupported && lastPresentedId > 0;
 
-	// Make the swapchain image into attachment optimal, so we can draw on it.
-	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	// Without present wait, the graphics timeline is the closest completion signal we have for the frame.
+	if (!waitForPresent && frame.inputTime > 0.0)
+	{
+		recordInputLatency(frame.inputTime, false);
+	}
 
-	renderImgui(deltaTime, cmd, swapchainImageViews[swapchainImageIndex]);
+	if (frame.timestampsWritten)
+	{
+		uint64_t timestamps[2];
 
-	// Make the swapchain image into presentable mode.
-	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		// The frame has retired, so the results are available without waiting.
+		if (vkGetQueryPoolResults(device, frame.timestampQueryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			gpuFrameTime = (float)((timestamps[1] - timestamps[0]) * timestampPeriod / 1'000'000.0);
+			gpuFrameTimeFrame = frame.frameNumber;
 
-	VK_CHECK(vkEndCommandBuffer(cmd));
+			if (dynamicResolution)
+			{
+				renderScale = resolutionController.update(gpuFrameTime, renderScale);
+			}
+		}
+	}
 
-	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
-	VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(getCurrentFrame().swapchainSemaphore, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
-	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(getCurrentFrame().renderSemaphore, VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT);
-	
-	// Submit command buffer to the queue and execute it.
-	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, &waitSemaphoreSubmitInfo, &signalSemaphoreSubmitInfo);
+	if (frame.overdrawPixelCount > 0)
+	{
+		uint64_t passedSamples;
 
-	VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submitInfo, getCurrentFrame().renderFence));
+		if (vkGetQueryPoolResults(device, frame.occlusionQueryPool, 0, 1, sizeof(passedSamples), &passedSamples, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			overdraw = (float)((double)passedSamples / (double)frame.overdrawPixelCount);
 
-	VkPresentInfoKHR presentInfo{};
+			if (depthPrepassMode == DepthPrepassMode::Automatic)
+			{
+				depthPrepassController.update(overdraw);
+			}
+		}
 
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = &swapchain;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &getCurrentFrame().renderSemaphore;
-	presentInfo.pImageIndices = &swapchainImageIndex;
+		frame.overdrawPixelCount = 0;
+	}
 
-	VkResult queuePresentResult = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+	collectRetiredResources();
 
-	if (queuePresentResult == VK_ERROR_OUT_OF_DATE_KHR)
+	if (waitForPresent)
 	{
-		resizeRequested = true;
-		return;
+		// Wait until the last frame reaches the display, so at most one frame is queued when inputs are sampled.
+		VkResult waitForPresentResult = vkWaitForPresent(device, swapchain, lastPresentedId, PRESENT_WAIT_TIMEOUT);
+
+		if (waitForPresentResult == VK_SUCCESS)
+		{
+			recordInputLatency(lastPresentedInputTime, true);
+		}
+		else if (waitForPresentResult == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			resizeRequested = true;
+		}
 	}
 
-	frameCount++;
+	frameWaited = true;
 }
 
-void Engine::renderInBackground(float deltaTime, VkCommandBuffer cmd)
+void Engine::waitForGraphicsTimeline(uint64_t value)
 {
-	// Make a clear-color from frame number. This will flash with a 120 frame period.
-	float flash = std::abs(std::sin(frameCount / 120.0f));
-	VkClearColorValue clearColorValue{ { 0.0f, 0.0f, flash, 1.0f } };
-	VkImageSubresourceRange clearRange = vkeUtils::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
-
-	// vkCmdClearColorImage(cmd, drawImage.image, VK_IMAGE_LAYOUT_GENERAL, &clearColorValue, 1, &clearRange);
+	VkSemaphoreWaitInfo semaphoreWaitInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
 
-	ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+	semaphoreWaitInfo.semaphoreCount = 1;
+	semaphoreWaitInfo.pSemaphores = &graphicsTimeline;
+	semaphoreWaitInfo.pValues = &value;
 
-	// Bind the background compute pipeline.
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
+	VK_CHECK(vkWaitSemaphores(device, &semaphoreWaitInfo, UINT64_MAX));
+}
 
-	// Bind the descriptor set containing the draw image for the compute pipeline.
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, defaultPipelineLayout, 0, 1, &drawImageDescriptors, 0, nullptr);
+void Engine::collectRetiredResources()
+{
+	uint64_t completedGraphicsValue;
+	uint64_t completedTransferValue;
 
-	vkCmdPushConstants(cmd, defaultPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.pushConstants);
+	VK_CHECK(vkGetSemaphoreCounterValue(device, graphicsTimeline, &completedGraphicsValue));
+	VK_CHECK(vkGetSemaphoreCounterValue(device, transferTimeline, &completedTransferValue));
 
-	// Execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it.
-	vkCmdDispatch(cmd, (uint32_t)std::ceil(drawExtent.width / 16), (uint32_t)std::ceil(drawExtent.height / 16), 1);
+	graphicsDeletionQueue.collect(completedGraphicsValue);
+	transferDeletionQueue.collect(completedTransferValue);
 }
 
-void Engine::renderGeometry(float deltaTime, VkCommandBuffer cmd)
+void Engine::recordInputLatency(double sampleTime, bool includesPresent)
 {
-	VkRenderingAttachmentInfo colorAttachment = vkeUtils::colorAttachmentInfo(drawImage.imageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, nullptr);
-	VkRenderingAttachmentInfo depthAttachment = vkeUtils::depthAttachmentInfo(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(drawExtent, &colorAttachment, &depthAttachment);
-	
-	vkCmdBeginRendering(cmd, &renderingInfo);
+	float latency = (float)((glfwGetTime() - sampleTime) * 1000.0);
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+	// Exponential moving average, so the displayed value is readable.
+	inputLatency = includesPresent == inputLatencyIncludesPresent ? glm::mix(inputLatency, latency, 0.1f) : latency;
+	inputLatencyIncludesPresent = includesPresent;
+}
 
-	VkViewport viewport = {};
-	VkRect2D scissor = {};
+void Engine::render(float deltaTime)
+{
+	waitForFrame();
 
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)drawExtent.width;
-	viewport.height = (float)drawExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	// Signaled by the last submission of this frame, the resources it retires are keyed on it.
+	const uint64_t frameTimelineValue = getFrameTimelineValue();
 
-	scissor.offset.x = 0;
+	// Pipelines rebuilt from modified shaders are swapped in between two frames.
+	shaderManager.applyPendingPipelines(graphicsDeletionQueue, frameTimelineValue);
+
+	// Request image from the swapchain.
+	uint32_t swapchainImageIndex;
+	VkResult acquireNextImageResult = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, getCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex);
+
+	if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		resizeRequested = true;
+		return;
+	}
+
+	upscaleExtent.width = std::min(swapchainExtent.width, drawImage.imageExtent2D.width);
+	upscaleExtent.height = std::min(swapchainExtent.height, drawImage.imageExtent2D.height);
+
+	drawExtent.width = (uint32_t)(upscaleExtent.width * renderScale);
+	drawExtent.height = (uint32_t)(upscaleExtent.height * renderScale);
+
+	Frame& frame = getCurrentFrame();
+
+	updateCameraMatrices();
+	updateShadowCascades();
+	updateLighting(deltaTime, frame);
+	updateAnimation(deltaTime, frame);
+
+	// Background generation, post effects and the depth pyramid run on the compute queue when there is a separate one.
+	bool asyncCompute = useAsyncCompute && asyncComputeSupported;
+	bool depthPyramidEnabled = buildDepthPyramid && downsampleSupported;
+
+	// The background effect is only dispatched again when its output is stale, otherwise the last one is copied.
+	bool refreshBackground = isBackgroundStale();
+
+	if (asyncCompute && refreshBackground)
+	{
+		submitBackground(deltaTime, frame);
+	}
+	else
+	{
+		// Nothing to wait for on the compute queue, the timeline starts past zero.
+		frame.backgroundTimelineValue = 0;
+	}
+
+	VkCommandBuffer cmd = frame.mainCommandBuffer;
+	VkQueryPool timestampQueryPool = frame.timestampQueryPool;
+
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+
+	vkCmdResetQueryPool(cmd, timestampQueryPool, 0, 2);
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timestampQueryPool, 0);
+
+	// Queries can't be reset inside a rendering pass, so the one of the geometry pass is reset here.
+	if (overdrawQuerySupported)
+	{
+		vkCmdResetQueryPool(cmd, frame.occlusionQueryPool, 0, 1);
+	}
+
+	vmaSetCurrentFrameIndex(allocator, frameCount);
+
+	// Mesh buffers are only read by graphics work, so the copies of a defragmentation pass can live in this command buffer.
+	uint64_t completedGraphicsValue;
+
+	VK_CHECK(vkGetSemaphoreCounterValue(device, graphicsTimeline, &completedGraphicsValue));
+
+	if (memoryManager.updateDefragmentation(cmd, frameTimelineValue, completedGraphicsValue))
+	{
+		geometryRelocationValue = frameTimelineValue;
+	}
+
+	if (geometryArena.isFragmented())
+	{
+		geometryArena.compact(cmd, graphicsDeletionQueue, frameTimelineValue, compactionBytesPerFrame);
+	}
+
+	// The uploads submitted so far land before the arena is read, or copied around by this frame.
+	VkSemaphoreSubmitInfo transferWaitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(transferTimeline, VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, transferTimelineValue);
+
+	// Semaphores the last graphics submission of the frame waits on.
+	std::vector<VkSemaphoreSubmitInfo> waitSemaphoreSubmitInfos;
+
+	waitSemaphoreSubmitInfos.push_back(vkeUtils::semaphoreSubmitInfo(frame.swapchainSemaphore, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR));
+	waitSemaphoreSubmitInfos.push_back(transferWaitSemaphoreSubmitInfo);
+
+	if (refreshBackground && asyncCompute)
+	{
+		// Acquire the background image written by the compute queue.
+		vkeUtils::transferImageOwnership(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, computeQueueFamily, graphicsQueueFamily);
+	}
+	else if (refreshBackground)
+	{
+		// Make the background image into writeable mode before rendering.
+		vkeUtils::transitionImageLayout(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+		renderInBackground(deltaTime, cmd);
+
+		vkeUtils::transitionImageLayout(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	}
+
+	// The background image stays in transfer source layout between refreshes, so it can be copied in again as it is.
+	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	vkeUtils::copyImageToImage(cmd, backgroundImage.image, drawImage.image, drawExtent, drawExtent);
+
+	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+	vkeUtils::transitionImageLayout(cmd, depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	frameStats = {};
+
+	// Every pass of the frame draws the skinned vertices, so they're written before the first one.
+	renderSkinning(cmd, frame);
+
+	renderShadows(cmd);
+
+	renderLightClusters(cmd, frame);
+
+	if (particlesEnabled)
+	{
+		simulateParticles(deltaTime, cmd);
+	}
+
+	if (frameCaptureRequested)
+	{
+		frameCaptureRequested = false;
+		frameCaptureBuilder = std::make_unique<FrameCaptureBuilder>();
+	}
+
+	renderGeometry(deltaTime, cmd);
+
+	if (particlesEnabled)
+	{
+		renderParticles(cmd);
+	}
+
+	if (depthPyramidEnabled && asyncCompute)
+	{
+		// Hand the depth image over to the compute queue. The next frame clears it, so it's never handed back.
+		vkeUtils::transferImageOwnership(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphicsQueueFamily, computeQueueFamily);
+	}
+	else if (depthPyramidEnabled)
+	{
+		// The depth image is cleared again by the next frame, reading it is the last thing done with it.
+		vkeUtils::transitionImageLayout(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		renderDepthPyramid(cmd, graphicsQueueFamily);
+	}
+
+	if (frameCaptureBuilder != nullptr)
+	{
+		captureFrame(cmd);
+	}
+
+	// The image copied into the swapchain is either the draw image, blitted with a bilinear filter, or the result of the upscale pass.
+	VkImage presentSourceImage = drawImage.image;
+	VkExtent2D presentSourceExtent = drawExtent;
+
+	if (asyncCompute && (useUpscalePass || depthPyramidEnabled))
+	{
+		// Compute work reading the results of the geometry pass can only start once it's submitted, so the frame is
+		// finished in a second command buffer.
+		if (useUpscalePass)
+		{
+			vkeUtils::transferImageOwnership(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphicsQueueFamily, computeQueueFamily);
+		}
+
+		VK_CHECK(vkEndCommandBuffer(cmd));
+
+		// The geometry submission signals the value right before the one reserved for the end of the frame.
+		VkCommandBufferSubmitInfo geometryCmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
+		VkSemaphoreSubmitInfo geometryWaitSemaphoreSubmitInfos[2] =
+		{
+			vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_TRANSFER_BIT, frame.backgroundTimelineValue),
+			transferWaitSemaphoreSubmitInfo
+		};
+		VkSemaphoreSubmitInfo geometrySignalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frameTimelineValue - 1);
+		VkSubmitInfo2 geometrySubmitInfo = vkeUtils::submitInfo(&geometryCmdBufferSubmitInfo, geometryWaitSemaphoreSubmitInfos, { &geometrySignalSemaphoreSubmitInfo, 1 });
+
+		VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &geometrySubmitInfo, VK_NULL_HANDLE));
+
+		// The post effects are submitted first, the end of the frame needs them sooner than the pyramid.
+		if (useUpscalePass)
+		{
+			// The draw image is not used by the graphics queue anymore in this frame.
+			drawImageReleaseValue = frameTimelineValue - 1;
+
+			submitPostEffects(deltaTime, frame);
+		}
+
+		if (depthPyramidEnabled)
+		{
+			submitDepthPyramid(frame, frameTimelineValue - 1);
+
+			// Only the interface pass waits, so the copy into the swapchain overlaps the pyramid. Once the frame's timeline
+			// value is reached, the pyramid is done too: the next frame can clear the depth image, and the slot be reused.
+			waitSemaphoreSubmitInfos.push_back(vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, frame.depthPyramidTimelineValue));
+		}
+
+		cmd = frame.presentCommandBuffer;
+
+		VK_CHECK(vkResetCommandBuffer(cmd, 0));
+		VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+
+		if (useUpscalePass)
+		{
+			// Acquire the sharpened image written by the compute queue.
+			vkeUtils::transferImageOwnership(cmd, sharpenImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, computeQueueFamily, graphicsQueueFamily);
+
+			waitSemaphoreSubmitInfos.push_back(vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_TRANSFER_BIT, frame.postEffectsTimelineValue));
+
+			presentSourceImage = sharpenImage.image;
+			presentSourceExtent = upscaleExtent;
+		}
+		else
+		{
+			vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		}
+	}
+	else if (useUpscalePass)
+	{
+		vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		renderUpscale(deltaTime, cmd);
+
+		presentSourceImage = sharpenImage.image;
+		presentSourceExtent = upscaleExtent;
+
+		vkeUtils::transitionImageLayout(cmd, sharpenImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	}
+	else
+	{
+		if (asyncCompute)
+		{
+			waitSemaphoreSubmitInfos.push_back(vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_TRANSFER_BIT, frame.backgroundTimelineValue));
+		}
+
+		vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	}
+
+	// Transition the swapchain image into its correct transfer layout.
+	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	// Execute a copy from the source image into the swapchain image.
+	vkeUtils::copyImageToImage(cmd, presentSourceImage, swapchainImages[swapchainImageIndex], presentSourceExtent, swapchainExtent);
+
+	// Make the swapchain image into attachment optimal, so we can draw on it.
+	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+	renderImgui(deltaTime, cmd, swapchainImageViews[swapchainImageIndex]);
+
+	// Make the swapchain image into presentable mode.
+	vkeUtils::transitionImageLayout(cmd, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestampQueryPool, 1);
+
+	frame.timestampsWritten = true;
+	frame.frameNumber = frameCount;
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
+	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfos[2] =
+	{
+		vkeUtils::semaphoreSubmitInfo(frame.renderSemaphore, VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT),
+		vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frameTimelineValue)
+	};
+	
+	// Submit command buffer to the queue and execute it.
+	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, waitSemaphoreSubmitInfos, signalSemaphoreSubmitInfos);
+
+	if (!(useUpscalePass && asyncCompute))
+	{
+		drawImageReleaseValue = frameTimelineValue;
+	}
+
+	frame.inputTime = inputTime;
+
+	VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+	// The slot is only keyed on the new value once it's submitted, so an early return never leaves it waiting on a value nobody signals.
+	frame.timelineValue = frameTimelineValue;
+	graphicsTimelineValue = frameTimelineValue;
+
+	frameWaited = false;
+
+	VkPresentIdKHR presentIdInfo{ .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
+	uint64_t framePresentId = ++presentId;
+
+	presentIdInfo.swapchainCount = 1;
+	presentIdInfo.pPresentIds = &framePresentId;
+
+	VkPresentInfoKHR presentInfo{};
+
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.pNext = presentWaitSupported ? &presentIdInfo : nullptr;
+	presentInfo.swapchainCount = 1;
+	presentInfo.pSwapchains = &swapchain;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = &frame.renderSemaphore;
+	presentInfo.pImageIndices = &swapchainImageIndex;
+
+	VkResult queuePresentResult = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+
+	lastPresentedId = framePresentId;
+	lastPresentedInputTime = inputTime;
+
+	if (queuePresentResult == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		resizeRequested = true;
+		return;
+	}
+
+	frameCount++;
+}
+
+void Engine::submitBackground(float deltaTime, Frame& frame)
+{
+	VkCommandBuffer cmd = frame.backgroundCommandBuffer;
+
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+
+	// The previous contents are discarded, so the background image doesn't need to be acquired from the graphics queue.
+	vkeUtils::transitionImageLayout(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	renderInBackground(deltaTime, cmd);
+
+	// Release the background image to the graphics queue, which copies it into the draw image.
+	vkeUtils::transferImageOwnership(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, computeQueueFamily, graphicsQueueFamily);
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	frame.backgroundTimelineValue = ++computeTimelineValue;
+
+	// Wait until the graphics queue is done copying the previous background, which the last submitted frame did at the latest.
+	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
+	VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, graphicsTimelineValue);
+	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.backgroundTimelineValue);
+	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, &waitSemaphoreSubmitInfo, &signalSemaphoreSubmitInfo);
+
+	VK_CHECK(vkQueueSubmit2(computeQueue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+void Engine::submitPostEffects(float deltaTime, Frame& frame)
+{
+	VkCommandBuffer cmd = frame.postEffectsCommandBuffer;
+
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+
+	// Acquire the draw image released by the graphics queue after the geometry pass.
+	vkeUtils::transferImageOwnership(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphicsQueueFamily, computeQueueFamily);
+
+	renderUpscale(deltaTime, cmd);
+
+	// Release the sharpened image to the graphics queue, which copies it into the swapchain.
+	vkeUtils::transferImageOwnership(cmd, sharpenImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, computeQueueFamily, graphicsQueueFamily);
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	frame.postEffectsTimelineValue = ++computeTimelineValue;
+
+	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
+	VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, drawImageReleaseValue);
+	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.postEffectsTimelineValue);
+	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, &waitSemaphoreSubmitInfo, &signalSemaphoreSubmitInfo);
+
+	VK_CHECK(vkQueueSubmit2(computeQueue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+void Engine::submitDepthPyramid(Frame& frame, uint64_t geometryTimelineValue)
+{
+	VkCommandBuffer cmd = frame.depthPyramidCommandBuffer;
+
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+	VkCommandBufferBeginInfo cmdBufferBeginInfo = vkeUtils::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBufferBeginInfo));
+
+	// Acquire the depth image released by the graphics queue after the geometry pass.
+	vkeUtils::transferImageOwnership(cmd, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphicsQueueFamily, computeQueueFamily);
+
+	renderDepthPyramid(cmd, computeQueueFamily);
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	frame.depthPyramidTimelineValue = ++computeTimelineValue;
+
+	VkCommandBufferSubmitInfo cmdBufferSubmitInfo = vkeUtils::commandBufferSubmitInfo(cmd);
+	VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(graphicsTimeline, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, geometryTimelineValue);
+	VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo = vkeUtils::semaphoreSubmitInfo(computeTimeline, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.depthPyramidTimelineValue);
+	VkSubmitInfo2 submitInfo = vkeUtils::submitInfo(&cmdBufferSubmitInfo, &waitSemaphoreSubmitInfo, &signalSemaphoreSubmitInfo);
+
+	VK_CHECK(vkQueueSubmit2(computeQueue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+bool Engine::isBackgroundStale() const
+{
+	const ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+
+	if (!lazyBackground)
+	{
+		return true;
+	}
+
+	// A hot reload replaces the pipeline, and new render targets come with a new background image.
+	if (backgroundState.effect != currentBackgroundEffect || backgroundState.pipeline != effect.pipeline || backgroundState.image != backgroundImage.image)
+	{
+		return true;
+	}
+
+	// The dispatch only covers the draw extent, so the cached output can't be stretched over a different one.
+	if (backgroundState.extent.width != drawExtent.width || backgroundState.extent.height != drawExtent.height)
+	{
+		return true;
+	}
+
+	if (std::memcmp(&backgroundState.pushConstants, &effect.pushConstants, sizeof(ComputePushConstants)) != 0)
+	{
+		return true;
+	}
+
+	return effect.animated && frameCount - backgroundState.frame >= effect.updateInterval;
+}
+
+void Engine::renderInBackground(float deltaTime, VkCommandBuffer cmd)
+{
+	// Make a clear-color from frame number. This will flash with a 120 frame period.
+	float flash = std::abs(std::sin(frameCount / 120.0f));
+	VkClearColorValue clearColorValue{ { 0.0f, 0.0f, flash, 1.0f } };
+	VkImageSubresourceRange clearRange = vkeUtils::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+
+	// vkCmdClearColorImage(cmd, backgroundImage.image, VK_IMAGE_LAYOUT_GENERAL, &clearColorValue, 1, &clearRange);
+
+	ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+
+	// Bind the background compute pipeline.
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
+
+	// Bind the descriptor set containing the background image for the compute pipeline.
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, defaultPipelineLayout, 0, 1, &backgroundImageDescriptors, 0, nullptr);
+
+	vkCmdPushConstants(cmd, defaultPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.pushConstants);
+
+	VkExtent2D groupCount = getDispatchSize(drawExtent);
+
+	vkCmdDispatch(cmd, groupCount.width, groupCount.height, 1);
+
+	backgroundState.effect = currentBackgroundEffect;
+	backgroundState.pipeline = effect.pipeline;
+	backgroundState.pushConstants = effect.pushConstants;
+	backgroundState.image = backgroundImage.image;
+	backgroundState.extent = drawExtent;
+	backgroundState.frame = frameCount;
+
+	backgroundDispatches++;
+}
+
+void Engine::updateCameraMatrices()
+{
+	// The replayed capture brings its own camera, built for the extent it was captured at.
+	if (replayedCapture.has_value())
+	{
+		viewMatrix = replayedCapture->viewMatrix;
+		projectionMatrix = replayedCapture->projectionMatrix;
+
+		return;
+	}
+
+	viewMatrix = glm::lookAt(cameraPosition, cameraPosition + cameraForward, glm::vec3{ 0.0f, 1.0f, 0.0f });
+	projectionMatrix = glm::perspective(glm::radians(CAMERA_FIELD_OF_VIEW), (float)drawExtent.width / (float)drawExtent.height, CAMERA_FAR_PLANE, CAMERA_NEAR_PLANE);
+
+	projectionMatrix[1][1] *= -1;
+}
+
+void Engine::updateLighting(float deltaTime, Frame& frame)
+{
+	if (animateLights)
+	{
+		lightTime += deltaTime;
+	}
+
+	// The frame slot is free, so its buffer can be written in place.
+	GPULightingData* lighting = (GPULightingData*)frame.lightingBuffer.allocationInfo.pMappedData;
+	GPULight* lights = (GPULight*)(lighting + 1);
+
+	lighting->view = viewMatrix;
+	lighting->inverseProjection = glm::inverse(projectionMatrix);
+	lighting->screenSize = glm::vec4(drawExtent.width, drawExtent.height, 0.0f, 0.0f);
+	lighting->depthSlicing = getClusterDepthSlicing(CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+	lighting->ambient = glm::vec4(ambientLight, 0.0f);
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		lighting->shadowMatrices[i] = shadowCascades[i].viewProjection;
+		lighting->cascadeSplits[i] = shadowCascades[i].splitDepth;
+		lighting->cascadeTexelSizes[i] = shadowCascades[i].texelSize;
+	}
+
+	lighting->sunDirection = glm::vec4(getSunDirection(), shadowNormalOffset);
+	lighting->sunColor = glm::vec4(sunColor, sunIntensity);
+
+	// The replayed capture brings the lights it was captured with.
+	if (replayedCapture.has_value())
+	{
+		lighting->lightCount = (uint32_t)std::min<size_t>(replayedCapture->lights.size(), MAX_LIGHTS);
+
+		std::memcpy(lights, replayedCapture->lights.data(), lighting->lightCount * sizeof(GPULight));
+	}
+	else
+	{
+		lighting->lightCount = (uint32_t)std::min<size_t>(std::max(lightCount, 0), pointLights.size());
+
+		for (uint32_t i = 0; i < lighting->lightCount; i++)
+		{
+			lights[i] = animatePointLight(pointLights[i], lightTime);
+		}
+	}
+
+	VK_CHECK(vmaFlushAllocation(allocator, frame.lightingBuffer.allocation, 0, sizeof(GPULightingData) + lighting->lightCount * sizeof(GPULight)));
+}
+
+void Engine::renderLightClusters(VkCommandBuffer cmd, Frame& frame)
+{
+	// The geometry pass (or the visibility buffer resolve) of the previous frame may still be reading the clusters.
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_NONE;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	ClusterPushConstants pushConstants;
+
+	pushConstants.lightingBufferAddress = frame.lightingBufferAddress;
+	pushConstants.clusterBufferAddress = clusterBufferAddress;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipeline);
+	vkCmdPushConstants(cmd, clusterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterPushConstants), &pushConstants);
+
+	// One invocation per cluster, in workgroups of 64.
+	vkCmdDispatch(cmd, (CLUSTER_COUNT + 63) / 64, 1, 1);
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+void Engine::updateAnimation(float deltaTime, Frame& frame)
+{
+	if (animatedInstances.empty())
+	{
+		return;
+	}
+
+	if (animateCrowd)
+	{
+		for (AnimatedInstance& instance : animatedInstances)
+		{
+			const std::vector<AnimationClip>& clips = instance.skeleton->clips;
+
+			if (instance.clip < clips.size() && clips[instance.clip].duration > 0.0f)
+			{
+				instance.time = std::fmod(instance.time + deltaTime * animationSpeed, clips[instance.clip].duration);
+			}
+		}
+	}
+
+	auto sampleStart = std::chrono::steady_clock::now();
+
+	// The frame slot is free, so its palettes can be written in place.
+	animationSampler.sample(animatedInstances, (glm::mat4*)frame.jointPaletteBuffer.allocationInfo.pMappedData);
+
+	animationSampleTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - sampleStart).count();
+
+	VK_CHECK(vmaFlushAllocation(allocator, frame.jointPaletteBuffer.allocation, 0, VK_WHOLE_SIZE));
+}
+
+void Engine::renderSkinning(VkCommandBuffer cmd, Frame& frame)
+{
+	if (skinnedInstances.empty())
+	{
+		return;
+	}
+
+	// The passes of the previous frame may still be reading the vertices about to be overwritten, and the compaction
+	// of this frame may have just copied them.
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_COPY_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipeline);
+
+	SkinningPushConstants pushConstants{};
+
+	pushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+	pushConstants.paletteBufferAddress = frame.jointPaletteBufferAddress;
+
+	// One dispatch per instance, the ranges of the arena they're written into aren't contiguous.
+	for (const SkinnedInstance& instance : skinnedInstances)
+	{
+		const SkinnedMesh& skinnedMesh = skinnedMeshes[instance.skinnedMesh];
+
+		pushConstants.sourceBufferAddress = skinnedMesh.sourceBufferAddress;
+		pushConstants.vertexOffset = instance.mesh->meshBuffers.vertices.offset;
+		pushConstants.vertexCount = instance.mesh->meshBuffers.vertices.size;
+		pushConstants.paletteOffset = animatedInstances[instance.animatedInstance].paletteOffset;
+
+		vkCmdPushConstants(cmd, skinningPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SkinningPushConstants), &pushConstants);
+
+		// One invocation per vertex, in workgroups of 64.
+		vkCmdDispatch(cmd, (pushConstants.vertexCount + 63) / 64, 1, 1);
+
+		frameStats.skinnedVertexCount += pushConstants.vertexCount;
+	}
+
+	// Read as vertices by the draws, as storage by the visibility buffer resolve, and copied by a frame capture.
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_COPY_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+void Engine::simulateParticles(float deltaTime, VkCommandBuffer cmd)
+{
+	uint32_t emitCount = getParticleEmitCount(particleEmitter.rate, deltaTime, particleEmitAccumulator);
+	uint32_t aliveList = particleAliveList;
+
+	// Every stage reads what the previous one wrote, counters included, and some of them are dispatched indirectly.
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	auto computeBarrier = [&]()
+	{
+		memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+		memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+		vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+	};
+
+	// The draw of the previous frame may still be reading the particles, and its indirect arguments.
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	if (emitCount > 0)
+	{
+		ParticleEmitPushConstants pushConstants{};
+
+		pushConstants.particleBufferAddress = particleBufferAddress;
+		pushConstants.counterBufferAddress = particleCounterBufferAddress;
+		pushConstants.deadListAddress = particleDeadListAddress;
+		pushConstants.aliveListAddress = particleAliveListAddresses[aliveList];
+		pushConstants.positionRadius = glm::vec4(particleEmitter.position, particleEmitter.radius);
+		pushConstants.velocityJitter = glm::vec4(particleEmitter.velocity, particleEmitter.velocityJitter);
+		pushConstants.lifetimeRange = { particleEmitter.minLifetime, std::max(particleEmitter.maxLifetime, particleEmitter.minLifetime) };
+		pushConstants.aliveList = aliveList;
+		pushConstants.emitCount = emitCount;
+		pushConstants.seed = (uint32_t)frameCount;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particleEmitPipeline);
+		vkCmdPushConstants(cmd, particleEmitPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleEmitPushConstants), &pushConstants);
+
+		vkCmdDispatch(cmd, (emitCount + PARTICLE_WORKGROUP_SIZE - 1) / PARTICLE_WORKGROUP_SIZE, 1, 1);
+
+		computeBarrier();
+	}
+
+	// Sized by the compact pass of the previous frame, and grown by the emission.
+	{
+		ParticleSimulatePushConstants pushConstants{};
+
+		pushConstants.particleBufferAddress = particleBufferAddress;
+		pushConstants.counterBufferAddress = particleCounterBufferAddress;
+		pushConstants.deadListAddress = particleDeadListAddress;
+		pushConstants.aliveListAddress = particleAliveListAddresses[aliveList];
+		pushConstants.survivorListAddress = particleAliveListAddresses[1 - aliveList];
+		pushConstants.sortBufferAddress = particleSortBufferAddress;
+		pushConstants.gravityDeltaTime = glm::vec4(particleGravity, deltaTime);
+		pushConstants.cameraPositionDrag = glm::vec4(cameraPosition, particleDrag);
+		pushConstants.aliveList = aliveList;
+		pushConstants.writeSortKeys = sortParticles;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particleSimulatePipeline);
+		vkCmdPushConstants(cmd, particleSimulatePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleSimulatePushConstants), &pushConstants);
+
+		vkCmdDispatchIndirect(cmd, particleCounterBuffer.buffer, offsetof(GPUParticleCounters, simulateDispatch));
+
+		computeBarrier();
+	}
+
+	{
+		ParticleCompactPushConstants pushConstants{};
+
+		pushConstants.counterBufferAddress = particleCounterBufferAddress;
+		pushConstants.aliveList = aliveList;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particleCompactPipeline);
+		vkCmdPushConstants(cmd, particleCompactPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleCompactPushConstants), &pushConstants);
+
+		vkCmdDispatch(cmd, 1, 1, 1);
+
+		computeBarrier();
+	}
+
+	// The passes are recorded for the capacity, the ones past the size of the survivors return right away. The
+	// dispatches are sized by the compact pass, one workgroup per sort block of the survivors.
+	if (sortParticles)
+	{
+		ParticleSortPushConstants pushConstants{};
+
+		pushConstants.sortBufferAddress = particleSortBufferAddress;
+		pushConstants.counterBufferAddress = particleCounterBufferAddress;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particleSortPipeline);
+
+		for (const ParticleSortStep& step : getParticleSortSteps(MAX_PARTICLES))
+		{
+			pushConstants.pass = (uint32_t)step.pass;
+			pushConstants.blockSize = step.blockSize;
+			pushConstants.distance = step.distance;
+
+			vkCmdPushConstants(cmd, particleSortPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticleSortPushConstants), &pushConstants);
+
+			vkCmdDispatchIndirect(cmd, particleCounterBuffer.buffer, offsetof(GPUParticleCounters, sortDispatch));
+
+			computeBarrier();
+		}
+	}
+
+	// The survivors are drawn this frame and simulated by the next one.
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	particleAliveList = 1 - aliveList;
+}
+
+void Engine::renderParticles(VkCommandBuffer cmd)
+{
+	bool pipelineReady = sortParticles
+		? acquirePipeline(particleAlphaPipeline, particleAlphaPipelineHandle, "alpha blended particle")
+		: acquirePipeline(particleAdditivePipeline, particleAdditivePipelineHandle, "additive particle");
+
+	if (!pipelineReady)
+	{
+		return;
+	}
+
+	// The geometry pass (or its resolve) wrote the color and depth the particles are blended onto and tested against.
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	VkRenderingAttachmentInfo colorAttachment = vkeUtils::colorAttachmentInfo(drawImage.imageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, nullptr);
+	VkRenderingAttachmentInfo depthAttachment = vkeUtils::depthAttachmentInfo(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(drawExtent, &colorAttachment, &depthAttachment);
+
+	vkCmdBeginRendering(cmd, &renderingInfo);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, sortParticles ? particleAlphaPipeline : particleAdditivePipeline);
+
+	VkViewport viewport = { 0.0f, 0.0f, (float)drawExtent.width, (float)drawExtent.height, 0.0f, 1.0f };
+	VkRect2D scissor = { { 0, 0 }, drawExtent };
+
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	vkCmdSetCullMode(cmd, VK_CULL_MODE_NONE);
+	vkCmdSetFrontFace(cmd, VK_FRONT_FACE_CLOCKWISE);
+	vkCmdSetPrimitiveTopology(cmd, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+	vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+	vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
+	vkCmdSetDepthTestEnable(cmd, VK_TRUE);
+	vkCmdSetDepthWriteEnable(cmd, VK_FALSE);
+	vkCmdSetDepthCompareOp(cmd, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	ParticleDrawPushConstants pushConstants{};
+
+	// The rows of the view matrix are the axes of the camera in world space.
+	pushConstants.viewProjection = projectionMatrix * viewMatrix;
+	pushConstants.cameraRightSize = glm::vec4(viewMatrix[0][0], viewMatrix[1][0], viewMatrix[2][0], particleSize);
+	pushConstants.cameraUp = glm::vec4(viewMatrix[0][1], viewMatrix[1][1], viewMatrix[2][1], 0.0f);
+	pushConstants.particleBufferAddress = particleBufferAddress;
+
+	// The survivors were written into the list the simulation swapped in.
+	pushConstants.indexBufferAddress = sortParticles ? particleSortBufferAddress : particleAliveListAddresses[particleAliveList];
+	pushConstants.sorted = sortParticles;
+
+	vkCmdPushConstants(cmd, particlePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ParticleDrawPushConstants), &pushConstants);
+
+	// One quad per survivor, the instance count never leaves the GPU.
+	vkCmdDrawIndirect(cmd, particleCounterBuffer.buffer, offsetof(GPUParticleCounters, draw), 1, 0);
+
+	vkCmdEndRendering(cmd);
+}
+
+glm::vec3 Engine::getSunDirection() const
+{
+	float azimuth = glm::radians(sunAzimuth);
+	float elevation = glm::radians(sunElevation);
+
+	// Pointing from the sun down to the scene.
+	return -glm::vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation), std::cos(elevation) * std::cos(azimuth));
+}
+
+void Engine::updateShadowCascades()
+{
+	// Streaming a cell in or out, or picking other scene meshes, changes what the static atlas has to contain.
+	StaticCasterState staticCasters;
+
+	staticCasters.sceneMesh = settings.sceneMesh;
+	staticCasters.sceneMeshCount = testMeshes.size();
+	staticCasters.residencyVersion = worldStreamer.residencyVersion;
+
+	if (staticCasters != staticCasterState)
+	{
+		staticCasterState = staticCasters;
+		staticCasterVersion++;
+	}
+
+	// The field of view comes from the projection, which may be the one of a replayed capture.
+	glm::mat4 inverseView = glm::inverse(viewMatrix);
+	glm::mat4 sunView = getSunView(getSunDirection());
+
+	float tanHalfFovX = 1.0f / std::abs(projectionMatrix[0][0]);
+	float tanHalfFovY = 1.0f / std::abs(projectionMatrix[1][1]);
+
+	std::array<float, SHADOW_CASCADE_COUNT> splits = getShadowCascadeSplits(CAMERA_NEAR_PLANE, shadowDistance, shadowCascadeSplitLambda);
+	float sliceNear = CAMERA_NEAR_PLANE;
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		ShadowCascadeFit fit = fitShadowCascade(inverseView, tanHalfFovX, tanHalfFovY, sliceNear, splits[i], sunView, shadowCasterDistance);
+
+		shadowCascades[i].viewProjection = fit.viewProjection;
+		shadowCascades[i].splitDepth = splits[i];
+		shadowCascades[i].texelSize = fit.texelSize;
+
+		sliceNear = splits[i];
+	}
+}
+
+void Engine::renderShadows(VkCommandBuffer cmd)
+{
+	// Block on the shadow pipeline the first time it is needed, like the mesh pipeline. Without it, the cascades are
+	// still cleared, so the scene is lit as if nothing cast a shadow.
+	acquirePipeline(shadowPipeline, shadowPipelineHandle, "shadow");
+
+	// A cascade of the static atlas is only rendered again when it doesn't hold what this frame would render into it.
+	// A hot reloaded shadow pipeline may rasterize differently, so it invalidates every cascade.
+	std::vector<uint32_t> staleCascades;
+	bool atlasInitialized = false;
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		const ShadowCascade& cascade = shadowCascades[i];
+
+		atlasInitialized |= cascade.cached;
+
+		if (!cacheStaticShadows || !cascade.cached || cascade.cachedViewProjection != cascade.viewProjection
+			|| cascade.cachedStaticCasterVersion != staticCasterVersion || cascade.cachedPipeline != shadowPipeline)
+		{
+			staleCascades.push_back(i);
+		}
+	}
+
+	if (!staleCascades.empty())
+	{
+		// Until the first render, the atlas holds nothing worth keeping. The transition also waits for the frames that
+		// sampled the cascades about to be overwritten.
+		vkeUtils::transitionImageLayout(cmd, staticShadowAtlas.image, atlasInitialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+		for (uint32_t i : staleCascades)
+		{
+			ShadowCascade& cascade = shadowCascades[i];
+
+			renderShadowCascade(cmd, staticShadowAtlas, i, true);
+
+			cascade.cached = true;
+			cascade.cachedViewProjection = cascade.viewProjection;
+			cascade.cachedStaticCasterVersion = staticCasterVersion;
+			cascade.cachedPipeline = shadowPipeline;
+
+			frameStats.shadowCascadeRenders++;
+			staticShadowCascadeRenders++;
+		}
+
+		vkeUtils::transitionImageLayout(cmd, staticShadowAtlas.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	// Without dynamic casters, the dynamic atlas only has to be cleared once.
+	if (dynamicMeshes.empty() && dynamicShadowAtlasCleared)
+	{
+		return;
+	}
+
+	vkeUtils::transitionImageLayout(cmd, dynamicShadowAtlas.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		renderShadowCascade(cmd, dynamicShadowAtlas, i, false);
+	}
+
+	vkeUtils::transitionImageLayout(cmd, dynamicShadowAtlas.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	dynamicShadowAtlasCleared = dynamicMeshes.empty();
+}
+
+void Engine::renderShadowCascade(VkCommandBuffer cmd, const AllocatedImage& atlas, uint32_t cascadeIndex, bool staticCasters)
+{
+	const ShadowCascade& cascade = shadowCascades[cascadeIndex];
+	VkRect2D cascadeRect = getShadowCascadeRect(cascadeIndex);
+
+	// The clear only covers the render area, so the other cascades of the atlas are left as they are.
+	VkRenderingAttachmentInfo depthAttachment = vkeUtils::depthAttachmentInfo(atlas.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(cascadeRect.extent, nullptr, &depthAttachment);
+
+	renderingInfo.renderArea = cascadeRect;
+
+	vkCmdBeginRendering(cmd, &renderingInfo);
+
+	if (shadowPipeline == VK_NULL_HANDLE)
+	{
+		vkCmdEndRendering(cmd);
+
+		return;
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+
+	VkViewport viewport = {};
+
+	viewport.x = (float)cascadeRect.offset.x;
+	viewport.y = (float)cascadeRect.offset.y;
+	viewport.width = (float)cascadeRect.extent.width;
+	viewport.height = (float)cascadeRect.extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &cascadeRect);
+
+	// Same raster state as the geometry pass, with the reversed depth of the cascades.
+	vkCmdSetCullMode(cmd, VK_CULL_MODE_NONE);
+	vkCmdSetFrontFace(cmd, VK_FRONT_FACE_CLOCKWISE);
+	vkCmdSetPrimitiveTopology(cmd, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+	vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+	// The only pass that applies the bias baked into its pipeline.
+	vkCmdSetDepthBiasEnable(cmd, VK_TRUE);
+	vkCmdSetDepthTestEnable(cmd, VK_TRUE);
+	vkCmdSetDepthWriteEnable(cmd, VK_TRUE);
+	vkCmdSetDepthCompareOp(cmd, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	ShadowPushConstants pushConstants;
+
+	pushConstants.viewProjection = cascade.viewProjection;
+	pushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+
+	vkCmdPushConstants(cmd, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants), &pushConstants);
+
+	vkCmdBindIndexBuffer(cmd, geometryArena.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+	Frustum frustum = extractFrustum(cascade.viewProjection);
+
+	auto drawMesh = [&](const MeshAsset& mesh)
+	{
+		for (const GeoSurface& surface : mesh.surfaces)
+		{
+			if (frustumCulling && !isSphereVisible(frustum, surface.bounds))
+			{
+				continue;
+			}
+
+			vkCmdDrawIndexed(cmd, surface.count, 1, mesh.meshBuffers.indices.offset + surface.startIndex, (int32_t)mesh.meshBuffers.vertices.offset, 0);
+
+			frameStats.shadowDrawCount++;
+		}
+	};
+
+	if (!staticCasters)
+	{
+		for (const std::shared_ptr<MeshAsset>& mesh : dynamicMeshes)
+		{
+			drawMesh(*mesh);
+		}
+	}
+	else
+	{
+		// Captured draws have no bounds to cull with.
+		if (replayedCapture.has_value())
+		{
+			for (const CapturedDraw& draw : replayedCapture->draws)
+			{
+				vkCmdDrawIndexed(cmd, draw.indexCount, 1, replayedCaptureBuffers.indices.offset + draw.firstIndex, (int32_t)replayedCaptureBuffers.vertices.offset + draw.vertexOffset, 0);
+
+				frameStats.shadowDrawCount++;
+			}
+		}
+
+		forEachSceneMesh(drawMesh);
+	}
+
+	vkCmdEndRendering(cmd);
+}
+
+void Engine::renderGeometry(float deltaTime, VkCommandBuffer cmd)
+{
+	Frame& frame = getCurrentFrame();
+
+	// The visibility buffer only rasterizes IDs on top of the depth, the draw image is shaded by the resolve that follows.
+	bool visibilityBuffer = useVisibilityBuffer && visibilityBufferSupported;
+
+	// Block on the pipelines the first time they are needed, their compilation started during initialization. Without
+	// its pipeline, the visibility buffer falls back to the forward path.
+	visibilityBuffer = visibilityBuffer && acquirePipeline(visibilityPipeline, visibilityPipelineHandle, "visibility");
+
+	glm::mat4 worldMatrix = projectionMatrix * viewMatrix;
+
+	// Meshes have no transform of their own, their bounds are tested against the frustum of the camera directly.
+	Frustum frustum = extractFrustum(worldMatrix);
+
+	// The visible draws are gathered first, the depth pre-pass and the main pass both go through them.
+	geometryDraws.clear();
+
+	auto addMesh = [&](const MeshAsset& mesh)
+	{
+		for (const GeoSurface& surface : mesh.surfaces)
+		{
+			if (frustumCulling && !isSphereVisible(frustum, surface.bounds))
+			{
+				frameStats.culledCount++;
+
+				continue;
+			}
+
+			geometryDraws.push_back({ surface.count, mesh.meshBuffers.indices.offset + surface.startIndex, (int32_t)mesh.meshBuffers.vertices.offset });
+
+			frameStats.drawCount++;
+			frameStats.triangleCount += surface.count / 3;
+
+			if (frameCaptureBuilder != nullptr)
+			{
+				frameCaptureBuilder->addDraw(mesh.meshBuffers, surface.startIndex, surface.count);
+			}
+		}
+	};
+
+	if (frameCaptureBuilder != nullptr)
+	{
+		const GPULightingData* lighting = (const GPULightingData*)frame.lightingBuffer.allocationInfo.pMappedData;
+		const GPULight* lights = (const GPULight*)(lighting + 1);
+
+		frameCaptureBuilder->capture.viewMatrix = viewMatrix;
+		frameCaptureBuilder->capture.projectionMatrix = projectionMatrix;
+		frameCaptureBuilder->capture.lights.assign(lights, lights + lighting->lightCount);
+	}
+
+	if (replayedCapture.has_value())
+	{
+		for (const CapturedDraw& draw : replayedCapture->draws)
+		{
+			geometryDraws.push_back({ draw.indexCount, replayedCaptureBuffers.indices.offset + draw.firstIndex, (int32_t)replayedCaptureBuffers.vertices.offset + draw.vertexOffset });
+
+			frameStats.drawCount++;
+			frameStats.triangleCount += draw.indexCount / 3;
+		}
+	}
+
+	forEachSceneMesh(addMesh);
+
+	for (const std::shared_ptr<MeshAsset>& mesh : dynamicMeshes)
+	{
+		addMesh(*mesh);
+	}
+
+	// Draws take an entry of the visibility draw table per MAX_VISIBILITY_DRAW_TRIANGLES triangles. A frame needing more
+	// entries than the IDs can tell apart goes through the forward path instead, rather than losing geometry.
+	if (visibilityBuffer)
+	{
+		uint64_t visibilityDrawCount = 0;
+
+		for (const GeometryDraw& draw : geometryDraws)
+		{
+			visibilityDrawCount += (draw.indexCount + 3 * MAX_VISIBILITY_DRAW_TRIANGLES - 1) / (3 * MAX_VISIBILITY_DRAW_TRIANGLES);
+		}
+
+		if (visibilityDrawCount > MAX_VISIBILITY_DRAWS)
+		{
+			visibilityBuffer = false;
+			frameStats.visibilityDrawOverflow = true;
+		}
+	}
+
+	// Without a pipeline to shade them with, the frame only shows the background.
+	if (!visibilityBuffer && !acquirePipeline(meshPipeline, meshPipelineHandle, "mesh"))
+	{
+		geometryDraws.clear();
+	}
+
+	// The pre-pass is only an optimization, it's skipped until its pipeline is ready rather than waited on.
+	depthPrepassActive = depthPrepassMode == DepthPrepassMode::On || (depthPrepassMode == DepthPrepassMode::Automatic && depthPrepassController.enabled);
+	depthPrepassActive = depthPrepassActive && acquirePipeline(depthPrepassPipeline, depthPrepassPipelineHandle, "depth pre-pass", false);
+
+	// Fragments passing the depth test are counted in the pass that writes the depth. Per pixel, it's the overdraw the
+	// main pass has without a pre-pass, and the one the pre-pass takes off it.
+	frame.overdrawPixelCount = overdrawQuerySupported ? (uint64_t)drawExtent.width * drawExtent.height : 0;
+
+	VkViewport viewport = {};
+	VkRect2D scissor = {};
+
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)drawExtent.width;
+	viewport.height = (float)drawExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	scissor.offset.x = 0;
 	scissor.offset.y = 0;
 	scissor.extent.width = drawExtent.width;
 	scissor.extent.height = drawExtent.height;
 
-	vkCmdSetViewport(cmd, 0, 1, &viewport);
-	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	// Both pipelines leave their raster and depth state dynamic.
+	auto setRenderState = [&](bool depthWriteEnable, VkCompareOp depthCompareOp)
+	{
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
+		vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+		vkCmdSetCullMode(cmd, VK_CULL_MODE_NONE);
+		vkCmdSetFrontFace(cmd, VK_FRONT_FACE_CLOCKWISE);
+		vkCmdSetPrimitiveTopology(cmd, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+		vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+		vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+		vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
+		vkCmdSetDepthTestEnable(cmd, VK_TRUE);
+		vkCmdSetDepthWriteEnable(cmd, depthWriteEnable);
+		vkCmdSetDepthCompareOp(cmd, depthCompareOp);
+
+		// Every mesh shares the arena's index buffer, gl_VertexIndex includes the vertex offset of the draw.
+		vkCmdBindIndexBuffer(cmd, geometryArena.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+	};
+
+	VkRenderingAttachmentInfo depthAttachment = vkeUtils::depthAttachmentInfo(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+	// Depth only, so the main pass shades the closest surface of each pixel alone. Its fragments are the ones that pass
+	// an EQUAL test against this depth, and the hardware rejects the others before shading them.
+	if (depthPrepassActive)
+	{
+		VkRenderingInfo prepassRenderingInfo = vkeUtils::renderingInfo(drawExtent, nullptr, &depthAttachment);
+
+		vkCmdBeginRendering(cmd, &prepassRenderingInfo);
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+
+		setRenderState(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+		ShadowPushConstants prepassPushConstants;
+
+		prepassPushConstants.viewProjection = worldMatrix;
+		prepassPushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+
+		vkCmdPushConstants(cmd, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants), &prepassPushConstants);
+
+		if (overdrawQuerySupported)
+		{
+			vkCmdBeginQuery(cmd, frame.occlusionQueryPool, 0, VK_QUERY_CONTROL_PRECISE_BIT);
+		}
+
+		for (const GeometryDraw& draw : geometryDraws)
+		{
+			vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+		}
+
+		if (overdrawQuerySupported)
+		{
+			vkCmdEndQuery(cmd, frame.occlusionQueryPool, 0);
+		}
+
+		vkCmdEndRendering(cmd);
+
+		// The main pass tests against the depth of the pre-pass.
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	}
+
+	VkClearValue visibilityClearValue{};
+
+	visibilityClearValue.color.uint32[0] = VISIBILITY_EMPTY;
+
+	if (visibilityBuffer)
+	{
+		vkeUtils::transitionImageLayout(cmd, visibilityImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	}
+
+	VkRenderingAttachmentInfo colorAttachment = visibilityBuffer
+		? vkeUtils::colorAttachmentInfo(visibilityImage.imageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &visibilityClearValue)
+		: vkeUtils::colorAttachmentInfo(drawImage.imageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, nullptr);
+	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(drawExtent, &colorAttachment, &depthAttachment);
+	
+	vkCmdBeginRendering(cmd, &renderingInfo);
+
+	if (visibilityBuffer)
+	{
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline);
+	}
+	else if (meshPipeline != VK_NULL_HANDLE)
+	{
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+
+		// The shadow atlases.
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineLayout, 0, 1, &shadowDescriptors, 0, nullptr);
+	}
+
+	// After a pre-pass, the depth is final and only the fragments matching it are shaded.
+	if (depthPrepassActive)
+	{
+		setRenderState(false, VK_COMPARE_OP_EQUAL);
+	}
+	else
+	{
+		setRenderState(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	}
+
+	if (visibilityBuffer)
+	{
+		VisibilityPushConstants pushConstants;
+
+		pushConstants.worldMatrix = worldMatrix;
+		pushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+
+		vkCmdPushConstants(cmd, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VisibilityPushConstants), &pushConstants);
+	}
+	else
+	{
+		GPUDrawPushConstants pushConstants;
+
+		pushConstants.worldMatrix = worldMatrix;
+		pushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+		pushConstants.lightingBufferAddress = frame.lightingBufferAddress;
+		pushConstants.clusterBufferAddress = clusterBufferAddress;
+
+		vkCmdPushConstants(cmd, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+	}
+
+	if (overdrawQuerySupported && !depthPrepassActive)
+	{
+		vkCmdBeginQuery(cmd, frame.occlusionQueryPool, 0, VK_QUERY_CONTROL_PRECISE_BIT);
+	}
+
+	GPUVisibilityDraw* visibilityDraws = (GPUVisibilityDraw*)frame.visibilityDrawBuffer.allocationInfo.pMappedData;
+
+	for (const GeometryDraw& draw : geometryDraws)
+	{
+		if (!visibilityBuffer)
+		{
+			vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+
+			continue;
+		}
+
+		// The visibility buffer draws its index into the table as instance, for the fragment shader to tag the pixels
+		// with. The frame was checked to fit in the table.
+		for (uint32_t offset = 0; offset < draw.indexCount; offset += 3 * MAX_VISIBILITY_DRAW_TRIANGLES)
+		{
+			uint32_t drawIndex = frameStats.visibilityDrawCount++;
+
+			visibilityDraws[drawIndex] = { draw.firstIndex + offset, draw.vertexOffset };
+
+			vkCmdDrawIndexed(cmd, std::min(draw.indexCount - offset, 3 * MAX_VISIBILITY_DRAW_TRIANGLES), 1, draw.firstIndex + offset, draw.vertexOffset, drawIndex);
+		}
+	}
+
+	if (overdrawQuerySupported && !depthPrepassActive)
+	{
+		vkCmdEndQuery(cmd, frame.occlusionQueryPool, 0);
+	}
+
+	vkCmdEndRendering(cmd);
+
+	if (visibilityBuffer)
+	{
+		resolveVisibilityBuffer(cmd, frame);
+	}
+}
+
+void Engine::resolveVisibilityBuffer(VkCommandBuffer cmd, Frame& frame)
+{
+	// The draw table was written while recording, host writes are visible to the submission that follows them.
+	VK_CHECK(vmaFlushAllocation(allocator, frame.visibilityDrawBuffer.allocation, 0, frameStats.visibilityDrawCount * sizeof(GPUVisibilityDraw)));
+
+	vkeUtils::transitionImageLayout(cmd, visibilityImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+
+	VkDescriptorSet descriptorSets[2] = { visibilityDescriptors, computeShadowDescriptors };
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibilityResolvePipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibilityResolvePipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+
+	VisibilityResolvePushConstants pushConstants;
+
+	pushConstants.worldMatrix = projectionMatrix * viewMatrix;
+	pushConstants.vertexBufferAddress = geometryArena.vertexBufferAddress;
+	pushConstants.indexBufferAddress = geometryArena.indexBufferAddress;
+	pushConstants.drawBufferAddress = frame.visibilityDrawBufferAddress;
+	pushConstants.lightingBufferAddress = frame.lightingBufferAddress;
+	pushConstants.clusterBufferAddress = clusterBufferAddress;
+
+	vkCmdPushConstants(cmd, visibilityResolvePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VisibilityResolvePushConstants), &pushConstants);
+
+	// Every pixel is shaded once, the empty ones keep the background.
+	VkExtent2D dispatchSize = getDispatchSize(drawExtent);
+
+	vkCmdDispatch(cmd, dispatchSize.width, dispatchSize.height, 1);
+
+	// Back to where the forward path leaves the draw image.
+	vkeUtils::transitionImageLayout(cmd, drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+}
+
+void Engine::renderDepthPyramid(VkCommandBuffer cmd, uint32_t queueFamily)
+{
+	depthPyramidExtent = getDepthPyramidExtent(drawExtent);
+
+	// The downsampler's counter isn't handed over between queue families, the one using it next clears it again.
+	if (queueFamily != downsampleBufferQueueFamily)
+	{
+		downsampleBufferQueueFamily = queueFamily;
+		downsampleBufferCleared = false;
+	}
+
+	vkeUtils::transitionImageLayout(cmd, depthPyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	// With reversed depth the farthest surface has the smallest depth, so the pyramid keeps the minimum of each footprint.
+	depthPyramidMipCount = downsample(cmd, depthPyramidDescriptors, drawExtent, depthPyramidExtent, depthPyramid.mipLevels, DownsampleReduction::Min);
+
+	vkeUtils::transitionImageLayout(cmd, depthPyramid.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+uint32_t Engine::downsample(VkCommandBuffer cmd, VkDescriptorSet descriptorSet, VkExtent2D sourceExtent, VkExtent2D destinationExtent, uint32_t mipCount, DownsampleReduction reduction)
+{
+	// The counter starts at zero, and the last workgroup of every dispatch puts it back.
+	if (!downsampleBufferCleared)
+	{
+		vkCmdFillBuffer(cmd, downsampleBuffer.buffer, 0, sizeof(uint32_t), 0);
+
+		downsampleBufferCleared = true;
+	}
+
+	// The previous dispatch, in this frame or an earlier one, may still be using the counter and the texels.
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	DownsampleDispatch dispatch = getDownsampleDispatch(destinationExtent, mipCount);
+
+	DownsamplePushConstants pushConstants;
+
+	pushConstants.dataBufferAddress = downsampleBufferAddress;
+	pushConstants.sourceSize = { (int)sourceExtent.width, (int)sourceExtent.height };
+	pushConstants.destinationSize = { (int)destinationExtent.width, (int)destinationExtent.height };
+	pushConstants.mipCount = dispatch.mipCount;
+	pushConstants.reduction = (uint32_t)reduction;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(cmd, downsamplePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DownsamplePushConstants), &pushConstants);
+
+	vkCmdDispatch(cmd, dispatch.groupCount.width, dispatch.groupCount.height, 1);
+
+	return dispatch.mipCount;
+}
+
+void Engine::forEachSceneMesh(const std::function<void(const MeshAsset&)>& function) const
+{
+	// A replayed capture replaces the test meshes.
+	if (!replayedCapture.has_value() && settings.sceneMesh < 0)
+	{
+		for (const std::shared_ptr<MeshAsset>& mesh : testMeshes)
+		{
+			function(*mesh);
+		}
+	}
+	else if (!replayedCapture.has_value() && settings.sceneMesh < (int)testMeshes.size())
+	{
+		function(*testMeshes[settings.sceneMesh]);
+	}
+
+	// Streamed cells are cooked in world space, they use the same matrices.
+	for (const WorldCell& cell : worldStreamer.getCells())
+	{
+		if (cell.state != CellState::Resident)
+		{
+			continue;
+		}
+
+		for (const std::shared_ptr<MeshAsset>& mesh : cell.meshes)
+		{
+			function(*mesh);
+		}
+	}
+}
+
+void Engine::captureFrame(VkCommandBuffer cmd)
+{
+	// Shared with the deletor writing the capture, deletors have to be copyable.
+	std::shared_ptr<FrameCaptureBuilder> builder = std::move(frameCaptureBuilder);
+	FrameCapture& capture = builder->capture;
+	const ComputeEffect& effect = backgroundEffects[currentBackgroundEffect];
+
+	capture.windowExtent = windowExtent;
+	capture.renderScale = renderScale;
+	capture.backgroundEffect = effect.name;
+	capture.backgroundPushConstants = effect.pushConstants;
+	capture.useUpscalePass = useUpscalePass;
+	capture.upscaleSharpness = upscaleSharpness;
+
+	if (builder->copyRanges.empty())
+	{
+		writeFrameCapture(FRAME_CAPTURE_PATH, capture);
+
+		return;
+	}
+
+	const VkDeviceSize verticesSize = builder->totalVertices * sizeof(Vertex);
+	const VkDeviceSize indicesSize = builder->totalIndices * sizeof(uint32_t);
+
+	AllocatedBuffer readbackBuffer = createBuffer(verticesSize + indicesSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryCategory::Readback);
+
+	std::vector<VkBufferCopy> vertexCopies;
+	std::vector<VkBufferCopy> indexCopies;
+
+	for (const FrameCaptureBuilder::CopyRange& range : builder->copyRanges)
+	{
+		vertexCopies.push_back({ range.source.vertices.offset * sizeof(Vertex), range.vertexBase * sizeof(Vertex), range.source.vertices.size * sizeof(Vertex) });
+		indexCopies.push_back({ range.source.indices.offset * sizeof(uint32_t), verticesSize + range.indexBase * sizeof(uint32_t), range.source.indices.size * sizeof(uint32_t) });
+	}
+
+	// The geometry pass only read the arena, so it can be copied from right away.
+	vkCmdCopyBuffer(cmd, geometryArena.vertexBuffer.buffer, readbackBuffer.buffer, (uint32_t)vertexCopies.size(), vertexCopies.data());
+	vkCmdCopyBuffer(cmd, geometryArena.indexBuffer.buffer, readbackBuffer.buffer, (uint32_t)indexCopies.size(), indexCopies.data());
+
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	// The deletor runs once the graphics timeline reaches the value of this frame, the copies are done by then.
+	graphicsDeletionQueue.pushFunction(getFrameTimelineValue(), [this, builder, readbackBuffer, verticesSize, indicesSize]()
+	{
+		FrameCapture& capture = builder->capture;
+		const char* data = (const char*)readbackBuffer.allocationInfo.pMappedData;
+
+		VK_CHECK(vmaInvalidateAllocation(allocator, readbackBuffer.allocation, 0, VK_WHOLE_SIZE));
+
+		capture.vertices.resize(builder->totalVertices);
+		capture.indices.resize(builder->totalIndices);
+
+		memcpy(capture.vertices.data(), data, verticesSize);
+		memcpy(capture.indices.data(), data + verticesSize, indicesSize);
+
+		writeFrameCapture(FRAME_CAPTURE_PATH, capture);
+
+		destroyBuffer(readbackBuffer);
+	});
+}
+
+void Engine::renderUpscale(float deltaTime, VkCommandBuffer cmd)
+{
+	// The draw image is expected to be in shader read only layout already.
+	vkeUtils::transitionImageLayout(cmd, upscaleImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	UpscalePushConstants pushConstants;
+
+	pushConstants.inputSize = glm::vec4(drawExtent.width, drawExtent.height, drawImage.imageExtent2D.width, drawImage.imageExtent2D.height);
+	pushConstants.outputSize = glm::vec4(upscaleExtent.width, upscaleExtent.height, upscaleSharpness, 0.0f);
+
+	// Both passes run at the output resolution.
+	VkExtent2D groupCount = getDispatchSize(upscaleExtent);
+
+	// Edge adaptive upsampling, from the draw image into the upscale image.
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, easuPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, upscalePipelineLayout, 0, 1, &easuDescriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, upscalePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(UpscalePushConstants), &pushConstants);
+	vkCmdDispatch(cmd, groupCount.width, groupCount.height, 1);
+
+	vkeUtils::transitionImageLayout(cmd, upscaleImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	vkeUtils::transitionImageLayout(cmd, sharpenImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+	// Contrast adaptive sharpening, from the upscale image into the sharpen image.
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, rcasPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, upscalePipelineLayout, 0, 1, &rcasDescriptors, 0, nullptr);
+	vkCmdPushConstants(cmd, upscalePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(UpscalePushConstants), &pushConstants);
+	vkCmdDispatch(cmd, groupCount.width, groupCount.height, 1);
+}
+
+void Engine::renderImgui(float deltaTime, VkCommandBuffer cmd, VkImageView targetImageView)
+{
+	VkRenderingAttachmentInfo colorAttachment = vkeUtils::colorAttachmentInfo(targetImageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, nullptr);
+	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(swapchainExtent, &colorAttachment, nullptr);
+
+	vkCmdBeginRendering(cmd, &renderingInfo);
+
+	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+
+	vkCmdEndRendering(cmd);
+}
+
+void Engine::processInputs(float deltaTime)
+{
+	// A lockstep replay renders one simulation tick per frame, whatever the frame time.
+	inputSystem.advance();
+
+	CameraState camera = inputSystem.getCamera(glfwGetTime());
+
+	cameraPosition = camera.position;
+	cameraForward = camera.getForward();
+}
+
+void Engine::windowKeyCallback(GLFWwindow* window, int key, int scanCode, int action, int mods)
+{
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+	{
+		glfwSetWindowShouldClose(window, true);
+	}
+
+	Engine* e = reinterpret_cast<Engine*>(glfwGetWindowUserPointer(window));
+
+	// Releases always go through, so no key stays held when ImGui grabs the keyboard in between.
+	if (action != GLFW_RELEASE && ImGui::GetIO().WantCaptureKeyboard)
+	{
+		return;
+	}
+
+	e->inputSystem.pushEvent({ InputEventType::Key, key, action });
+}
+
+void Engine::windowMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+	Engine* e = reinterpret_cast<Engine*>(glfwGetWindowUserPointer(window));
+
+	if (action != GLFW_RELEASE && ImGui::GetIO().WantCaptureMouse)
+	{
+		return;
+	}
+
+	e->inputSystem.pushEvent({ InputEventType::MouseButton, button, action });
+}
+
+void Engine::windowCursorPositionCallback(GLFWwindow* window, double x, double y)
+{
+	Engine* e = reinterpret_cast<Engine*>(glfwGetWindowUserPointer(window));
+
+	e->inputSystem.pushEvent({ .type = InputEventType::MouseMove, .x = x, .y = y });
+}
+
+void Engine::windowFramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+	Engine* e = reinterpret_cast<Engine*>(glfwGetWindowUserPointer(window));
+
+	e->stopRendering = width == 0 || height == 0;
+}
+
+void Engine::initializeVulkan()
+{
+	vkb::InstanceBuilder vkbInstanceBuilder;
+	vkb::Result<vkb::Instance> vkbResult = vkbInstanceBuilder
+		.set_app_name("Vulkan Engine")
+		.request_validation_layers(useValidationLayers)
+		.use_default_debug_messenger()
+		.require_api_version(1, 3, 0)
+		.build();
+	vkb::Instance vkbInstance = vkbResult.value();
+
+	instance = vkbInstance.instance;
+	debugMessenger = vkbInstance.debug_messenger;
+
+	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create window surface!");
+	}
+
+	VkPhysicalDeviceVulkan13Features features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+	VkPhysicalDeviceVulkan12Features moreFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+
+	features.dynamicRendering = true;
+	features.synchronization2 = true;
+	moreFeatures.bufferDeviceAddress = true;
+	moreFeatures.descriptorIndexing = true;
+	moreFeatures.timelineSemaphore = true;
+
+	vkb::PhysicalDeviceSelector vkbGPUSelector{ vkbInstance };
+	vkb::PhysicalDevice vkbGPU = vkbGPUSelector
+		.set_minimum_version(1, 3)
+		.set_required_features_13(features)
+		.set_required_features_12(moreFeatures)
+		.set_surface(surface)
+		.select()
+		.value();
+
+	// Present wait is optional, it's only used by the low-latency mode.
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR };
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
+
+	presentIdFeatures.presentId = true;
+	presentWaitFeatures.presentWait = true;
+
+	presentWaitSupported = vkbGPU.is_extension_present(VK_KHR_PRESENT_ID_EXTENSION_NAME)
+		&& vkbGPU.is_extension_present(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)
+		&& vkbGPU.enable_extension_features_if_present(presentIdFeatures)
+		&& vkbGPU.enable_extension_features_if_present(presentWaitFeatures)
+		&& vkbGPU.enable_extensions_if_present({ VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME });
+
+	// Graphics pipeline libraries are only worth it when linking is fast, otherwise complete pipelines are built.
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphicsPipelineLibraryFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT };
+	VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT graphicsPipelineLibraryProperties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT };
+
+	graphicsPipelineLibraryFeatures.graphicsPipelineLibrary = true;
+
+	if (vkbGPU.is_extension_present(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) && vkbGPU.is_extension_present(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceProperties2 properties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &graphicsPipelineLibraryProperties };
+
+		vkGetPhysicalDeviceProperties2(vkbGPU.physical_device, &properties);
+
+		graphicsPipelineLibrarySupported = graphicsPipelineLibraryProperties.graphicsPipelineLibraryFastLinking
+			&& vkbGPU.enable_extension_features_if_present(graphicsPipelineLibraryFeatures)
+			&& vkbGPU.enable_extensions_if_present({ VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME });
+	}
+
+	fmt::println("Graphics pipeline library: {}.", graphicsPipelineLibrarySupported ? "enabled" : "unavailable");
+
+	// Without VK_EXT_memory_budget, VMA can only estimate the budget from the heap sizes.
+	memoryBudgetSupported = vkbGPU.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	// The visibility buffer reads gl_PrimitiveID in its fragment shader, which requires the geometry shader feature.
+	VkPhysicalDeviceFeatures visibilityBufferFeatures{};
+
+	visibilityBufferFeatures.geometryShader = true;
+
+	visibilityBufferSupported = vkbGPU.enable_features_if_present(visibilityBufferFeatures);
+
+	fmt::println("Visibility buffer: {}.", visibilityBufferSupported ? "enabled" : "unavailable");
+
+	// Imprecise occlusion queries may only tell whether any sample passed, the overdraw needs the actual count.
+	VkPhysicalDeviceFeatures overdrawQueryFeatures{};
+
+	overdrawQueryFeatures.occlusionQueryPrecise = true;
+
+	overdrawQuerySupported = vkbGPU.enable_features_if_present(overdrawQueryFeatures);
+
+	// Without the counts, the automatic mode has nothing to go on.
+	if (!overdrawQuerySupported && depthPrepassMode == DepthPrepassMode::Automatic)
+	{
+		depthPrepassMode = DepthPrepassMode::Off;
+	}
+
+	// The downsampler writes every level through images declared without a format, whatever the format of the chain.
+	VkPhysicalDeviceFeatures downsampleFeatures{};
+
+	downsampleFeatures.shaderStorageImageWriteWithoutFormat = true;
+
+	downsampleSupported = vkbGPU.enable_features_if_present(downsampleFeatures);
+
+	fmt::println("Single pass downsampler: {}.", downsampleSupported ? "enabled" : "unavailable");
+
+	vkb::DeviceBuilder deviceBuilder{ vkbGPU };
+	vkb::Device vkbDevice = deviceBuilder.build().value();
+
+	device = vkbDevice.device;
+	gpu = vkbGPU.physical_device;
+
+	timestampPeriod = vkbGPU.properties.limits.timestampPeriod;
+
+	VkPhysicalDeviceProperties2 deviceProperties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &subgroupProperties };
+
+	vkGetPhysicalDeviceProperties2(gpu, &deviceProperties);
+
+	computeWorkgroupSize = vkeUtils::computeWorkgroupSize(subgroupProperties.subgroupSize, vkbGPU.properties.limits.maxComputeWorkGroupInvocations);
+
+	fmt::println("Subgroup size: {}, compute workgroups: {}x{}.", subgroupProperties.subgroupSize, computeWorkgroupSize.width, computeWorkgroupSize.height);
+
+	if (presentWaitSupported)
+	{
+		vkWaitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+		presentWaitSupported = vkWaitForPresent != nullptr;
+	}
+
+	graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
+	graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+
+	// Look for a compute queue family without graphics support, so compute work can overlap with rasterization.
+	vkb::Result<VkQueue> computeQueueResult = vkbDevice.get_queue(vkb::QueueType::compute);
+
+	if (computeQueueResult.has_value())
+	{
+		computeQueue = computeQueueResult.value();
+		computeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+	}
+	else
+	{
+		computeQueue = graphicsQueue;
+		computeQueueFamily = graphicsQueueFamily;
+	}
+
+	asyncComputeSupported = computeQueueFamily != graphicsQueueFamily;
+
+	fmt::println("Async compute: {}.", asyncComputeSupported ? "enabled" : "unavailable");
+
+	// Same for uploads, with a transfer queue family without graphics support.
+	vkb::Result<VkQueue> transferQueueResult = vkbDevice.get_queue(vkb::QueueType::transfer);
+
+	if (transferQueueResult.has_value())
+	{
+		transferQueue = transferQueueResult.value();
+		transferQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		transferQueue = graphicsQueue;
+		transferQueueFamily = graphicsQueueFamily;
+	}
+
+	asyncTransferSupported = transferQueueFamily != graphicsQueueFamily;
+
+	fmt::println("Async transfer: {}.", asyncTransferSupported ? "enabled" : "unavailable");
+
+	VmaAllocatorCreateInfo allocatorCreateInfo{};
+
+	allocatorCreateInfo.physicalDevice = gpu;
+	allocatorCreateInfo.device = device;
+	allocatorCreateInfo.instance = instance;
+	allocatorCreateInfo.vulkanApiVersion = VK_API_VERSION_1_3;
+	allocatorCreateInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
+	if (memoryBudgetSupported)
+	{
+		allocatorCreateInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
+
+	vmaCreateAllocator(&allocatorCreateInfo, &allocator);
+
+	memoryManager.initialize(device, allocator);
+
+	mainDeletionQueue.pushFunction([&]()
+	{
+		vmaDestroyAllocator(allocator);
+	});
+}
+
+void Engine::initializeSwapchain()
+{
+	createSwapchain(windowExtent.width, windowExtent.height);
+
+	renderTargetManager.initialize(device, allocator, &memoryManager);
+
+	createRenderTargets(swapchainExtent);
+
+	// The current targets go back to the pool first, so they're destroyed along with it.
+	mainDeletionQueue.pushFunction([this]()
+	{
+		for (const AllocatedImage& image : { drawImage, depthImage, visibilityImage, depthPyramid, backgroundImage, upscaleImage, sharpenImage })
+		{
+			renderTargetManager.release(image);
+		}
+
+		for (VkImageView imageView : depthPyramidMipViews)
+		{
+			vkDestroyImageView(device, imageView, nullptr);
+		}
+
+		renderTargetManager.cleanUp();
+	});
+}
+
+void Engine::initializeCommandStructures()
+{
+	VkCommandPoolCreateInfo cmdPoolCreateInfo = vkeUtils::commandPoolCreateInfo(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VkCommandPoolCreateInfo computeCmdPoolCreateInfo = vkeUtils::commandPoolCreateInfo(computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+
+		VK_CHECK(vkCreateCommandPool(device, &cmdPoolCreateInfo, nullptr, &frames[i].commandPool));
+
+		VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkeUtils::commandBufferAllocateInfo(frames[i].commandPool, 1);
+
+		VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &frames[i].mainCommandBuffer));
+		VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &frames[i].presentCommandBuffer));
+
+		VK_CHECK(vkCreateCommandPool(device, &computeCmdPoolCreateInfo, nullptr, &frames[i].computeCommandPool));
+
+		VkCommandBufferAllocateInfo computeCmdBufferAllocateInfo = vkeUtils::commandBufferAllocateInfo(frames[i].computeCommandPool, 1);
+
+		VK_CHECK(vkAllocateCommandBuffers(device, &computeCmdBufferAllocateInfo, &frames[i].backgroundCommandBuffer));
+		VK_CHECK(vkAllocateCommandBuffers(device, &computeCmdBufferAllocateInfo, &frames[i].postEffectsCommandBuffer));
+		VK_CHECK(vkAllocateCommandBuffers(device, &computeCmdBufferAllocateInfo, &frames[i].depthPyramidCommandBuffer));
+	}
+
+	// Upload command buffers are allocated on demand, as many as there are uploads in flight.
+	VkCommandPoolCreateInfo transferCmdPoolCreateInfo = vkeUtils::commandPoolCreateInfo(transferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+	VK_CHECK(vkCreateCommandPool(device, &transferCmdPoolCreateInfo, nullptr, &transferCommandPool));
+
+	mainDeletionQueue.pushFunction([=]()
+	{
+		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	});
+}
+
+void Engine::initializeSyncStructures()
+{
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vkeUtils::semaphoreCreateInfo();
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		VK_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].renderSemaphore));
+		VK_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].swapchainSemaphore));
+
+		VkQueryPoolCreateInfo queryPoolCreateInfo{ .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCreateInfo.queryCount = 2;
+
+		VK_CHECK(vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &frames[i].timestampQueryPool));
+
+		if (overdrawQuerySupported)
+		{
+			queryPoolCreateInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+			queryPoolCreateInfo.queryCount = 1;
+
+			VK_CHECK(vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &frames[i].occlusionQueryPool));
+		}
+	}
+
+	// Timeline semaphores synchronizing the graphics, compute and transfer queues, and the CPU with all of them.
+	VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = vkeUtils::semaphoreTypeCreateInfo(VK_SEMAPHORE_TYPE_TIMELINE, 0);
+	VkSemaphoreCreateInfo timelineSemaphoreCreateInfo = vkeUtils::semaphoreCreateInfo();
+
+	timelineSemaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+	VK_CHECK(vkCreateSemaphore(device, &timelineSemaphoreCreateInfo, nullptr, &graphicsTimeline));
+	VK_CHECK(vkCreateSemaphore(device, &timelineSemaphoreCreateInfo, nullptr, &computeTimeline));
+	VK_CHECK(vkCreateSemaphore(device, &timelineSemaphoreCreateInfo, nullptr, &transferTimeline));
+
+	mainDeletionQueue.pushFunction([=]()
+	{
+		vkDestroySemaphore(device, graphicsTimeline, nullptr);
+		vkDestroySemaphore(device, computeTimeline, nullptr);
+		vkDestroySemaphore(device, transferTimeline, nullptr);
+	});
+}
+
+void Engine::initializeGeometryArena()
+{
+	// Both buffers are also transfer sources, for the compaction and the defragmentation to copy ranges around.
+	// Uploads write them from the transfer queue, so they're shared with its family instead of changing owner on every upload.
+	std::vector<uint32_t> queueFamilies = { graphicsQueueFamily };
+
+	if (asyncTransferSupported)
+	{
+		queueFamilies.push_back(transferQueueFamily);
+	}
+
+	AllocatedBuffer vertexBuffer = createBuffer(GEOMETRY_ARENA_VERTEX_CAPACITY * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Mesh, 0, queueFamilies);
+	AllocatedBuffer indexBuffer = createBuffer(GEOMETRY_ARENA_INDEX_CAPACITY * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Mesh, 0, queueFamilies);
+
+	geometryArena.initialize(device, vertexBuffer, GEOMETRY_ARENA_VERTEX_CAPACITY, indexBuffer, GEOMETRY_ARENA_INDEX_CAPACITY);
+
+	memoryManager.registerMovableBuffer(&geometryArena.vertexBuffer, vertexBuffer.allocationInfo.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, &geometryArena.vertexBufferAddress, queueFamilies);
+	memoryManager.registerMovableBuffer(&geometryArena.indexBuffer, indexBuffer.allocationInfo.size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, &geometryArena.indexBufferAddress, queueFamilies);
+
+	// The handles are read at cleanup time, the defragmentation may have replaced them.
+	mainDeletionQueue.pushFunction([this]()
+	{
+		destroyBuffer(geometryArena.vertexBuffer);
+		destroyBuffer(geometryArena.indexBuffer);
+	});
+}
+
+void Engine::initializeLighting()
+{
+	// Written by the compute pass and read by the geometry pass that follows it on the same queue, so one grid is enough.
+	clusterBuffer = createBuffer(CLUSTER_COUNT * sizeof(GPUCluster), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Lighting);
+	clusterBufferAddress = getBufferAddress(clusterBuffer);
+
+	for (Frame& frame : frames)
+	{
+		frame.lightingBuffer = createBuffer(sizeof(GPULightingData) + MAX_LIGHTS * sizeof(GPULight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Lighting, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+		frame.lightingBufferAddress = getBufferAddress(frame.lightingBuffer);
+	}
+
+	// Spread over the area around the scene loaded up front.
+	pointLights = scatterPointLights(MAX_LIGHTS, glm::vec3(0.0f), glm::vec3(60.0f, 8.0f, 60.0f), 1);
+
+	mainDeletionQueue.pushFunction([this]()
+	{
+		destroyBuffer(clusterBuffer);
+
+		for (Frame& frame : frames)
+		{
+			destroyBuffer(frame.lightingBuffer);
+		}
+	});
+}
+
+void Engine::initializeShadows()
+{
+	VkImageUsageFlags atlasUsages = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VkExtent3D atlasExtent = { SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION, 1 };
+
+	for (AllocatedImage* atlas : { &staticShadowAtlas, &dynamicShadowAtlas })
+	{
+		atlas->imageFormat = VK_FORMAT_D32_SFLOAT;
+		atlas->imageExtent2D = { SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION };
+		atlas->imageExtent3D = atlasExtent;
+
+		createImage(*atlas, vkeUtils::imageCreateInfo(atlas->imageFormat, atlasExtent, atlasUsages), MemoryCategory::RenderTarget);
+
+		VkImageViewCreateInfo imageViewCreateInfo = vkeUtils::imageViewCreateInfo(atlas->imageFormat, atlas->image, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+		VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, nullptr, &atlas->imageView));
+	}
+
+	// Hardware comparison, with a bilinear filter blending four of them. The cascades have a reversed depth, so a
+	// fragment is lit when it's at least as close to the sun as the caster.
+	VkSamplerCreateInfo samplerCreateInfo{ .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.compareEnable = VK_TRUE;
+	samplerCreateInfo.compareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+
+	VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, nullptr, &shadowSampler));
+
+	// Has to match the bindings the mesh fragment shader and the visibility resolve declare, so the cache hands out the
+	// layouts of their pipelines.
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+		shadowDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+		computeShadowDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	shadowDescriptors = globalDescriptorAllocator.allocate(device, shadowDescriptorLayout);
+	computeShadowDescriptors = globalDescriptorAllocator.allocate(device, computeShadowDescriptorLayout);
+
+	VkDescriptorImageInfo descriptorImageInfos[2]{};
+	VkWriteDescriptorSet writeDescriptorSets[4]{};
+
+	descriptorImageInfos[0].sampler = shadowSampler;
+	descriptorImageInfos[0].imageView = staticShadowAtlas.imageView;
+	descriptorImageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	descriptorImageInfos[1].sampler = shadowSampler;
+	descriptorImageInfos[1].imageView = dynamicShadowAtlas.imageView;
+	descriptorImageInfos[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	for (int i = 0; i < 4; i++)
+	{
+		writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDescriptorSets[i].pNext = nullptr;
+		writeDescriptorSets[i].dstSet = i < 2 ? shadowDescriptors : computeShadowDescriptors;
+		writeDescriptorSets[i].dstBinding = i % 2;
+		writeDescriptorSets[i].descriptorCount = 1;
+		writeDescriptorSets[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writeDescriptorSets[i].pImageInfo = &descriptorImageInfos[i % 2];
+	}
+
+	vkUpdateDescriptorSets(device, 4, writeDescriptorSets, 0, nullptr);
+
+	mainDeletionQueue.pushFunction([this]()
+	{
+		vkDestroySampler(device, shadowSampler, nullptr);
+
+		for (const AllocatedImage& atlas : { staticShadowAtlas, dynamicShadowAtlas })
+		{
+			vkDestroyImageView(device, atlas.imageView, nullptr);
+			destroyImage(atlas);
+		}
+	});
+}
+
+void Engine::initializeVisibilityBuffer()
+{
+	// One table per frame in flight, the resolve of a frame may still be reading the previous one.
+	for (Frame& frame : frames)
+	{
+		frame.visibilityDrawBuffer = createBuffer(MAX_VISIBILITY_DRAWS * sizeof(GPUVisibilityDraw), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Mesh, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+		frame.visibilityDrawBufferAddress = getBufferAddress(frame.visibilityDrawBuffer);
+	}
+
+	mainDeletionQueue.pushFunction([this]()
+	{
+		for (Frame& frame : frames)
+		{
+			destroyBuffer(frame.visibilityDrawBuffer);
+		}
+	});
+}
+
+void Engine::initializeDownsample()
+{
+	// Only the counter needs a starting value, it's cleared by the first dispatch.
+	downsampleBuffer = createBuffer(sizeof(GPUDownsampleData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::RenderTarget);
+	downsampleBufferAddress = getBufferAddress(downsampleBuffer);
+
+	mainDeletionQueue.pushFunction([this]()
+	{
+		destroyBuffer(downsampleBuffer);
+	});
+}
+
+void Engine::initializeDescriptors()
+{
+	std::vector<DescriptorAllocator::PoolSizeRatio> sizes =
+	{
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
+	};
+
+	// Create a descriptor pool that will hold 10 sets with up to 1 storage image and 1 sampled image each.
+	globalDescriptorAllocator.initialize(device, 10, sizes);
+
+	// Five sets per generation of render targets: the current one, and the ones retired by resizes while frames are in flight.
+	// A generation writes seventeen storage images, the visibility resolve set has two and the depth pyramid set twelve.
+	std::vector<DescriptorAllocator::PoolSizeRatio> renderTargetSizes =
+	{
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
+	};
+
+	renderTargetDescriptorAllocator.initialize(device, 5 * (MAX_FRAMES_IN_FLIGHT + 2), renderTargetSizes, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+
+	// Descriptor set and pipeline layouts are shared through the cache, and destroyed along with it.
+	layoutCache.initialize(device);
+
+	// Make the descriptor set layout for our compute draw.
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+		drawImageDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	// Make the descriptor set layout for the upscale passes, reading a sampled image and writing a storage image.
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+		upscaleDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	// Make the descriptor set layout for the visibility buffer resolve, reading the IDs and writing the draw image.
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+		visibilityDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	// Make the descriptor set layout for the downsampler, reading the source and writing a storage image per level.
+	{
+		DescriptorLayoutBuilder builder;
+
+		builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DOWNSAMPLE_MAX_MIPS);
+
+		downsampleDescriptorLayout = builder.build(layoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
+	}
+
+	VkSamplerCreateInfo samplerCreateInfo{ .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+	VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, nullptr, &linearSampler));
+
+	updateRenderTargetDescriptors();
+
+	mainDeletionQueue.pushFunction([&]()
+	{
+		globalDescriptorAllocator.clear(device);
+		renderTargetDescriptorAllocator.clear(device);
+		layoutCache.cleanUp();
+
+		vkDestroySampler(device, linearSampler, nullptr);
+	});
+}
+
+void Engine::initializePipelines()
+{
+	shaderManager.initialize(device, "sources/shaders");
+	pipelineLibrary.initialize(device, graphicsPipelineLibrarySupported);
+
+	mainDeletionQueue.pushFunction([&]()
+	{
+		pipelineLibrary.cleanUp();
+	});
+
+	// Compute pipelines.
+	initializeBackgroundPipelines();
+
+	initializeUpscalePipelines();
+
+	initializeClusterPipeline();
+
+	initializeDownsamplePipeline();
+
+	initializeSkinningPipeline();
+
+	// Graphics pipelines.
+	initializeMeshPipeline();
+
+	initializeShadowPipeline();
+
+	initializeVisibilityPipelines();
+
+	initializeDepthPrepassPipeline();
+
+	initializeParticlePipelines();
+}
+
+void Engine::initializeBackgroundPipelines()
+{
+	VkShaderModule gradientShaderModule;
+	VkShaderModule skyShaderModule;
+
+	ShaderReflection reflection;
+
+	if (!loadShader("sources/shaders/gradient.comp.spv", &gradientShaderModule, reflection))
+	{
+		fmt::println("Error when building the compute shader.");
+	}
+
+	if (!loadShader("sources/shaders/sky.comp.spv", &skyShaderModule, reflection))
+	{
+		fmt::println("Error when building the compute shader.");
+	}
+
+	// Both effects share the layout, and the push constants have to match ComputePushConstants.
+	defaultPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(ComputePushConstants), "background");
+
+	ComputeEffect gradientComputeEffect;
+	ComputeEffect skyComputeEffect;
+
+	gradientComputeEffect.name = "Gradient";
+	gradientComputeEffect.pipelineLayout = defaultPipelineLayout;
+	gradientComputeEffect.pushConstants = {};
+	gradientComputeEffect.pushConstants.data1 = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+	gradientComputeEffect.pushConstants.data2 = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+	skyComputeEffect.name = "Sky";
+	skyComputeEffect.pipelineLayout = defaultPipelineLayout;
+	skyComputeEffect.pushConstants = {};
+	skyComputeEffect.pushConstants.data1 = glm::vec4(0.1f, 0.2f, 0.4f, 0.97f);
+
+	gradientComputeEffect.pipeline = buildComputePipeline(defaultPipelineLayout, gradientShaderModule);
+	skyComputeEffect.pipeline = buildComputePipeline(defaultPipelineLayout, skyShaderModule);
+
+	backgroundEffects.push_back(gradientComputeEffect);
+	backgroundEffects.push_back(skyComputeEffect);
+
+	vkDestroyShaderModule(device, gradientShaderModule, nullptr);
+	vkDestroyShaderModule(device, skyShaderModule, nullptr);
+
+	shaderManager.registerPipeline("Gradient", { "gradient.comp" }, reflection, &backgroundEffects[0].pipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(defaultPipelineLayout, shaderModules[0]);
+	});
+
+	shaderManager.registerPipeline("Sky", { "sky.comp" }, reflection, &backgroundEffects[1].pipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(defaultPipelineLayout, shaderModules[0]);
+	});
+
+	mainDeletionQueue.pushFunction([=]()
+	{
+		vkDestroyPipeline(device, gradientComputeEffect.pipeline, nullptr);
+		vkDestroyPipeline(device, skyComputeEffect.pipeline, nullptr);
+	});
+}
+
+void Engine::initializeMeshPipeline()
+{
+	VkShaderModule triangleVertexShaderModule;
+	VkShaderModule triangleFragmentShaderModule;
+
+	ShaderReflection reflection;
+
+	if (!loadShader("sources/shaders/colored_triangle_mesh.vert.spv", &triangleVertexShaderModule, reflection))
+	{
+		fmt::println("Error when building the triangle vertex shader module.");
+	}
+	else
+	{
+		fmt::println("Triangle vertex shader succesfully loaded.");
+	}
+
+	if (!loadShader("sources/shaders/colored_triangle.frag.spv", &triangleFragmentShaderModule, reflection))
+	{
+		fmt::println("Error when building the triangle fragment shader module.");
+	}
+	else
+	{
+		fmt::println("Triangle fragment shader succesfully loaded.");
+	}
+
+	meshPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(GPUDrawPushConstants), "mesh");
+
+	// Compiled by the pipeline library workers, and only waited on when the geometry is first drawn.
+	meshPipelineHandle = pipelineLibrary.request(getMeshPipelineBuilder(triangleVertexShaderModule, triangleFragmentShaderModule));
+
+	pipelineLibrary.keepShaderModule(triangleVertexShaderModule);
+	pipelineLibrary.keepShaderModule(triangleFragmentShaderModule);
+
+	shaderManager.registerPipeline("Mesh", { "colored_triangle_mesh.vert", "colored_triangle.frag" }, reflection, &meshPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return getMeshPipelineBuilder(shaderModules[0], shaderModules[1]).build(device);
+	});
+}
+
+void Engine::initializeShadowPipeline()
+{
+	VkShaderModule shadowVertexShaderModule;
+
+	ShaderReflection reflection;
+
+	if (!loadShader("sources/shaders/shadow.vert.spv", &shadowVertexShaderModule, reflection))
+	{
+		fmt::println("Error when building the shadow vertex shader module.");
+	}
+
+	shadowPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(ShadowPushConstants), "shadow");
+
+	shadowPipelineHandle = pipelineLibrary.request(getShadowPipelineBuilder(shadowVertexShaderModule));
+
+	pipelineLibrary.keepShaderModule(shadowVertexShaderModule);
+
+	shaderManager.registerPipeline("Shadow", { "shadow.vert" }, reflection, &shadowPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return getShadowPipelineBuilder(shaderModules[0]).build(device);
+	});
+}
+
+void Engine::initializeDepthPrepassPipeline()
+{
+	VkShaderModule prepassVertexShaderModule;
+
+	ShaderReflection reflection;
+
+	// The shadow vertex shader only outputs the position, and shares its layout with the shadow pipeline.
+	if (!loadShader("sources/shaders/shadow.vert.spv", &prepassVertexShaderModule, reflection))
+	{
+		fmt::println("Error when building the depth pre-pass vertex shader module.");
+	}
+
+	depthPrepassPipelineHandle = pipelineLibrary.request(getDepthPrepassPipelineBuilder(prepassVertexShaderModule));
+
+	pipelineLibrary.keepShaderModule(prepassVertexShaderModule);
+
+	shaderManager.registerPipeline("Depth Pre-pass", { "shadow.vert" }, reflection, &depthPrepassPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return getDepthPrepassPipelineBuilder(shaderModules[0]).build(device);
+	});
+}
+
+void Engine::initializeVisibilityPipelines()
+{
+	// The visibility fragment shader can't be compiled into a pipeline without the geometry shader feature.
+	if (!visibilityBufferSupported)
+	{
+		return;
+	}
+
+	VkShaderModule visibilityVertexShaderModule;
+	VkShaderModule visibilityFragmentShaderModule;
+
+	ShaderReflection reflection;
+
+	if (!loadShader("sources/shaders/visibility.vert.spv", &visibilityVertexShaderModule, reflection))
+	{
+		fmt::println("Error when building the visibility vertex shader module.");
+	}
+
+	if (!loadShader("sources/shaders/visibility.frag.spv", &visibilityFragmentShaderModule, reflection))
+	{
+		fmt::println("Error when building the visibility fragment shader module.");
+	}
+
+	visibilityPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(VisibilityPushConstants), "visibility");
+
+	visibilityPipelineHandle = pipelineLibrary.request(getVisibilityPipelineBuilder(visibilityVertexShaderModule, visibilityFragmentShaderModule));
+
+	pipelineLibrary.keepShaderModule(visibilityVertexShaderModule);
+	pipelineLibrary.keepShaderModule(visibilityFragmentShaderModule);
+
+	shaderManager.registerPipeline("Visibility", { "visibility.vert", "visibility.frag" }, reflection, &visibilityPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return getVisibilityPipelineBuilder(shaderModules[0], shaderModules[1]).build(device);
+	});
+
+	VkShaderModule resolveShaderModule;
+
+	ShaderReflection resolveReflection;
+
+	if (!loadShader("sources/shaders/visibility.comp.spv", &resolveShaderModule, resolveReflection))
+	{
+		fmt::println("Error when building the visibility resolve compute shader.");
+	}
+
+	visibilityResolvePipelineLayout = getReflectedPipelineLayout(resolveReflection, sizeof(VisibilityResolvePushConstants), "visibility resolve");
+	visibilityResolvePipeline = buildComputePipeline(visibilityResolvePipelineLayout, resolveShaderModule);
+
+	vkDestroyShaderModule(device, resolveShaderModule, nullptr);
+
+	shaderManager.registerPipeline("Visibility Resolve", { "visibility.comp" }, resolveReflection, &visibilityResolvePipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(visibilityResolvePipelineLayout, shaderModules[0]);
+	});
+
+	mainDeletionQueue.pushFunction([this, visibilityResolvePipeline = visibilityResolvePipeline]()
+	{
+		vkDestroyPipeline(device, visibilityResolvePipeline, nullptr);
+	});
+}
+
+bool Engine::loadShader(const char* filePath, VkShaderModule* outShaderModule, ShaderReflection& reflection)
+{
+	std::vector<uint32_t> code;
+	ShaderReflection moduleReflection;
+
+	if (!vkeUtils::loadShaderCode(filePath, code) || !moduleReflection.reflect(code))
+	{
+		return false;
+	}
+
+	// Accumulate the resources of every stage of the pipeline.
+	reflection.merge(moduleReflection);
+
+	return vkeUtils::createShaderModule(code, device, outShaderModule);
+}
+
+VkPipelineLayout Engine::getReflectedPipelineLayout(const ShaderReflection& reflection, uint32_t pushConstantsSize, const char* pipelineName)
+{
+	// A C++ struct that drifted from its GLSL block would silently corrupt the push constants.
+	uint32_t reflectedSize = reflection.pushConstantRange.offset + reflection.pushConstantRange.size;
+
+	if (reflectedSize != pushConstantsSize)
+	{
+		throw std::runtime_error(fmt::format("The {} shaders declare {} bytes of push constants, but the engine pushes {} bytes!", pipelineName, reflectedSize, pushConstantsSize));
+	}
+
+	return layoutCache.getPipelineLayout(reflection);
+}
+
+bool Engine::acquirePipeline(VkPipeline& pipeline, PipelineHandle& handle, const char* pipelineName, bool wait)
+{
+	if (pipeline != VK_NULL_HANDLE || handle == INVALID_PIPELINE_HANDLE)
+	{
+		return pipeline != VK_NULL_HANDLE;
+	}
+
+	std::optional<VkPipeline> compiledPipeline = wait ? std::optional<VkPipeline>(pipelineLibrary.get(handle)) : pipelineLibrary.tryGet(handle);
+
+	if (!compiledPipeline.has_value())
+	{
+		return false;
+	}
+
+	// The library is only asked once, a failed variant would fail again.
+	pipeline = compiledPipeline.value();
+	handle = INVALID_PIPELINE_HANDLE;
+
+	if (pipeline == VK_NULL_HANDLE)
+	{
+		fmt::println("The {} pipeline failed to compile, its pass is skipped.", pipelineName);
+	}
+
+	return pipeline != VK_NULL_HANDLE;
+}
+
+PipelineBuilder Engine::getMeshPipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule)
+{
+	PipelineBuilder pipelineBuilder;
+
+	pipelineBuilder.pipelineLayout = meshPipelineLayout;
+
+	pipelineBuilder.setShaders(vertexShaderModule, fragmentShaderModule);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.disableMultisampling();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	// Opaque, blending would keep the hardware from discarding hidden fragments early.
+	pipelineBuilder.disableBlending();
+
+	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+
+	pipelineBuilder.enableDynamicRenderState();
+
+	return pipelineBuilder;
+}
+
+PipelineBuilder Engine::getShadowPipelineBuilder(VkShaderModule vertexShaderModule)
+{
+	PipelineBuilder pipelineBuilder;
+
+	pipelineBuilder.pipelineLayout = shadowPipelineLayout;
+
+	// No fragment shader and no color attachment, the cascades only need depth.
+	pipelineBuilder.setShaders(vertexShaderModule);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.disableMultisampling();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	// With a reversed depth, a negative bias pushes the casters away from the sun.
+	pipelineBuilder.enableDepthBias(-2.0f, -2.5f);
+
+	pipelineBuilder.setDepthFormat(staticShadowAtlas.imageFormat);
+
+	pipelineBuilder.enableDynamicRenderState();
+
+	return pipelineBuilder;
+}
+
+PipelineBuilder Engine::getDepthPrepassPipelineBuilder(VkShaderModule vertexShaderModule)
+{
+	PipelineBuilder pipelineBuilder;
+
+	pipelineBuilder.pipelineLayout = shadowPipelineLayout;
+
+	// Depth only, without a bias: the main pass has to find the exact same depths.
+	pipelineBuilder.setShaders(vertexShaderModule);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.disableMultisampling();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+
+	pipelineBuilder.enableDynamicRenderState();
+
+	return pipelineBuilder;
+}
+
+PipelineBuilder Engine::getVisibilityPipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule)
+{
+	PipelineBuilder pipelineBuilder;
+
+	pipelineBuilder.pipelineLayout = visibilityPipelineLayout;
+
+	// Same raster and depth state as the mesh pipeline, but the IDs are written as they are.
+	pipelineBuilder.setShaders(vertexShaderModule, fragmentShaderModule);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.disableMultisampling();
+	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	pipelineBuilder.disableBlending();
+
+	pipelineBuilder.setColorAttachmentFormat(visibilityImage.imageFormat);
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+
+	pipelineBuilder.enableDynamicRenderState();
+
+	return pipelineBuilder;
+}
+
+PipelineBuilder Engine::getParticlePipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule, bool alphaBlend)
+{
+	PipelineBuilder pipelineBuilder;
+
+	pipelineBuilder.pipelineLayout = particlePipelineLayout;
+
+	// Tested against the depth of the scene, but never written: the particles don't hide each other.
+	pipelineBuilder.setShaders(vertexShaderModule, fragmentShaderModule);
+	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipelineBuilder.disableMultisampling();
+	pipelineBuilder.enableDepthTest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+	// Additive blending doesn't depend on the order, alpha blending needs the particles sorted back to front.
+	if (alphaBlend)
+	{
+		pipelineBuilder.enableBlendingAlphaBlend();
+	}
+	else
+	{
+		pipelineBuilder.enableBlendingAdditive();
+	}
 
-	GPUDrawPushConstants pushConstants;
-	glm::mat4 view = glm::translate(glm::vec3{ 0.0f, 0.0f, -5.0f });
-	glm::mat4 projection = glm::perspective(glm::radians(70.0f), (float)drawExtent.width / (float)drawExtent.height, 10000.0f, 0.1f);
+	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
+	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
 
-	projection[1][1] *= -1;
+	pipelineBuilder.enableDynamicRenderState();
 
-	pushConstants.worldMatrix = projection * view;
-	pushConstants.vertexBufferAddress = testMeshes[2]->meshBuffers.vertexBufferAddress;
+	return pipelineBuilder;
+}
 
-	vkCmdPushConstants(cmd, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
-	vkCmdBindIndexBuffer(cmd, testMeshes[2]->meshBuffers.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+VkPipeline Engine::buildComputePipeline(VkPipelineLayout pipelineLayout, VkShaderModule shaderModule)
+{
+	VkComputePipelineCreateInfo computePipelineCreateInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	VkPipeline pipeline;
 
-	vkCmdDrawIndexed(cmd, testMeshes[2]->surfaces[0].count, 1, testMeshes[2]->surfaces[0].startIndex, 0, 0);
+	// Constant ids 0 and 1 are the workgroup width and height (local_size_x_id and local_size_y_id).
+	VkSpecializationMapEntry specializationMapEntries[2] =
+	{
+		{ 0, offsetof(VkExtent2D, width), sizeof(uint32_t) },
+		{ 1, offsetof(VkExtent2D, height), sizeof(uint32_t) }
+	};
 
-	vkCmdEndRendering(cmd);
-}
+	VkSpecializationInfo specializationInfo{};
 
-void Engine::renderImgui(float deltaTime, VkCommandBuffer cmd, VkImageView targetImageView)
-{
-	VkRenderingAttachmentInfo colorAttachment = vkeUtils::colorAttachmentInfo(targetImageView, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, nullptr);
-	VkRenderingInfo renderingInfo = vkeUtils::renderingInfo(swapchainExtent, &colorAttachment, nullptr);
+	specializationInfo.mapEntryCount = 2;
+	specializationInfo.pMapEntries = specializationMapEntries;
+	specializationInfo.dataSize = sizeof(VkExtent2D);
+	specializationInfo.pData = &computeWorkgroupSize;
 
-	vkCmdBeginRendering(cmd, &renderingInfo);
+	computePipelineCreateInfo.layout = pipelineLayout;
+	computePipelineCreateInfo.stage = vkeUtils::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, shaderModule);
+	computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
 
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		return VK_NULL_HANDLE;
+	}
 
-	vkCmdEndRendering(cmd);
+	return pipeline;
 }
 
-void Engine::processInputs(float deltaTime)
+VkExtent2D Engine::getDispatchSize(VkExtent2D extent) const
 {
+	return
+	{
+		(extent.width + computeWorkgroupSize.width - 1) / computeWorkgroupSize.width,
+		(extent.height + computeWorkgroupSize.height - 1) / computeWorkgroupSize.height
+	};
 }
 
-void Engine::windowKeyCallback(GLFWwindow* window, int key, int scanCode, int action, int mods)
+void Engine::initializeUpscalePipelines()
 {
-	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+	VkShaderModule easuShaderModule;
+	VkShaderModule rcasShaderModule;
+
+	ShaderReflection reflection;
+
+	if (!loadShader("sources/shaders/easu.comp.spv", &easuShaderModule, reflection))
 	{
-		glfwSetWindowShouldClose(window, true);
+		fmt::println("Error when building the EASU compute shader.");
 	}
-}
 
-void Engine::windowFramebufferSizeCallback(GLFWwindow* window, int width, int height)
-{
-	Engine* e = reinterpret_cast<Engine*>(glfwGetWindowUserPointer(window));
+	if (!loadShader("sources/shaders/rcas.comp.spv", &rcasShaderModule, reflection))
+	{
+		fmt::println("Error when building the RCAS compute shader.");
+	}
 
-	e->stopRendering = width == 0 || height == 0;
+	upscalePipelineLayout = getReflectedPipelineLayout(reflection, sizeof(UpscalePushConstants), "upscale");
+
+	easuPipeline = buildComputePipeline(upscalePipelineLayout, easuShaderModule);
+	rcasPipeline = buildComputePipeline(upscalePipelineLayout, rcasShaderModule);
+
+	vkDestroyShaderModule(device, easuShaderModule, nullptr);
+	vkDestroyShaderModule(device, rcasShaderModule, nullptr);
+
+	shaderManager.registerPipeline("EASU", { "easu.comp" }, reflection, &easuPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(upscalePipelineLayout, shaderModules[0]);
+	});
+
+	shaderManager.registerPipeline("RCAS", { "rcas.comp" }, reflection, &rcasPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(upscalePipelineLayout, shaderModules[0]);
+	});
+
+	// Pipelines rebuilt by the shader manager are its own, only the ones created here are destroyed.
+	mainDeletionQueue.pushFunction([this, easuPipeline = easuPipeline, rcasPipeline = rcasPipeline]()
+	{
+		vkDestroyPipeline(device, easuPipeline, nullptr);
+		vkDestroyPipeline(device, rcasPipeline, nullptr);
+	});
 }
 
-void Engine::initializeVulkan()
+void Engine::initializeClusterPipeline()
 {
-	vkb::InstanceBuilder vkbInstanceBuilder;
-	vkb::Result<vkb::Instance> vkbResult = vkbInstanceBuilder
-		.set_app_name("Vulkan Engine")
-		.request_validation_layers(useValidationLayers)
-		.use_default_debug_messenger()
-		.require_api_version(1, 3, 0)
-		.build();
-	vkb::Instance vkbInstance = vkbResult.value();
+	VkShaderModule clusterShaderModule;
 
-	instance = vkbInstance.instance;
-	debugMessenger = vkbInstance.debug_messenger;
+	ShaderReflection reflection;
 
-	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+	if (!loadShader("sources/shaders/clusters.comp.spv", &clusterShaderModule, reflection))
 	{
-		throw std::runtime_error("Failed to create window surface!");
+		fmt::println("Error when building the light clustering compute shader.");
 	}
 
-	VkPhysicalDeviceVulkan13Features features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
-	VkPhysicalDeviceVulkan12Features moreFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	clusterPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(ClusterPushConstants), "cluster");
+	clusterPipeline = buildComputePipeline(clusterPipelineLayout, clusterShaderModule);
 
-	features.dynamicRendering = true;
-	features.synchronization2 = true;
-	moreFeatures.bufferDeviceAddress = true;
-	moreFeatures.descriptorIndexing = true;
+	vkDestroyShaderModule(device, clusterShaderModule, nullptr);
 
-	vkb::PhysicalDeviceSelector vkbGPUSelector{ vkbInstance };
-	vkb::PhysicalDevice vkbGPU = vkbGPUSelector
-		.set_minimum_version(1, 3)
-		.set_required_features_13(features)
-		.set_required_features_12(moreFeatures)
-		.set_surface(surface)
-		.select()
-		.value();
-	vkb::DeviceBuilder deviceBuilder{ vkbGPU };
-	vkb::Device vkbDevice = deviceBuilder.build().value();
+	shaderManager.registerPipeline("Clusters", { "clusters.comp" }, reflection, &clusterPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(clusterPipelineLayout, shaderModules[0]);
+	});
 
-	device = vkbDevice.device;
-	gpu = vkbGPU.physical_device;
+	mainDeletionQueue.pushFunction([this, clusterPipeline = clusterPipeline]()
+	{
+		vkDestroyPipeline(device, clusterPipeline, nullptr);
+	});
+}
 
-	graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
-	graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+void Engine::initializeSkinningPipeline()
+{
+	VkShaderModule skinningShaderModule;
 
-	VmaAllocatorCreateInfo allocatorCreateInfo{};
+	ShaderReflection reflection;
 
-	allocatorCreateInfo.physicalDevice = gpu;
-	allocatorCreateInfo.device = device;
-	allocatorCreateInfo.instance = instance;
-	allocatorCreateInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+	if (!loadShader("sources/shaders/skinning.comp.spv", &skinningShaderModule, reflection))
+	{
+		fmt::println("Error when building the skinning compute shader.");
+	}
 
-	vmaCreateAllocator(&allocatorCreateInfo, &allocator);
+	skinningPipelineLayout = getReflectedPipelineLayout(reflection, sizeof(SkinningPushConstants), "skinning");
+	skinningPipeline = buildComputePipeline(skinningPipelineLayout, skinningShaderModule);
 
-	mainDeletionQueue.pushFunction([&]()
+	vkDestroyShaderModule(device, skinningShaderModule, nullptr);
+
+	shaderManager.registerPipeline("Skinning", { "skinning.comp" }, reflection, &skinningPipeline, [this](std::span<VkShaderModule> shaderModules)
 	{
-		vmaDestroyAllocator(allocator);
+		return buildComputePipeline(skinningPipelineLayout, shaderModules[0]);
+	});
+
+	mainDeletionQueue.pushFunction([this, skinningPipeline = skinningPipeline]()
+	{
+		vkDestroyPipeline(device, skinningPipeline, nullptr);
 	});
 }
 
-void Engine::initializeSwapchain()
+void Engine::initializeParticlePipelines()
 {
-	createSwapchain(windowExtent.width, windowExtent.height);
-
-	VmaAllocationCreateInfo imageAllocationCreateinfo{};
-
-	imageAllocationCreateinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	imageAllocationCreateinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	// The four compute stages only differ by their shader and push constants.
+	auto initializeComputeStage = [this](const char* name, const char* source, uint32_t pushConstantsSize, VkPipelineLayout& pipelineLayout, VkPipeline& pipeline)
+	{
+		VkShaderModule shaderModule;
 
-	drawImage.imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
-	drawImage.imageExtent2D = { windowExtent.width, windowExtent.height };
-	drawImage.imageExtent3D = { windowExtent.width, windowExtent.height, 1 };
+		ShaderReflection reflection;
 
-	VkImageUsageFlags drawImageUsages{};
+		if (!loadShader(fmt::format("sources/shaders/{}.spv", source).c_str(), &shaderModule, reflection))
+		{
+			fmt::println("Error when building the {} compute shader.", source);
+		}
 
-	drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-	drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
-	drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		pipelineLayout = getReflectedPipelineLayout(reflection, pushConstantsSize, name);
+		pipeline = buildComputePipeline(pipelineLayout, shaderModule);
 
-	VkImageCreateInfo drawImageCreateInfo = vkeUtils::imageCreateInfo(drawImage.imageFormat, drawImage.imageExtent3D, drawImageUsages);
+		vkDestroyShaderModule(device, shaderModule, nullptr);
 
-	vmaCreateImage(allocator, &drawImageCreateInfo, &imageAllocationCreateinfo, &drawImage.image, &drawImage.allocation, nullptr);
+		shaderManager.registerPipeline(name, { source }, reflection, &pipeline, [this, pipelineLayout](std::span<VkShaderModule> shaderModules)
+		{
+			return buildComputePipeline(pipelineLayout, shaderModules[0]);
+		});
 
-	VkImageViewCreateInfo drawImageViewCreateinfo = vkeUtils::imageViewCreateInfo(drawImage.imageFormat, drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		mainDeletionQueue.pushFunction([this, pipeline]()
+		{
+			vkDestroyPipeline(device, pipeline, nullptr);
+		});
+	};
 
-	VK_CHECK(vkCreateImageView(device, &drawImageViewCreateinfo, nullptr, &drawImage.imageView));
+	initializeComputeStage("Particle Emit", "particles_emit.comp", sizeof(ParticleEmitPushConstants), particleEmitPipelineLayout, particleEmitPipeline);
+	initializeComputeStage("Particle Simulate", "particles_simulate.comp", sizeof(ParticleSimulatePushConstants), particleSimulatePipelineLayout, particleSimulatePipeline);
+	initializeComputeStage("Particle Compact", "particles_compact.comp", sizeof(ParticleCompactPushConstants), particleCompactPipelineLayout, particleCompactPipeline);
+	initializeComputeStage("Particle Sort", "particles_sort.comp", sizeof(ParticleSortPushConstants), particleSortPipelineLayout, particleSortPipeline);
 
-	depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
-	depthImage.imageExtent2D = drawImage.imageExtent2D;
-	depthImage.imageExtent3D = drawImage.imageExtent3D;
+	VkShaderModule particleVertexShaderModule;
+	VkShaderModule particleFragmentShaderModule;
 
-	VkImageUsageFlags depthImageUsages{};
+	ShaderReflection reflection;
 
-	depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (!loadShader("sources/shaders/particles.vert.spv", &particleVertexShaderModule, reflection))
+	{
+		fmt::println("Error when building the particle vertex shader module.");
+	}
 
-	VkImageCreateInfo depthImageCreateInfo = vkeUtils::imageCreateInfo(depthImage.imageFormat, depthImage.imageExtent3D, depthImageUsages);
+	if (!loadShader("sources/shaders/particles.frag.spv", &particleFragmentShaderModule, reflection))
+	{
+		fmt::println("Error when building the particle fragment shader module.");
+	}
 
-	vmaCreateImage(allocator, &depthImageCreateInfo, &imageAllocationCreateinfo, &depthImage.image, &depthImage.allocation, nullptr);
+	particlePipelineLayout = getReflectedPipelineLayout(reflection, sizeof(ParticleDrawPushConstants), "particle");
 
-	VkImageViewCreateInfo depthImageViewCreateinfo = vkeUtils::imageViewCreateInfo(depthImage.imageFormat, depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	particleAdditivePipelineHandle = pipelineLibrary.request(getParticlePipelineBuilder(particleVertexShaderModule, particleFragmentShaderModule, false));
+	particleAlphaPipelineHandle = pipelineLibrary.request(getParticlePipelineBuilder(particleVertexShaderModule, particleFragmentShaderModule, true));
 
-	VK_CHECK(vkCreateImageView(device, &depthImageViewCreateinfo, nullptr, &depthImage.imageView));
+	pipelineLibrary.keepShaderModule(particleVertexShaderModule);
+	pipelineLibrary.keepShaderModule(particleFragmentShaderModule);
 
-	mainDeletionQueue.pushFunction([=]()
+	shaderManager.registerPipeline("Particles Additive", { "particles.vert", "particles.frag" }, reflection, &particleAdditivePipeline, [this](std::span<VkShaderModule> shaderModules)
 	{
-		vkDestroyImageView(device, drawImage.imageView, nullptr);
-		vmaDestroyImage(allocator, drawImage.image, drawImage.allocation);
+		return getParticlePipelineBuilder(shaderModules[0], shaderModules[1], false).build(device);
+	});
 
-		vkDestroyImageView(device, depthImage.imageView, nullptr);
-		vmaDestroyImage(allocator, depthImage.image, depthImage.allocation);
+	shaderManager.registerPipeline("Particles Alpha", { "particles.vert", "particles.frag" }, reflection, &particleAlphaPipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return getParticlePipelineBuilder(shaderModules[0], shaderModules[1], true).build(device);
 	});
 }
 
-void Engine::initializeCommandStructures()
+void Engine::initializeDownsamplePipeline()
 {
-	VkCommandPoolCreateInfo cmdPoolCreateInfo = vkeUtils::commandPoolCreateInfo(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-
-	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+	// The shader writes images declared without a format, it can't be built into a pipeline without the feature.
+	if (!downsampleSupported)
+	{
+		return;
+	}
 
-		VK_CHECK(vkCreateCommandPool(device, &cmdPoolCreateInfo, nullptr, &frames[i].commandPool));
+	VkShaderModule downsampleShaderModule;
 
-		VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkeUtils::commandBufferAllocateInfo(frames[i].commandPool, 1);
+	ShaderReflection reflection;
 
-		VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &frames[i].mainCommandBuffer));
+	if (!loadShader("sources/shaders/downsample.comp.spv", &downsampleShaderModule, reflection))
+	{
+		fmt::println("Error when building the downsample compute shader.");
 	}
 
-	VK_CHECK(vkCreateCommandPool(device, &cmdPoolCreateInfo, nullptr, &immCommandPool));
+	downsamplePipelineLayout = getReflectedPipelineLayout(reflection, sizeof(DownsamplePushConstants), "downsample");
+	downsamplePipeline = buildComputePipeline(downsamplePipelineLayout, downsampleShaderModule);
 
-	VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkeUtils::commandBufferAllocateInfo(immCommandPool, 1);
+	vkDestroyShaderModule(device, downsampleShaderModule, nullptr);
 
-	VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &immCommandBuffer));
+	shaderManager.registerPipeline("Downsample", { "downsample.comp" }, reflection, &downsamplePipeline, [this](std::span<VkShaderModule> shaderModules)
+	{
+		return buildComputePipeline(downsamplePipelineLayout, shaderModules[0]);
+	});
 
-	mainDeletionQueue.pushFunction([=]()
+	mainDeletionQueue.pushFunction([this, downsamplePipeline = downsamplePipeline]()
 	{
-		vkDestroyCommandPool(device, immCommandPool, nullptr);
+		vkDestroyPipeline(device, downsamplePipeline, nullptr);
 	});
 }
 
-void Engine::initializeSyncStructures()
+void Engine::initializeImgui()
 {
-	VkFenceCreateInfo fenceCreateInfo = vkeUtils::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vkeUtils::semaphoreCreateInfo();
+	// Create a descriptor pool for ImGUI.
+	VkDescriptorPoolSize poolSizes[] = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1000 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1000 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1000 },
+		{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1000 }
+	};
 
-	for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
-	{
-		VK_CHECK(vkCreateFence(device, &fenceCreateInfo, nullptr, &frames[i].renderFence));
+	VkDescriptorPoolCreateInfo descriptorPoolCreateinfo{};
+	VkDescriptorPool imguiDescriptorPool;
 
-		VK_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].renderSemaphore));
-		VK_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].swapchainSemaphore));
-	}
+	descriptorPoolCreateinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCreateinfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	descriptorPoolCreateinfo.maxSets = 1000;
+	descriptorPoolCreateinfo.poolSizeCount = (uint32_t)std::size(poolSizes);
+	descriptorPoolCreateinfo.pPoolSizes = poolSizes;
 
-	VK_CHECK(vkCreateFence(device, &fenceCreateInfo, nullptr, &immFence));
+	VK_CHECK(vkCreateDescriptorPool(device, &descriptorPoolCreateinfo, nullptr, &imguiDescriptorPool));
+
+	// Initialize imgui library.
+	ImGui::CreateContext();
+
+	ImGui_ImplGlfw_InitForVulkan(window, true);
+
+	ImGui_ImplVulkan_InitInfo imguiVulkanInitInfo{};
+
+	imguiVulkanInitInfo.Instance = instance;
+	imguiVulkanInitInfo.PhysicalDevice = gpu;
+	imguiVulkanInitInfo.Device = device;
+	imguiVulkanInitInfo.Queue = graphicsQueue;
+	imguiVulkanInitInfo.DescriptorPool = imguiDescriptorPool;
+	imguiVulkanInitInfo.MinImageCount = 3;
+	imguiVulkanInitInfo.ImageCount = 3;
+	imguiVulkanInitInfo.UseDynamicRendering = true;
+	imguiVulkanInitInfo.PipelineRenderingCreateInfo = {};
+	imguiVulkanInitInfo.PipelineRenderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	imguiVulkanInitInfo.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
+	imguiVulkanInitInfo.PipelineRenderingCreateInfo.pColorAttachmentFormats = &swapchainImageFormat;
+	imguiVulkanInitInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+
+	ImGui_ImplVulkan_Init(&imguiVulkanInitInfo);
+	ImGui_ImplVulkan_CreateFontsTexture();
 
 	mainDeletionQueue.pushFunction([=]()
 	{
-		vkDestroyFence(device, immFence, nullptr);
+		ImGui_ImplVulkan_Shutdown();
+		ImGui_ImplGlfw_Shutdown();
+
+		ImGui::DestroyContext();
+
+		vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
 	});
 }
 
-void Engine::initializeDescriptors()
+void Engine::initalizeDefaultData()
 {
-	std::vector<DescriptorAllocator::PoolSizeRatio> sizes =
+	testMeshes = loadGLTFMeshes(this, settings.scenePath).value();
+
+	// Streamed geometry gets three quarters of the arena, the rest is left to the meshes loaded up front.
+	worldStreamer.initialize(this, (GEOMETRY_ARENA_VERTEX_CAPACITY * sizeof(Vertex) + GEOMETRY_ARENA_INDEX_CAPACITY * sizeof(uint32_t)) / 4 * 3);
+
+	if (replayedCapture.has_value())
 	{
-		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }
-	};
+		initializeReplayedCapture();
+	}
+	else if (std::filesystem::exists(settings.worldManifestPath))
+	{
+		worldStreamer.loadManifest(settings.worldManifestPath);
+	}
+}
 
-	// Create a descriptor pool that will hold 10 sets with 1 image each.
-	globalDescriptorAllocator.initialize(device, 10, sizes);
+void Engine::initializeAnimation()
+{
+	if (settings.animatedModelPath.empty() || settings.crowdSize == 0)
+	{
+		return;
+	}
 
-	// Make the descriptor set layout for our compute draw.
+	std::optional<AnimatedModelData> model = parseGLTFAnimatedModel(settings.animatedModelPath);
+
+	if (!model.has_value())
 	{
-		DescriptorLayoutBuilder builder;
+		return;
+	}
 
-		builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+	skeletons = std::move(model->skeletons);
 
-		drawImageDescriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+	// Every member of the crowd gets the palettes of all the skeletons, one after the other.
+	std::vector<uint32_t> skeletonPaletteOffsets;
+	uint32_t paletteSize = 0;
+
+	for (const Skeleton& skeleton : skeletons)
+	{
+		skeletonPaletteOffsets.push_back(paletteSize);
+		paletteSize += (uint32_t)skeleton.jointNodes.size();
 	}
 
-	// Allocate a descriptor set for our draw image.
-	drawImageDescriptors = globalDescriptorAllocator.allocate(device, drawImageDescriptorLayout);
+	// Rigid meshes of the model are left out.
+	for (MeshData& meshData : model->meshes)
+	{
+		if (meshData.skinning.empty() || meshData.skin >= (int32_t)skeletons.size() || skeletons[meshData.skin].jointNodes.empty())
+		{
+			continue;
+		}
 
-	VkDescriptorImageInfo descriptorImageInfo{};
+		std::vector<GPUSkinnedVertex> sourceVertices(meshData.vertices.size());
 
-	descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-	descriptorImageInfo.imageView = drawImage.imageView;
+		// Out of range joints would read the palette of the next instance, or past the end of the buffer.
+		glm::u16vec4 lastJoint{ (uint16_t)(skeletons[meshData.skin].jointNodes.size() - 1) };
 
-	VkWriteDescriptorSet writeDescriptorSet{};
+		for (size_t i = 0; i < sourceVertices.size(); i++)
+		{
+			const VertexSkin& skin = meshData.skinning[i];
+			glm::u16vec4 joints = glm::min(skin.joints, lastJoint);
+			float weightSum = skin.weights.x + skin.weights.y + skin.weights.z + skin.weights.w;
+
+			sourceVertices[i].position = meshData.vertices[i].position;
+			sourceVertices[i].normal = meshData.vertices[i].normal;
+			sourceVertices[i].joints01 = (uint32_t)joints.x | ((uint32_t)joints.y << 16);
+			sourceVertices[i].joints23 = (uint32_t)joints.z | ((uint32_t)joints.w << 16);
+			sourceVertices[i].weights = weightSum > 0.0f ? skin.weights / weightSum : glm::vec4{ 1.0f, 0.0f, 0.0f, 0.0f };
+		}
 
-	writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writeDescriptorSet.pNext = nullptr;
-	writeDescriptorSet.dstBinding = 0;
-	writeDescriptorSet.dstSet = drawImageDescriptors;
-	writeDescriptorSet.descriptorCount = 1;
-	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	writeDescriptorSet.pImageInfo = &descriptorImageInfo;
+		SkinnedMesh& skinnedMesh = skinnedMeshes.emplace_back();
 
-	vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, nullptr);
+		// Written from the transfer queue once, then only read by the skinning pass, like the arena.
+		std::vector<uint32_t> queueFamilies = { graphicsQueueFamily };
 
-	mainDeletionQueue.pushFunction([&]()
-	{
-		globalDescriptorAllocator.clear(device);
+		if (asyncTransferSupported)
+		{
+			queueFamilies.push_back(transferQueueFamily);
+		}
 
-		vkDestroyDescriptorSetLayout(device, drawImageDescriptorLayout, nullptr);
-	});
-}
+		size_t sourceBufferSize = sourceVertices.size() * sizeof(GPUSkinnedVertex);
 
-void Engine::initializePipelines()
-{
-	// Compute pipelines.
-	initializeBackgroundPipelines();
+		skinnedMesh.sourceBuffer = createBuffer(sourceBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Mesh, 0, queueFamilies);
+		skinnedMesh.sourceBufferAddress = getBufferAddress(skinnedMesh.sourceBuffer);
+		skinnedMesh.skeleton = (uint32_t)meshData.skin;
 
-	// Graphics pipelines.
-	initializeMeshPipeline();
-}
+		AllocatedBuffer stagingBuffer = createBuffer(sourceBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::Staging);
 
-void Engine::initializeBackgroundPipelines()
-{
-	VkPushConstantRange pushConstantRange{};
-	VkPipelineLayoutCreateInfo computePipelineLayoutCreateInfo{};
+		std::memcpy(stagingBuffer.allocationInfo.pMappedData, sourceVertices.data(), sourceBufferSize);
 
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(ComputePushConstants);
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		uint64_t uploadValue = submitTransfer([&](VkCommandBuffer cmd)
+		{
+			VkBufferCopy bufferCopy{ 0 };
 
-	computePipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	computePipelineLayoutCreateInfo.pNext = nullptr;
-	computePipelineLayoutCreateInfo.pSetLayouts = &drawImageDescriptorLayout;
-	computePipelineLayoutCreateInfo.setLayoutCount = 1;
-	computePipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-	computePipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+			bufferCopy.size = sourceBufferSize;
 
-	VK_CHECK(vkCreatePipelineLayout(device, &computePipelineLayoutCreateInfo, nullptr, &defaultPipelineLayout));
+			vkCmdCopyBuffer(cmd, stagingBuffer.buffer, skinnedMesh.sourceBuffer.buffer, 1, &bufferCopy);
+		});
 
-	VkShaderModule gradientShaderModule;
-	VkShaderModule skyShaderModule;
+		transferDeletionQueue.pushFunction(uploadValue, [this, stagingBuffer]()
+		{
+			destroyBuffer(stagingBuffer);
+		});
 
-	if (!vkeUtils::loadShaderModule("sources/shaders/gradient.comp.spv", device, &gradientShaderModule))
+		skinnedMesh.meshData = std::move(meshData);
+	}
+
+	if (skinnedMeshes.empty())
 	{
-		fmt::println("Error when building the compute shader.");
+		fmt::println("No skinned mesh found in \"{}\".", settings.animatedModelPath);
+
+		return;
 	}
 
-	if (!vkeUtils::loadShaderModule("sources/shaders/sky.comp.spv", device, &skyShaderModule))
+	uint32_t crowdSize = std::min(settings.crowdSize, MAX_JOINT_PALETTE_MATRICES / std::max(paletteSize, 1u));
+
+	// Spaced by the size of the model in its bind pose.
+	float modelRadius = 1.0f;
+
+	for (const SkinnedMesh& skinnedMesh : skinnedMeshes)
 	{
-		fmt::println("Error when building the compute shader.");
+		for (const GeoSurface& surface : skinnedMesh.meshData.surfaces)
+		{
+			modelRadius = std::max(modelRadius, glm::length(glm::vec3(surface.bounds)) + surface.bounds.w);
+		}
 	}
 
-	VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo[2]{ {}, {} };
+	uint32_t crowdColumns = (uint32_t)std::ceil(std::sqrt((float)crowdSize));
+	float spacing = modelRadius * 2.5f;
+
+	// Every member starts at another point of its clip, so the crowd doesn't move in lockstep.
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	for (uint32_t member = 0; member < crowdSize; member++)
+	{
+		glm::vec2 cell = glm::vec2(member % crowdColumns, member / crowdColumns) - (float)(crowdColumns - 1) * 0.5f;
+		glm::mat4 worldMatrix = glm::translate(glm::vec3(cell.x * spacing, 0.0f, cell.y * spacing));
+
+		uint32_t firstInstance = (uint32_t)animatedInstances.size();
+
+		for (size_t i = 0; i < skeletons.size(); i++)
+		{
+			AnimatedInstance& instance = animatedInstances.emplace_back();
 
-	pipelineShaderStageCreateInfo[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	pipelineShaderStageCreateInfo[0].pNext = nullptr;
-	pipelineShaderStageCreateInfo[0].stage = VK_SHADER_STAGE_COMPUTE_BIT;
-	pipelineShaderStageCreateInfo[0].module = gradientShaderModule;
-	pipelineShaderStageCreateInfo[0].pName = "main";
+			instance.skeleton = &skeletons[i];
+			instance.time = skeletons[i].clips.empty() ? 0.0f : unit(generator) * skeletons[i].clips[0].duration;
+			instance.worldMatrix = worldMatrix;
+			instance.paletteOffset = member * paletteSize + skeletonPaletteOffsets[i];
+		}
 
-	pipelineShaderStageCreateInfo[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	pipelineShaderStageCreateInfo[1].pNext = nullptr;
-	pipelineShaderStageCreateInfo[1].stage = VK_SHADER_STAGE_COMPUTE_BIT;
-	pipelineShaderStageCreateInfo[1].module = skyShaderModule;
-	pipelineShaderStageCreateInfo[1].pName = "main";
+		for (uint32_t i = 0; i < skinnedMeshes.size(); i++)
+		{
+			SkinnedMesh& skinnedMesh = skinnedMeshes[i];
 
-	VkComputePipelineCreateInfo computePipelineCreateInfo[2]{ {}, {} };
+			// The bind pose is only a placeholder, the skinning pass overwrites it before the first draw.
+			std::shared_ptr<MeshAsset> mesh = uploadMeshData(this, skinnedMesh.meshData);
 
-	computePipelineCreateInfo[0].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	computePipelineCreateInfo[0].pNext = nullptr;
-	computePipelineCreateInfo[0].layout = defaultPipelineLayout;
-	computePipelineCreateInfo[0].stage = pipelineShaderStageCreateInfo[0];
+			if (mesh == nullptr)
+			{
+				throw std::runtime_error("Failed to allocate the animated crowd in the geometry arena!");
+			}
 
-	computePipelineCreateInfo[1].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	computePipelineCreateInfo[1].pNext = nullptr;
-	computePipelineCreateInfo[1].layout = defaultPipelineLayout;
-	computePipelineCreateInfo[1].stage = pipelineShaderStageCreateInfo[1];
+			// Skinned vertices are in world space. The animations move them away from the bind pose, so its bounds are
+			// moved along with the instance and grown by a margin instead of being computed again every frame.
+			for (GeoSurface& surface : mesh->surfaces)
+			{
+				surface.bounds = glm::vec4(glm::vec3(worldMatrix * glm::vec4(glm::vec3(surface.bounds), 1.0f)), surface.bounds.w * 1.5f);
+			}
 
-	ComputeEffect gradientComputeEffect;
-	ComputeEffect skyComputeEffect;
+			skinnedInstances.push_back({ mesh, i, firstInstance + skinnedMesh.skeleton });
+			dynamicMeshes.push_back(mesh);
+		}
+	}
 
-	gradientComputeEffect.name = "Gradient";
-	gradientComputeEffect.pipelineLayout = defaultPipelineLayout;
-	gradientComputeEffect.pushConstants = {};
-	gradientComputeEffect.pushConstants.data1 = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
-	gradientComputeEffect.pushConstants.data2 = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	for (Frame& frame : frames)
+	{
+		frame.jointPaletteBuffer = createBuffer(crowdSize * paletteSize * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::Mesh, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+		frame.jointPaletteBufferAddress = getBufferAddress(frame.jointPaletteBuffer);
+	}
 
-	skyComputeEffect.name = "Sky";
-	skyComputeEffect.pipelineLayout = defaultPipelineLayout;
-	skyComputeEffect.pushConstants = {};
-	skyComputeEffect.pushConstants.data1 = glm::vec4(0.1f, 0.2f, 0.4f, 0.97f);
+	animationSampler.initialize();
 
-	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo[0], nullptr, &gradientComputeEffect.pipeline));
-	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo[1], nullptr, &skyComputeEffect.pipeline));
+	fmt::println("Animated crowd: {} instances of {} skinned meshes, {} joints each.", crowdSize, skinnedMeshes.size(), paletteSize);
 
-	backgroundEffects.push_back(gradientComputeEffect);
-	backgroundEffects.push_back(skyComputeEffect);
+	mainDeletionQueue.pushFunction([this]()
+	{
+		animationSampler.cleanUp();
 
-	vkDestroyShaderModule(device, gradientShaderModule, nullptr);
-	vkDestroyShaderModule(device, skyShaderModule, nullptr);
+		for (SkinnedMesh& skinnedMesh : skinnedMeshes)
+		{
+			destroyBuffer(skinnedMesh.sourceBuffer);
+		}
 
-	mainDeletionQueue.pushFunction([=]()
-	{
-		vkDestroyPipelineLayout(device, defaultPipelineLayout, nullptr);
-		vkDestroyPipeline(device, gradientComputeEffect.pipeline, nullptr);
-		vkDestroyPipeline(device, skyComputeEffect.pipeline, nullptr);
+		for (Frame& frame : frames)
+		{
+			destroyBuffer(frame.jointPaletteBuffer);
+		}
 	});
 }
 
-void Engine::initializeMeshPipeline()
+void Engine::initializeParticles()
 {
-	VkShaderModule triangleVertexShaderModule;
-	VkShaderModule triangleFragmentShaderModule;
+	// Written from the transfer queue once, then only by the particle passes.
+	std::vector<uint32_t> queueFamilies = { graphicsQueueFamily };
 
-	if (!vkeUtils::loadShaderModule("sources/shaders/colored_triangle_mesh.vert.spv", device, &triangleVertexShaderModule))
-	{
-		fmt::println("Error when building the triangle vertex shader module.");
-	}
-	else
+	if (asyncTransferSupported)
 	{
-		fmt::println("Triangle vertex shader succesfully loaded.");
+		queueFamilies.push_back(transferQueueFamily);
 	}
 
-	if (!vkeUtils::loadShaderModule("sources/shaders/colored_triangle.frag.spv", device, &triangleFragmentShaderModule))
-	{
-		fmt::println("Error when building the triangle fragment shader module.");
-	}
-	else
+	VkBufferUsageFlags usages = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	particleBuffer = createBuffer(MAX_PARTICLES * sizeof(GPUParticle), usages, MemoryCategory::Mesh, 0, queueFamilies);
+	particleCounterBuffer = createBuffer(sizeof(GPUParticleCounters), usages | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, MemoryCategory::Mesh, 0, queueFamilies);
+	particleDeadList = createBuffer(MAX_PARTICLES * sizeof(uint32_t), usages, MemoryCategory::Mesh, 0, queueFamilies);
+	particleSortBuffer = createBuffer(MAX_PARTICLES * sizeof(GPUParticleSortEntry), usages, MemoryCategory::Mesh, 0, queueFamilies);
+
+	particleBufferAddress = getBufferAddress(particleBuffer);
+	particleCounterBufferAddress = getBufferAddress(particleCounterBuffer);
+	particleDeadListAddress = getBufferAddress(particleDeadList);
+	particleSortBufferAddress = getBufferAddress(particleSortBuffer);
+
+	for (uint32_t i = 0; i < 2; i++)
 	{
-		fmt::println("Triangle fragment shader succesfully loaded.");
+		particleAliveLists[i] = createBuffer(MAX_PARTICLES * sizeof(uint32_t), usages, MemoryCategory::Mesh, 0, queueFamilies);
+		particleAliveListAddresses[i] = getBufferAddress(particleAliveLists[i]);
 	}
 
-	VkPushConstantRange pushConstantRange{};
+	// Every particle starts dead, and nothing is simulated or drawn until the first ones are emitted.
+	GPUParticleCounters counters{};
 
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(GPUDrawPushConstants);
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	counters.deadCount = (int32_t)MAX_PARTICLES;
+	counters.sortSize = PARTICLE_SORT_BLOCK_SIZE;
+	counters.simulateDispatch = { 0, 1, 1 };
+	counters.sortDispatch = { 1, 1, 1 };
+	counters.draw = { 6, 0, 0, 0 };
 
-	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vkeUtils::pipelineLayoutCreateInfo();
+	size_t deadListSize = MAX_PARTICLES * sizeof(uint32_t);
 
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	AllocatedBuffer stagingBuffer = createBuffer(deadListSize + sizeof(GPUParticleCounters), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::Staging);
 
-	VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &meshPipelineLayout));
+	uint32_t* deadList = (uint32_t*)stagingBuffer.allocationInfo.pMappedData;
 
-	PipelineBuilder pipelineBuilder;
+	for (uint32_t i = 0; i < MAX_PARTICLES; i++)
+	{
+		deadList[i] = i;
+	}
 
-	pipelineBuilder.pipelineLayout = meshPipelineLayout;
+	std::memcpy((uint8_t*)stagingBuffer.allocationInfo.pMappedData + deadListSize, &counters, sizeof(GPUParticleCounters));
 
-	pipelineBuilder.setShaders(triangleVertexShaderModule, triangleFragmentShaderModule);
-	pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
-	pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-	pipelineBuilder.disableMultisampling();
-	pipelineBuilder.enableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	pipelineBuilder.enableBlendingAdditive();
+	uint64_t uploadValue = submitTransfer([&](VkCommandBuffer cmd)
+	{
+		VkBufferCopy deadListCopy{ 0 };
 
-	pipelineBuilder.setColorAttachmentFormat(drawImage.imageFormat);
-	pipelineBuilder.setDepthFormat(depthImage.imageFormat);
+		deadListCopy.size = deadListSize;
 
-	meshPipeline = pipelineBuilder.build(device);
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, particleDeadList.buffer, 1, &deadListCopy);
 
-	vkDestroyShaderModule(device, triangleVertexShaderModule, nullptr);
-	vkDestroyShaderModule(device, triangleFragmentShaderModule, nullptr);
+		VkBufferCopy counterCopy{ 0 };
 
-	mainDeletionQueue.pushFunction([&]()
+		counterCopy.srcOffset = deadListSize;
+		counterCopy.size = sizeof(GPUParticleCounters);
+
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, particleCounterBuffer.buffer, 1, &counterCopy);
+	});
+
+	transferDeletionQueue.pushFunction(uploadValue, [this, stagingBuffer]()
+	{
+		destroyBuffer(stagingBuffer);
+	});
+
+	mainDeletionQueue.pushFunction([this]()
 	{
-		vkDestroyPipelineLayout(device, meshPipelineLayout, nullptr);
-		vkDestroyPipeline(device, meshPipeline, nullptr);
+		destroyBuffer(particleBuffer);
+		destroyBuffer(particleCounterBuffer);
+		destroyBuffer(particleDeadList);
+		destroyBuffer(particleAliveLists[0]);
+		destroyBuffer(particleAliveLists[1]);
+		destroyBuffer(particleSortBuffer);
 	});
 }
 
-void Engine::initializeImgui()
+void Engine::initializeReplayedCapture()
 {
-	// Create a descriptor pool for ImGUI.
-	VkDescriptorPoolSize poolSizes[] = {
-		{ VK_DESCRIPTOR_TYPE_SAMPLER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1000 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1000 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1000 },
-		{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1000 }
-	};
+	FrameCapture& capture = replayedCapture.value();
 
-	VkDescriptorPoolCreateInfo descriptorPoolCreateinfo{};
-	VkDescriptorPool imguiDescriptorPool;
-
-	descriptorPoolCreateinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descriptorPoolCreateinfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	descriptorPoolCreateinfo.maxSets = 1000;
-	descriptorPoolCreateinfo.poolSizeCount = (uint32_t)std::size(poolSizes);
-	descriptorPoolCreateinfo.pPoolSizes = poolSizes;
+	replayedCaptureBuffers = uploadMesh(capture.vertices, capture.indices);
 
-	VK_CHECK(vkCreateDescriptorPool(device, &descriptorPoolCreateinfo, nullptr, &imguiDescriptorPool));
-
-	// Initialize imgui library.
-	ImGui::CreateContext();
+	registerMeshBuffers(replayedCaptureBuffers);
 
-	ImGui_ImplGlfw_InitForVulkan(window, true);
-
-	ImGui_ImplVulkan_InitInfo imguiVulkanInitInfo{};
+	// The geometry lives in the arena from now on.
+	capture.vertices = {};
+	capture.indices = {};
 
-	imguiVulkanInitInfo.Instance = instance;
-	imguiVulkanInitInfo.PhysicalDevice = gpu;
-	imguiVulkanInitInfo.Device = device;
-	imguiVulkanInitInfo.Queue = graphicsQueue;
-	imguiVulkanInitInfo.DescriptorPool = imguiDescriptorPool;
-	imguiVulkanInitInfo.MinImageCount = 3;
-	imguiVulkanInitInfo.ImageCount = 3;
-	imguiVulkanInitInfo.UseDynamicRendering = true;
-	imguiVulkanInitInfo.PipelineRenderingCreateInfo = {};
-	imguiVulkanInitInfo.PipelineRenderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
-	imguiVulkanInitInfo.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
-	imguiVulkanInitInfo.PipelineRenderingCreateInfo.pColorAttachmentFormats = &swapchainImageFormat;
-	imguiVulkanInitInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+	// Everything else the frame depends on is restored as it was, and left alone by the dynamic resolution.
+	dynamicResolution = false;
+	renderScale = capture.renderScale;
+	useUpscalePass = capture.useUpscalePass;
+	upscaleSharpness = capture.upscaleSharpness;
 
-	ImGui_ImplVulkan_Init(&imguiVulkanInitInfo);
-	ImGui_ImplVulkan_CreateFontsTexture();
+	auto effect = std::find_if(backgroundEffects.begin(), backgroundEffects.end(), [&capture](const ComputeEffect& candidate) { return capture.backgroundEffect == candidate.name; });
 
-	mainDeletionQueue.pushFunction([=]()
+	if (effect == backgroundEffects.end())
 	{
-		ImGui_ImplVulkan_Shutdown();
-		ImGui_ImplGlfw_Shutdown();
-
-		ImGui::DestroyContext();
+		fmt::println("Frame capture uses an unknown background effect \"{}\".", capture.backgroundEffect);
 
-		vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
-	});
-}
+		return;
+	}
 
-void Engine::initalizeDefaultData()
-{
-	testMeshes = loadGLTFMeshes(this, "assets/basicmesh.glb").value();
+	effect->pushConstants = capture.backgroundPushConstants;
+	currentBackgroundEffect = (int)(effect - backgroundEffects.begin());
 }
 
-void Engine::createSwapchain(uint32_t width, uint32_t height)
+void Engine::createSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain)
 {
 	swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
@@ -822,9 +3916,10 @@ void Engine::createSwapchain(uint32_t width, uint32_t height)
 	vkb::Swapchain vkbSwapchain = vkbSwapchainBuilder
 		// .use_default_format_selection()
 		.set_desired_format(VkSurfaceFormatKHR{ .format = swapchainImageFormat, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR })
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+		.set_desired_present_mode(settings.vsync ? VK_PRESENT_MODE_FIFO_KHR : VK_PRESENT_MODE_IMMEDIATE_KHR)
 		.set_desired_extent(width, height)
 		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+		.set_old_swapchain(oldSwapchain)
 		.build()
 		.value();
 
@@ -834,25 +3929,56 @@ void Engine::createSwapchain(uint32_t width, uint32_t height)
 	swapchainImageViews = vkbSwapchain.get_image_views().value();
 }
 
-void Engine::resizeSwapchain()
+bool Engine::resizeSwapchain()
 {
 	int width = 0, height = 0;
 
-	do
+	glfwGetFramebufferSize(window, &width, &height);
+
+	if (width == 0 || height == 0)
 	{
-		glfwGetFramebufferSize(window, &width, &height);
-		// glfwWaitEvents();
-	} while (width == 0 || height == 0);
+		return false;
+	}
 
 	windowExtent.width = (uint32_t)width;
 	windowExtent.height = (uint32_t)height;
 
-	vkDeviceWaitIdle(device);
+	// The frames in flight keep using the old swapchain and render targets, so they're retired with the next frame
+	// instead of waiting for the device to be idle.
+	const uint64_t retireValue = getFrameTimelineValue();
 
-	cleanUpSwapchain();
-	createSwapchain(windowExtent.width, windowExtent.height);
+	VkSwapchainKHR oldSwapchain = swapchain;
+	std::vector<VkImageView> oldSwapchainImageViews = std::move(swapchainImageViews);
+
+	createSwapchain(windowExtent.width, windowExtent.height, oldSwapchain);
+
+	graphicsDeletionQueue.pushFunction(retireValue, [this, oldSwapchain, oldSwapchainImageViews]()
+	{
+		for (VkImageView imageView : oldSwapchainImageViews)
+		{
+			vkDestroyImageView(device, imageView, nullptr);
+		}
+
+		vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+	});
+
+	// The render targets are only replaced when the new extent crosses a granularity step.
+	VkExtent2D targetExtent = RenderTargetManager::getTargetExtent(swapchainExtent);
+
+	if (targetExtent.width != drawImage.imageExtent2D.width || targetExtent.height != drawImage.imageExtent2D.height)
+	{
+		retireRenderTargets(retireValue);
+		createRenderTargets(swapchainExtent);
+		updateRenderTargetDescriptors();
+	}
+
+	// Present ids are tracked per swapchain, there is nothing to wait for on the new one yet.
+	lastPresentedId = 0;
+	frameWaited = false;
 
 	resizeRequested = false;
+
+	return true;
 }
 
 void Engine::cleanUpSwapchain()
@@ -866,27 +3992,302 @@ void Engine::cleanUpSwapchain()
 	}
 }
 
-AllocatedBuffer Engine::createBuffer(size_t allocationSize, VkBufferUsageFlags bufferUsageFlags, VmaMemoryUsage memoryUsage)
+void Engine::createRenderTargets(VkExtent2D extent)
+{
+	VkImageUsageFlags drawImageUsages{};
+
+	drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
+	drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	drawImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	drawImage = renderTargetManager.acquire(VK_FORMAT_R16G16B16A16_SFLOAT, drawImageUsages, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+	depthImage = renderTargetManager.acquire(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, extent);
+
+	// Rasterized next to the depth image, and read back by the visibility buffer resolve.
+	visibilityImage = renderTargetManager.acquire(VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+
+	// Room for the largest pyramid of a draw extent within the targets, with its whole chain.
+	VkExtent2D pyramidExtent = getDepthPyramidExtent(RenderTargetManager::getTargetExtent(extent));
+	uint32_t pyramidMipLevels = std::min(vkeUtils::mipLevelCount(pyramidExtent), DOWNSAMPLE_MAX_MIPS);
+
+	depthPyramid = renderTargetManager.acquire(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT, pyramidExtent, pyramidMipLevels);
+
+	depthPyramidMipViews.fill(VK_NULL_HANDLE);
+
+	for (uint32_t mip = 0; mip < depthPyramid.mipLevels; mip++)
+	{
+		VkImageViewCreateInfo imageViewCreateInfo = vkeUtils::imageViewCreateInfo(depthPyramid.imageFormat, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT, mip, 1);
+
+		VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, nullptr, &depthPyramidMipViews[mip]));
+	}
+
+	// Written by the background effect and copied into the draw image.
+	backgroundImage = renderTargetManager.acquire(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+
+	// The upscale targets are as large as the draw image, which is the largest output extent we support.
+	VkImageUsageFlags upscaleImageUsages{};
+
+	upscaleImageUsages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	upscaleImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
+	upscaleImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	upscaleImage = renderTargetManager.acquire(VK_FORMAT_R16G16B16A16_SFLOAT, upscaleImageUsages, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+	sharpenImage = renderTargetManager.acquire(VK_FORMAT_R16G16B16A16_SFLOAT, upscaleImageUsages, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+}
+
+void Engine::retireRenderTargets(uint64_t retireValue)
+{
+	std::array<AllocatedImage, 7> images = { drawImage, depthImage, visibilityImage, depthPyramid, backgroundImage, upscaleImage, sharpenImage };
+	std::array<VkDescriptorSet, 5> descriptorSets = { backgroundImageDescriptors, easuDescriptors, rcasDescriptors, visibilityDescriptors, depthPyramidDescriptors };
+
+	// Every image is written from scratch before it's read, so they can be handed out again as they are. The views of the
+	// pyramid levels aren't part of the pool, the next generation makes its own.
+	graphicsDeletionQueue.pushFunction(retireValue, [this, images, descriptorSets, mipViews = depthPyramidMipViews]()
+	{
+		for (const AllocatedImage& image : images)
+		{
+			renderTargetManager.release(image);
+		}
+
+		for (VkImageView imageView : mipViews)
+		{
+			vkDestroyImageView(device, imageView, nullptr);
+		}
+
+		for (VkDescriptorSet descriptorSet : descriptorSets)
+		{
+			renderTargetDescriptorAllocator.free(device, descriptorSet);
+		}
+	});
+}
+
+void Engine::updateRenderTargetDescriptors()
+{
+	// Sets in use by the frames in flight can't be updated, so each generation of render targets gets its own.
+	backgroundImageDescriptors = renderTargetDescriptorAllocator.allocate(device, drawImageDescriptorLayout);
+	easuDescriptors = renderTargetDescriptorAllocator.allocate(device, upscaleDescriptorLayout);
+	rcasDescriptors = renderTargetDescriptorAllocator.allocate(device, upscaleDescriptorLayout);
+	visibilityDescriptors = renderTargetDescriptorAllocator.allocate(device, visibilityDescriptorLayout);
+	depthPyramidDescriptors = renderTargetDescriptorAllocator.allocate(device, downsampleDescriptorLayout);
+
+	VkDescriptorImageInfo backgroundImageDescriptorImageInfo{};
+
+	backgroundImageDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	backgroundImageDescriptorImageInfo.imageView = backgroundImage.imageView;
+
+	VkWriteDescriptorSet backgroundImageWriteDescriptorSet{};
+
+	backgroundImageWriteDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	backgroundImageWriteDescriptorSet.pNext = nullptr;
+	backgroundImageWriteDescriptorSet.dstBinding = 0;
+	backgroundImageWriteDescriptorSet.dstSet = backgroundImageDescriptors;
+	backgroundImageWriteDescriptorSet.descriptorCount = 1;
+	backgroundImageWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	backgroundImageWriteDescriptorSet.pImageInfo = &backgroundImageDescriptorImageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &backgroundImageWriteDescriptorSet, 0, nullptr);
+
+	// EASU samples the draw image, RCAS samples the EASU output.
+	VkDescriptorImageInfo descriptorImageInfos[4]{};
+
+	descriptorImageInfos[0].sampler = linearSampler;
+	descriptorImageInfos[0].imageView = drawImage.imageView;
+	descriptorImageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	descriptorImageInfos[1].imageView = upscaleImage.imageView;
+	descriptorImageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	descriptorImageInfos[2].sampler = linearSampler;
+	descriptorImageInfos[2].imageView = upscaleImage.imageView;
+	descriptorImageInfos[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	descriptorImageInfos[3].imageView = sharpenImage.imageView;
+	descriptorImageInfos[3].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet writeDescriptorSets[4]{};
+
+	for (int i = 0; i < 4; i++)
+	{
+		writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writeDescriptorSets[i].pNext = nullptr;
+		writeDescriptorSets[i].dstSet = i < 2 ? easuDescriptors : rcasDescriptors;
+		writeDescriptorSets[i].dstBinding = i % 2;
+		writeDescriptorSets[i].descriptorCount = 1;
+		writeDescriptorSets[i].descriptorType = i % 2 == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writeDescriptorSets[i].pImageInfo = &descriptorImageInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, 4, writeDescriptorSets, 0, nullptr);
+
+	// The visibility buffer resolve reads the IDs and writes the draw image, both in general layout.
+	VkDescriptorImageInfo visibilityDescriptorImageInfos[2]{};
+
+	visibilityDescriptorImageInfos[0].imageView = visibilityImage.imageView;
+	visibilityDescriptorImageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	visibilityDescriptorImageInfos[1].imageView = drawImage.imageView;
+	visibilityDescriptorImageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet visibilityWriteDescriptorSets[2]{};
+
+	for (int i = 0; i < 2; i++)
+	{
+		visibilityWriteDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		visibilityWriteDescriptorSets[i].pNext = nullptr;
+		visibilityWriteDescriptorSets[i].dstSet = visibilityDescriptors;
+		visibilityWriteDescriptorSets[i].dstBinding = i;
+		visibilityWriteDescriptorSets[i].descriptorCount = 1;
+		visibilityWriteDescriptorSets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		visibilityWriteDescriptorSets[i].pImageInfo = &visibilityDescriptorImageInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, 2, visibilityWriteDescriptorSets, 0, nullptr);
+
+	// The depth pyramid reads the depth image, and writes its levels in general layout. Every element of the array has to
+	// be valid, the ones past the last level repeat it and are never written.
+	VkDescriptorImageInfo depthDescriptorImageInfo{};
+
+	depthDescriptorImageInfo.sampler = linearSampler;
+	depthDescriptorImageInfo.imageView = depthImage.imageView;
+	depthDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	std::array<VkDescriptorImageInfo, DOWNSAMPLE_MAX_MIPS> mipDescriptorImageInfos{};
+
+	for (uint32_t mip = 0; mip < DOWNSAMPLE_MAX_MIPS; mip++)
+	{
+		mipDescriptorImageInfos[mip].imageView = depthPyramidMipViews[std::min(mip, depthPyramid.mipLevels - 1)];
+		mipDescriptorImageInfos[mip].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+
+	VkWriteDescriptorSet depthPyramidWriteDescriptorSets[2]{};
+
+	for (int i = 0; i < 2; i++)
+	{
+		depthPyramidWriteDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		depthPyramidWriteDescriptorSets[i].pNext = nullptr;
+		depthPyramidWriteDescriptorSets[i].dstSet = depthPyramidDescriptors;
+		depthPyramidWriteDescriptorSets[i].dstBinding = i;
+	}
+
+	depthPyramidWriteDescriptorSets[0].descriptorCount = 1;
+	depthPyramidWriteDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	depthPyramidWriteDescriptorSets[0].pImageInfo = &depthDescriptorImageInfo;
+
+	depthPyramidWriteDescriptorSets[1].descriptorCount = DOWNSAMPLE_MAX_MIPS;
+	depthPyramidWriteDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	depthPyramidWriteDescriptorSets[1].pImageInfo = mipDescriptorImageInfos.data();
+
+	vkUpdateDescriptorSets(device, 2, depthPyramidWriteDescriptorSets, 0, nullptr);
+}
+
+AllocatedBuffer Engine::createBuffer(size_t allocationSize, VkBufferUsageFlags bufferUsageFlags, MemoryCategory category, VmaAllocationCreateFlags allocationFlags, std::span<const uint32_t> queueFamilies)
 {
 	VkBufferCreateInfo bufferCreateInfo{};
-	VmaAllocationCreateInfo bufferAllocationCreateInfo{};
+	VmaAllocationCreateInfo bufferAllocationCreateInfo = allocationCreateInfo(category, allocationFlags);
 
 	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferCreateInfo.pNext = nullptr;
 	bufferCreateInfo.size = allocationSize;
 	bufferCreateInfo.usage = bufferUsageFlags;
 
-	bufferAllocationCreateInfo.usage = memoryUsage;
-	bufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	if (queueFamilies.size() > 1)
+	{
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+		bufferCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
 
 	AllocatedBuffer buffer;
 
 	VK_CHECK(vmaCreateBuffer(allocator, &bufferCreateInfo, &bufferAllocationCreateInfo, &buffer.buffer, &buffer.allocation, &buffer.allocationInfo));
 
+	memoryManager.track(buffer.allocation, category);
+
 	return buffer;
 }
 
 void Engine::destroyBuffer(const AllocatedBuffer& buffer)
 {
+	memoryManager.untrack(buffer.allocation);
+
 	vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
 }
+
+VkDeviceAddress Engine::getBufferAddress(const AllocatedBuffer& buffer)
+{
+	VkBufferDeviceAddressInfo deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+
+	deviceAddressInfo.buffer = buffer.buffer;
+
+	return vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+}
+
+void Engine::createImage(AllocatedImage& image, const VkImageCreateInfo& imageCreateInfo, MemoryCategory category)
+{
+	VmaAllocationCreateInfo imageAllocationCreateInfo = allocationCreateInfo(category);
+
+	VK_CHECK(vmaCreateImage(allocator, &imageCreateInfo, &imageAllocationCreateInfo, &image.image, &image.allocation, nullptr));
+
+	memoryManager.track(image.allocation, category);
+}
+
+void Engine::destroyImage(const AllocatedImage& image)
+{
+	memoryManager.untrack(image.allocation);
+
+	vmaDestroyImage(allocator, image.image, image.allocation);
+}
+
+void Engine::drawMemoryDashboard()
+{
+	if (ImGui::Begin("Memory"))
+	{
+		ImGui::Text("Memory Budget: %s", memoryBudgetSupported ? "VK_EXT_memory_budget" : "estimated");
+
+		std::vector<MemoryHeapStats> heapStats = memoryManager.getHeapStats();
+
+		for (size_t i = 0; i < heapStats.size(); i++)
+		{
+			const MemoryHeapStats& heap = heapStats[i];
+			std::string overlay = fmt::format("{:.1f} / {:.1f} MB", heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0));
+
+			ImGui::Text("Heap %zu (%s)", i, heap.deviceLocal ? "device local" : "host");
+			ImGui::ProgressBar(heap.budget > 0 ? (float)((double)heap.usage / heap.budget) : 0.0f, ImVec2(-1.0f, 0.0f), overlay.c_str());
+		}
+
+		ImGui::Separator();
+
+		for (uint32_t i = 0; i < (uint32_t)MemoryCategory::Count; i++)
+		{
+			const MemoryCategoryStats& stats = memoryManager.getCategoryStats((MemoryCategory)i);
+
+			ImGui::Text("%s: %.2f MB in %u allocations", memoryCategoryName((MemoryCategory)i), stats.bytes / (1024.0 * 1024.0), stats.allocations);
+		}
+
+		ImGui::Separator();
+
+		ImGui::Text("Geometry Arena: %u / %u vertices, %u / %u indices", geometryArena.vertexAllocator.getUsedSize(), geometryArena.vertexAllocator.getCapacity(),
+			geometryArena.indexAllocator.getUsedSize(), geometryArena.indexAllocator.getCapacity());
+		ImGui::Text("Largest Free Range: %u vertices, %u indices", geometryArena.vertexAllocator.getLargestFreeRange(), geometryArena.indexAllocator.getLargestFreeRange());
+		ImGui::Text("Compacted Meshes: %u", geometryArena.compactedMeshes);
+		ImGui::Text("Render Targets: %u created, %u reused", renderTargetManager.createdImages, renderTargetManager.reusedImages);
+
+		ImGui::Separator();
+
+		ImGui::BeginDisabled(memoryManager.isDefragmenting());
+
+		if (ImGui::Button("Defragment"))
+		{
+			memoryManager.startDefragmentation(defragmentationBytesPerFrame);
+		}
+
+		ImGui::EndDisabled();
+
+		ImGui::Text("Defragmentation: %s, %u allocations (%.2f MB) moved", memoryManager.isDefragmenting() ? "running" : "idle",
+			memoryManager.defragmentedAllocations, memoryManager.defragmentedBytes / (1024.0 * 1024.0));
+	}
+
+	ImGui::End();
+}
@@ -18,33 +18,99 @@
 #include <glm/gtx/transform.hpp>
 
 #include <array>
+#include <string>
+#include <memory>
+#include <optional>
 #include <chrono>
+#include <algorithm>
 #include <thread>
+#include <random>
 #include <cassert>
+#include <cstring>
 
 #include "utils.h"
 #include "structures.h"
 #include "loader.h"
-
-constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+#include "scaling.h"
+#include "shaders.h"
+#include "pipelines.h"
+#include "allocations.h"
+#include "geometry.h"
+#include "streaming.h"
+#include "input.h"
+#include "culling.h"
+#include "capture.h"
+#include "targets.h"
+#include "lighting.h"
+#include "shadows.h"
+#include "prepass.h"
+#include "downsample.h"
+#include "animation.h"
+#include "particles.h"
+
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+// Capacity of the geometry arena, in vertices and in indices.
+constexpr uint32_t GEOMETRY_ARENA_VERTEX_CAPACITY = 1 << 20;
+constexpr uint32_t GEOMETRY_ARENA_INDEX_CAPACITY = 1 << 22;
+
+// Reversed-Z perspective of the camera, the near plane maps to a depth of one.
+constexpr float CAMERA_FIELD_OF_VIEW = 70.0f;
+constexpr float CAMERA_NEAR_PLANE = 0.1f;
+constexpr float CAMERA_FAR_PLANE = 10000.0f;
+
+constexpr const char* WORLD_MANIFEST_PATH = "assets/world/manifest.txt";
+constexpr const char* INPUT_RECORDING_PATH = "input.rec";
+constexpr const char* FRAME_CAPTURE_PATH = "frame.cap";
+
+// How long the low-latency mode waits on a present before giving up (in nanoseconds).
+constexpr uint64_t PRESENT_WAIT_TIMEOUT = 100'000'000;
 
 struct Frame
 {
 	VkCommandPool commandPool;
 	VkCommandBuffer mainCommandBuffer;
+	VkCommandBuffer presentCommandBuffer; // Finishes the frame when the post effects or the depth pyramid run on the compute queue.
+
+	VkCommandPool computeCommandPool;
+	VkCommandBuffer backgroundCommandBuffer;
+	VkCommandBuffer postEffectsCommandBuffer;
+	VkCommandBuffer depthPyramidCommandBuffer;
+
+	// Compute timeline values signaled by this frame's compute submissions.
+	uint64_t backgroundTimelineValue = 0;
+	uint64_t postEffectsTimelineValue = 0;
+	uint64_t depthPyramidTimelineValue = 0;
+
+	// Camera and lights of the frame, written by the CPU while recording it.
+	AllocatedBuffer lightingBuffer;
+	VkDeviceAddress lightingBufferAddress = 0;
+
+	// Draws of the visibility buffer, written by the CPU while recording them and read by the resolve.
+	AllocatedBuffer visibilityDrawBuffer;
+	VkDeviceAddress visibilityDrawBufferAddress = 0;
+
+	// Joint palettes of the animated instances, sampled by the CPU while recording the frame and read by the skinning pass.
+	AllocatedBuffer jointPaletteBuffer;
+	VkDeviceAddress jointPaletteBufferAddress = 0;
 
-	VkFence renderFence;
+	// Graphics timeline value signaled by the last submission of this frame, the slot is free again once it's reached.
+	uint64_t timelineValue = 0;
+
+	// Binary semaphores, only used for the swapchain acquire and present.
 	VkSemaphore renderSemaphore, swapchainSemaphore;
 
-	DeletionQueue deletionQueue;
-};
+	// Time at which the inputs used to record this frame were sampled.
+	double inputTime = 0.0;
 
-struct ComputePushConstants
-{
-	glm::vec4 data1;
-	glm::vec4 data2;
-	glm::vec4 data3;
-	glm::vec4 data4;
+	// GPU timestamps written at the beginning and at the end of the frame.
+	VkQueryPool timestampQueryPool;
+	bool timestampsWritten = false;
+	uint32_t frameNumber = 0; // The frameCount it was recorded at.
+
+	// Samples passing the depth test in the pass that writes the depth, and the pixels it covered (zero when unmeasured).
+	VkQueryPool occlusionQueryPool = VK_NULL_HANDLE;
+	uint64_t overdrawPixelCount = 0;
 };
 
 struct ComputeEffect
@@ -55,6 +121,115 @@ struct ComputeEffect
 	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
 
 	ComputePushConstants pushConstants;
+
+	// Static effects only depend on their push constants and on the extent, so their output is kept and dispatched
+	// again only when one of those changes. Animated ones are dispatched again every updateInterval frames.
+	bool animated = false;
+	uint32_t updateInterval = 1;
+};
+
+// What the cached background was dispatched with.
+struct BackgroundState
+{
+	int effect = -1;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	ComputePushConstants pushConstants{};
+	VkImage image = VK_NULL_HANDLE;
+	VkExtent2D extent{};
+	uint32_t frame = 0;
+};
+
+struct UpscalePushConstants
+{
+	glm::vec4 inputSize;  // Input extent (xy) and input image size (zw).
+	glm::vec4 outputSize; // Output extent (xy) and sharpness (z).
+};
+
+// Startup options, set before initialize. The defaults are the interactive viewer.
+struct EngineSettings
+{
+	std::string scenePath = "assets/basicmesh.glb";
+	std::string worldManifestPath = WORLD_MANIFEST_PATH;
+
+	// When set, the frame of this capture is rendered again and again instead of the scene.
+	std::string frameCapturePath;
+
+	// Index of the scene mesh to draw, or -1 to draw all of them.
+	int sceneMesh = 2;
+
+	// When set, a crowd of this skinned and animated glTF model is spawned around the origin.
+	std::string animatedModelPath;
+	uint32_t crowdSize = 100;
+
+	bool visibleWindow = true;
+	bool vsync = true;
+	bool showInterface = true;
+};
+
+// Counters of the last recorded frame.
+struct FrameStats
+{
+	uint32_t drawCount = 0;
+	uint32_t culledCount = 0;
+	uint64_t triangleCount = 0;
+
+	uint32_t shadowCascadeRenders = 0;
+	uint32_t shadowDrawCount = 0;
+
+	uint32_t visibilityDrawCount = 0;
+	bool visibilityDrawOverflow = false; // More draws than the visibility buffer can tell apart, drawn forward instead.
+
+	uint32_t skinnedVertexCount = 0;
+};
+
+// Bind pose of a skinned mesh, kept to upload a copy of it into the arena for every instance of the crowd.
+struct SkinnedMesh
+{
+	MeshData meshData;
+
+	AllocatedBuffer sourceBuffer; // The bind pose as GPUSkinnedVertex, read by the skinning pass.
+	VkDeviceAddress sourceBufferAddress = 0;
+
+	uint32_t skeleton = 0;
+};
+
+// A skinned mesh of an instance of the crowd. The mesh is the range of the arena the skinning pass writes it into.
+struct SkinnedInstance
+{
+	std::shared_ptr<MeshAsset> mesh;
+	uint32_t skinnedMesh;
+	uint32_t animatedInstance;
+};
+
+// A visible draw of the geometry pass, recorded again by each of its passes.
+struct GeometryDraw
+{
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+};
+
+// What the static shadow casters are made of. The cached cascades are rendered again when it changes.
+struct StaticCasterState
+{
+	int sceneMesh = 0;
+	size_t sceneMeshCount = 0;
+	uint64_t residencyVersion = 0;
+
+	bool operator==(const StaticCasterState&) const = default;
+};
+
+// A shadow cascade of the frame, and what its part of the static atlas was last rendered with.
+struct ShadowCascade
+{
+	glm::mat4 viewProjection{ 1.0f };
+	float splitDepth = 0.0f;
+	float texelSize = 0.0f;
+
+	bool cached = false;
+	glm::mat4 cachedViewProjection{ 1.0f };
+	uint64_t cachedStaticCasterVersion = 0;
+	VkPipeline cachedPipeline = VK_NULL_HANDLE;
 };
 
 class Engine
@@ -62,6 +237,8 @@ class Engine
 public:
 	Engine();
 
+	EngineSettings settings;
+
 	bool isInitialized = false;
 	bool stopRendering = false;
 	bool resizeRequested = false;
@@ -72,6 +249,46 @@ public:
 
 	uint32_t frameCount = 0;
 
+	// Frame pacing. The number of frames in flight can be changed at runtime, between 1 and MAX_FRAMES_IN_FLIGHT.
+	uint32_t framesInFlight = 2;
+	uint32_t requestedFramesInFlight = 2;
+	bool frameWaited = false;
+
+	// Low-latency mode waits for the GPU (and for the display, when VK_KHR_present_wait is available) before sampling inputs.
+	bool lowLatencyMode = false;
+	bool presentWaitSupported = false;
+	uint64_t presentId = 0;
+	uint64_t lastPresentedId = 0;
+	double inputTime = 0.0;
+	double lastPresentedInputTime = 0.0;
+	float inputLatency = 0.0f;
+	bool inputLatencyIncludesPresent = false;
+
+	PFN_vkWaitForPresentKHR vkWaitForPresent = nullptr;
+
+	// Graphics pipelines are linked from precompiled parts when VK_EXT_graphics_pipeline_library is available.
+	bool graphicsPipelineLibrarySupported = false;
+
+	// Visibility buffer rendering, in place of the forward mesh pipeline. The geometry pass only writes the draw and the
+	// triangle seen by each pixel, and a compute pass shades every pixel once from them. Reading gl_PrimitiveID from the
+	// fragment shader requires the geometry shader feature.
+	bool visibilityBufferSupported = false;
+	bool useVisibilityBuffer = false;
+
+	// Optional depth pre-pass, after which the main pass only shades the fragments whose depth is EQUAL to the final one.
+	// The automatic mode follows the overdraw measured with precise occlusion queries.
+	DepthPrepassMode depthPrepassMode = DepthPrepassMode::Automatic;
+	DepthPrepassController depthPrepassController;
+	bool depthPrepassActive = false;
+	bool overdrawQuerySupported = false;
+	float overdraw = 0.0f;
+	std::vector<GeometryDraw> geometryDraws;
+
+	// Hierarchical depth: the depth image reduced to the farthest depth of each texel footprint, level by level, with the
+	// single pass downsampler. Writing storage images declared without a format requires its own feature.
+	bool downsampleSupported = false;
+	bool buildDepthPyramid = false;
+
 	GLFWwindow* window = nullptr;
 	VkExtent2D windowExtent{ 1600, 900 };
 
@@ -83,8 +300,44 @@ public:
 	VkQueue graphicsQueue = VK_NULL_HANDLE;
 	uint32_t graphicsQueueFamily;
 
+	// Async compute. When the device has no separate compute family, the compute queue is the graphics queue.
+	VkQueue computeQueue = VK_NULL_HANDLE;
+	uint32_t computeQueueFamily;
+	bool asyncComputeSupported = false;
+	bool useAsyncCompute = true;
+
+	// Uploads. When the device has no separate transfer family, the transfer queue is the graphics queue.
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	uint32_t transferQueueFamily;
+	bool asyncTransferSupported = false;
+
+	// Each submission signals the next value of its queue's timeline. A frame submits to the graphics queue at most twice,
+	// and its last submission signals graphicsTimelineValue + 2, reserved before recording starts (see getFrameTimelineValue).
+	VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+	VkSemaphore computeTimeline = VK_NULL_HANDLE;
+	VkSemaphore transferTimeline = VK_NULL_HANDLE;
+	uint64_t graphicsTimelineValue = 0;
+	uint64_t computeTimelineValue = 0;
+	uint64_t transferTimelineValue = 0;
+
+	// Graphics timeline value after which the draw image is free to be overwritten.
+	uint64_t drawImageReleaseValue = 0;
+
+	// Graphics timeline value of the last frame that moved the geometry arena buffers. Uploads wait for it, so the
+	// defragmentation copy never overwrites them.
+	uint64_t geometryRelocationValue = 0;
+
 	VmaAllocator allocator;
 
+	// Memory budget tracking and incremental defragmentation of the mesh buffers.
+	MemoryManager memoryManager;
+	bool memoryBudgetSupported = false;
+	VkDeviceSize defragmentationBytesPerFrame = 16 * 1024 * 1024;
+
+	// Shared vertex and index buffers of every mesh. Compaction moves at most this many bytes per frame.
+	GeometryArena geometryArena;
+	VkDeviceSize compactionBytesPerFrame = 4 * 1024 * 1024;
+
 	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	VkFormat swapchainImageFormat;
 	std::vector<VkImage> swapchainImages;
@@ -94,50 +347,327 @@ public:
 	VkExtent2D drawExtent;
 	float renderScale = 1.0f;
 
+	// Dynamic resolution, driven by the GPU frame time measured with timestamps.
+	bool dynamicResolution = false;
+	ResolutionController resolutionController;
+	float gpuFrameTime = 0.0f;
+	uint32_t gpuFrameTimeFrame = UINT32_MAX; // The frameCount gpuFrameTime was measured on, frames in flight ago.
+	FrameStats frameStats;
+	double timestampPeriod = 1.0;
+
+	// The 2D compute kernels take their workgroup size from specialization constants 0 and 1, picked from the subgroup size.
+	VkPhysicalDeviceSubgroupProperties subgroupProperties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+	VkExtent2D computeWorkgroupSize = { 16, 16 };
+
 	AllocatedImage drawImage;
 	AllocatedImage depthImage;
 
-	Frame frames[FRAMES_IN_FLIGHT];
+	// Draw and triangle IDs of the visibility buffer, VISIBILITY_EMPTY where nothing was drawn.
+	AllocatedImage visibilityImage;
+
+	// Allocated for the whole target extent, but only the levels of getDepthPyramidExtent(drawExtent) are written.
+	// The downsampler writes each level through a view of its own.
+	AllocatedImage depthPyramid;
+	std::array<VkImageView, DOWNSAMPLE_MAX_MIPS> depthPyramidMipViews{};
+	VkExtent2D depthPyramidExtent{};
+	uint32_t depthPyramidMipCount = 0;
+
+	// Output of the background effect, copied into the draw image every frame. Lazy updates only dispatch the effect
+	// again when its output is stale.
+	AllocatedImage backgroundImage;
+	BackgroundState backgroundState;
+	bool lazyBackground = true;
+	uint32_t backgroundDispatches = 0;
+
+	// Optional EASU + RCAS upscale, replacing the bilinear blit into the swapchain.
+	bool useUpscalePass = false;
+	float upscaleSharpness = 0.2f;
+	VkExtent2D upscaleExtent;
+
+	AllocatedImage upscaleImage;
+	AllocatedImage sharpenImage;
+
+	// Owns the images above. They cover the swapchain extent rounded up to RENDER_TARGET_EXTENT_GRANULARITY, and are
+	// replaced along with the swapchain when a resize crosses a step.
+	RenderTargetManager renderTargetManager;
+
+	VkSampler linearSampler = VK_NULL_HANDLE;
+
+	Frame frames[MAX_FRAMES_IN_FLIGHT];
 
 	DescriptorAllocator globalDescriptorAllocator;
 
-	VkDescriptorSet drawImageDescriptors = VK_NULL_HANDLE;
+	// Descriptor sets of the render targets, allocated again whenever the targets are replaced.
+	DescriptorAllocator renderTargetDescriptorAllocator;
+
+	VkDescriptorSet backgroundImageDescriptors = VK_NULL_HANDLE;
 	VkDescriptorSetLayout drawImageDescriptorLayout = VK_NULL_HANDLE;
 
+	VkDescriptorSet easuDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSet rcasDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSetLayout upscaleDescriptorLayout = VK_NULL_HANDLE;
+
+	VkDescriptorSet visibilityDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSetLayout visibilityDescriptorLayout = VK_NULL_HANDLE;
+
+	VkDescriptorSet depthPyramidDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSetLayout downsampleDescriptorLayout = VK_NULL_HANDLE;
+
+	LayoutCache layoutCache;
+
 	VkPipelineLayout defaultPipelineLayout = VK_NULL_HANDLE;
 
 	std::vector<ComputeEffect> backgroundEffects;
 	int currentBackgroundEffect = 0;
 
-	VkPipelineLayout meshPipelineLayout;
-	VkPipeline meshPipeline;
+	PipelineLibrary pipelineLibrary;
 
-	// Immediate submit structures.
-	VkFence immFence;
-	VkCommandBuffer immCommandBuffer;
-	VkCommandPool immCommandPool;
+	VkPipelineLayout meshPipelineLayout;
+	VkPipeline meshPipeline = VK_NULL_HANDLE;
+	PipelineHandle meshPipelineHandle = INVALID_PIPELINE_HANDLE;
+
+	VkPipelineLayout visibilityPipelineLayout;
+	VkPipeline visibilityPipeline = VK_NULL_HANDLE;
+	PipelineHandle visibilityPipelineHandle = INVALID_PIPELINE_HANDLE;
+
+	VkPipelineLayout visibilityResolvePipelineLayout;
+	VkPipeline visibilityResolvePipeline = VK_NULL_HANDLE;
+
+	VkPipelineLayout upscalePipelineLayout;
+	VkPipeline easuPipeline;
+	VkPipeline rcasPipeline;
+
+	// Clustered forward lighting. A compute pass bins the lights into the froxels of the camera every frame, and the mesh
+	// fragment shader only loops over the lights of its cluster.
+	std::vector<PointLight> pointLights;
+	int lightCount = 256;
+	bool animateLights = true;
+	float lightTime = 0.0f;
+	glm::vec3 ambientLight{ 0.2f };
+
+	AllocatedBuffer clusterBuffer;
+	VkDeviceAddress clusterBufferAddress = 0;
+
+	VkPipelineLayout clusterPipelineLayout;
+	VkPipeline clusterPipeline;
+
+	// Animated crowd. The joint palettes of the instances are sampled on worker threads into the palette buffer of the
+	// frame, then a compute pass skins every instance into its own range of the geometry arena, once per frame. The
+	// depth, shadow and main passes draw the result as dynamic meshes, without skinning it again.
+	AnimationSampler animationSampler;
+	std::vector<Skeleton> skeletons;
+	std::vector<SkinnedMesh> skinnedMeshes;
+	std::vector<AnimatedInstance> animatedInstances;
+	std::vector<SkinnedInstance> skinnedInstances;
+	bool animateCrowd = true;
+	float animationSpeed = 1.0f;
+	float animationSampleTime = 0.0f;
+
+	VkPipelineLayout skinningPipelineLayout;
+	VkPipeline skinningPipeline = VK_NULL_HANDLE;
+
+	// GPU particles. They live in persistent buffers, emitted, simulated and compacted by compute passes, and drawn with
+	// an indirect draw whose instance count is written by the GPU. Two alive lists take turns: one holds the particles
+	// simulated this frame, the other receives the survivors, which are drawn this frame and simulated the next.
+	bool particlesEnabled = false;
+	bool sortParticles = false; // Alpha blended back to front, instead of additive in any order.
+	ParticleEmitter particleEmitter;
+	glm::vec3 particleGravity{ 0.0f, -9.8f, 0.0f };
+	float particleDrag = 0.2f;
+	float particleSize = 0.05f;
+	float particleEmitAccumulator = 0.0f;
+	uint32_t particleAliveList = 0;
+
+	AllocatedBuffer particleBuffer;
+	AllocatedBuffer particleCounterBuffer;
+	AllocatedBuffer particleDeadList;
+	AllocatedBuffer particleAliveLists[2];
+	AllocatedBuffer particleSortBuffer;
+	VkDeviceAddress particleBufferAddress = 0;
+	VkDeviceAddress particleCounterBufferAddress = 0;
+	VkDeviceAddress particleDeadListAddress = 0;
+	VkDeviceAddress particleAliveListAddresses[2] = {};
+	VkDeviceAddress particleSortBufferAddress = 0;
+
+	VkPipelineLayout particleEmitPipelineLayout;
+	VkPipeline particleEmitPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout particleSimulatePipelineLayout;
+	VkPipeline particleSimulatePipeline = VK_NULL_HANDLE;
+	VkPipelineLayout particleCompactPipelineLayout;
+	VkPipeline particleCompactPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout particleSortPipelineLayout;
+	VkPipeline particleSortPipeline = VK_NULL_HANDLE;
+
+	VkPipelineLayout particlePipelineLayout;
+	VkPipeline particleAdditivePipeline = VK_NULL_HANDLE;
+	PipelineHandle particleAdditivePipelineHandle = INVALID_PIPELINE_HANDLE;
+	VkPipeline particleAlphaPipeline = VK_NULL_HANDLE;
+	PipelineHandle particleAlphaPipelineHandle = INVALID_PIPELINE_HANDLE;
+
+	// Texels left by the workgroups of a downsample, and the counter finding the last one. Dispatches are serialized
+	// with a barrier, so they all share it.
+	AllocatedBuffer downsampleBuffer;
+	VkDeviceAddress downsampleBufferAddress = 0;
+	bool downsampleBufferCleared = false;
+	uint32_t downsampleBufferQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+
+	VkPipelineLayout downsamplePipelineLayout;
+	VkPipeline downsamplePipeline = VK_NULL_HANDLE;
+
+	// Cascaded shadows of the sun. Static casters are rendered into a cached atlas, and a cascade of it is only rendered
+	// again when its fitted matrix, the sun or the static casters change. Dynamic casters are rendered into a second atlas
+	// every frame, and the lookups take the darkest of the two.
+	float sunAzimuth = 30.0f;
+	float sunElevation = 50.0f;
+	glm::vec3 sunColor{ 1.0f, 0.95f, 0.85f };
+	float sunIntensity = 1.0f;
+
+	float shadowDistance = 150.0f;
+	float shadowCascadeSplitLambda = 0.75f;
+	float shadowCasterDistance = 200.0f;
+	float shadowNormalOffset = 1.5f;
+	bool cacheStaticShadows = true;
+
+	std::array<ShadowCascade, SHADOW_CASCADE_COUNT> shadowCascades;
+	StaticCasterState staticCasterState;
+	uint64_t staticCasterVersion = 0;
+	uint32_t staticShadowCascadeRenders = 0;
+
+	AllocatedImage staticShadowAtlas;
+	AllocatedImage dynamicShadowAtlas;
+	bool dynamicShadowAtlasCleared = false;
+
+	VkSampler shadowSampler = VK_NULL_HANDLE;
+	VkDescriptorSet shadowDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSetLayout shadowDescriptorLayout = VK_NULL_HANDLE;
+
+	// Same atlases, for the visibility buffer resolve. The stages are part of the layout, so it gets a set of its own.
+	VkDescriptorSet computeShadowDescriptors = VK_NULL_HANDLE;
+	VkDescriptorSetLayout computeShadowDescriptorLayout = VK_NULL_HANDLE;
+
+	VkPipelineLayout shadowPipelineLayout;
+	VkPipeline shadowPipeline = VK_NULL_HANDLE;
+	PipelineHandle shadowPipelineHandle = INVALID_PIPELINE_HANDLE;
+
+	// Position only, through the shadow vertex shader and its layout.
+	VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+	PipelineHandle depthPrepassPipelineHandle = INVALID_PIPELINE_HANDLE;
+
+	// Upload command buffers, recycled once the transfer timeline reaches the value of their submission.
+	VkCommandPool transferCommandPool;
+	std::vector<VkCommandBuffer> freeTransferCommandBuffers;
 
 	DeletionQueue mainDeletionQueue;
 
+	// Resources retired while they may still be in use, released once the GPU reaches the value they're keyed on.
+	TimelineDeletionQueue graphicsDeletionQueue;
+	TimelineDeletionQueue transferDeletionQueue;
+
+	ShaderManager shaderManager;
+
 	std::vector<std::shared_ptr<MeshAsset>> testMeshes;
 
+	// Meshes that move, drawn into the dynamic shadow atlas every frame instead of being cached with the scene.
+	std::vector<std::shared_ptr<MeshAsset>> dynamicMeshes;
+
+	// World cells listed by the manifest are streamed around the camera, when the manifest exists.
+	WorldStreamer worldStreamer;
+
+	// Camera of the frame, interpolated from the input system's fixed timestep simulation.
+	InputSystem inputSystem;
+	bool replayLockstep = true;
+
+	// A requested capture records the draws of the next frame, and is written to disk once that frame is complete.
+	bool frameCaptureRequested = false;
+	std::unique_ptr<FrameCaptureBuilder> frameCaptureBuilder;
+
+	// Capture replayed in place of the scene, with its geometry uploaded into the arena.
+	std::optional<FrameCapture> replayedCapture;
+	GPUMeshBuffers replayedCaptureBuffers;
+
+	// Surfaces outside of the view frustum are skipped, from their bounding spheres.
+	bool frustumCulling = true;
+
+	glm::vec3 cameraPosition{ 0.0f, 0.0f, 5.0f };
+	glm::vec3 cameraForward{ 0.0f, 0.0f, -1.0f };
+
+	// Matrices of the frame being recorded, the ones of the replayed capture when there is one.
+	glm::mat4 viewMatrix{ 1.0f };
+	glm::mat4 projectionMatrix{ 1.0f };
+
 	void initialize();
 	void run();
 	void cleanUp();
 
-	Frame& getCurrentFrame() { return frames[frameCount % FRAMES_IN_FLIGHT]; };
-	void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
+	// One iteration of the main loop: polls the window events, then renders and presents a frame.
+	void runFrame();
+
+	Frame& getCurrentFrame() { return frames[frameCount % framesInFlight]; };
+	void setFramesInFlight(uint32_t count);
+
+	// Graphics timeline value the frame being recorded (or the next one) signals once it's complete. Resources it may use
+	// are retired on this value.
+	uint64_t getFrameTimelineValue() const { return graphicsTimelineValue + 2; }
+
+	// Records and submits work to the transfer queue without waiting for it. Returns the transfer timeline value signaled
+	// once it's done, which the next graphics submission waits on.
+	uint64_t submitTransfer(std::function<void(VkCommandBuffer cmd)>&& function);
 
 	GPUMeshBuffers uploadMesh(std::span<Vertex> vertices, std::span<uint32_t> indices);
 
+	// Same as uploadMesh, but returns false instead of throwing when the geometry arena is full.
+	bool tryUploadMesh(std::span<Vertex> vertices, std::span<uint32_t> indices, GPUMeshBuffers& meshBuffers);
+
+	// Lets the arena compaction move the ranges of a mesh. They have to stay at the same address until they're freed.
+	void registerMeshBuffers(GPUMeshBuffers& meshBuffers);
+
+	// Releases the ranges of a mesh once the frames in flight are done with them.
+	void freeMeshBuffers(GPUMeshBuffers& meshBuffers);
+
 private:
+	void sampleInputs();
+	void waitForFrame();
+	void waitForGraphicsTimeline(uint64_t value);
+	void collectRetiredResources();
+	void recordInputLatency(double sampleTime, bool includesPresent);
+
 	void render(float deltaTime);
+	void submitBackground(float deltaTime, Frame& frame);
+	void submitPostEffects(float deltaTime, Frame& frame);
+	void submitDepthPyramid(Frame& frame, uint64_t geometryTimelineValue);
+	bool isBackgroundStale() const;
 	void renderInBackground(float deltaTime, VkCommandBuffer cmd);
+	void updateCameraMatrices();
+	void updateLighting(float deltaTime, Frame& frame);
+	void renderLightClusters(VkCommandBuffer cmd, Frame& frame);
+	void updateAnimation(float deltaTime, Frame& frame);
+	void renderSkinning(VkCommandBuffer cmd, Frame& frame);
+	void simulateParticles(float deltaTime, VkCommandBuffer cmd);
+	void renderParticles(VkCommandBuffer cmd);
+	glm::vec3 getSunDirection() const;
+	void updateShadowCascades();
+	void renderShadows(VkCommandBuffer cmd);
+	void renderShadowCascade(VkCommandBuffer cmd, const AllocatedImage& atlas, uint32_t cascadeIndex, bool staticCasters);
 	void renderGeometry(float deltaTime, VkCommandBuffer cmd);
+	void resolveVisibilityBuffer(VkCommandBuffer cmd, Frame& frame);
+	void renderDepthPyramid(VkCommandBuffer cmd, uint32_t queueFamily);
+
+	// Writes up to mipCount levels below the source bound to the descriptor set, the first one of the given extent.
+	// Returns the number of levels written.
+	uint32_t downsample(VkCommandBuffer cmd, VkDescriptorSet descriptorSet, VkExtent2D sourceExtent, VkExtent2D destinationExtent, uint32_t mipCount, DownsampleReduction reduction);
+	void renderUpscale(float deltaTime, VkCommandBuffer cmd);
 	void renderImgui(float deltaTime, VkCommandBuffer cmd, VkImageView targetImageView);
 	void processInputs(float deltaTime);
+	void buildInterface();
+	void captureFrame(VkCommandBuffer cmd);
+
+	// Calls the function on every mesh of the scene: the selected test meshes and the meshes of the resident cells.
+	void forEachSceneMesh(const std::function<void(const MeshAsset&)>& function) const;
+	void initializeReplayedCapture();
 
 	static void windowKeyCallback(GLFWwindow* window, int key, int scanCode, int action, int mods);
+	static void windowMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+	static void windowCursorPositionCallback(GLFWwindow* window, double x, double y);
 	static void windowFramebufferSizeCallback(GLFWwindow* window, int width, int height);
 
 	void initializeVulkan();
@@ -145,16 +675,61 @@ private:
 	void initializeCommandStructures();
 	void initializeSyncStructures();
 	void initializeDescriptors();
+	void initializeGeometryArena();
+	void initializeLighting();
+	void initializeShadows();
+	void initializeVisibilityBuffer();
+	void initializeDownsample();
+	void initializeAnimation();
+	void initializeParticles();
 	void initializePipelines();
 	void initializeBackgroundPipelines();
 	void initializeMeshPipeline();
+	void initializeUpscalePipelines();
+	void initializeClusterPipeline();
+	void initializeDownsamplePipeline();
+	void initializeSkinningPipeline();
+	void initializeParticlePipelines();
+	void initializeShadowPipeline();
+	void initializeVisibilityPipelines();
+	void initializeDepthPrepassPipeline();
+
+	bool loadShader(const char* filePath, VkShaderModule* outShaderModule, ShaderReflection& reflection);
+	VkPipelineLayout getReflectedPipelineLayout(const ShaderReflection& reflection, uint32_t pushConstantsSize, const char* pipelineName);
+
+	// Fetches a variant of the pipeline library the first time it's needed, blocking on its compilation unless wait is
+	// false. A variant that failed to compile is reported once and leaves the pipeline null, until a hot reload replaces
+	// it. Returns whether the pipeline can be bound.
+	bool acquirePipeline(VkPipeline& pipeline, PipelineHandle& handle, const char* pipelineName, bool wait = true);
+
+	PipelineBuilder getMeshPipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule);
+	PipelineBuilder getShadowPipelineBuilder(VkShaderModule vertexShaderModule);
+	PipelineBuilder getDepthPrepassPipelineBuilder(VkShaderModule vertexShaderModule);
+	PipelineBuilder getVisibilityPipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule);
+	PipelineBuilder getParticlePipelineBuilder(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule, bool alphaBlend);
+	VkPipeline buildComputePipeline(VkPipelineLayout pipelineLayout, VkShaderModule shaderModule);
+
+	// Workgroups covering the given extent with computeWorkgroupSize.
+	VkExtent2D getDispatchSize(VkExtent2D extent) const;
+
 	void initializeImgui();
 	void initalizeDefaultData();
 
-	void createSwapchain(uint32_t width, uint32_t height);
-	void resizeSwapchain();
+	void createSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+	bool resizeSwapchain();
 	void cleanUpSwapchain();
 
-	AllocatedBuffer createBuffer(size_t allocationSize, VkBufferUsageFlags bufferUsageFlags, VmaMemoryUsage memoryUsage);
+	void createRenderTargets(VkExtent2D extent);
+	void retireRenderTargets(uint64_t retireValue);
+	void updateRenderTargetDescriptors();
+
+	// Buffers used by several queue families are created with concurrent sharing between them.
+	AllocatedBuffer createBuffer(size_t allocationSize, VkBufferUsageFlags bufferUsageFlags, MemoryCategory category, VmaAllocationCreateFlags allocationFlags = 0, std::span<const uint32_t> queueFamilies = {});
 	void destroyBuffer(const AllocatedBuffer& buffer);
+	VkDeviceAddress getBufferAddress(const AllocatedBuffer& buffer);
+
+	void createImage(AllocatedImage& image, const VkImageCreateInfo& imageCreateInfo, MemoryCategory category);
+	void destroyImage(const AllocatedImage& image);
+
+	void drawMemoryDashboard();
 };
@@ -0,0 +1,410 @@
+#include "geometry.h"
+
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	constexpr uint32_t SECOND_LEVEL_BITS = 3;
+	constexpr uint32_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_BITS;
+
+	// Sizes below eight get a class each, above that every power of two is split in eight classes.
+	// Rounding up gives the first class whose ranges are all large enough for the size.
+	uint32_t sizeClass(uint32_t size, bool roundUp)
+	{
+		if (size < SECOND_LEVEL_COUNT)
+		{
+			return size;
+		}
+
+		uint32_t firstLevel = std::bit_width(size) - 1;
+		uint32_t shift = firstLevel - SECOND_LEVEL_BITS;
+		uint32_t secondLevel = (size >> shift) & (SECOND_LEVEL_COUNT - 1);
+		uint32_t bin = ((shift + 1) << SECOND_LEVEL_BITS) | secondLevel;
+
+		if (roundUp && (size & ((1u << shift) - 1)) != 0)
+		{
+			bin++;
+		}
+
+		return bin;
+	}
+}
+
+void OffsetAllocator::initialize(uint32_t capacity)
+{
+	this->capacity = capacity;
+
+	usedSize = 0;
+
+	nodes.clear();
+	unusedNodes.clear();
+
+	bins.fill(INVALID_OFFSET_NODE);
+	binMask.fill(0);
+
+	insertFreeNode(createNode(0, capacity));
+}
+
+OffsetAllocation OffsetAllocator::allocate(uint32_t size)
+{
+	assert(size > 0);
+
+	uint32_t bin = findBin(sizeClass(size, true));
+
+	if (bin == INVALID_OFFSET_NODE)
+	{
+		return {};
+	}
+
+	uint32_t node = bins[bin];
+
+	removeFreeNode(node);
+
+	// The rest of the range goes back to the free lists as a new node, right after this one.
+	if (nodes[node].size > size)
+	{
+		uint32_t remainder = createNode(nodes[node].offset + size, nodes[node].size - size);
+		uint32_t next = nodes[node].neighborNext;
+
+		nodes[remainder].neighborPrev = node;
+		nodes[remainder].neighborNext = next;
+
+		if (next != INVALID_OFFSET_NODE)
+		{
+			nodes[next].neighborPrev = remainder;
+		}
+
+		nodes[node].neighborNext = remainder;
+		nodes[node].size = size;
+
+		insertFreeNode(remainder);
+	}
+
+	nodes[node].used = true;
+	usedSize += size;
+
+	return { nodes[node].offset, size, node };
+}
+
+void OffsetAllocator::free(const OffsetAllocation& allocation)
+{
+	uint32_t node = allocation.node;
+
+	assert(node != INVALID_OFFSET_NODE && nodes[node].used);
+
+	nodes[node].used = false;
+	usedSize -= nodes[node].size;
+
+	uint32_t prev = nodes[node].neighborPrev;
+
+	if (prev != INVALID_OFFSET_NODE && !nodes[prev].used)
+	{
+		removeFreeNode(prev);
+
+		nodes[prev].size += nodes[node].size;
+		nodes[prev].neighborNext = nodes[node].neighborNext;
+
+		if (nodes[node].neighborNext != INVALID_OFFSET_NODE)
+		{
+			nodes[nodes[node].neighborNext].neighborPrev = prev;
+		}
+
+		unusedNodes.push_back(node);
+		node = prev;
+	}
+
+	uint32_t next = nodes[node].neighborNext;
+
+	if (next != INVALID_OFFSET_NODE && !nodes[next].used)
+	{
+		removeFreeNode(next);
+
+		nodes[node].size += nodes[next].size;
+		nodes[node].neighborNext = nodes[next].neighborNext;
+
+		if (nodes[next].neighborNext != INVALID_OFFSET_NODE)
+		{
+			nodes[nodes[next].neighborNext].neighborPrev = node;
+		}
+
+		unusedNodes.push_back(next);
+	}
+
+	insertFreeNode(node);
+}
+
+uint32_t OffsetAllocator::getLargestFreeRange() const
+{
+	uint32_t largest = 0;
+
+	// Only the highest non-empty size class can hold the largest range.
+	for (int32_t i = (int32_t)binMask.size() - 1; i >= 0; i--)
+	{
+		if (binMask[i] != 0)
+		{
+			uint32_t bin = i * 64 + (63 - std::countl_zero(binMask[i]));
+
+			for (uint32_t node = bins[bin]; node != INVALID_OFFSET_NODE; node = nodes[node].binNext)
+			{
+				largest = std::max(largest, nodes[node].size);
+			}
+
+			break;
+		}
+	}
+
+	return largest;
+}
+
+uint32_t OffsetAllocator::createNode(uint32_t offset, uint32_t size)
+{
+	uint32_t node;
+
+	if (!unusedNodes.empty())
+	{
+		node = unusedNodes.back();
+		unusedNodes.pop_back();
+	}
+	else
+	{
+		node = (uint32_t)nodes.size();
+		nodes.emplace_back();
+	}
+
+	nodes[node] = Node{ .offset = offset, .size = size };
+
+	return node;
+}
+
+void OffsetAllocator::insertFreeNode(uint32_t node)
+{
+	uint32_t bin = sizeClass(nodes[node].size, false);
+
+	nodes[node].binPrev = INVALID_OFFSET_NODE;
+	nodes[node].binNext = bins[bin];
+
+	if (bins[bin] != INVALID_OFFSET_NODE)
+	{
+		nodes[bins[bin]].binPrev = node;
+	}
+
+	bins[bin] = node;
+	binMask[bin / 64] |= 1ull << (bin % 64);
+}
+
+void OffsetAllocator::removeFreeNode(uint32_t node)
+{
+	uint32_t bin = sizeClass(nodes[node].size, false);
+
+	if (nodes[node].binPrev != INVALID_OFFSET_NODE)
+	{
+		nodes[nodes[node].binPrev].binNext = nodes[node].binNext;
+	}
+	else
+	{
+		bins[bin] = nodes[node].binNext;
+	}
+
+	if (nodes[node].binNext != INVALID_OFFSET_NODE)
+	{
+		nodes[nodes[node].binNext].binPrev = nodes[node].binPrev;
+	}
+
+	if (bins[bin] == INVALID_OFFSET_NODE)
+	{
+		binMask[bin / 64] &= ~(1ull << (bin % 64));
+	}
+}
+
+uint32_t OffsetAllocator::findBin(uint32_t firstBin) const
+{
+	for (uint32_t i = firstBin / 64; i < binMask.size(); i++)
+	{
+		uint64_t mask = binMask[i];
+
+		// Skip the classes below the first one in its own word.
+		if (i == firstBin / 64)
+		{
+			mask &= ~0ull << (firstBin % 64);
+		}
+
+		if (mask != 0)
+		{
+			return i * 64 + std::countr_zero(mask);
+		}
+	}
+
+	return INVALID_OFFSET_NODE;
+}
+
+void GeometryArena::initialize(VkDevice device, const AllocatedBuffer& vertexBuffer, uint32_t vertexCapacity, const AllocatedBuffer& indexBuffer, uint32_t indexCapacity)
+{
+	this->device = device;
+	this->vertexBuffer = vertexBuffer;
+	this->indexBuffer = indexBuffer;
+
+	vertexAllocator.initialize(vertexCapacity);
+	indexAllocator.initialize(indexCapacity);
+
+	updateBufferAddresses();
+}
+
+bool GeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount, GPUMeshBuffers& meshBuffers)
+{
+	OffsetAllocation vertices = vertexAllocator.allocate(vertexCount);
+
+	if (vertices.node == INVALID_OFFSET_NODE)
+	{
+		return false;
+	}
+
+	OffsetAllocation indices = indexAllocator.allocate(indexCount);
+
+	if (indices.node == INVALID_OFFSET_NODE)
+	{
+		vertexAllocator.free(vertices);
+
+		return false;
+	}
+
+	meshBuffers.vertices = vertices;
+	meshBuffers.indices = indices;
+
+	return true;
+}
+
+void GeometryArena::free(const GPUMeshBuffers& meshBuffers)
+{
+	vertexAllocator.free(meshBuffers.vertices);
+	indexAllocator.free(meshBuffers.indices);
+}
+
+void GeometryArena::registerMesh(GPUMeshBuffers* meshBuffers)
+{
+	meshes.insert(meshBuffers);
+}
+
+void GeometryArena::unregisterMesh(GPUMeshBuffers* meshBuffers)
+{
+	meshes.erase(meshBuffers);
+}
+
+bool GeometryArena::isFragmented() const
+{
+	// Fragmented when less than half of the free space is contiguous.
+	uint32_t freeVertices = vertexAllocator.getCapacity() - vertexAllocator.getUsedSize();
+	uint32_t freeIndices = indexAllocator.getCapacity() - indexAllocator.getUsedSize();
+
+	return vertexAllocator.getLargestFreeRange() < freeVertices / 2 || indexAllocator.getLargestFreeRange() < freeIndices / 2;
+}
+
+void GeometryArena::compact(VkCommandBuffer cmd, TimelineDeletionQueue& deletionQueue, uint64_t retireValue, VkDeviceSize maxBytes)
+{
+	// Meshes furthest from the start are moved first, that's where they leave the largest holes behind.
+	std::vector<GPUMeshBuffers*> candidates(meshes.begin(), meshes.end());
+
+	std::sort(candidates.begin(), candidates.end(), [](const GPUMeshBuffers* a, const GPUMeshBuffers* b)
+	{
+		return a->vertices.offset > b->vertices.offset;
+	});
+
+	std::vector<VkBufferCopy> vertexCopies;
+	std::vector<VkBufferCopy> indexCopies;
+	VkDeviceSize movedBytes = 0;
+
+	for (GPUMeshBuffers* mesh : candidates)
+	{
+		if (movedBytes >= maxBytes)
+		{
+			break;
+		}
+
+		bool movedVertices = moveRange(vertexAllocator, mesh->vertices, sizeof(Vertex), vertexCopies, deletionQueue, retireValue);
+		bool movedIndices = moveRange(indexAllocator, mesh->indices, sizeof(uint32_t), indexCopies, deletionQueue, retireValue);
+
+		if (movedVertices || movedIndices)
+		{
+			movedBytes += (movedVertices ? mesh->vertices.size * sizeof(Vertex) : 0) + (movedIndices ? mesh->indices.size * sizeof(uint32_t) : 0);
+			compactedMeshes++;
+		}
+	}
+
+	if (vertexCopies.empty() && indexCopies.empty())
+	{
+		return;
+	}
+
+	// The source and destination ranges never overlap, since the source is still allocated when the destination is picked.
+	if (!vertexCopies.empty())
+	{
+		vkCmdCopyBuffer(cmd, vertexBuffer.buffer, vertexBuffer.buffer, (uint32_t)vertexCopies.size(), vertexCopies.data());
+	}
+
+	if (!indexCopies.empty())
+	{
+		vkCmdCopyBuffer(cmd, indexBuffer.buffer, indexBuffer.buffer, (uint32_t)indexCopies.size(), indexCopies.data());
+	}
+
+	VkMemoryBarrier2 memoryBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+	memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+
+	VkDependencyInfo dependencyInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+
+	dependencyInfo.memoryBarrierCount = 1;
+	dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+void GeometryArena::updateBufferAddresses()
+{
+	VkBufferDeviceAddressInfo deviceAddressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = vertexBuffer.buffer };
+
+	vertexBufferAddress = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+
+	deviceAddressInfo.buffer = indexBuffer.buffer;
+
+	indexBufferAddress = vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+}
+
+bool GeometryArena::moveRange(OffsetAllocator& allocator, OffsetAllocation& range, VkDeviceSize elementSize, std::vector<VkBufferCopy>& copies, TimelineDeletionQueue& deletionQueue, uint64_t retireValue)
+{
+	OffsetAllocation destination = allocator.allocate(range.size);
+
+	if (destination.node == INVALID_OFFSET_NODE)
+	{
+		return false;
+	}
+
+	if (destination.offset >= range.offset)
+	{
+		allocator.free(destination);
+
+		return false;
+	}
+
+	copies.push_back({ range.offset * elementSize, destination.offset * elementSize, range.size * elementSize });
+
+	// Frames already in flight still read the old range.
+	deletionQueue.pushFunction(retireValue, [&allocator, source = range]()
+	{
+		allocator.free(source);
+	});
+
+	range = destination;
+
+	return true;
+}
+
+void packMeshGeometry(std::span<const Vertex> vertices, std::span<const uint32_t> indices, void* destination)
+{
+	memcpy(destination, vertices.data(), vertices.size_bytes());
+	memcpy((char*)destination + vertices.size_bytes(), indices.data(), indices.size_bytes());
+}
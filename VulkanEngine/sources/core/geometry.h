@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <vector>
+#include <unordered_set>
+
+#include "structures.h"
+
+// Two-level segregated fit allocator of ranges inside a fixed capacity. Free ranges are kept in size classes
+// (a power of two split in eight), so both allocation and release are constant time, and freed ranges are merged
+// with their free neighbours.
+class OffsetAllocator
+{
+public:
+	void initialize(uint32_t capacity);
+
+	// Returns an allocation without a node when no free range is large enough.
+	OffsetAllocation allocate(uint32_t size);
+	void free(const OffsetAllocation& allocation);
+
+	uint32_t getCapacity() const { return capacity; }
+	uint32_t getUsedSize() const { return usedSize; }
+	uint32_t getLargestFreeRange() const;
+
+private:
+	static constexpr uint32_t BIN_COUNT = 256;
+
+	struct Node
+	{
+		uint32_t offset;
+		uint32_t size;
+
+		// Free list of the node's size class.
+		uint32_t binPrev = INVALID_OFFSET_NODE;
+		uint32_t binNext = INVALID_OFFSET_NODE;
+
+		// Adjacent ranges, used or not, ordered by offset.
+		uint32_t neighborPrev = INVALID_OFFSET_NODE;
+		uint32_t neighborNext = INVALID_OFFSET_NODE;
+
+		bool used = false;
+	};
+
+	uint32_t capacity = 0;
+	uint32_t usedSize = 0;
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> unusedNodes;
+
+	std::array<uint32_t, BIN_COUNT> bins;
+	std::array<uint64_t, BIN_COUNT / 64> binMask;
+
+	uint32_t createNode(uint32_t offset, uint32_t size);
+	void insertFreeNode(uint32_t node);
+	void removeFreeNode(uint32_t node);
+	uint32_t findBin(uint32_t firstBin) const;
+};
+
+// Every mesh lives in one of two large device-local buffers, one of vertices and one of indices.
+// The vertex buffer is read through its device address and the index buffer is bound once for every mesh.
+class GeometryArena
+{
+public:
+	// Takes ownership of the range bookkeeping of the buffers. The buffers themselves are created and destroyed by the engine.
+	void initialize(VkDevice device, const AllocatedBuffer& vertexBuffer, uint32_t vertexCapacity, const AllocatedBuffer& indexBuffer, uint32_t indexCapacity);
+
+	bool allocate(uint32_t vertexCount, uint32_t indexCount, GPUMeshBuffers& meshBuffers);
+
+	// The ranges have to be released only once the GPU is done with them.
+	void free(const GPUMeshBuffers& meshBuffers);
+
+	// Registered meshes can be moved by the compaction, which patches their ranges in place.
+	void registerMesh(GPUMeshBuffers* meshBuffers);
+	void unregisterMesh(GPUMeshBuffers* meshBuffers);
+
+	// True when the free space is split enough that large meshes may not fit anymore.
+	bool isFragmented() const;
+
+	// Moves the meshes at the end of the buffers into free ranges closer to the start, up to maxBytes per call.
+	// The copies are recorded in cmd, and the ranges they leave are released through the deletion queue once the graphics
+	// timeline reaches retireValue, the value signaled by the submission of cmd.
+	void compact(VkCommandBuffer cmd, TimelineDeletionQueue& deletionQueue, uint64_t retireValue, VkDeviceSize maxBytes);
+
+	void updateBufferAddresses();
+
+	AllocatedBuffer vertexBuffer;
+	AllocatedBuffer indexBuffer;
+	VkDeviceAddress vertexBufferAddress = 0;
+	VkDeviceAddress indexBufferAddress = 0; // For shaders fetching whole triangles, like the visibility buffer resolve.
+
+	OffsetAllocator vertexAllocator;
+	OffsetAllocator indexAllocator;
+
+	uint32_t compactedMeshes = 0;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+
+	std::unordered_set<GPUMeshBuffers*> meshes;
+
+	bool moveRange(OffsetAllocator& allocator, OffsetAllocation& range, VkDeviceSize elementSize, std::vector<VkBufferCopy>& copies, TimelineDeletionQueue& deletionQueue, uint64_t retireValue);
+};
+
+// Layout of a mesh in its staging buffer, the vertices followed by the indices.
+void packMeshGeometry(std::span<const Vertex> vertices, std::span<const uint32_t> indices, void* destination);
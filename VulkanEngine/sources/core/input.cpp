@@ -0,0 +1,395 @@
+#include "input.h"
+
+#include <GLFW/glfw3.h>
+
+#include <fmt/core.h>
+
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+namespace
+{
+	constexpr uint32_t RECORDING_MAGIC = 0x52494B56; // "VKIR".
+	constexpr uint32_t RECORDING_VERSION = 1;
+
+	// Past this many late ticks the simulation gives up catching up and resynchronizes with the clock.
+	constexpr uint64_t MAX_CATCH_UP_TICKS = 10;
+
+	struct RecordingHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		double tickDuration;
+		CameraState camera;
+		uint64_t length;
+		uint64_t eventCount;
+	};
+}
+
+glm::vec3 CameraState::getForward() const
+{
+	return glm::vec3{ std::cos(pitch) * std::sin(yaw), std::sin(pitch), -std::cos(pitch) * std::cos(yaw) };
+}
+
+void InputSystem::initialize(const CameraState& initialCamera, float tickRate)
+{
+	tickDuration = 1.0 / tickRate;
+	startTime = glfwGetTime();
+
+	resetState(initialCamera);
+
+	previousCamera = initialCamera;
+	currentCamera = initialCamera;
+
+	simulation = std::thread(&InputSystem::simulate, this);
+}
+
+void InputSystem::cleanUp()
+{
+	{
+		std::scoped_lock lock(mutex);
+
+		stopping = true;
+	}
+
+	condition.notify_all();
+
+	if (simulation.joinable())
+	{
+		simulation.join();
+	}
+}
+
+void InputSystem::pushEvent(const InputEvent& event)
+{
+	if (!events.push(event))
+	{
+		droppedEvents++;
+	}
+}
+
+CameraState InputSystem::getCamera(double time)
+{
+	std::scoped_lock lock(mutex);
+
+	// A lockstep frame shows exactly the tick it asked for.
+	if (lockstep)
+	{
+		return currentCamera;
+	}
+
+	// Rendering lags one tick behind the simulation, blending the last two ticks by the time elapsed since the latest.
+	float alpha = (float)std::clamp((time - (startTime + tick * tickDuration)) / tickDuration, 0.0, 1.0);
+
+	CameraState camera;
+
+	camera.position = glm::mix(previousCamera.position, currentCamera.position, alpha);
+	camera.yaw = glm::mix(previousCamera.yaw, currentCamera.yaw, alpha);
+	camera.pitch = glm::mix(previousCamera.pitch, currentCamera.pitch, alpha);
+
+	return camera;
+}
+
+void InputSystem::advance()
+{
+	std::unique_lock lock(mutex);
+
+	if (!lockstep)
+	{
+		return;
+	}
+
+	requestedTicks++;
+
+	condition.notify_all();
+
+	// Waiting for the tick keeps the frame and the simulation in step, the frame then renders exactly that tick.
+	condition.wait(lock, [this]() { return stopping || requestedTicks == 0 || !lockstep; });
+}
+
+void InputSystem::startRecording()
+{
+	std::scoped_lock lock(mutex);
+
+	// Held keys aren't part of the recording, so both the recording and its replay start with none.
+	resetState(camera);
+
+	recordedEvents.clear();
+	recordingCamera = camera;
+	recordingStartTick = tick;
+	recording = true;
+}
+
+bool InputSystem::stopRecording(const std::filesystem::path& path)
+{
+	std::vector<RecordedEvent> events;
+	RecordingHeader header{};
+
+	{
+		std::scoped_lock lock(mutex);
+
+		if (!recording)
+		{
+			return false;
+		}
+
+		recording = false;
+
+		events = std::move(recordedEvents);
+
+		header.camera = recordingCamera;
+		header.length = tick - recordingStartTick;
+	}
+
+	header.magic = RECORDING_MAGIC;
+	header.version = RECORDING_VERSION;
+	header.tickDuration = tickDuration;
+	header.eventCount = events.size();
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to write input recording \"{}\".", path.string());
+
+		return false;
+	}
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)events.data(), events.size() * sizeof(RecordedEvent));
+
+	fmt::println("Recorded {} input events over {} ticks into \"{}\".", events.size(), header.length, path.string());
+
+	return true;
+}
+
+bool InputSystem::startReplay(const std::filesystem::path& path, bool lockstep)
+{
+	std::ifstream file(path, std::ios::binary);
+	RecordingHeader header{};
+
+	if (!file.is_open() || !file.read((char*)&header, sizeof(header)) || header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION)
+	{
+		fmt::println("Failed to read input recording \"{}\".", path.string());
+
+		return false;
+	}
+
+	// Movement is integrated per tick, the same events at another tick rate would follow another path.
+	if (header.tickDuration != tickDuration)
+	{
+		fmt::println("Input recording \"{}\" was made at {:.1f} ticks per second, not {:.1f}.", path.string(), 1.0 / header.tickDuration, 1.0 / tickDuration);
+
+		return false;
+	}
+
+	std::vector<RecordedEvent> events(header.eventCount);
+
+	if (!file.read((char*)events.data(), events.size() * sizeof(RecordedEvent)))
+	{
+		fmt::println("Input recording \"{}\" is truncated.", path.string());
+
+		return false;
+	}
+
+	{
+		std::scoped_lock lock(mutex);
+
+		recording = false;
+
+		resetState(header.camera);
+
+		previousCamera = header.camera;
+		currentCamera = header.camera;
+
+		replayEvents = std::move(events);
+		replayStartTick = tick;
+		replayLength = header.length;
+		replayCursor = 0;
+		replayFinished = false;
+		replaying = true;
+
+		this->lockstep = lockstep;
+		requestedTicks = 0;
+	}
+
+	condition.notify_all();
+
+	return true;
+}
+
+void InputSystem::stopReplay()
+{
+	{
+		std::scoped_lock lock(mutex);
+
+		replaying = false;
+		replayEvents.clear();
+
+		resetState(camera);
+
+		// Back on the clock, starting from the current tick.
+		lockstep = false;
+		startTime = glfwGetTime() - tick * tickDuration;
+	}
+
+	condition.notify_all();
+}
+
+void InputSystem::simulate()
+{
+	while (true)
+	{
+		double sleepTime;
+
+		{
+			std::unique_lock lock(mutex);
+
+			if (lockstep)
+			{
+				condition.wait(lock, [this]() { return stopping || requestedTicks > 0 || !lockstep; });
+
+				if (stopping)
+				{
+					return;
+				}
+
+				if (lockstep)
+				{
+					requestedTicks--;
+
+					step();
+
+					condition.notify_all();
+				}
+
+				continue;
+			}
+
+			if (stopping)
+			{
+				return;
+			}
+
+			double now = glfwGetTime();
+			double nextTickTime = startTime + (tick + 1) * tickDuration;
+
+			if (now >= nextTickTime)
+			{
+				if (now - nextTickTime > MAX_CATCH_UP_TICKS * tickDuration)
+				{
+					startTime = now - (tick + 1) * tickDuration;
+				}
+
+				step();
+
+				continue;
+			}
+
+			sleepTime = nextTickTime - now;
+		}
+
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleepTime));
+	}
+}
+
+void InputSystem::step()
+{
+	InputEvent event;
+
+	// Live events are still drained during a replay, so they don't pile up in the queue.
+	while (events.pop(event))
+	{
+		if (replaying)
+		{
+			continue;
+		}
+
+		if (recording)
+		{
+			recordedEvents.push_back({ tick - recordingStartTick, event });
+		}
+
+		applyEvent(event);
+	}
+
+	if (replaying)
+	{
+		uint64_t replayTick = tick - replayStartTick;
+
+		while (replayCursor < replayEvents.size() && replayEvents[replayCursor].tick <= replayTick)
+		{
+			applyEvent(replayEvents[replayCursor++].event);
+		}
+
+		if (replayCursor == replayEvents.size() && replayTick >= replayLength)
+		{
+			replayFinished = true;
+		}
+	}
+
+	glm::vec3 forward = camera.getForward();
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3{ 0.0f, 1.0f, 0.0f }));
+	glm::vec3 direction{ 0.0f };
+
+	direction += forward * (float)(keysDown[GLFW_KEY_W] - keysDown[GLFW_KEY_S]);
+	direction += right * (float)(keysDown[GLFW_KEY_D] - keysDown[GLFW_KEY_A]);
+	direction += glm::vec3{ 0.0f, 1.0f, 0.0f } * (float)(keysDown[GLFW_KEY_E] - keysDown[GLFW_KEY_Q]);
+
+	if (glm::dot(direction, direction) > 0.0f)
+	{
+		float speed = movementSpeed * (keysDown[GLFW_KEY_LEFT_SHIFT] ? 4.0f : 1.0f);
+
+		camera.position += glm::normalize(direction) * speed * (float)tickDuration;
+	}
+
+	previousCamera = currentCamera;
+	currentCamera = camera;
+
+	tick++;
+}
+
+void InputSystem::applyEvent(const InputEvent& event)
+{
+	switch (event.type)
+	{
+	case InputEventType::Key:
+		if (event.code >= 0 && event.code < (int32_t)keysDown.size())
+		{
+			keysDown[event.code] = event.action != GLFW_RELEASE;
+		}
+
+		break;
+
+	case InputEventType::MouseButton:
+		if (event.code == GLFW_MOUSE_BUTTON_RIGHT)
+		{
+			mouseLook = event.action != GLFW_RELEASE;
+		}
+
+		break;
+
+	case InputEventType::MouseMove:
+		if (mouseLook && cursorKnown)
+		{
+			camera.yaw += (float)(event.x - cursorX) * mouseSensitivity;
+			camera.pitch = std::clamp(camera.pitch - (float)(event.y - cursorY) * mouseSensitivity, -1.55f, 1.55f);
+		}
+
+		cursorX = event.x;
+		cursorY = event.y;
+		cursorKnown = true;
+
+		break;
+	}
+}
+
+void InputSystem::resetState(const CameraState& initialCamera)
+{
+	camera = initialCamera;
+
+	keysDown.fill(false);
+	mouseLook = false;
+	cursorKnown = false;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <condition_variable>
+
+// Lock-free ring buffer between exactly one producer thread and one consumer thread.
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two.");
+
+public:
+	// Returns false when the queue is full, the value is dropped.
+	bool push(const T& value)
+	{
+		size_t currentTail = tail.load(std::memory_order_relaxed);
+
+		if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+		{
+			return false;
+		}
+
+		buffer[currentTail & (Capacity - 1)] = value;
+		tail.store(currentTail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool pop(T& value)
+	{
+		size_t currentHead = head.load(std::memory_order_relaxed);
+
+		if (currentHead == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		value = buffer[currentHead & (Capacity - 1)];
+		head.store(currentHead + 1, std::memory_order_release);
+
+		return true;
+	}
+
+private:
+	// On separate cache lines, so the producer and the consumer don't invalidate each other's index.
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+
+	std::array<T, Capacity> buffer;
+};
+
+enum class InputEventType : uint32_t
+{
+	Key,
+	MouseButton,
+	MouseMove
+};
+
+// Raw GLFW input, as it comes out of the window callbacks.
+struct InputEvent
+{
+	InputEventType type;
+
+	// Key or mouse button code and GLFW action.
+	int32_t code = 0;
+	int32_t action = 0;
+
+	// Cursor position, for mouse moves.
+	double x = 0.0;
+	double y = 0.0;
+};
+
+struct CameraState
+{
+	glm::vec3 position{ 0.0f, 0.0f, 5.0f };
+
+	// In radians. Zero yaw and pitch look down -Z.
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+
+	glm::vec3 getForward() const;
+};
+
+// Free-fly camera simulated at a fixed timestep on its own thread. The window callbacks push raw events through a
+// lock-free queue, the simulation consumes them tick by tick, and the render thread interpolates between the last two ticks.
+//
+// Each event is bound to the tick that consumed it, so a recording replayed from the same initial camera produces
+// the same camera path. In lockstep mode the simulation advances exactly one tick per rendered frame instead of following
+// the clock, so every frame of a replay sees the same camera, whatever the frame rate.
+class InputSystem
+{
+public:
+	void initialize(const CameraState& initialCamera, float tickRate = 120.0f);
+	void cleanUp();
+
+	// Producer side, called from the thread polling the window events.
+	void pushEvent(const InputEvent& event);
+
+	// Interpolated camera at the given time, in seconds on the glfwGetTime clock.
+	CameraState getCamera(double time);
+
+	// Lockstep mode only, runs one more tick and returns once it's simulated.
+	void advance();
+
+	void startRecording();
+	bool stopRecording(const std::filesystem::path& path);
+
+	// Restarts from the camera the recording started with. The live events are ignored until the replay is stopped.
+	bool startReplay(const std::filesystem::path& path, bool lockstep);
+	void stopReplay();
+
+	bool isRecording() const { return recording; }
+	bool isReplaying() const { return replaying; }
+	bool isReplayFinished() const { return replayFinished; }
+
+	float getTickRate() const { return (float)(1.0 / tickDuration); }
+
+	// Read by the simulation thread, so changing them while recording breaks the replay.
+	float movementSpeed = 5.0f;
+	float mouseSensitivity = 0.002f;
+
+	// Producer side only.
+	uint32_t droppedEvents = 0;
+
+private:
+	struct RecordedEvent
+	{
+		uint64_t tick;
+		InputEvent event;
+	};
+
+	SpscQueue<InputEvent, 1024> events;
+
+	std::thread simulation;
+	std::atomic<bool> stopping = false;
+
+	double tickDuration = 0.0;
+
+	// Everything below is only touched under the mutex. Ticks are short, so they run entirely under it.
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	// Time of tick zero, moved forward when the simulation falls too far behind the clock.
+	double startTime = 0.0;
+
+	CameraState previousCamera;
+	CameraState currentCamera;
+	uint64_t tick = 0;
+	uint64_t requestedTicks = 0;
+	bool lockstep = false;
+
+	CameraState camera;
+	std::array<bool, 512> keysDown{};
+	bool mouseLook = false;
+	bool cursorKnown = false;
+	double cursorX = 0.0;
+	double cursorY = 0.0;
+
+	// Recorded ticks are relative to the start of the recording.
+	std::atomic<bool> recording = false;
+	std::vector<RecordedEvent> recordedEvents;
+	CameraState recordingCamera;
+	uint64_t recordingStartTick = 0;
+
+	std::atomic<bool> replaying = false;
+	std::atomic<bool> replayFinished = false;
+	std::vector<RecordedEvent> replayEvents;
+	uint64_t replayStartTick = 0;
+	uint64_t replayLength = 0;
+	size_t replayCursor = 0;
+
+	void simulate();
+	void step();
+	void applyEvent(const InputEvent& event);
+	void resetState(const CameraState& initialCamera);
+};
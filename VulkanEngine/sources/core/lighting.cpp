@@ -0,0 +1,41 @@
+#include "lighting.h"
+
+#include <cmath>
+#include <random>
+
+std::vector<PointLight> scatterPointLights(uint32_t count, glm::vec3 center, glm::vec3 extent, uint32_t seed)
+{
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<PointLight> lights(count);
+
+	for (PointLight& light : lights)
+	{
+		light.anchor = center + (glm::vec3(unit(generator), unit(generator), unit(generator)) - 0.5f) * extent;
+		light.orbitRadius = 0.5f + unit(generator) * 2.5f;
+		light.orbitSpeed = (unit(generator) - 0.5f) * 2.0f;
+		light.phase = unit(generator) * 6.2831853f;
+
+		light.radius = 2.0f + unit(generator) * 6.0f;
+		light.color = glm::vec3(unit(generator), unit(generator), unit(generator)) * 0.8f + 0.2f;
+		light.intensity = 1.0f + unit(generator) * 2.0f;
+	}
+
+	return lights;
+}
+
+GPULight animatePointLight(const PointLight& light, float time)
+{
+	float angle = light.phase + light.orbitSpeed * time;
+	glm::vec3 position = light.anchor + glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * light.orbitRadius;
+
+	return { glm::vec4(position, light.radius), glm::vec4(light.color, light.intensity) };
+}
+
+glm::vec4 getClusterDepthSlicing(float zNear, float zFar)
+{
+	float scale = (float)CLUSTER_GRID_Z / std::log(zFar / zNear);
+
+	return { zNear, zFar, scale, -std::log(zNear) * scale };
+}
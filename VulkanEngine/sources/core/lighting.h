@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "shadows.h"
+
+// Froxel grid of the clustered forward lighting: screen tiles times exponential depth slices.
+// clusters.comp and colored_triangle.frag declare the same constants.
+constexpr uint32_t CLUSTER_GRID_X = 16;
+constexpr uint32_t CLUSTER_GRID_Y = 9;
+constexpr uint32_t CLUSTER_GRID_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+// Lights past this many in a single cluster are dropped from it.
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 64;
+
+// Capacity of the per-frame lighting buffers.
+constexpr uint32_t MAX_LIGHTS = 1024;
+
+// Point light, in world space like the meshes.
+struct GPULight
+{
+	glm::vec4 positionRadius;
+	glm::vec4 colorIntensity;
+};
+
+// Lights of a cluster, as written by clusters.comp.
+struct GPUCluster
+{
+	uint32_t lightCount;
+	uint32_t lightIndices[MAX_LIGHTS_PER_CLUSTER];
+};
+
+// Header of the per-frame lighting buffer, the lights follow it. It has to match the std430 layout of the shaders.
+struct GPULightingData
+{
+	glm::mat4 view;
+	glm::mat4 inverseProjection;
+	glm::vec4 screenSize;   // Draw extent (xy).
+	glm::vec4 depthSlicing; // Near and far planes of the grid (xy), slice scale and bias (zw).
+	glm::vec4 ambient;
+
+	// Sun and its shadow cascades.
+	glm::mat4 shadowMatrices[SHADOW_CASCADE_COUNT];
+	glm::vec4 cascadeSplits;     // Far view depth of each cascade.
+	glm::vec4 cascadeTexelSizes; // World space size of a texel of each cascade.
+	glm::vec4 sunDirection;      // Direction the light travels in (xyz), and normal offset of the shadow lookups in texels (w).
+	glm::vec4 sunColor;          // Color (rgb) and intensity (a), a zero intensity skips the sun.
+
+	uint32_t lightCount;
+	uint32_t padding[3];
+};
+
+struct ClusterPushConstants
+{
+	VkDeviceAddress lightingBufferAddress;
+	VkDeviceAddress clusterBufferAddress;
+};
+
+// A point light orbiting around its anchor.
+struct PointLight
+{
+	glm::vec3 anchor;
+	float orbitRadius;
+	float orbitSpeed;
+	float phase;
+
+	float radius;
+	glm::vec3 color;
+	float intensity;
+};
+
+// Lights with random colors and orbits inside the given box. The same seed gives the same lights.
+std::vector<PointLight> scatterPointLights(uint32_t count, glm::vec3 center, glm::vec3 extent, uint32_t seed);
+
+GPULight animatePointLight(const PointLight& light, float time);
+
+// The slice of a view depth is floor(log(depth) * z + w), for exponential slices between the near and far planes.
+glm::vec4 getClusterDepthSlicing(float zNear, float zFar);
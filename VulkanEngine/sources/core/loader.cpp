@@ -3,43 +3,196 @@
 // Due to forward declaration...
 #include "engine.h"
 
-std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* engine, std::filesystem::path filePath)
+namespace
 {
-	fmt::println("Loading glTF from \"{}\".", filePath.string());
+	// Centered on the bounding box, which is close enough to the smallest sphere for culling.
+	glm::vec4 computeBoundingSphere(std::span<const Vertex> vertices)
+	{
+		if (vertices.empty())
+		{
+			return glm::vec4{ 0.0f };
+		}
+
+		glm::vec3 minimum = vertices[0].position;
+		glm::vec3 maximum = vertices[0].position;
+
+		for (const Vertex& vertex : vertices)
+		{
+			minimum = glm::min(minimum, vertex.position);
+			maximum = glm::max(maximum, vertex.position);
+		}
+
+		glm::vec3 center = (minimum + maximum) * 0.5f;
+		float radiusSquared = 0.0f;
+
+		for (const Vertex& vertex : vertices)
+		{
+			glm::vec3 offset = vertex.position - center;
+
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
 
-	auto data = fastgltf::GltfDataBuffer::FromPath(filePath);
+		return glm::vec4{ center, std::sqrt(radiusSquared) };
+	}
 
-	if (data.error() != fastgltf::Error::None)
+	std::optional<fastgltf::Asset> parseGLTFAsset(const std::filesystem::path& filePath)
 	{
-		fmt::println("Failed to load glTF data buffer from path \"{}\".", filePath.string());
+		fmt::println("Loading glTF from \"{}\".", filePath.string());
 
-		return {};
+		auto data = fastgltf::GltfDataBuffer::FromPath(filePath);
+
+		if (data.error() != fastgltf::Error::None)
+		{
+			fmt::println("Failed to load glTF data buffer from path \"{}\".", filePath.string());
+
+			return {};
+		}
+
+		fastgltf::Parser parser;
+		constexpr auto gltfOptions = fastgltf::Options::LoadExternalBuffers;
+		auto expected = parser.loadGltf(data.get(), filePath.parent_path(), gltfOptions);
+
+		if (auto error = expected.error(); error != fastgltf::Error::None)
+		{
+			fmt::println("Failed to load glTF: {}.", fastgltf::to_underlying(expected.error()));
+
+			return {};
+		}
+
+		return std::move(expected.get());
 	}
 
-	fastgltf::Parser parser;
-	constexpr auto gltfOptions = fastgltf::Options::LoadExternalBuffers;
-	auto expected = parser.loadGltf(data.get(), filePath.parent_path(), gltfOptions);
+	NodePose getNodePose(const fastgltf::Node& node)
+	{
+		fastgltf::math::fvec3 translation, scale;
+		fastgltf::math::fquat rotation;
+
+		if (const fastgltf::TRS* trs = std::get_if<fastgltf::TRS>(&node.transform))
+		{
+			translation = trs->translation;
+			rotation = trs->rotation;
+			scale = trs->scale;
+		}
+		else
+		{
+			fastgltf::math::decomposeTransformMatrix(std::get<fastgltf::math::fmat4x4>(node.transform), scale, rotation, translation);
+		}
+
+		NodePose pose;
+
+		pose.translation = glm::vec4{ translation[0], translation[1], translation[2], 0.0f };
+		pose.rotation = glm::vec4{ rotation[0], rotation[1], rotation[2], rotation[3] };
+		pose.scale = glm::vec4{ scale[0], scale[1], scale[2], 0.0f };
 
-	if (auto error = expected.error(); error != fastgltf::Error::None)
+		return pose;
+	}
+
+	// The keyframes of an animation channel, with the values of the given skeleton node.
+	std::optional<AnimationChannel> convertGLTFChannel(const fastgltf::Asset& asset, const fastgltf::Animation& animation, const fastgltf::AnimationChannel& gltfChannel, uint32_t node)
 	{
-		fmt::println("Failed to load glTF: {}.", fastgltf::to_underlying(expected.error()));
+		AnimationChannel channel;
+
+		channel.node = node;
+
+		switch (gltfChannel.path)
+		{
+		case fastgltf::AnimationPath::Translation: channel.path = AnimationPath::Translation; break;
+		case fastgltf::AnimationPath::Rotation: channel.path = AnimationPath::Rotation; break;
+		case fastgltf::AnimationPath::Scale: channel.path = AnimationPath::Scale; break;
+		default: return {}; // Morph target weights aren't supported.
+		}
+
+		const fastgltf::AnimationSampler& sampler = animation.samplers[gltfChannel.samplerIndex];
+		const fastgltf::Accessor& inputAccessor = asset.accessors[sampler.inputAccessor];
+		const fastgltf::Accessor& outputAccessor = asset.accessors[sampler.outputAccessor];
+
+		if (inputAccessor.count == 0)
+		{
+			return {};
+		}
+
+		channel.step = sampler.interpolation == fastgltf::AnimationInterpolation::Step;
+		channel.times.resize(inputAccessor.count);
+
+		fastgltf::iterateAccessorWithIndex<float>(asset, inputAccessor, [&](float time, size_t index)
+		{
+			channel.times[index] = time;
+		});
+
+		// Cubic spline keyframes come with an in and an out tangent around their value. Only the values are kept, and
+		// interpolated linearly.
+		size_t stride = sampler.interpolation == fastgltf::AnimationInterpolation::CubicSpline ? 3 : 1;
+		size_t valueOffset = stride == 3 ? 1 : 0;
+
+		std::vector<glm::vec4> values(outputAccessor.count);
 
+		if (channel.path == AnimationPath::Rotation)
+		{
+			fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, outputAccessor, [&](glm::vec4 value, size_t index)
+			{
+				values[index] = value;
+			});
+		}
+		else
+		{
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, outputAccessor, [&](glm::vec3 value, size_t index)
+			{
+				values[index] = glm::vec4{ value, 0.0f };
+			});
+		}
+
+		if (values.size() < channel.times.size() * stride)
+		{
+			return {};
+		}
+
+		channel.values.resize(channel.times.size());
+
+		for (size_t i = 0; i < channel.times.size(); i++)
+		{
+			channel.values[i] = values[i * stride + valueOffset];
+		}
+
+		return channel;
+	}
+}
+
+std::optional<std::vector<MeshData>> parseGLTFMeshes(std::filesystem::path filePath)
+{
+	std::optional<fastgltf::Asset> asset = parseGLTFAsset(filePath);
+
+	if (!asset.has_value())
+	{
 		return {};
 	}
 
-	fastgltf::Asset asset = std::move(expected.get());
-	std::vector<std::shared_ptr<MeshAsset>> meshes;
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	return convertGLTFMeshes(asset.value());
+}
+
+std::vector<MeshData> convertGLTFMeshes(const fastgltf::Asset& asset)
+{
+	std::vector<MeshData> meshes;
 
-	for (fastgltf::Mesh& mesh : asset.meshes)
+	// Skins only hang off nodes, a mesh is skinned by the first node that draws it with one.
+	std::vector<int32_t> meshSkins(asset.meshes.size(), -1);
+
+	for (const fastgltf::Node& node : asset.nodes)
+	{
+		if (node.meshIndex.has_value() && node.skinIndex.has_value() && meshSkins[node.meshIndex.value()] < 0)
+		{
+			meshSkins[node.meshIndex.value()] = (int32_t)node.skinIndex.value();
+		}
+	}
+
+	for (const fastgltf::Mesh& mesh : asset.meshes)
 	{
-		MeshAsset newMeshAsset;
+		MeshData& newMeshData = meshes.emplace_back();
 
-		newMeshAsset.name = mesh.name;
+		newMeshData.name = mesh.name;
+		newMeshData.skin = meshSkins[meshes.size() - 1];
 
-		vertices.clear();
-		indices.clear();
+		std::vector<Vertex>& vertices = newMeshData.vertices;
+		std::vector<uint32_t>& indices = newMeshData.indices;
 
 		for (auto&& p : mesh.primitives)
 		{
@@ -52,7 +205,7 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 
 			// Load indexes.
 			{
-				fastgltf::Accessor& indexAccessor = asset.accessors[p.indicesAccessor.value()];
+				const fastgltf::Accessor& indexAccessor = asset.accessors[p.indicesAccessor.value()];
 
 				indices.reserve(indices.size() + indexAccessor.count);
 
@@ -64,8 +217,8 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 
 			// Load vertex positions.
 			{
-				fastgltf::Attribute* positionAttribute = p.findAttribute("POSITION");
-				fastgltf::Accessor& positionAccessor = asset.accessors[positionAttribute->accessorIndex];
+				auto positionAttribute = p.findAttribute("POSITION");
+				const fastgltf::Accessor& positionAccessor = asset.accessors[positionAttribute->accessorIndex];
 
 				vertices.resize(vertices.size() + positionAccessor.count);
 
@@ -84,11 +237,11 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 			}
 
 			// Load vertex normals.
-			fastgltf::Attribute* normalAttribute = p.findAttribute("NORMAL");
+			auto normalAttribute = p.findAttribute("NORMAL");
 
 			if (normalAttribute != p.attributes.end())
 			{
-				fastgltf::Accessor& normalAccessor = asset.accessors[normalAttribute->accessorIndex];
+				const fastgltf::Accessor& normalAccessor = asset.accessors[normalAttribute->accessorIndex];
 
 				fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, normalAccessor, [&](glm::vec3 normal, size_t index)
 				{
@@ -97,11 +250,11 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 			}
 
 			// Load UVs.
-			fastgltf::Attribute* uvAttribute = p.findAttribute("TEXCOORD_0");
+			auto uvAttribute = p.findAttribute("TEXCOORD_0");
 
 			if (uvAttribute != p.attributes.end())
 			{
-				fastgltf::Accessor& uvAccessor = asset.accessors[uvAttribute->accessorIndex];
+				const fastgltf::Accessor& uvAccessor = asset.accessors[uvAttribute->accessorIndex];
 
 				fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, uvAccessor, [&](glm::vec2 uv, size_t index)
 				{
@@ -111,11 +264,11 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 			}
 
 			// Load vertex colors.
-			fastgltf::Attribute* colorAttribute = p.findAttribute("COLOR_0");
+			auto colorAttribute = p.findAttribute("COLOR_0");
 
 			if (colorAttribute != p.attributes.end())
 			{
-				fastgltf::Accessor& colorAccessor = asset.accessors[colorAttribute->accessorIndex];
+				const fastgltf::Accessor& colorAccessor = asset.accessors[colorAttribute->accessorIndex];
 
 				fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, colorAccessor, [&](glm::vec4 color, size_t index)
 				{
@@ -123,7 +276,39 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 				});
 			}
 
-			newMeshAsset.surfaces.push_back(newSurface);
+			// Load joints and weights, only used by meshes drawn with a skin.
+			auto jointsAttribute = p.findAttribute("JOINTS_0");
+			auto weightsAttribute = p.findAttribute("WEIGHTS_0");
+
+			if (newMeshData.skin >= 0 && jointsAttribute != p.attributes.end() && weightsAttribute != p.attributes.end())
+			{
+				std::vector<VertexSkin>& skinning = newMeshData.skinning;
+
+				skinning.resize(vertices.size());
+
+				const fastgltf::Accessor& jointsAccessor = asset.accessors[jointsAttribute->accessorIndex];
+				const fastgltf::Accessor& weightsAccessor = asset.accessors[weightsAttribute->accessorIndex];
+
+				fastgltf::iterateAccessorWithIndex<glm::u16vec4>(asset, jointsAccessor, [&](glm::u16vec4 joints, size_t index)
+				{
+					skinning[startVertex + index].joints = joints;
+				});
+
+				fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, weightsAccessor, [&](glm::vec4 weights, size_t index)
+				{
+					skinning[startVertex + index].weights = weights;
+				});
+			}
+
+			newSurface.bounds = computeBoundingSphere(std::span<const Vertex>(vertices).subspan(startVertex));
+
+			newMeshData.surfaces.push_back(newSurface);
+		}
+
+		// Primitives without joints follow the first joint of the skin.
+		if (!newMeshData.skinning.empty())
+		{
+			newMeshData.skinning.resize(vertices.size());
 		}
 
 		// Display the vertex normals.
@@ -137,9 +322,181 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* en
 			}
 		}
 
-		newMeshAsset.meshBuffers = engine->uploadMesh(vertices, indices);
+	}
+
+	return meshes;
+}
+
+std::vector<Skeleton> convertGLTFSkeletons(const fastgltf::Asset& asset)
+{
+	std::vector<int32_t> nodeParents(asset.nodes.size(), -1);
+
+	for (size_t i = 0; i < asset.nodes.size(); i++)
+	{
+		for (size_t child : asset.nodes[i].children)
+		{
+			nodeParents[child] = (int32_t)i;
+		}
+	}
+
+	auto getDepth = [&](size_t node)
+	{
+		uint32_t depth = 0;
+
+		for (int32_t parent = nodeParents[node]; parent >= 0; parent = nodeParents[parent])
+		{
+			depth++;
+		}
+
+		return depth;
+	};
+
+	std::vector<Skeleton> skeletons;
+
+	for (const fastgltf::Skin& skin : asset.skins)
+	{
+		Skeleton& skeleton = skeletons.emplace_back();
+
+		skeleton.name = skin.name;
+
+		// The joints and every node above them, whose transforms the joints inherit. Sorted by depth, so parents come
+		// before their children.
+		std::vector<size_t> nodes;
+		std::unordered_map<size_t, uint32_t> skeletonNodes;
+
+		for (size_t joint : skin.joints)
+		{
+			for (int32_t node = (int32_t)joint; node >= 0 && !skeletonNodes.contains(node); node = nodeParents[node])
+			{
+				skeletonNodes[node] = 0;
+				nodes.push_back(node);
+			}
+		}
+
+		std::stable_sort(nodes.begin(), nodes.end(), [&](size_t a, size_t b) { return getDepth(a) < getDepth(b); });
+
+		for (uint32_t i = 0; i < nodes.size(); i++)
+		{
+			skeletonNodes[nodes[i]] = i;
+		}
+
+		for (size_t node : nodes)
+		{
+			int32_t parent = nodeParents[node];
+
+			skeleton.parents.push_back(parent >= 0 ? (int32_t)skeletonNodes[parent] : -1);
+			skeleton.restPose.push_back(getNodePose(asset.nodes[node]));
+		}
+
+		for (size_t joint : skin.joints)
+		{
+			skeleton.jointNodes.push_back(skeletonNodes[joint]);
+		}
+
+		skeleton.inverseBindMatrices.resize(skin.joints.size(), glm::mat4{ 1.0f });
+
+		if (skin.inverseBindMatrices.has_value())
+		{
+			const fastgltf::Accessor& matrixAccessor = asset.accessors[skin.inverseBindMatrices.value()];
+
+			fastgltf::iterateAccessorWithIndex<glm::mat4>(asset, matrixAccessor, [&](glm::mat4 matrix, size_t index)
+			{
+				if (index < skeleton.inverseBindMatrices.size())
+				{
+					skeleton.inverseBindMatrices[index] = matrix;
+				}
+			});
+		}
+
+		// Every animation becomes a clip of the skeleton, with the channels targeting its nodes.
+		for (const fastgltf::Animation& animation : asset.animations)
+		{
+			AnimationClip clip;
+
+			clip.name = animation.name;
+
+			for (const fastgltf::AnimationChannel& gltfChannel : animation.channels)
+			{
+				if (!gltfChannel.nodeIndex.has_value() || !skeletonNodes.contains(gltfChannel.nodeIndex.value()))
+				{
+					continue;
+				}
+
+				std::optional<AnimationChannel> channel = convertGLTFChannel(asset, animation, gltfChannel, skeletonNodes[gltfChannel.nodeIndex.value()]);
+
+				if (channel.has_value())
+				{
+					clip.duration = std::max(clip.duration, channel->times.back());
+					clip.channels.push_back(std::move(channel.value()));
+				}
+			}
+
+			if (!clip.channels.empty())
+			{
+				skeleton.clips.push_back(std::move(clip));
+			}
+		}
+	}
+
+	return skeletons;
+}
+
+std::optional<AnimatedModelData> parseGLTFAnimatedModel(std::filesystem::path filePath)
+{
+	std::optional<fastgltf::Asset> asset = parseGLTFAsset(filePath);
+
+	if (!asset.has_value())
+	{
+		return {};
+	}
+
+	AnimatedModelData model;
+
+	model.meshes = convertGLTFMeshes(asset.value());
+	model.skeletons = convertGLTFSkeletons(asset.value());
+
+	return model;
+}
+
+std::shared_ptr<MeshAsset> uploadMeshData(Engine* engine, MeshData& meshData)
+{
+	std::shared_ptr<MeshAsset> meshAsset = std::make_shared<MeshAsset>();
+
+	meshAsset->name = meshData.name;
+	meshAsset->surfaces = meshData.surfaces;
+
+	if (!engine->tryUploadMesh(meshData.vertices, meshData.indices, meshAsset->meshBuffers))
+	{
+		return nullptr;
+	}
+
+	// Registered once the buffers sit at their final address, inside the shared mesh asset.
+	engine->registerMeshBuffers(meshAsset->meshBuffers);
+
+	return meshAsset;
+}
+
+std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* engine, std::filesystem::path filePath)
+{
+	std::optional<std::vector<MeshData>> meshData = parseGLTFMeshes(filePath);
+
+	if (!meshData.has_value())
+	{
+		return {};
+	}
+
+	std::vector<std::shared_ptr<MeshAsset>> meshes;
+
+	for (MeshData& data : meshData.value())
+	{
+		std::shared_ptr<MeshAsset> meshAsset = uploadMeshData(engine, data);
+
+		if (meshAsset == nullptr)
+		{
+			throw std::runtime_error("Failed to allocate the mesh in the geometry arena!");
+		}
 
-		meshes.emplace_back(std::make_shared<MeshAsset>(std::move(newMeshAsset)));
+		meshes.push_back(meshAsset);
 	}
 
 	return meshes;
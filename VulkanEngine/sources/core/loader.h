@@ -16,6 +16,7 @@
 #include <unordered_map>
 
 #include "structures.h"
+#include "animation.h"
 
 // Forward declaration...
 class Engine;
@@ -24,6 +25,9 @@ struct GeoSurface
 {
     uint32_t startIndex;
     uint32_t count;
+
+    // Bounding sphere of the surface, center (xyz) and radius (w), in the space of the mesh.
+    glm::vec4 bounds{ 0.0f };
 };
 
 struct MeshAsset
@@ -35,4 +39,42 @@ struct MeshAsset
     GPUMeshBuffers meshBuffers;
 };
 
+// CPU side geometry of a mesh, parsed but not uploaded yet.
+struct MeshData
+{
+    std::string name;
+
+    std::vector<GeoSurface> surfaces;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    // Joints and weights of every vertex, empty when the mesh isn't skinned.
+    std::vector<VertexSkin> skinning;
+
+    // Skin of the first node drawing the mesh with one, as an index of the asset's skins.
+    int32_t skin = -1;
+};
+
+// An animated glTF model: its meshes, and one skeleton per skin with every animation retargeted onto it.
+struct AnimatedModelData
+{
+    std::vector<MeshData> meshes;
+    std::vector<Skeleton> skeletons;
+};
+
+// Parsing doesn't touch the engine, so it can run on any thread.
+std::optional<std::vector<MeshData>> parseGLTFMeshes(std::filesystem::path filePath);
+
+// The accessor conversion of parseGLTFMeshes, from an asset already parsed.
+std::vector<MeshData> convertGLTFMeshes(const fastgltf::Asset& asset);
+
+// Skeletons of the skins of an asset, in the same order, each with the channels of the animations that move its nodes.
+std::vector<Skeleton> convertGLTFSkeletons(const fastgltf::Asset& asset);
+
+std::optional<AnimatedModelData> parseGLTFAnimatedModel(std::filesystem::path filePath);
+
+// Uploads the geometry into the engine's geometry arena. Returns nullptr when the arena has no room left for it.
+std::shared_ptr<MeshAsset> uploadMeshData(Engine* engine, MeshData& meshData);
+
 std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGLTFMeshes(Engine* engine, std::filesystem::path filePath);
@@ -0,0 +1,37 @@
+#include "particles.h"
+
+#include <cmath>
+#include <algorithm>
+
+std::vector<ParticleSortStep> getParticleSortSteps(uint32_t entryCount)
+{
+	std::vector<ParticleSortStep> steps;
+
+	steps.push_back({ ParticleSortPass::LocalSort, PARTICLE_SORT_BLOCK_SIZE, 0 });
+
+	for (uint32_t blockSize = PARTICLE_SORT_BLOCK_SIZE * 2; blockSize <= entryCount; blockSize *= 2)
+	{
+		steps.push_back({ ParticleSortPass::Flip, blockSize, blockSize / 2 });
+
+		for (uint32_t distance = blockSize / 4; distance >= PARTICLE_SORT_BLOCK_SIZE; distance /= 2)
+		{
+			steps.push_back({ ParticleSortPass::Disperse, blockSize, distance });
+		}
+
+		steps.push_back({ ParticleSortPass::LocalDisperse, blockSize, PARTICLE_SORT_BLOCK_SIZE / 2 });
+	}
+
+	return steps;
+}
+
+uint32_t getParticleEmitCount(float rate, float deltaTime, float& accumulator)
+{
+	accumulator += std::max(rate, 0.0f) * deltaTime;
+
+	// A long frame (or a breakpoint) shouldn't empty the whole dead list at once.
+	float emitCount = std::min(std::floor(accumulator), (float)MAX_PARTICLES);
+
+	accumulator = std::min(accumulator - emitCount, 1.0f);
+
+	return (uint32_t)emitCount;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// GPU particles. Every particle lives in persistent buffers and is only ever touched by compute shaders:
+//  - emit pops free particles off the dead list and appends them to the alive list of the frame,
+//  - simulate integrates the alive list, appends the survivors to the other alive list (compacting it) and pushes the
+//    others back onto the dead list,
+//  - compact closes the frame's lists: it writes the indirect draw and the dispatches of the next stages from the counts,
+//  - sort orders the survivors back to front with a bitonic sort, for the alpha blended path.
+// The counts never come back to the CPU, the stages that depend on them are dispatched and drawn indirectly.
+// Has to match the particle shaders.
+constexpr uint32_t MAX_PARTICLES = 1 << 20;
+constexpr uint32_t PARTICLE_WORKGROUP_SIZE = 64;
+
+// Entries sorted in shared memory by a workgroup of the sort, two per invocation.
+constexpr uint32_t PARTICLE_SORT_BLOCK_SIZE = 512;
+
+struct GPUParticle
+{
+	glm::vec4 positionLife;     // Position (xyz) and remaining life in seconds (w).
+	glm::vec4 velocityLifetime; // Velocity (xyz) and life at birth (w).
+};
+
+struct GPUParticleCounters
+{
+	int32_t deadCount; // Signed, emission takes particles optimistically and gives back the ones it can't have.
+	uint32_t aliveCounts[2];
+	uint32_t sortSize; // Power of two covering the survivors, at least PARTICLE_SORT_BLOCK_SIZE.
+
+	VkDispatchIndirectCommand simulateDispatch;
+	uint32_t padding0;
+	VkDispatchIndirectCommand sortDispatch;
+	uint32_t padding1;
+
+	VkDrawIndirectCommand draw; // One quad instance per survivor.
+};
+
+// The shaders see the indirect commands as arrays of four words.
+static_assert(offsetof(GPUParticleCounters, sortDispatch) == 32 && offsetof(GPUParticleCounters, draw) == 48, "The particle counters don't match the shaders.");
+
+// Sorted by key, the distance to the camera with its bits inverted, so the farthest particles come first.
+struct GPUParticleSortEntry
+{
+	uint32_t key;
+	uint32_t particle;
+};
+
+struct ParticleEmitPushConstants
+{
+	VkDeviceAddress particleBufferAddress;
+	VkDeviceAddress counterBufferAddress;
+	VkDeviceAddress deadListAddress;
+	VkDeviceAddress aliveListAddress;
+
+	glm::vec4 positionRadius;
+	glm::vec4 velocityJitter;
+	glm::vec2 lifetimeRange;
+
+	uint32_t aliveList;
+	uint32_t emitCount;
+	uint32_t seed;
+	uint32_t padding;
+};
+
+struct ParticleSimulatePushConstants
+{
+	VkDeviceAddress particleBufferAddress;
+	VkDeviceAddress counterBufferAddress;
+	VkDeviceAddress deadListAddress;
+	VkDeviceAddress aliveListAddress;
+	VkDeviceAddress survivorListAddress;
+	VkDeviceAddress sortBufferAddress;
+
+	glm::vec4 gravityDeltaTime; // Gravity (xyz) and time step (w).
+	glm::vec4 cameraPositionDrag; // Camera position (xyz) and drag per second (w).
+
+	uint32_t aliveList;
+	uint32_t writeSortKeys;
+	uint32_t padding[2];
+};
+
+struct ParticleCompactPushConstants
+{
+	VkDeviceAddress counterBufferAddress;
+
+	uint32_t aliveList;
+	uint32_t padding;
+};
+
+enum class ParticleSortPass : uint32_t
+{
+	LocalSort,     // Every step of the blocks up to PARTICLE_SORT_BLOCK_SIZE, in shared memory.
+	Flip,          // First step of a block larger than that, comparing each entry with its mirror in the block.
+	Disperse,      // Later steps, comparing entries a distance apart, as long as it crosses sort blocks.
+	LocalDisperse  // The remaining steps of a block, in shared memory.
+};
+
+struct ParticleSortPushConstants
+{
+	VkDeviceAddress sortBufferAddress;
+	VkDeviceAddress counterBufferAddress;
+
+	uint32_t pass;
+	uint32_t blockSize;
+	uint32_t distance;
+	uint32_t padding;
+};
+
+struct ParticleDrawPushConstants
+{
+	glm::mat4 viewProjection;
+
+	glm::vec4 cameraRightSize; // Right vector of the camera (xyz) and size of the particles (w).
+	glm::vec4 cameraUp;
+
+	VkDeviceAddress particleBufferAddress;
+	VkDeviceAddress indexBufferAddress; // The survivor list, or the sort entries when sorted.
+
+	uint32_t sorted;
+	uint32_t padding;
+};
+
+// A point emitter, spawning particles in a sphere around it.
+struct ParticleEmitter
+{
+	glm::vec3 position{ 0.0f, 1.0f, 0.0f };
+	float radius = 0.5f;
+
+	glm::vec3 velocity{ 0.0f, 12.0f, 0.0f };
+	float velocityJitter = 4.0f;
+
+	float rate = 200000.0f; // Particles per second.
+	float minLifetime = 3.0f;
+	float maxLifetime = 6.0f;
+};
+
+struct ParticleSortStep
+{
+	ParticleSortPass pass;
+	uint32_t blockSize;
+	uint32_t distance;
+};
+
+// The passes of a bitonic sort of up to entryCount entries (a power of two), where every comparison orders the lower
+// entry first. A block is merged by comparing each entry of its first half with its mirror in the second half, then with
+// the entry half the distance away, and so on. Entries past the end are never moved, so they don't have to exist.
+// Steps within a sort block are merged into shared memory passes.
+std::vector<ParticleSortStep> getParticleSortSteps(uint32_t entryCount);
+
+// Particles to emit this frame. The fraction left over is carried to the next frame in the accumulator.
+uint32_t getParticleEmitCount(float rate, float deltaTime, float& accumulator);
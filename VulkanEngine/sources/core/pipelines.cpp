@@ -0,0 +1,230 @@
+#include "pipelines.h"
+
+#include <chrono>
+#include <algorithm>
+
+void PipelineLibrary::initialize(VkDevice device, bool useGraphicsPipelineLibrary, uint32_t workerCount)
+{
+	this->device = device;
+	this->useGraphicsPipelineLibrary = useGraphicsPipelineLibrary;
+
+	// The pipeline cache is internally synchronized, so all the workers can share it.
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+
+	VK_CHECK(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+
+	if (workerCount == 0)
+	{
+		// Leave a core for the render thread. The core count is zero when it can't be determined.
+		uint32_t coreCount = std::thread::hardware_concurrency();
+
+		workerCount = coreCount > 1 ? coreCount - 1 : 1;
+	}
+
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&PipelineLibrary::work, this);
+	}
+}
+
+void PipelineLibrary::cleanUp()
+{
+	{
+		std::scoped_lock lock(mutex);
+
+		// Variants still queued are dropped, nobody will wait on them anymore.
+		stopping = true;
+		queue.clear();
+	}
+
+	condition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	workers.clear();
+
+	for (Variant& variant : variants)
+	{
+		if (variant.pipeline.valid() && variant.pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready && variant.pipeline.get() != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(device, variant.pipeline.get(), nullptr);
+		}
+	}
+
+	// Linked pipelines don't reference their parts anymore, so the order doesn't matter.
+	for (auto& [key, part] : parts)
+	{
+		if (part.get() != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(device, part.get(), nullptr);
+		}
+	}
+
+	for (VkShaderModule shaderModule : shaderModules)
+	{
+		vkDestroyShaderModule(device, shaderModule, nullptr);
+	}
+
+	vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+	variants.clear();
+	handles.clear();
+	parts.clear();
+	shaderModules.clear();
+}
+
+PipelineHandle PipelineLibrary::request(const PipelineBuilder& builder)
+{
+	std::string key = builder.key();
+	PipelineHandle handle;
+
+	{
+		std::scoped_lock lock(mutex);
+
+		auto it = handles.find(key);
+
+		if (it != handles.end())
+		{
+			return it->second;
+		}
+
+		handle = (PipelineHandle)variants.size();
+		Variant& variant = variants.emplace_back();
+
+		variant.builder = builder;
+		variant.pipeline = variant.promise.get_future().share();
+
+		handles.emplace(std::move(key), handle);
+		queue.push_back(handle);
+	}
+
+	condition.notify_one();
+
+	return handle;
+}
+
+VkPipeline PipelineLibrary::get(PipelineHandle handle)
+{
+	std::shared_future<VkPipeline> pipeline;
+
+	{
+		std::scoped_lock lock(mutex);
+
+		pipeline = variants[handle].pipeline;
+	}
+
+	return pipeline.get();
+}
+
+std::optional<VkPipeline> PipelineLibrary::tryGet(PipelineHandle handle)
+{
+	std::shared_future<VkPipeline> pipeline;
+
+	{
+		std::scoped_lock lock(mutex);
+
+		pipeline = variants[handle].pipeline;
+	}
+
+	if (pipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	{
+		return std::nullopt;
+	}
+
+	return pipeline.get();
+}
+
+void PipelineLibrary::keepShaderModule(VkShaderModule shaderModule)
+{
+	std::scoped_lock lock(mutex);
+
+	shaderModules.push_back(shaderModule);
+}
+
+uint32_t PipelineLibrary::getVariantCount()
+{
+	std::scoped_lock lock(mutex);
+
+	return (uint32_t)variants.size();
+}
+
+void PipelineLibrary::work()
+{
+	while (true)
+	{
+		Variant* variant;
+
+		{
+			std::unique_lock lock(mutex);
+
+			condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			// Variants are never removed from the deque before cleanup, so the reference stays valid without the lock.
+			variant = &variants[queue.front()];
+			queue.pop_front();
+		}
+
+		variant->promise.set_value(buildVariant(variant->builder));
+	}
+}
+
+VkPipeline PipelineLibrary::buildVariant(const PipelineBuilder& builder)
+{
+	if (!useGraphicsPipelineLibrary)
+	{
+		return builder.build(device, pipelineCache);
+	}
+
+	// Parts are always requested in the same order, so two workers waiting on each other's parts can't deadlock.
+	VkPipeline libraries[] =
+	{
+		getPart(builder, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT),
+		getPart(builder, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT),
+		getPart(builder, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT),
+		getPart(builder, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT)
+	};
+
+	if (std::find(std::begin(libraries), std::end(libraries), VK_NULL_HANDLE) != std::end(libraries))
+	{
+		return VK_NULL_HANDLE;
+	}
+
+	return PipelineBuilder::link(device, libraries, builder.pipelineLayout, false, pipelineCache);
+}
+
+VkPipeline PipelineLibrary::getPart(const PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagBitsEXT libraryPart)
+{
+	std::string key = builder.key(libraryPart);
+	std::promise<VkPipeline> promise;
+
+	{
+		std::unique_lock lock(mutex);
+
+		auto it = parts.find(key);
+
+		if (it != parts.end())
+		{
+			std::shared_future<VkPipeline> part = it->second;
+
+			lock.unlock();
+
+			return part.get();
+		}
+
+		parts.emplace(std::move(key), promise.get_future().share());
+	}
+
+	VkPipeline part = builder.buildLibrary(device, libraryPart, pipelineCache);
+
+	promise.set_value(part);
+
+	return part;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <string>
+#include <thread>
+#include <optional>
+#include <vector>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "structures.h"
+
+using PipelineHandle = uint32_t;
+
+constexpr PipelineHandle INVALID_PIPELINE_HANDLE = UINT32_MAX;
+
+// Compiles graphics pipeline variants on worker threads. Each distinct builder state is compiled only once,
+// and requesting it again returns the same handle.
+// With VK_EXT_graphics_pipeline_library, variants are linked from separately compiled parts (vertex input,
+// pre-rasterization, fragment shader and fragment output), so a new variant only compiles the parts it doesn't share.
+class PipelineLibrary
+{
+public:
+	void initialize(VkDevice device, bool useGraphicsPipelineLibrary, uint32_t workerCount = 0);
+	void cleanUp();
+
+	// Queues the compilation of the variant described by the builder, unless it was already requested.
+	// The shader modules it references have to stay alive until the library is cleaned up, see keepShaderModule.
+	PipelineHandle request(const PipelineBuilder& builder);
+
+	// Blocks until the variant is compiled. Returns VK_NULL_HANDLE if its compilation failed.
+	VkPipeline get(PipelineHandle handle);
+
+	// Returns nothing while the variant is still being compiled, so the caller can skip it or draw with a placeholder,
+	// then the result of get.
+	std::optional<VkPipeline> tryGet(PipelineHandle handle);
+
+	// Hands a shader module over to the library, which destroys it after every pipeline using it.
+	void keepShaderModule(VkShaderModule shaderModule);
+
+	uint32_t getVariantCount();
+
+private:
+	struct Variant
+	{
+		PipelineBuilder builder;
+
+		std::promise<VkPipeline> promise;
+		std::shared_future<VkPipeline> pipeline;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	bool useGraphicsPipelineLibrary = false;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	std::deque<Variant> variants;
+	std::unordered_map<std::string, PipelineHandle> handles;
+	std::deque<PipelineHandle> queue;
+
+	// Pipeline library parts, keyed by the state of the part only.
+	std::unordered_map<std::string, std::shared_future<VkPipeline>> parts;
+
+	std::vector<VkShaderModule> shaderModules;
+	std::vector<std::thread> workers;
+
+	void work();
+
+	VkPipeline buildVariant(const PipelineBuilder& builder);
+	VkPipeline getPart(const PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagBitsEXT libraryPart);
+};
@@ -0,0 +1,36 @@
+#include "prepass.h"
+
+bool DepthPrepassController::update(float overdraw)
+{
+	if (overdraw <= 0.0f)
+	{
+		return enabled;
+	}
+
+	// Low-pass filter the measurements, the overdraw changes with every camera move.
+	filteredOverdraw = filteredOverdraw == 0.0f ? overdraw : filteredOverdraw + (overdraw - filteredOverdraw) * 0.1f;
+
+	if (cooldown > 0)
+	{
+		cooldown--;
+
+		return enabled;
+	}
+
+	bool shouldEnable = enabled ? filteredOverdraw > disableOverdraw : filteredOverdraw > enableOverdraw;
+
+	if (shouldEnable != enabled)
+	{
+		enabled = shouldEnable;
+		cooldown = holdFrames;
+	}
+
+	return enabled;
+}
+
+void DepthPrepassController::reset()
+{
+	filteredOverdraw = 0.0f;
+	enabled = false;
+	cooldown = 0;
+}
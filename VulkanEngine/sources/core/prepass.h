@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+enum class DepthPrepassMode
+{
+	Off,
+	On,
+	Automatic
+};
+
+// Turns the depth pre-pass on and off from the measured overdraw: the fragments passing the depth test per pixel, in
+// the pass that writes the depth. The pre-pass draws the geometry twice, so it only pays off when the main pass would
+// shade many hidden fragments. Separate thresholds and a hold time keep it from flipping every frame near the limit.
+struct DepthPrepassController
+{
+	float enableOverdraw = 2.0f;
+	float disableOverdraw = 1.5f;
+
+	// Number of frames to keep a decision before switching again.
+	uint32_t holdFrames = 30;
+
+	float filteredOverdraw = 0.0f;
+	bool enabled = false;
+	uint32_t cooldown = 0;
+
+	// Returns whether the pre-pass should run.
+	bool update(float overdraw);
+	void reset();
+};
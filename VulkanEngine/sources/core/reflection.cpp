@@ -0,0 +1,588 @@
+#include "reflection.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+namespace
+{
+	// The subset of the SPIR-V specification needed to find descriptor bindings and push constant blocks.
+	constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+	constexpr uint32_t SPIRV_HEADER_SIZE = 5;
+
+	enum SpirvOp : uint16_t
+	{
+		OP_ENTRY_POINT = 15,
+		OP_TYPE_BOOL = 20,
+		OP_TYPE_INT = 21,
+		OP_TYPE_FLOAT = 22,
+		OP_TYPE_VECTOR = 23,
+		OP_TYPE_MATRIX = 24,
+		OP_TYPE_IMAGE = 25,
+		OP_TYPE_SAMPLER = 26,
+		OP_TYPE_SAMPLED_IMAGE = 27,
+		OP_TYPE_ARRAY = 28,
+		OP_TYPE_RUNTIME_ARRAY = 29,
+		OP_TYPE_STRUCT = 30,
+		OP_TYPE_POINTER = 32,
+		OP_CONSTANT = 43,
+		OP_VARIABLE = 59,
+		OP_DECORATE = 71,
+		OP_MEMBER_DECORATE = 72,
+		OP_TYPE_ACCELERATION_STRUCTURE = 5341
+	};
+
+	enum SpirvDecoration : uint32_t
+	{
+		DECORATION_BUFFER_BLOCK = 3,
+		DECORATION_ARRAY_STRIDE = 6,
+		DECORATION_MATRIX_STRIDE = 7,
+		DECORATION_BINDING = 33,
+		DECORATION_DESCRIPTOR_SET = 34,
+		DECORATION_OFFSET = 35
+	};
+
+	enum SpirvStorageClass : uint32_t
+	{
+		STORAGE_CLASS_UNIFORM_CONSTANT = 0,
+		STORAGE_CLASS_UNIFORM = 2,
+		STORAGE_CLASS_PUSH_CONSTANT = 9,
+		STORAGE_CLASS_STORAGE_BUFFER = 12,
+		STORAGE_CLASS_PHYSICAL_STORAGE_BUFFER = 5349
+	};
+
+	struct SpirvId
+	{
+		uint16_t opcode = 0;
+		std::span<const uint32_t> operands; // Operands of the defining instruction, without the result id.
+
+		uint32_t storageClass = 0;
+		uint32_t set = UINT32_MAX;
+		uint32_t binding = UINT32_MAX;
+		uint32_t arrayStride = 0;
+		bool bufferBlock = false;
+
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	struct SpirvModule
+	{
+		std::vector<SpirvId> ids;
+
+		uint32_t constant(uint32_t id) const
+		{
+			// Array lengths are 32 bit integer constants: result type, id, value.
+			return ids[id].opcode == OP_CONSTANT ? ids[id].operands[1] : 1;
+		}
+
+		uint32_t size(uint32_t typeId, uint32_t matrixStride = 0) const
+		{
+			const SpirvId& type = ids[typeId];
+
+			switch (type.opcode)
+			{
+			case OP_TYPE_BOOL:
+				return 4;
+
+			case OP_TYPE_INT:
+			case OP_TYPE_FLOAT:
+				return type.operands[0] / 8;
+
+			case OP_TYPE_VECTOR:
+				return type.operands[1] * size(type.operands[0]);
+
+			case OP_TYPE_MATRIX:
+				return type.operands[1] * (matrixStride > 0 ? matrixStride : size(type.operands[0]));
+
+			case OP_TYPE_ARRAY:
+				return constant(type.operands[1]) * (type.arrayStride > 0 ? type.arrayStride : size(type.operands[0]));
+
+			case OP_TYPE_STRUCT:
+			{
+				uint32_t structSize = 0;
+
+				for (uint32_t i = 0; i < type.operands.size(); i++)
+				{
+					uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : 0;
+					uint32_t stride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+
+					structSize = std::max(structSize, offset + size(type.operands[i], stride));
+				}
+
+				return structSize;
+			}
+
+			case OP_TYPE_POINTER:
+				// Buffer device addresses.
+				return type.storageClass == STORAGE_CLASS_PHYSICAL_STORAGE_BUFFER ? 8 : 0;
+
+			default:
+				return 0;
+			}
+		}
+	};
+
+	VkShaderStageFlagBits executionModelStage(uint32_t executionModel)
+	{
+		switch (executionModel)
+		{
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: return VK_SHADER_STAGE_ALL;
+		}
+	}
+
+	bool descriptorType(const SpirvModule& module, uint32_t storageClass, uint32_t typeId, VkDescriptorType& outType)
+	{
+		const SpirvId& type = module.ids[typeId];
+
+		switch (type.opcode)
+		{
+		case OP_TYPE_SAMPLER:
+			outType = VK_DESCRIPTOR_TYPE_SAMPLER;
+			return true;
+
+		case OP_TYPE_SAMPLED_IMAGE:
+			outType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			return true;
+
+		case OP_TYPE_IMAGE:
+		{
+			// Operands: sampled type, dim, depth, arrayed, ms, sampled, format. Sampled is 2 for storage images.
+			bool storage = type.operands[5] == 2;
+
+			if (type.operands[1] == 5) // Buffer.
+			{
+				outType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			}
+			else if (type.operands[1] == 6) // SubpassData.
+			{
+				outType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			}
+			else
+			{
+				outType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			}
+
+			return true;
+		}
+
+		case OP_TYPE_STRUCT:
+			outType = storageClass == STORAGE_CLASS_STORAGE_BUFFER || type.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			return true;
+
+		case OP_TYPE_ACCELERATION_STRUCTURE:
+			outType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	template<typename T>
+	void appendBytes(std::string& key, const T& value)
+	{
+		key.append((const char*)&value, sizeof(T));
+	}
+}
+
+bool ShaderReflection::reflect(std::span<const uint32_t> code)
+{
+	if (code.size() < SPIRV_HEADER_SIZE || code[0] != SPIRV_MAGIC)
+	{
+		fmt::println("Invalid SPIR-V module.");
+
+		return false;
+	}
+
+	SpirvModule module;
+
+	module.ids.resize(code[3]); // The id bound.
+
+	std::vector<uint32_t> variables;
+
+	for (size_t i = SPIRV_HEADER_SIZE; i < code.size();)
+	{
+		uint16_t opcode = (uint16_t)(code[i] & 0xFFFF);
+		uint16_t wordCount = (uint16_t)(code[i] >> 16);
+
+		if (wordCount == 0 || i + wordCount > code.size())
+		{
+			fmt::println("Malformed SPIR-V instruction.");
+
+			return false;
+		}
+
+		std::span<const uint32_t> words = code.subspan(i + 1, wordCount - 1);
+
+		switch (opcode)
+		{
+		case OP_ENTRY_POINT:
+			stages |= executionModelStage(words[0]);
+			break;
+
+		case OP_DECORATE:
+		{
+			SpirvId& target = module.ids[words[0]];
+
+			if (words[1] == DECORATION_DESCRIPTOR_SET) target.set = words[2];
+			else if (words[1] == DECORATION_BINDING) target.binding = words[2];
+			else if (words[1] == DECORATION_ARRAY_STRIDE) target.arrayStride = words[2];
+			else if (words[1] == DECORATION_BUFFER_BLOCK) target.bufferBlock = true;
+
+			break;
+		}
+
+		case OP_MEMBER_DECORATE:
+		{
+			SpirvId& target = module.ids[words[0]];
+			uint32_t member = words[1];
+
+			if (words[2] == DECORATION_OFFSET || words[2] == DECORATION_MATRIX_STRIDE)
+			{
+				std::vector<uint32_t>& values = words[2] == DECORATION_OFFSET ? target.memberOffsets : target.memberMatrixStrides;
+
+				if (values.size() <= member)
+				{
+					values.resize(member + 1, 0);
+				}
+
+				values[member] = words[3];
+			}
+
+			break;
+		}
+
+		case OP_TYPE_BOOL:
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_MATRIX:
+		case OP_TYPE_IMAGE:
+		case OP_TYPE_SAMPLER:
+		case OP_TYPE_SAMPLED_IMAGE:
+		case OP_TYPE_ARRAY:
+		case OP_TYPE_RUNTIME_ARRAY:
+		case OP_TYPE_STRUCT:
+		case OP_TYPE_ACCELERATION_STRUCTURE:
+			module.ids[words[0]].opcode = opcode;
+			module.ids[words[0]].operands = words.subspan(1);
+			break;
+
+		case OP_TYPE_POINTER:
+			module.ids[words[0]].opcode = opcode;
+			module.ids[words[0]].operands = words.subspan(1);
+			module.ids[words[0]].storageClass = words[1];
+			break;
+
+		case OP_CONSTANT:
+			// Result type comes first for constants and variables.
+			module.ids[words[1]].opcode = opcode;
+			module.ids[words[1]].operands = words;
+			break;
+
+		case OP_VARIABLE:
+			module.ids[words[1]].opcode = opcode;
+			module.ids[words[1]].operands = words;
+			module.ids[words[1]].storageClass = words[2];
+			variables.push_back(words[1]);
+			break;
+
+		default:
+			break;
+		}
+
+		i += wordCount;
+	}
+
+	for (uint32_t variableId : variables)
+	{
+		const SpirvId& variable = module.ids[variableId];
+		const SpirvId& pointer = module.ids[variable.operands[0]];
+		uint32_t typeId = pointer.operands[1];
+
+		if (variable.storageClass == STORAGE_CLASS_PUSH_CONSTANT)
+		{
+			const SpirvId& block = module.ids[typeId];
+			uint32_t begin = block.memberOffsets.empty() ? 0 : *std::min_element(block.memberOffsets.begin(), block.memberOffsets.end());
+
+			pushConstantRange.stageFlags = stages;
+			pushConstantRange.offset = begin;
+			pushConstantRange.size = module.size(typeId) - begin;
+
+			continue;
+		}
+
+		if (variable.storageClass != STORAGE_CLASS_UNIFORM_CONSTANT && variable.storageClass != STORAGE_CLASS_UNIFORM && variable.storageClass != STORAGE_CLASS_STORAGE_BUFFER)
+		{
+			continue;
+		}
+
+		if (variable.set == UINT32_MAX || variable.binding == UINT32_MAX)
+		{
+			continue;
+		}
+
+		VkDescriptorSetLayoutBinding binding{};
+
+		binding.binding = variable.binding;
+		binding.descriptorCount = 1;
+		binding.stageFlags = stages;
+
+		// Descriptor arrays. Runtime sized ones get a single descriptor, as variable counts aren't supported by the layouts yet.
+		if (module.ids[typeId].opcode == OP_TYPE_ARRAY)
+		{
+			binding.descriptorCount = module.constant(module.ids[typeId].operands[1]);
+			typeId = module.ids[typeId].operands[0];
+		}
+		else if (module.ids[typeId].opcode == OP_TYPE_RUNTIME_ARRAY)
+		{
+			typeId = module.ids[typeId].operands[0];
+		}
+
+		if (!descriptorType(module, variable.storageClass, typeId, binding.descriptorType))
+		{
+			fmt::println("Unsupported descriptor at set {}, binding {}.", variable.set, variable.binding);
+
+			return false;
+		}
+
+		descriptorSets[variable.set].push_back(binding);
+	}
+
+	for (auto& [set, bindings] : descriptorSets)
+	{
+		std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	}
+
+	return true;
+}
+
+void ShaderReflection::merge(const ShaderReflection& other)
+{
+	stages |= other.stages;
+
+	for (const auto& [set, otherBindings] : other.descriptorSets)
+	{
+		std::vector<VkDescriptorSetLayoutBinding>& bindings = descriptorSets[set];
+
+		for (const VkDescriptorSetLayoutBinding& otherBinding : otherBindings)
+		{
+			auto it = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& binding) { return binding.binding == otherBinding.binding; });
+
+			if (it != bindings.end())
+			{
+				it->stageFlags |= otherBinding.stageFlags;
+			}
+			else
+			{
+				bindings.push_back(otherBinding);
+			}
+		}
+
+		std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	}
+
+	// A single range visible to every stage that declares push constants.
+	if (other.pushConstantRange.size > 0)
+	{
+		if (pushConstantRange.size == 0)
+		{
+			pushConstantRange = other.pushConstantRange;
+		}
+		else
+		{
+			uint32_t begin = std::min(pushConstantRange.offset, other.pushConstantRange.offset);
+			uint32_t end = std::max(pushConstantRange.offset + pushConstantRange.size, other.pushConstantRange.offset + other.pushConstantRange.size);
+
+			pushConstantRange.stageFlags |= other.pushConstantRange.stageFlags;
+			pushConstantRange.offset = begin;
+			pushConstantRange.size = end - begin;
+		}
+	}
+}
+
+bool ShaderReflection::fitsLayout(const ShaderReflection& layout, std::string& mismatch) const
+{
+	for (const auto& [set, bindings] : descriptorSets)
+	{
+		auto layoutSet = layout.descriptorSets.find(set);
+
+		for (const VkDescriptorSetLayoutBinding& binding : bindings)
+		{
+			const VkDescriptorSetLayoutBinding* layoutBinding = nullptr;
+
+			if (layoutSet != layout.descriptorSets.end())
+			{
+				auto it = std::find_if(layoutSet->second.begin(), layoutSet->second.end(), [&](const VkDescriptorSetLayoutBinding& other) { return other.binding == binding.binding; });
+
+				layoutBinding = it != layoutSet->second.end() ? &*it : nullptr;
+			}
+
+			// Bindings the shaders stopped using are fine, new or changed ones aren't bound by the engine.
+			if (layoutBinding == nullptr || layoutBinding->descriptorType != binding.descriptorType || layoutBinding->descriptorCount != binding.descriptorCount
+				|| (binding.stageFlags & ~layoutBinding->stageFlags) != 0)
+			{
+				mismatch = fmt::format("set {}, binding {} differs", set, binding.binding);
+
+				return false;
+			}
+		}
+	}
+
+	if (pushConstantRange.size > 0)
+	{
+		uint32_t size = pushConstantRange.offset + pushConstantRange.size;
+		uint32_t layoutSize = layout.pushConstantRange.offset + layout.pushConstantRange.size;
+
+		if (size != layoutSize)
+		{
+			mismatch = fmt::format("{} bytes of push constants instead of {}", size, layoutSize);
+
+			return false;
+		}
+
+		if ((pushConstantRange.stageFlags & ~layout.pushConstantRange.stageFlags) != 0)
+		{
+			mismatch = "push constants read by a new stage";
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void LayoutCache::initialize(VkDevice device)
+{
+	this->device = device;
+}
+
+void LayoutCache::cleanUp()
+{
+	for (auto& [key, pipelineLayout] : pipelineLayouts)
+	{
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	}
+
+	for (auto& [key, descriptorSetLayout] : descriptorSetLayouts)
+	{
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	}
+
+	pipelineLayouts.clear();
+	descriptorSetLayouts.clear();
+}
+
+std::string LayoutCache::getDescriptorSetLayoutKey(std::span<const VkDescriptorSetLayoutBinding> bindings)
+{
+	std::string key;
+
+	key.reserve(bindings.size() * (sizeof(uint32_t) + sizeof(VkDescriptorType) + sizeof(uint32_t) + sizeof(VkShaderStageFlags)));
+
+	for (const VkDescriptorSetLayoutBinding& binding : bindings)
+	{
+		appendBytes(key, binding.binding);
+		appendBytes(key, binding.descriptorType);
+		appendBytes(key, binding.descriptorCount);
+		appendBytes(key, binding.stageFlags);
+	}
+
+	return key;
+}
+
+VkDescriptorSetLayout LayoutCache::getDescriptorSetLayout(std::span<const VkDescriptorSetLayoutBinding> bindings)
+{
+	std::string key = getDescriptorSetLayoutKey(bindings);
+
+	auto it = descriptorSetLayouts.find(key);
+
+	if (it != descriptorSetLayouts.end())
+	{
+		return it->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	VkDescriptorSetLayout descriptorSetLayout;
+
+	descriptorSetLayoutCreateInfo.pBindings = bindings.data();
+	descriptorSetLayoutCreateInfo.bindingCount = (uint32_t)bindings.size();
+
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout));
+
+	descriptorSetLayouts.emplace(std::move(key), descriptorSetLayout);
+
+	return descriptorSetLayout;
+}
+
+VkPipelineLayout LayoutCache::getPipelineLayout(std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstantRanges)
+{
+	std::string key;
+
+	// Set layouts are already deduplicated, so their handles identify them.
+	appendBytes(key, (uint32_t)setLayouts.size());
+
+	for (VkDescriptorSetLayout setLayout : setLayouts)
+	{
+		appendBytes(key, setLayout);
+	}
+
+	for (const VkPushConstantRange& pushConstantRange : pushConstantRanges)
+	{
+		appendBytes(key, pushConstantRange.stageFlags);
+		appendBytes(key, pushConstantRange.offset);
+		appendBytes(key, pushConstantRange.size);
+	}
+
+	auto it = pipelineLayouts.find(key);
+
+	if (it != pipelineLayouts.end())
+	{
+		return it->second;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vkeUtils::pipelineLayoutCreateInfo();
+	VkPipelineLayout pipelineLayout;
+
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutCreateInfo.setLayoutCount = (uint32_t)setLayouts.size();
+	pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = (uint32_t)pushConstantRanges.size();
+
+	VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+	pipelineLayouts.emplace(std::move(key), pipelineLayout);
+
+	return pipelineLayout;
+}
+
+VkPipelineLayout LayoutCache::getPipelineLayout(const ShaderReflection& reflection)
+{
+	std::vector<VkDescriptorSetLayout> setLayouts;
+
+	for (const auto& [set, bindings] : reflection.descriptorSets)
+	{
+		// Unused sets in between still need a (empty) layout.
+		while (setLayouts.size() < set)
+		{
+			setLayouts.push_back(getDescriptorSetLayout({}));
+		}
+
+		setLayouts.push_back(getDescriptorSetLayout(bindings));
+	}
+
+	std::span<const VkPushConstantRange> pushConstantRanges;
+
+	if (reflection.pushConstantRange.size > 0)
+	{
+		pushConstantRanges = { &reflection.pushConstantRange, 1 };
+	}
+
+	return getPipelineLayout(setLayouts, pushConstantRanges);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Resources used by one or more shader modules, read back from their SPIR-V.
+struct ShaderReflection
+{
+	VkShaderStageFlags stages = 0;
+
+	// Bindings of each descriptor set, sorted by binding number.
+	std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>> descriptorSets;
+
+	// A size of zero means the shaders don't use push constants.
+	VkPushConstantRange pushConstantRange{};
+
+	bool reflect(std::span<const uint32_t> code);
+
+	// Combines the resources of another stage of the same pipeline.
+	void merge(const ShaderReflection& other);
+
+	// Whether these resources can be used through the pipeline layout built from the given reflection. Shaders may use
+	// less than the layout, but every binding and the push constant block have to match it. Otherwise, mismatch says why.
+	bool fitsLayout(const ShaderReflection& layout, std::string& mismatch) const;
+};
+
+// Creates descriptor set and pipeline layouts once per distinct description and hands out the same object afterwards.
+class LayoutCache
+{
+public:
+	void initialize(VkDevice device);
+	void cleanUp();
+
+	VkDescriptorSetLayout getDescriptorSetLayout(std::span<const VkDescriptorSetLayoutBinding> bindings);
+
+	// Key of a set layout in the cache, built from the bindings alone.
+	static std::string getDescriptorSetLayoutKey(std::span<const VkDescriptorSetLayoutBinding> bindings);
+	VkPipelineLayout getPipelineLayout(std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstantRanges);
+
+	// Builds the pipeline layout of the reflected shaders. Gaps between set numbers get empty set layouts.
+	VkPipelineLayout getPipelineLayout(const ShaderReflection& reflection);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+
+	// Keyed by the raw bytes of the description, so the hash map never confuses two different layouts.
+	std::unordered_map<std::string, VkDescriptorSetLayout> descriptorSetLayouts;
+	std::unordered_map<std::string, VkPipelineLayout> pipelineLayouts;
+};
@@ -0,0 +1,62 @@
+#include "scaling.h"
+
+float ResolutionController::update(float gpuFrameTime, float currentScale)
+{
+	if (gpuFrameTime <= 0.0f || targetFrameTime <= 0.0f)
+	{
+		return currentScale;
+	}
+
+	// Low-pass filter the measurements, a single spike shouldn't change the resolution.
+	filteredFrameTime = filteredFrameTime == 0.0f ? gpuFrameTime : filteredFrameTime + (gpuFrameTime - filteredFrameTime) * 0.2f;
+
+	// Positive error means there is headroom, negative means we are over budget.
+	float error = (targetFrameTime - filteredFrameTime) / targetFrameTime;
+	float derivative = error - previousError;
+
+	previousError = error;
+
+	if (cooldown > 0)
+	{
+		cooldown--;
+
+		return currentScale;
+	}
+
+	if (std::abs(error) < deadBand)
+	{
+		// Inside the dead band, bleed the integral term so it doesn't wind up while we hold the current scale.
+		integral *= 0.9f;
+
+		return currentScale;
+	}
+
+	integral = std::clamp(integral + error, -2.0f, 2.0f);
+
+	float output = proportionalGain * error + integralGain * integral + derivativeGain * derivative;
+
+	if (output > 0.0f)
+	{
+		output *= increaseDamping;
+	}
+
+	// GPU time scales roughly with the pixel count, which is quadratic on the render scale.
+	float scale = std::sqrt(std::clamp(currentScale * currentScale * (1.0f + output), minScale * minScale, maxScale * maxScale));
+
+	if (std::abs(scale - currentScale) < minimumStep)
+	{
+		return currentScale;
+	}
+
+	cooldown = cooldownFrames;
+
+	return scale;
+}
+
+void ResolutionController::reset()
+{
+	filteredFrameTime = 0.0f;
+	integral = 0.0f;
+	previousError = 0.0f;
+	cooldown = 0;
+}
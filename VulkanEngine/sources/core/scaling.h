@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// Drives Engine::renderScale from the measured GPU frame time, trying to hold a target frame time.
+// It's a PID controller on the relative frame time error, with a dead band and a cooldown acting as hysteresis,
+// so the resolution doesn't oscillate when the frame time is close to the target.
+struct ResolutionController
+{
+	float targetFrameTime = 16.6f; // In milliseconds.
+
+	float minScale = 0.25f;
+	float maxScale = 1.0f;
+
+	float proportionalGain = 0.15f;
+	float integralGain = 0.02f;
+	float derivativeGain = 0.05f;
+
+	// Relative error below which the scale is left untouched.
+	float deadBand = 0.05f;
+
+	// Increasing the resolution is damped, since overshooting the budget is worse than leaving some headroom.
+	float increaseDamping = 0.5f;
+
+	// Minimum scale change worth applying, and number of frames to wait after each change.
+	float minimumStep = 0.01f;
+	uint32_t cooldownFrames = 8;
+
+	float filteredFrameTime = 0.0f;
+	float integral = 0.0f;
+	float previousError = 0.0f;
+	uint32_t cooldown = 0;
+
+	float update(float gpuFrameTime, float currentScale);
+	void reset();
+};
@@ -0,0 +1,468 @@
+#include "shaders.h"
+
+#include <shaderc/shaderc.hpp>
+
+#include <chrono>
+#include <cassert>
+#include <sstream>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace
+{
+	// Resolves the #include directives of the shaders (GL_GOOGLE_include_directive) to files of the source directory.
+	class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface
+	{
+	public:
+		explicit ShaderIncluder(const std::filesystem::path& sourceDirectory) : sourceDirectory(sourceDirectory) {}
+
+		shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+		{
+			IncludedFile* included = new IncludedFile();
+			std::ifstream file(sourceDirectory / requestedSource);
+
+			// An empty source name tells shaderc the include failed, the content is then its error message.
+			if (file.is_open())
+			{
+				std::stringstream code;
+
+				code << file.rdbuf();
+
+				included->name = requestedSource;
+				included->content = code.str();
+			}
+			else
+			{
+				included->content = fmt::format("Can't open file {} included by {}.", requestedSource, requestingSource);
+			}
+
+			included->result = { included->name.c_str(), included->name.size(), included->content.c_str(), included->content.size(), included };
+
+			return &included->result;
+		}
+
+		void ReleaseInclude(shaderc_include_result* result) override
+		{
+			delete (IncludedFile*)result->user_data;
+		}
+
+	private:
+		struct IncludedFile
+		{
+			std::string name;
+			std::string content;
+
+			shaderc_include_result result;
+		};
+
+		std::filesystem::path sourceDirectory;
+	};
+}
+
+void ShaderManager::initialize(VkDevice device, const std::filesystem::path& sourceDirectory)
+{
+	this->device = device;
+	this->sourceDirectory = sourceDirectory;
+}
+
+void ShaderManager::cleanUp()
+{
+	running = false;
+
+	if (watcherThread.joinable())
+	{
+		watcherThread.join();
+	}
+
+#ifdef __linux__
+	if (inotifyFd >= 0)
+	{
+		close(inotifyFd);
+
+		inotifyFd = -1;
+	}
+#endif
+
+	// Pipelines rebuilt after the last frame boundary were never used.
+	for (PendingPipeline& pending : pendingPipelines)
+	{
+		vkDestroyPipeline(device, pending.pipeline, nullptr);
+	}
+
+	for (VkPipeline pipeline : ownedPipelines)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+	}
+
+	pendingPipelines.clear();
+	ownedPipelines.clear();
+	pipelines.clear();
+}
+
+void ShaderManager::registerPipeline(const char* name, std::vector<std::string> sources, const ShaderReflection& layout, VkPipeline* target, PipelineBuildFunction&& build)
+{
+	assert(!running);
+
+	pipelines.push_back({ name, std::move(sources), layout, target, std::move(build) });
+}
+
+void ShaderManager::startWatching()
+{
+	for (const ReloadablePipeline& pipeline : pipelines)
+	{
+		for (const std::string& source : pipeline.sources)
+		{
+			collectIncludes(source, includedFiles[source]);
+		}
+	}
+
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK);
+
+	if (inotifyFd < 0 || inotify_add_watch(inotifyFd, sourceDirectory.string().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		fmt::println("Can't watch the shader directory at {}.", sourceDirectory.string());
+
+		return;
+	}
+#endif
+
+	running = true;
+
+	watcherThread = std::thread(&ShaderManager::watch, this);
+}
+
+void ShaderManager::applyPendingPipelines(TimelineDeletionQueue& deletionQueue, uint64_t retireValue)
+{
+	std::scoped_lock lock(pendingMutex);
+
+	for (PendingPipeline& pending : pendingPipelines)
+	{
+		VkPipeline oldPipeline = *pending.target;
+
+		*pending.target = pending.pipeline;
+
+		ownedPipelines.insert(pending.pipeline);
+
+		// Frames still in flight may reference the old pipeline.
+		if (ownedPipelines.erase(oldPipeline) > 0)
+		{
+			deletionQueue.pushFunction(retireValue, [device = device, oldPipeline]()
+			{
+				vkDestroyPipeline(device, oldPipeline, nullptr);
+			});
+		}
+	}
+
+	pendingPipelines.clear();
+}
+
+void ShaderManager::watch()
+{
+	while (running)
+	{
+		std::unordered_set<std::string> changedSources;
+
+		waitForChanges(changedSources);
+
+		if (!changedSources.empty())
+		{
+			reload(changedSources);
+		}
+	}
+}
+
+#ifdef __linux__
+void ShaderManager::waitForChanges(std::unordered_set<std::string>& changedSources)
+{
+	alignas(inotify_event) char buffer[4096];
+
+	while (running)
+	{
+		ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+
+		for (ssize_t offset = 0; offset < length;)
+		{
+			inotify_event* event = (inotify_event*)(buffer + offset);
+
+			if (event->len > 0)
+			{
+				changedSources.insert(event->name);
+			}
+
+			offset += sizeof(inotify_event) + event->len;
+		}
+
+		// Editors usually save in several steps, so keep collecting events until the directory settles down.
+		if (length <= 0 && !changedSources.empty())
+		{
+			break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+#else
+void ShaderManager::waitForChanges(std::unordered_set<std::string>& changedSources)
+{
+	// Without inotify, poll the modification time of the registered sources.
+	while (running && changedSources.empty())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+		for (const ReloadablePipeline& pipeline : pipelines)
+		{
+			for (const std::string& source : pipeline.sources)
+			{
+				std::vector<std::string> watchedFiles = { source };
+
+				watchedFiles.insert(watchedFiles.end(), includedFiles[source].begin(), includedFiles[source].end());
+
+				for (const std::string& watchedFile : watchedFiles)
+				{
+					std::error_code error;
+					std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(sourceDirectory / watchedFile, error);
+
+					if (error)
+					{
+						continue;
+					}
+
+					auto [it, inserted] = lastWriteTimes.try_emplace(watchedFile, writeTime);
+
+					if (!inserted && it->second != writeTime)
+					{
+						it->second = writeTime;
+
+						changedSources.insert(watchedFile);
+					}
+				}
+			}
+		}
+	}
+}
+#endif
+
+void ShaderManager::reload(const std::unordered_set<std::string>& changedSources)
+{
+	// A source is stale when it changed itself, or when one of the files it includes did.
+	std::unordered_set<std::string> staleSources;
+
+	for (const ReloadablePipeline& pipeline : pipelines)
+	{
+		for (const std::string& source : pipeline.sources)
+		{
+			const std::unordered_set<std::string>& includes = includedFiles[source];
+
+			if (changedSources.contains(source) || std::any_of(includes.begin(), includes.end(), [&](const std::string& include) { return changedSources.contains(include); }))
+			{
+				staleSources.insert(source);
+			}
+		}
+	}
+
+	for (const std::string& source : staleSources)
+	{
+		spirvCache.erase(source);
+
+		// The edit may have added or removed includes.
+		includedFiles[source].clear();
+
+		collectIncludes(source, includedFiles[source]);
+	}
+
+	for (ReloadablePipeline& pipeline : pipelines)
+	{
+		bool affected = std::any_of(pipeline.sources.begin(), pipeline.sources.end(), [&](const std::string& source) { return staleSources.contains(source); });
+
+		if (!affected)
+		{
+			continue;
+		}
+
+		std::vector<VkShaderModule> shaderModules;
+		ShaderReflection reflection;
+		bool succeeded = true;
+
+		for (const std::string& source : pipeline.sources)
+		{
+			auto it = spirvCache.find(source);
+
+			if (it == spirvCache.end())
+			{
+				std::vector<uint32_t> spirv;
+
+				if (!compile(source, spirv))
+				{
+					succeeded = false;
+					break;
+				}
+
+				it = spirvCache.emplace(source, std::move(spirv)).first;
+			}
+
+			ShaderReflection moduleReflection;
+
+			if (!moduleReflection.reflect(it->second))
+			{
+				succeeded = false;
+				break;
+			}
+
+			reflection.merge(moduleReflection);
+
+			VkShaderModule shaderModule;
+
+			if (!vkeUtils::createShaderModule(it->second, device, &shaderModule))
+			{
+				succeeded = false;
+				break;
+			}
+
+			shaderModules.push_back(shaderModule);
+		}
+
+		std::string mismatch;
+
+		// A changed push constant block or binding would be read through the old layout, and silently corrupted.
+		if (succeeded && !reflection.fitsLayout(pipeline.layout, mismatch))
+		{
+			fmt::println("The {} shaders don't fit the pipeline layout anymore ({}), restart to apply them.", pipeline.name, mismatch);
+
+			succeeded = false;
+		}
+
+		VkPipeline newPipeline = succeeded ? pipeline.build(shaderModules) : VK_NULL_HANDLE;
+
+		for (VkShaderModule shaderModule : shaderModules)
+		{
+			vkDestroyShaderModule(device, shaderModule, nullptr);
+		}
+
+		// On failure the current pipeline is kept, so a typo never takes the renderer down.
+		if (newPipeline == VK_NULL_HANDLE)
+		{
+			fmt::println("Keeping the previous {} pipeline.", pipeline.name);
+
+			continue;
+		}
+
+		fmt::println("Reloaded the {} pipeline.", pipeline.name);
+
+		std::scoped_lock lock(pendingMutex);
+
+		// A pipeline rebuilt twice before a frame boundary only needs its latest version.
+		for (auto it = pendingPipelines.begin(); it != pendingPipelines.end(); it++)
+		{
+			if (it->target == pipeline.target)
+			{
+				vkDestroyPipeline(device, it->pipeline, nullptr);
+				pendingPipelines.erase(it);
+				break;
+			}
+		}
+
+		pendingPipelines.push_back({ pipeline.target, newPipeline });
+	}
+}
+
+bool ShaderManager::compile(const std::string& source, std::vector<uint32_t>& spirv)
+{
+	std::filesystem::path sourcePath = sourceDirectory / source;
+	std::ifstream file(sourcePath);
+
+	if (!file.is_open())
+	{
+		fmt::println("Can't open file at {}.", sourcePath.string());
+
+		return false;
+	}
+
+	std::stringstream code;
+
+	code << file.rdbuf();
+	file.close();
+
+	std::string extension = sourcePath.extension().string();
+	shaderc_shader_kind kind;
+
+	if (extension == ".vert")
+	{
+		kind = shaderc_glsl_vertex_shader;
+	}
+	else if (extension == ".frag")
+	{
+		kind = shaderc_glsl_fragment_shader;
+	}
+	else if (extension == ".comp")
+	{
+		kind = shaderc_glsl_compute_shader;
+	}
+	else
+	{
+		fmt::println("Unknown shader stage for {}.", source);
+
+		return false;
+	}
+
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options;
+
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	options.SetIncluder(std::make_unique<ShaderIncluder>(sourceDirectory));
+
+	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(code.str(), kind, source.c_str(), options);
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		fmt::println("Failed to compile {}:\n{}", source, result.GetErrorMessage());
+
+		return false;
+	}
+
+	spirv.assign(result.cbegin(), result.cend());
+
+	// Keep the binary next to its source, so the next launch starts with the latest version.
+	std::ofstream binary(sourcePath.string() + ".spv", std::ios::binary | std::ios::trunc);
+
+	binary.write((const char*)spirv.data(), spirv.size() * sizeof(uint32_t));
+
+	return true;
+}
+
+void ShaderManager::collectIncludes(const std::string& file, std::unordered_set<std::string>& includes)
+{
+	std::ifstream stream(sourceDirectory / file);
+	std::string line;
+
+	while (std::getline(stream, line))
+	{
+		size_t directive = line.find_first_not_of(" \t");
+
+		if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+		{
+			continue;
+		}
+
+		size_t begin = line.find('"', directive);
+		size_t end = begin == std::string::npos ? std::string::npos : line.find('"', begin + 1);
+
+		if (end == std::string::npos)
+		{
+			continue;
+		}
+
+		std::string include = line.substr(begin + 1, end - begin - 1);
+
+		// Included files may include others in turn, the set also guards against cycles.
+		if (includes.insert(include).second)
+		{
+			collectIncludes(include, includes);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <span>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utils.h"
+#include "reflection.h"
+#include "structures.h"
+
+// Builds a pipeline from shader modules given in the same order as the sources it was registered with.
+using PipelineBuildFunction = std::function<VkPipeline(std::span<VkShaderModule> shaderModules)>;
+
+// Watches the shader sources, recompiles the ones that changed on a background thread and rebuilds the pipelines
+// that use them. Rebuilt pipelines are only swapped in by the render thread, between two frames.
+class ShaderManager
+{
+public:
+	void initialize(VkDevice device, const std::filesystem::path& sourceDirectory);
+	void cleanUp();
+
+	// Registers a pipeline to be rebuilt whenever one of its GLSL sources (file names inside the source directory), or a
+	// file they include, changes. The layout is the reflection the pipeline layout was built from: rebuilt shaders that
+	// don't fit it anymore are rejected, since the layout itself is never rebuilt.
+	// Pipelines have to be registered before the watcher is started.
+	void registerPipeline(const char* name, std::vector<std::string> sources, const ShaderReflection& layout, VkPipeline* target, PipelineBuildFunction&& build);
+	void startWatching();
+
+	// Swaps in the rebuilt pipelines. The replaced ones are destroyed by the given deletion queue, once the graphics timeline
+	// reaches retireValue. Pipelines the manager didn't create (the ones built at startup) are left to their owner.
+	void applyPendingPipelines(TimelineDeletionQueue& deletionQueue, uint64_t retireValue);
+
+private:
+	struct ReloadablePipeline
+	{
+		std::string name;
+		std::vector<std::string> sources;
+		ShaderReflection layout;
+
+		VkPipeline* target;
+		PipelineBuildFunction build;
+	};
+
+	struct PendingPipeline
+	{
+		VkPipeline* target;
+		VkPipeline pipeline;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::filesystem::path sourceDirectory;
+
+	std::vector<ReloadablePipeline> pipelines;
+	std::unordered_map<std::string, std::vector<uint32_t>> spirvCache;
+
+	// Files each source pulls in through #include, followed recursively. Only touched by the watcher thread once started.
+	std::unordered_map<std::string, std::unordered_set<std::string>> includedFiles;
+
+	std::mutex pendingMutex;
+	std::vector<PendingPipeline> pendingPipelines;
+
+	// Rebuilt pipelines currently in use, destroyed when replaced again or at cleanup.
+	std::unordered_set<VkPipeline> ownedPipelines;
+
+	std::thread watcherThread;
+	std::atomic<bool> running = false;
+
+#ifdef __linux__
+	int inotifyFd = -1;
+#else
+	std::unordered_map<std::string, std::filesystem::file_time_type> lastWriteTimes;
+#endif
+
+	void watch();
+	void waitForChanges(std::unordered_set<std::string>& changedSources);
+	void reload(const std::unordered_set<std::string>& changedSources);
+
+	bool compile(const std::string& source, std::vector<uint32_t>& spirv);
+	void collectIncludes(const std::string& file, std::unordered_set<std::string>& includes);
+};
@@ -0,0 +1,66 @@
+#include "shadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <algorithm>
+
+std::array<float, SHADOW_CASCADE_COUNT> getShadowCascadeSplits(float zNear, float shadowDistance, float lambda)
+{
+	std::array<float, SHADOW_CASCADE_COUNT> splits;
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		float fraction = (float)(i + 1) / (float)SHADOW_CASCADE_COUNT;
+
+		float logarithmic = zNear * std::pow(shadowDistance / zNear, fraction);
+		float uniform = zNear + (shadowDistance - zNear) * fraction;
+
+		splits[i] = lambda * logarithmic + (1.0f - lambda) * uniform;
+	}
+
+	return splits;
+}
+
+glm::mat4 getSunView(glm::vec3 direction)
+{
+	// Any up vector works as long as it isn't parallel to the direction.
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	return glm::lookAt(glm::vec3(0.0f), direction, up);
+}
+
+ShadowCascadeFit fitShadowCascade(const glm::mat4& inverseView, float tanHalfFovX, float tanHalfFovY, float sliceNear, float sliceFar, const glm::mat4& sunView, float casterDistance)
+{
+	// The smallest sphere through the corners of the slice is centered on the view axis. Squared distance of a corner to
+	// the axis, per unit of depth.
+	float diagonal = tanHalfFovX * tanHalfFovX + tanHalfFovY * tanHalfFovY;
+	float centerDepth = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + diagonal), sliceFar);
+	float radius = std::sqrt((sliceFar - centerDepth) * (sliceFar - centerDepth) + sliceFar * sliceFar * diagonal);
+
+	// Padding the sphere by a snapping step, which is a fraction of the padded extent.
+	float halfExtent = radius / (1.0f - 2.0f * (float)SHADOW_CASCADE_SNAP_TEXELS / (float)SHADOW_CASCADE_RESOLUTION);
+	float texelSize = 2.0f * halfExtent / (float)SHADOW_CASCADE_RESOLUTION;
+	float step = texelSize * (float)SHADOW_CASCADE_SNAP_TEXELS;
+
+	glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+	glm::vec3 lightCenter = glm::floor(glm::vec3(sunView * glm::vec4(center, 1.0f)) / step + 0.5f) * step;
+
+	// Light space looks down -z, towards the scene. Swapping the planes reverses the depth, and the depth range is Vulkan's
+	// whether or not GLM_FORCE_DEPTH_ZERO_TO_ONE is defined.
+	glm::mat4 projection = glm::orthoRH_ZO(lightCenter.x - halfExtent, lightCenter.x + halfExtent, lightCenter.y - halfExtent, lightCenter.y + halfExtent,
+		-(lightCenter.z - halfExtent), -(lightCenter.z + halfExtent + casterDistance));
+
+	return { projection * sunView, texelSize };
+}
+
+VkRect2D getShadowCascadeRect(uint32_t cascade)
+{
+	VkRect2D rect;
+
+	rect.offset.x = (int32_t)((cascade % 2) * SHADOW_CASCADE_RESOLUTION);
+	rect.offset.y = (int32_t)((cascade / 2) * SHADOW_CASCADE_RESOLUTION);
+	rect.extent = { SHADOW_CASCADE_RESOLUTION, SHADOW_CASCADE_RESOLUTION };
+
+	return rect;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+// Cascades of the sun's shadow map, laid out as a 2x2 grid in the shadow atlases.
+// colored_triangle.frag declares the same constants.
+constexpr uint32_t SHADOW_CASCADE_COUNT = 4;
+constexpr uint32_t SHADOW_CASCADE_RESOLUTION = 2048;
+constexpr uint32_t SHADOW_ATLAS_RESOLUTION = 2 * SHADOW_CASCADE_RESOLUTION;
+
+// Cascades move in steps of this many texels. Coarse steps keep a cached cascade valid while the camera moves inside
+// a step, and every cascade is padded by a step so its slice of the view frustum stays covered.
+constexpr uint32_t SHADOW_CASCADE_SNAP_TEXELS = 64;
+
+struct ShadowPushConstants
+{
+	glm::mat4 viewProjection;
+
+	VkDeviceAddress vertexBufferAddress;
+};
+
+// Orthographic projection of a cascade, with a reversed depth like the camera (the light side maps to one).
+struct ShadowCascadeFit
+{
+	glm::mat4 viewProjection;
+	float texelSize; // World space size of a texel of the cascade.
+};
+
+// Far view depths of the cascades, blending a logarithmic and a uniform distribution of [zNear, shadowDistance] by lambda.
+std::array<float, SHADOW_CASCADE_COUNT> getShadowCascadeSplits(float zNear, float shadowDistance, float lambda);
+
+// View of a light shining in the given direction.
+glm::mat4 getSunView(glm::vec3 direction);
+
+// Fits a cascade around the slice [sliceNear, sliceFar] of the camera frustum. The slice is wrapped in a sphere, whose
+// radius only depends on the field of view and the slice depths, so the cascade doesn't change size as the camera turns.
+// Its center is snapped in light space to steps of SHADOW_CASCADE_SNAP_TEXELS texels, and casters up to casterDistance
+// in front of the sphere are kept.
+ShadowCascadeFit fitShadowCascade(const glm::mat4& inverseView, float tanHalfFovX, float tanHalfFovY, float sliceNear, float sliceFar, const glm::mat4& sunView, float casterDistance);
+
+// Area of a cascade inside the shadow atlases.
+VkRect2D getShadowCascadeRect(uint32_t cascade);
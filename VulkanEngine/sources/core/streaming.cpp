@@ -0,0 +1,398 @@
+#include "streaming.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// Due to forward declaration...
+#include "engine.h"
+
+void WorldStreamer::initialize(Engine* engine, VkDeviceSize budget)
+{
+	this->engine = engine;
+	this->budget = budget;
+
+	worker = std::thread(&WorldStreamer::work, this);
+}
+
+void WorldStreamer::cleanUp()
+{
+	{
+		std::scoped_lock lock(mutex);
+
+		stopping = true;
+		queue.clear();
+	}
+
+	condition.notify_all();
+
+	if (worker.joinable())
+	{
+		worker.join();
+	}
+
+	for (WorldCell& cell : cells)
+	{
+		if (cell.state == CellState::Resident)
+		{
+			evictCell(cell);
+		}
+	}
+
+	cells.clear();
+	results.clear();
+}
+
+bool WorldStreamer::loadManifest(const std::filesystem::path& manifestPath)
+{
+	std::ifstream file(manifestPath);
+
+	if (!file.is_open())
+	{
+		fmt::println("Failed to open world manifest \"{}\".", manifestPath.string());
+
+		return false;
+	}
+
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string keyword;
+
+		if (!(stream >> keyword) || keyword[0] == '#')
+		{
+			continue;
+		}
+
+		WorldCell cell;
+		std::string path;
+
+		if (keyword != "cell" || !(stream >> cell.center.x >> cell.center.y >> cell.center.z >> cell.radius >> path))
+		{
+			fmt::println("Ignoring invalid world manifest line \"{}\".", line);
+
+			continue;
+		}
+
+		cell.path = manifestPath.parent_path() / path;
+
+		std::error_code error;
+		cell.estimatedBytes = std::filesystem::file_size(cell.path, error);
+
+		if (error)
+		{
+			fmt::println("Ignoring missing world cell \"{}\".", cell.path.string());
+
+			continue;
+		}
+
+		cells.push_back(std::move(cell));
+	}
+
+	fmt::println("World manifest \"{}\": {} cells.", manifestPath.string(), cells.size());
+
+	return true;
+}
+
+void WorldStreamer::update(const glm::vec3& viewPosition, const glm::vec3& viewDirection)
+{
+	for (WorldCell& cell : cells)
+	{
+		glm::vec3 toCell = cell.center - viewPosition;
+		float centerDistance = glm::length(toCell);
+		float facing = centerDistance > cell.radius ? glm::dot(toCell / centerDistance, viewDirection) : 1.0f;
+
+		// Cells behind the camera count as up to twice as far as the ones in front of it.
+		cell.distance = std::max(0.0f, centerDistance - cell.radius);
+		cell.priority = cell.distance * (1.5f - 0.5f * facing);
+	}
+
+	receiveResults();
+
+	for (WorldCell& cell : cells)
+	{
+		if (cell.distance <= unloadRadius)
+		{
+			continue;
+		}
+
+		// Requests still in the queue are dropped when it is rebuilt, the ones being parsed are ignored on arrival.
+		if (cell.state == CellState::Resident)
+		{
+			evictCell(cell);
+		}
+		else if (cell.state == CellState::Requested || cell.state == CellState::Parsed)
+		{
+			cell.parsedMeshes = {};
+			cell.state = CellState::Unloaded;
+		}
+	}
+
+	uploadCells();
+	requestCells();
+}
+
+void WorldStreamer::work()
+{
+	while (true)
+	{
+		std::pair<uint32_t, uint32_t> request;
+
+		{
+			std::unique_lock lock(mutex);
+
+			condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			request = queue.front();
+			queue.pop_front();
+		}
+
+		// Cells are only added by loadManifest, before streaming starts, so the path can be read without the lock.
+		std::optional<std::vector<MeshData>> meshes = parseGLTFMeshes(cells[request.first].path);
+
+		std::scoped_lock lock(mutex);
+
+		results.push_back({ request.first, request.second, std::move(meshes) });
+	}
+}
+
+void WorldStreamer::receiveResults()
+{
+	std::vector<ParseResult> receivedResults;
+
+	{
+		std::scoped_lock lock(mutex);
+
+		std::swap(receivedResults, results);
+	}
+
+	for (ParseResult& result : receivedResults)
+	{
+		WorldCell& cell = cells[result.cell];
+
+		if (cell.state != CellState::Requested || cell.generation != result.generation)
+		{
+			continue;
+		}
+
+		if (!result.meshes.has_value())
+		{
+			fmt::println("Failed to stream world cell \"{}\".", cell.path.string());
+
+			cell.state = CellState::Failed;
+
+			continue;
+		}
+
+		cell.parsedMeshes = std::move(result.meshes.value());
+		cell.estimatedBytes = 0;
+
+		for (const MeshData& meshData : cell.parsedMeshes)
+		{
+			cell.estimatedBytes += meshData.vertices.size() * sizeof(Vertex) + meshData.indices.size() * sizeof(uint32_t);
+		}
+
+		cell.state = CellState::Parsed;
+	}
+}
+
+void WorldStreamer::uploadCells()
+{
+	std::vector<WorldCell*> parsedCells;
+
+	for (WorldCell& cell : cells)
+	{
+		if (cell.state == CellState::Parsed)
+		{
+			parsedCells.push_back(&cell);
+		}
+	}
+
+	std::sort(parsedCells.begin(), parsedCells.end(), [](const WorldCell* a, const WorldCell* b) { return a->priority < b->priority; });
+
+	VkDeviceSize uploadedBytes = 0;
+
+	for (WorldCell* cell : parsedCells)
+	{
+		// At least one cell is uploaded per frame, however large it is.
+		if (uploadedBytes > 0 && uploadedBytes + cell->estimatedBytes > uploadBytesPerFrame)
+		{
+			break;
+		}
+
+		// When the cell isn't worth evicting anything, it goes back to the unloaded cells to be requested again later.
+		if (!makeRoom(cell->estimatedBytes, cell->priority, true) || !uploadCell(*cell))
+		{
+			cell->parsedMeshes = {};
+			cell->state = CellState::Unloaded;
+
+			continue;
+		}
+
+		uploadedBytes += cell->residentBytes;
+	}
+}
+
+void WorldStreamer::requestCells()
+{
+	std::vector<WorldCell*> candidates;
+	uint32_t requestedCells = 0;
+
+	for (WorldCell& cell : cells)
+	{
+		if (cell.state == CellState::Unloaded && cell.distance <= loadRadius)
+		{
+			candidates.push_back(&cell);
+		}
+		else if (cell.state == CellState::Requested || cell.state == CellState::Parsed)
+		{
+			requestedCells++;
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const WorldCell* a, const WorldCell* b) { return a->priority < b->priority; });
+
+	for (WorldCell* cell : candidates)
+	{
+		if (requestedCells >= maxRequestedCells)
+		{
+			break;
+		}
+
+		if (!makeRoom(cell->estimatedBytes, cell->priority, false))
+		{
+			continue;
+		}
+
+		cell->state = CellState::Requested;
+		cell->generation++;
+
+		requestedCells++;
+	}
+
+	// The queue is rebuilt every frame, so the worker always picks the most urgent cell next.
+	std::vector<uint32_t> requested;
+
+	for (uint32_t i = 0; i < (uint32_t)cells.size(); i++)
+	{
+		if (cells[i].state == CellState::Requested)
+		{
+			requested.push_back(i);
+		}
+	}
+
+	std::sort(requested.begin(), requested.end(), [this](uint32_t a, uint32_t b) { return cells[a].priority < cells[b].priority; });
+
+	{
+		std::scoped_lock lock(mutex);
+
+		queue.clear();
+
+		for (uint32_t cell : requested)
+		{
+			queue.emplace_back(cell, cells[cell].generation);
+		}
+	}
+
+	if (!requested.empty())
+	{
+		condition.notify_one();
+	}
+}
+
+bool WorldStreamer::uploadCell(WorldCell& cell)
+{
+	VkDeviceSize cellBytes = 0;
+
+	for (MeshData& meshData : cell.parsedMeshes)
+	{
+		std::shared_ptr<MeshAsset> meshAsset = uploadMeshData(engine, meshData);
+
+		// The geometry arena is full, nothing of the cell stays resident.
+		if (meshAsset == nullptr)
+		{
+			for (std::shared_ptr<MeshAsset>& uploadedMesh : cell.meshes)
+			{
+				engine->freeMeshBuffers(uploadedMesh->meshBuffers);
+			}
+
+			cell.meshes.clear();
+
+			return false;
+		}
+
+		cellBytes += meshData.vertices.size() * sizeof(Vertex) + meshData.indices.size() * sizeof(uint32_t);
+
+		cell.meshes.push_back(meshAsset);
+	}
+
+	// The CPU copy isn't needed anymore, the cell can be parsed again if it's evicted.
+	cell.parsedMeshes = {};
+	cell.residentBytes = cellBytes;
+	cell.state = CellState::Resident;
+
+	residentBytes += cellBytes;
+	residencyVersion++;
+
+	return true;
+}
+
+void WorldStreamer::evictCell(WorldCell& cell)
+{
+	for (std::shared_ptr<MeshAsset>& meshAsset : cell.meshes)
+	{
+		engine->freeMeshBuffers(meshAsset->meshBuffers);
+	}
+
+	cell.meshes.clear();
+
+	residentBytes -= cell.residentBytes;
+
+	cell.residentBytes = 0;
+	cell.state = CellState::Unloaded;
+
+	residencyVersion++;
+}
+
+bool WorldStreamer::makeRoom(VkDeviceSize bytes, float priority, bool evict)
+{
+	VkDeviceSize evictableBytes = 0;
+
+	for (const WorldCell& cell : cells)
+	{
+		if (cell.state == CellState::Resident && cell.priority > priority)
+		{
+			evictableBytes += cell.residentBytes;
+		}
+	}
+
+	if (residentBytes - evictableBytes + bytes > budget)
+	{
+		return false;
+	}
+
+	// Least urgent first.
+	while (evict && residentBytes + bytes > budget)
+	{
+		WorldCell* leastUrgent = nullptr;
+
+		for (WorldCell& cell : cells)
+		{
+			if (cell.state == CellState::Resident && cell.priority > priority && (leastUrgent == nullptr || cell.priority > leastUrgent->priority))
+			{
+				leastUrgent = &cell;
+			}
+		}
+
+		evictCell(*leastUrgent);
+	}
+
+	return true;
+}
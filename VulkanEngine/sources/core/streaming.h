@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <condition_variable>
+
+#include "loader.h"
+
+// Forward declaration...
+class Engine;
+
+enum class CellState
+{
+	Unloaded,
+	Requested,
+	Parsed,
+	Resident,
+	Failed
+};
+
+// A region of the world, backed by a cooked glTF file whose meshes are already in world space.
+struct WorldCell
+{
+	std::filesystem::path path;
+
+	glm::vec3 center;
+	float radius;
+
+	CellState state = CellState::Unloaded;
+
+	// Lower is more urgent, see WorldStreamer::update.
+	float priority = 0.0f;
+	float distance = 0.0f;
+
+	// The file size until the cell is parsed once, the size of its geometry afterwards.
+	VkDeviceSize estimatedBytes = 0;
+	VkDeviceSize residentBytes = 0;
+
+	// Incremented by each request, so results of a cancelled request are recognized and dropped.
+	uint32_t generation = 0;
+
+	std::vector<MeshData> parsedMeshes;
+	std::vector<std::shared_ptr<MeshAsset>> meshes;
+};
+
+// Streams the cells of a world in and out around the camera. Cells are parsed on a background thread, uploaded
+// on the render thread a few per frame, and evicted once they're out of range or when the geometry budget is exceeded.
+//
+// The manifest is a text file with one cell per line: "cell <x> <y> <z> <radius> <path>", the path being
+// relative to the manifest. Empty lines and lines starting with '#' are ignored.
+class WorldStreamer
+{
+public:
+	void initialize(Engine* engine, VkDeviceSize budget);
+	void cleanUp();
+
+	bool loadManifest(const std::filesystem::path& manifestPath);
+
+	// Called once per frame by the render thread, before recording.
+	void update(const glm::vec3& viewPosition, const glm::vec3& viewDirection);
+
+	const std::vector<WorldCell>& getCells() const { return cells; }
+
+	VkDeviceSize budget = 0;
+	VkDeviceSize residentBytes = 0;
+
+	// Incremented whenever a cell becomes resident or is evicted, so caches built from the resident geometry can tell
+	// when it changed.
+	uint64_t residencyVersion = 0;
+
+	// Cells are requested inside the load radius and evicted outside the unload radius (both from the cell bounds).
+	float loadRadius = 100.0f;
+	float unloadRadius = 150.0f;
+
+	// Parsed cells wait in RAM until they're uploaded, this bounds how many of them can pile up.
+	uint32_t maxRequestedCells = 4;
+	VkDeviceSize uploadBytesPerFrame = 8 * 1024 * 1024;
+
+private:
+	struct ParseResult
+	{
+		uint32_t cell;
+		uint32_t generation;
+
+		std::optional<std::vector<MeshData>> meshes;
+	};
+
+	Engine* engine = nullptr;
+
+	std::vector<WorldCell> cells;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	// Both shared with the worker, under the mutex. The queue is kept sorted by priority.
+	std::deque<std::pair<uint32_t, uint32_t>> queue;
+	std::vector<ParseResult> results;
+
+	std::thread worker;
+
+	void work();
+
+	void receiveResults();
+	void uploadCells();
+	void requestCells();
+
+	bool uploadCell(WorldCell& cell);
+	void evictCell(WorldCell& cell);
+
+	// Checks whether the bytes fit in the budget once the resident cells less urgent than the priority are gone,
+	// and evicts them if asked to.
+	bool makeRoom(VkDeviceSize bytes, float priority, bool evict);
+};
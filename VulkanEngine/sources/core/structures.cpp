@@ -1,11 +1,11 @@
 #include "structures.h"
 
-void DescriptorLayoutBuilder::addBinding(uint32_t binding, VkDescriptorType type)
+void DescriptorLayoutBuilder::addBinding(uint32_t binding, VkDescriptorType type, uint32_t count)
 {
 	VkDescriptorSetLayoutBinding descriptorSetLayoutBinding = {};
 
 	descriptorSetLayoutBinding.binding = binding;
-	descriptorSetLayoutBinding.descriptorCount = 1;
+	descriptorSetLayoutBinding.descriptorCount = count;
 	descriptorSetLayoutBinding.descriptorType = type;
 
 	bindings.push_back(descriptorSetLayoutBinding);
@@ -37,7 +37,18 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderSt
 	return descriptorSetLayout;
 }
 
-void DescriptorAllocator::initialize(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios)
+VkDescriptorSetLayout DescriptorLayoutBuilder::build(LayoutCache& layoutCache, VkShaderStageFlags shaderStages)
+{
+	for (VkDescriptorSetLayoutBinding& binding : bindings)
+	{
+		binding.stageFlags |= shaderStages;
+	}
+
+	// The cache owns the layout, and returns the same one to the pipelines reflecting these bindings.
+	return layoutCache.getDescriptorSetLayout(bindings);
+}
+
+void DescriptorAllocator::initialize(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios, VkDescriptorPoolCreateFlags flags)
 {
 	std::vector<VkDescriptorPoolSize> poolSizes;
 
@@ -52,7 +63,7 @@ void DescriptorAllocator::initialize(VkDevice device, uint32_t maxSets, std::spa
 	info.maxSets = maxSets;
 	info.pPoolSizes = poolSizes.data();
 	info.poolSizeCount = (uint32_t)poolSizes.size();
-	info.flags = 0;
+	info.flags = flags;
 	
 	vkCreateDescriptorPool(device, &info, nullptr, &pool);
 }
@@ -83,9 +94,15 @@ VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLa
 	return descriptorSet;
 }
 
+void DescriptorAllocator::free(VkDevice device, VkDescriptorSet descriptorSet)
+{
+	VK_CHECK(vkFreeDescriptorSets(device, pool, 1, &descriptorSet));
+}
+
 void PipelineBuilder::clear()
 {
 	pipelineLayout = {};
+	dynamicRenderState = false;
 
 	inputAssemblyStateCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
 
@@ -98,6 +115,7 @@ void PipelineBuilder::clear()
 	colorBlendAttachmentState = {};
 
 	renderingCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	colorAttachmentFormat = VK_FORMAT_UNDEFINED;
 
 	shaderStages.clear();
 }
@@ -108,7 +126,10 @@ void PipelineBuilder::setShaders(VkShaderModule vertexShaderModule, VkShaderModu
 
 	shaderStages.push_back(vkeUtils::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vertexShaderModule));
 
-	shaderStages.push_back(vkeUtils::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShaderModule));
+	if (fragmentShaderModule != VK_NULL_HANDLE)
+	{
+		shaderStages.push_back(vkeUtils::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShaderModule));
+	}
 }
 
 void PipelineBuilder::setInputTopology(VkPrimitiveTopology primitiveTopology)
@@ -139,6 +160,14 @@ void PipelineBuilder::disableMultisampling()
 	multisampleStateCreateInfo.alphaToOneEnable = VK_FALSE;
 }
 
+void PipelineBuilder::enableDepthBias(float constantFactor, float slopeFactor)
+{
+	rasterizationStateCreateInfo.depthBiasEnable = VK_TRUE;
+	rasterizationStateCreateInfo.depthBiasConstantFactor = constantFactor;
+	rasterizationStateCreateInfo.depthBiasClamp = 0.0f;
+	rasterizationStateCreateInfo.depthBiasSlopeFactor = slopeFactor;
+}
+
 void PipelineBuilder::enableDepthTest(bool depthWriteEnable, VkCompareOp compareOp)
 {
 	depthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
@@ -199,8 +228,8 @@ void PipelineBuilder::setColorAttachmentFormat(VkFormat format)
 {
 	colorAttachmentFormat = format;
 
+	// The format pointer is only resolved in build, so copies of the builder don't point into the original.
 	renderingCreateInfo.colorAttachmentCount = 1;
-	renderingCreateInfo.pColorAttachmentFormats = &colorAttachmentFormat;
 }
 
 void PipelineBuilder::setDepthFormat(VkFormat format)
@@ -208,7 +237,162 @@ void PipelineBuilder::setDepthFormat(VkFormat format)
 	renderingCreateInfo.depthAttachmentFormat = format;
 }
 
-VkPipeline PipelineBuilder::build(VkDevice device)
+void PipelineBuilder::enableDynamicRenderState()
+{
+	dynamicRenderState = true;
+}
+
+std::string PipelineBuilder::key(VkGraphicsPipelineLibraryFlagsEXT libraryParts) const
+{
+	std::string key;
+
+	auto append = [&key](const auto& value)
+	{
+		key.append((const char*)&value, sizeof(value));
+	};
+
+	auto appendStages = [&](bool fragmentStages)
+	{
+		for (const VkPipelineShaderStageCreateInfo& shaderStage : shaderStages)
+		{
+			if ((shaderStage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) == fragmentStages)
+			{
+				append(shaderStage.stage);
+				append(shaderStage.module);
+
+				key.append(shaderStage.pName);
+				key.push_back('\0');
+			}
+		}
+	};
+
+	append(libraryParts);
+	append(dynamicRenderState);
+
+	if (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT)
+	{
+		// With a dynamic topology only its class (points, lines, triangles or patches) is part of the pipeline.
+		VkPrimitiveTopology topology = inputAssemblyStateCreateInfo.topology;
+
+		if (dynamicRenderState)
+		{
+			topology = topology <= VK_PRIMITIVE_TOPOLOGY_POINT_LIST ? VK_PRIMITIVE_TOPOLOGY_POINT_LIST
+				: topology <= VK_PRIMITIVE_TOPOLOGY_LINE_STRIP ? VK_PRIMITIVE_TOPOLOGY_LINE_LIST
+				: topology == VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY || topology == VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY ? VK_PRIMITIVE_TOPOLOGY_LINE_LIST
+				: topology == VK_PRIMITIVE_TOPOLOGY_PATCH_LIST ? VK_PRIMITIVE_TOPOLOGY_PATCH_LIST
+				: VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		}
+
+		append(topology);
+
+		if (!dynamicRenderState)
+		{
+			append(inputAssemblyStateCreateInfo.primitiveRestartEnable);
+		}
+	}
+
+	if (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)
+	{
+		append(pipelineLayout);
+		appendStages(false);
+
+		append(rasterizationStateCreateInfo.depthClampEnable);
+		append(rasterizationStateCreateInfo.polygonMode);
+		append(rasterizationStateCreateInfo.depthBiasConstantFactor);
+		append(rasterizationStateCreateInfo.depthBiasClamp);
+		append(rasterizationStateCreateInfo.depthBiasSlopeFactor);
+		append(rasterizationStateCreateInfo.lineWidth);
+
+		if (!dynamicRenderState)
+		{
+			append(rasterizationStateCreateInfo.rasterizerDiscardEnable);
+			append(rasterizationStateCreateInfo.depthBiasEnable);
+			append(rasterizationStateCreateInfo.cullMode);
+			append(rasterizationStateCreateInfo.frontFace);
+		}
+
+		append(renderingCreateInfo.viewMask);
+	}
+
+	if (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT)
+	{
+		append(pipelineLayout);
+		appendStages(true);
+
+		append(depthStencilStateCreateInfo.depthBoundsTestEnable);
+		append(depthStencilStateCreateInfo.stencilTestEnable);
+		append(depthStencilStateCreateInfo.front);
+		append(depthStencilStateCreateInfo.back);
+		append(depthStencilStateCreateInfo.minDepthBounds);
+		append(depthStencilStateCreateInfo.maxDepthBounds);
+
+		if (!dynamicRenderState)
+		{
+			append(depthStencilStateCreateInfo.depthTestEnable);
+			append(depthStencilStateCreateInfo.depthWriteEnable);
+			append(depthStencilStateCreateInfo.depthCompareOp);
+		}
+	}
+
+	if (libraryParts & (VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT | VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT))
+	{
+		append(multisampleStateCreateInfo.rasterizationSamples);
+		append(multisampleStateCreateInfo.sampleShadingEnable);
+		append(multisampleStateCreateInfo.minSampleShading);
+		append(multisampleStateCreateInfo.alphaToCoverageEnable);
+		append(multisampleStateCreateInfo.alphaToOneEnable);
+
+		append(renderingCreateInfo.colorAttachmentCount);
+		append(colorAttachmentFormat);
+		append(renderingCreateInfo.depthAttachmentFormat);
+		append(renderingCreateInfo.stencilAttachmentFormat);
+	}
+
+	if (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT)
+	{
+		append(colorBlendAttachmentState);
+	}
+
+	return key;
+}
+
+VkPipeline PipelineBuilder::build(VkDevice device, VkPipelineCache pipelineCache) const
+{
+	return create(device, pipelineCache, 0);
+}
+
+VkPipeline PipelineBuilder::buildLibrary(VkDevice device, VkGraphicsPipelineLibraryFlagBitsEXT libraryPart, VkPipelineCache pipelineCache) const
+{
+	return create(device, pipelineCache, libraryPart);
+}
+
+VkPipeline PipelineBuilder::link(VkDevice device, std::span<const VkPipeline> libraries, VkPipelineLayout pipelineLayout, bool optimize, VkPipelineCache pipelineCache)
+{
+	VkPipelineLibraryCreateInfoKHR pipelineLibraryCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+
+	pipelineLibraryCreateInfo.libraryCount = (uint32_t)libraries.size();
+	pipelineLibraryCreateInfo.pLibraries = libraries.data();
+
+	// Without link time optimization, linking only stitches the precompiled parts together and is fast enough to do mid-frame.
+	VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+
+	graphicsPipelineCreateInfo.pNext = &pipelineLibraryCreateInfo;
+	graphicsPipelineCreateInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+	graphicsPipelineCreateInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		fmt::println("Failed to link pipeline!");
+
+		return VK_NULL_HANDLE;
+	}
+
+	return pipeline;
+}
+
+VkPipeline PipelineBuilder::create(VkDevice device, VkPipelineCache pipelineCache, VkGraphicsPipelineLibraryFlagsEXT libraryParts) const
 {
 	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
 
@@ -223,25 +407,75 @@ VkPipeline PipelineBuilder::build(VkDevice device)
 	colorBlendStateCreateInfo.pNext = nullptr;
 	colorBlendStateCreateInfo.logicOpEnable = VK_FALSE;
 	colorBlendStateCreateInfo.logicOp = VK_LOGIC_OP_COPY;
-	colorBlendStateCreateInfo.attachmentCount = 1;
+	colorBlendStateCreateInfo.attachmentCount = renderingCreateInfo.colorAttachmentCount;
 	colorBlendStateCreateInfo.pAttachments = &colorBlendAttachmentState;
 
 	// Let VertexInputStateCreateInfo completely clear, as we have no need for it.
 	VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
 
-	VkDynamicState dynamicState[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	// Extended dynamic state 1 and 2, both core since Vulkan 1.3. The depth bias factors stay baked, only whether they apply is dynamic.
+	if (dynamicRenderState)
+	{
+		dynamicStates.insert(dynamicStates.end(),
+		{
+			VK_DYNAMIC_STATE_CULL_MODE,
+			VK_DYNAMIC_STATE_FRONT_FACE,
+			VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY,
+			VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE,
+			VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_COMPARE_OP
+		});
+	}
 
 	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
 	
-	dynamicStateCreateInfo.pDynamicStates = &dynamicState[0];
-	dynamicStateCreateInfo.dynamicStateCount = 2;
+	dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+	dynamicStateCreateInfo.dynamicStateCount = (uint32_t)dynamicStates.size();
+
+	// A library part only takes the shader stages it owns, the state of the other parts is ignored.
+	std::vector<VkPipelineShaderStageCreateInfo> stages;
+
+	for (const VkPipelineShaderStageCreateInfo& shaderStage : shaderStages)
+	{
+		bool fragmentStage = shaderStage.stage == VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		if (libraryParts == 0
+			|| (fragmentStage && (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT))
+			|| (!fragmentStage && (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)))
+		{
+			stages.push_back(shaderStage);
+		}
+	}
 
 	// Build the actual pipeline.
 	VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 	
-	graphicsPipelineCreateInfo.pNext = &renderingCreateInfo;
-	graphicsPipelineCreateInfo.stageCount = (uint32_t)shaderStages.size();
-	graphicsPipelineCreateInfo.pStages = shaderStages.data();
+	VkPipelineRenderingCreateInfo pipelineRenderingCreateInfo = renderingCreateInfo;
+
+	pipelineRenderingCreateInfo.pColorAttachmentFormats = renderingCreateInfo.colorAttachmentCount > 0 ? &colorAttachmentFormat : nullptr;
+
+	VkGraphicsPipelineLibraryCreateInfoEXT graphicsPipelineLibraryCreateInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+
+	graphicsPipelineLibraryCreateInfo.pNext = &pipelineRenderingCreateInfo;
+	graphicsPipelineLibraryCreateInfo.flags = libraryParts;
+
+	if (libraryParts != 0)
+	{
+		graphicsPipelineCreateInfo.pNext = &graphicsPipelineLibraryCreateInfo;
+		graphicsPipelineCreateInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+	}
+	else
+	{
+		graphicsPipelineCreateInfo.pNext = &pipelineRenderingCreateInfo;
+	}
+
+	graphicsPipelineCreateInfo.stageCount = (uint32_t)stages.size();
+	graphicsPipelineCreateInfo.pStages = stages.data();
 	graphicsPipelineCreateInfo.layout = pipelineLayout;
 	graphicsPipelineCreateInfo.pVertexInputState = &vertexInputStateCreateInfo;
 	graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyStateCreateInfo;
@@ -254,7 +488,7 @@ VkPipeline PipelineBuilder::build(VkDevice device)
 
 	VkPipeline pipeline;
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
 	{
 		fmt::println("Failed to create pipeline!");
 
@@ -8,9 +8,11 @@
 
 #include <span>
 #include <deque>
+#include <string>
 #include <functional>
 
 #include "utils.h"
+#include "reflection.h"
 
 struct DeletionQueue
 {
@@ -33,6 +35,33 @@ struct DeletionQueue
 	}
 };
 
+// Deletors keyed by the timeline semaphore value after which the GPU is done with what they release.
+// Values are pushed in increasing order, so the deletors run in the order they were pushed.
+struct TimelineDeletionQueue
+{
+	std::deque<std::pair<uint64_t, std::function<void()>>> deletors;
+
+	void pushFunction(uint64_t value, std::function<void()>&& function)
+	{
+		deletors.emplace_back(value, std::move(function));
+	}
+
+	// Runs the deletors whose value the timeline has reached.
+	void collect(uint64_t completedValue)
+	{
+		while (!deletors.empty() && deletors.front().first <= completedValue)
+		{
+			deletors.front().second();
+			deletors.pop_front();
+		}
+	}
+
+	void flush()
+	{
+		collect(UINT64_MAX);
+	}
+};
+
 struct AllocatedImage
 {
 	VkImage image;
@@ -40,6 +69,7 @@ struct AllocatedImage
 	VkFormat imageFormat;
 	VkExtent2D imageExtent2D;
 	VkExtent3D imageExtent3D;
+	uint32_t mipLevels = 1;
 
 	VmaAllocation allocation;
 };
@@ -56,9 +86,10 @@ struct DescriptorLayoutBuilder
 {
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-	void addBinding(uint32_t binding, VkDescriptorType type);
+	void addBinding(uint32_t binding, VkDescriptorType type, uint32_t count = 1);
 	void clear();
 	VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
+	VkDescriptorSetLayout build(LayoutCache& layoutCache, VkShaderStageFlags shaderStages);
 };
 
 struct DescriptorAllocator
@@ -71,10 +102,13 @@ struct DescriptorAllocator
 
 	VkDescriptorPool pool;
 
-	void initialize(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios);
+	void initialize(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios, VkDescriptorPoolCreateFlags flags = 0);
 	void clearDescriptors(VkDevice device);
 	void clear(VkDevice device);
 	VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout);
+
+	// Only for pools created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT.
+	void free(VkDevice device, VkDescriptorSet descriptorSet);
 };
 
 class PipelineBuilder
@@ -92,16 +126,23 @@ public:
 	VkPipelineRenderingCreateInfo renderingCreateInfo;
 	VkFormat colorAttachmentFormat;
 
+	// Cull mode, front face, topology, primitive restart, rasterizer discard, depth bias enable and the depth test are set with vkCmdSet* at draw time instead of being baked.
+	bool dynamicRenderState;
+
 	PipelineBuilder() { clear(); }
 
 	void clear();
-	void setShaders(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule);
+	// Without a fragment shader (and without a color attachment format) the pipeline only writes depth.
+	void setShaders(VkShaderModule vertexShaderModule, VkShaderModule fragmentShaderModule = VK_NULL_HANDLE);
 	void setInputTopology(VkPrimitiveTopology primitiveTopology);
 	void setPolygonMode(VkPolygonMode polygonMode);
 	void setCullMode(VkCullModeFlags cullModeFlags, VkFrontFace frontFace);
 
 	void disableMultisampling();
 
+	// Pushes the rasterized depth by a constant and a slope-scaled amount, in the depth format's units.
+	void enableDepthBias(float constantFactor, float slopeFactor);
+
 	void enableDepthTest(bool depthWriteEnable, VkCompareOp compareOp);
 	void disableDepthTest();
 
@@ -112,7 +153,26 @@ public:
 	void setColorAttachmentFormat(VkFormat format);
 	void setDepthFormat(VkFormat format);
 
-	VkPipeline build(VkDevice device);
+	void enableDynamicRenderState();
+
+	// Packs every piece of state that ends up in the given parts of the pipeline, so identical variants get identical keys.
+	std::string key(VkGraphicsPipelineLibraryFlagsEXT libraryParts = PIPELINE_LIBRARY_ALL_PARTS) const;
+
+	VkPipeline build(VkDevice device, VkPipelineCache pipelineCache = VK_NULL_HANDLE) const;
+
+	// Builds a single part of the pipeline with VK_EXT_graphics_pipeline_library, to be linked with the other parts.
+	VkPipeline buildLibrary(VkDevice device, VkGraphicsPipelineLibraryFlagBitsEXT libraryPart, VkPipelineCache pipelineCache = VK_NULL_HANDLE) const;
+
+	static VkPipeline link(VkDevice device, std::span<const VkPipeline> libraries, VkPipelineLayout pipelineLayout, bool optimize, VkPipelineCache pipelineCache = VK_NULL_HANDLE);
+
+	static constexpr VkGraphicsPipelineLibraryFlagsEXT PIPELINE_LIBRARY_ALL_PARTS =
+		VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT |
+		VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT |
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT |
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+
+private:
+	VkPipeline create(VkDevice device, VkPipelineCache pipelineCache, VkGraphicsPipelineLibraryFlagsEXT libraryParts) const;
 };
 
 // The reason the uv parameters are interleaved is due to alignement limitations on GPUs.
@@ -126,12 +186,30 @@ struct Vertex
 	glm::vec4 color;
 };
 
+constexpr uint32_t INVALID_OFFSET_NODE = UINT32_MAX;
+
+// A range handed out by an OffsetAllocator. The node identifies the range inside the allocator.
+struct OffsetAllocation
+{
+	uint32_t offset = 0;
+	uint32_t size = 0;
+	uint32_t node = INVALID_OFFSET_NODE;
+};
+
+// Ranges of a mesh inside the geometry arena, counted in vertices and in indices. Every mesh shares the arena's
+// vertex and index buffers, so meshes are drawn with vertexOffset and firstIndex instead of binding their own buffers.
 struct GPUMeshBuffers
 {
-	AllocatedBuffer vertexBuffer;
-	AllocatedBuffer indexBuffer;
+	OffsetAllocation vertices;
+	OffsetAllocation indices;
+};
 
-	VkDeviceAddress vertexBufferAddress;
+struct ComputePushConstants
+{
+	glm::vec4 data1;
+	glm::vec4 data2;
+	glm::vec4 data3;
+	glm::vec4 data4;
 };
 
 struct GPUDrawPushConstants
@@ -139,4 +217,40 @@ struct GPUDrawPushConstants
 	glm::mat4 worldMatrix;
 
 	VkDeviceAddress vertexBufferAddress;
+	VkDeviceAddress lightingBufferAddress;
+	VkDeviceAddress clusterBufferAddress;
+};
+
+// A visibility buffer pixel holds the draw it sees in its upper bits, and the triangle of that draw in its lower bits.
+// Draws with more triangles than the lower bits can count are split. The visibility shaders declare the same constants.
+constexpr uint32_t VISIBILITY_TRIANGLE_BITS = 19;
+constexpr uint32_t MAX_VISIBILITY_DRAW_TRIANGLES = 1u << VISIBILITY_TRIANGLE_BITS;
+
+// The last draw index is left out, so no ID can be mistaken for an empty pixel.
+constexpr uint32_t MAX_VISIBILITY_DRAWS = (1u << (32 - VISIBILITY_TRIANGLE_BITS)) - 1;
+constexpr uint32_t VISIBILITY_EMPTY = UINT32_MAX;
+
+// Where the indices of a draw of the visibility buffer start, for the resolve to fetch its triangles again.
+struct GPUVisibilityDraw
+{
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+};
+
+struct VisibilityPushConstants
+{
+	glm::mat4 worldMatrix;
+
+	VkDeviceAddress vertexBufferAddress;
+};
+
+struct VisibilityResolvePushConstants
+{
+	glm::mat4 worldMatrix;
+
+	VkDeviceAddress vertexBufferAddress;
+	VkDeviceAddress indexBufferAddress;
+	VkDeviceAddress drawBufferAddress;
+	VkDeviceAddress lightingBufferAddress;
+	VkDeviceAddress clusterBufferAddress;
 };
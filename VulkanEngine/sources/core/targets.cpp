@@ -0,0 +1,97 @@
+#include "targets.h"
+
+#include <algorithm>
+
+void RenderTargetManager::initialize(VkDevice device, VmaAllocator allocator, MemoryManager* memoryManager)
+{
+	this->device = device;
+	this->allocator = allocator;
+	this->memoryManager = memoryManager;
+}
+
+void RenderTargetManager::cleanUp()
+{
+	for (const PooledImage& pooled : pool)
+	{
+		destroy(pooled.image);
+	}
+
+	pool.clear();
+}
+
+VkExtent2D RenderTargetManager::getTargetExtent(VkExtent2D extent)
+{
+	auto roundUp = [](uint32_t size)
+	{
+		return std::max((size + RENDER_TARGET_EXTENT_GRANULARITY - 1) / RENDER_TARGET_EXTENT_GRANULARITY, 1u) * RENDER_TARGET_EXTENT_GRANULARITY;
+	};
+
+	return { roundUp(extent.width), roundUp(extent.height) };
+}
+
+AllocatedImage RenderTargetManager::acquire(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent, uint32_t mipLevels)
+{
+	VkExtent2D targetExtent = getTargetExtent(extent);
+
+	for (auto it = pool.begin(); it != pool.end(); it++)
+	{
+		const AllocatedImage& image = it->image;
+
+		if (image.imageFormat == format && it->usage == usage && image.mipLevels == mipLevels && image.imageExtent2D.width == targetExtent.width && image.imageExtent2D.height == targetExtent.height)
+		{
+			AllocatedImage reused = image;
+
+			pool.erase(it);
+			reusedImages++;
+
+			return reused;
+		}
+	}
+
+	AllocatedImage image;
+
+	image.imageFormat = format;
+	image.imageExtent2D = targetExtent;
+	image.imageExtent3D = { targetExtent.width, targetExtent.height, 1 };
+	image.mipLevels = mipLevels;
+
+	VkImageCreateInfo imageCreateInfo = vkeUtils::imageCreateInfo(format, image.imageExtent3D, usage, mipLevels);
+	VmaAllocationCreateInfo imageAllocationCreateInfo = allocationCreateInfo(MemoryCategory::RenderTarget);
+
+	VK_CHECK(vmaCreateImage(allocator, &imageCreateInfo, &imageAllocationCreateInfo, &image.image, &image.allocation, nullptr));
+
+	memoryManager->track(image.allocation, MemoryCategory::RenderTarget);
+
+	VkImageViewCreateInfo imageViewCreateInfo = vkeUtils::imageViewCreateInfo(format, image.image, aspect, 0, mipLevels);
+
+	VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, nullptr, &image.imageView));
+
+	usages[image.image] = usage;
+	createdImages++;
+
+	return image;
+}
+
+void RenderTargetManager::release(const AllocatedImage& image)
+{
+	pool.push_back({ image, usages[image.image] });
+
+	// The images released the longest time ago are the least likely to be needed again.
+	if (pool.size() > MAX_POOLED_RENDER_TARGETS)
+	{
+		destroy(pool.front().image);
+
+		pool.erase(pool.begin());
+	}
+}
+
+void RenderTargetManager::destroy(const AllocatedImage& image)
+{
+	usages.erase(image.image);
+
+	vkDestroyImageView(device, image.imageView, nullptr);
+
+	memoryManager->untrack(image.allocation);
+
+	vmaDestroyImage(allocator, image.image, image.allocation);
+}
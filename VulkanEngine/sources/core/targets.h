@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vkma/vk_mem_alloc.h>
+
+#include <vector>
+#include <unordered_map>
+
+#include "structures.h"
+#include "allocations.h"
+
+// Render target extents are rounded up to a multiple of this, so resizing the window within a step keeps the same images.
+constexpr uint32_t RENDER_TARGET_EXTENT_GRANULARITY = 256;
+
+// Images kept around for reuse once the window has been resized away from their extent.
+constexpr size_t MAX_POOLED_RENDER_TARGETS = 16;
+
+// Size dependent images. The ones released are pooled by format, usage and extent, so resizing the window back to
+// an extent it had before (maximizing and restoring it, dragging its border back and forth) doesn't allocate.
+class RenderTargetManager
+{
+public:
+	void initialize(VkDevice device, VmaAllocator allocator, MemoryManager* memoryManager);
+	void cleanUp();
+
+	// Extent of the images covering the given extent.
+	static VkExtent2D getTargetExtent(VkExtent2D extent);
+
+	// Takes an image from the pool, or creates one. Its extent is getTargetExtent(extent), and its view covers every level.
+	AllocatedImage acquire(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent, uint32_t mipLevels = 1);
+
+	// Puts an image back into the pool. The GPU has to be done with it, so it's usually called from a deletion queue.
+	void release(const AllocatedImage& image);
+
+	uint32_t createdImages = 0;
+	uint32_t reusedImages = 0;
+
+private:
+	struct PooledImage
+	{
+		AllocatedImage image;
+		VkImageUsageFlags usage;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VmaAllocator allocator = VK_NULL_HANDLE;
+	MemoryManager* memoryManager = nullptr;
+
+	// Oldest released first.
+	std::vector<PooledImage> pool;
+
+	// Usage of every image created by the manager, pooled or not.
+	std::unordered_map<VkImage, VkImageUsageFlags> usages;
+
+	void destroy(const AllocatedImage& image);
+};
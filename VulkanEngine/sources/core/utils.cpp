@@ -1,5 +1,8 @@
 #include "utils.h"
 
+#include <bit>
+#include <algorithm>
+
 VkCommandPoolCreateInfo vkeUtils::commandPoolCreateInfo(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags)
 {
 	VkCommandPoolCreateInfo info = {};
@@ -71,7 +74,19 @@ VkSemaphoreCreateInfo vkeUtils::semaphoreCreateInfo(VkSemaphoreCreateFlags flags
 	return info;
 }
 
-VkSemaphoreSubmitInfo vkeUtils::semaphoreSubmitInfo(VkSemaphore semaphore, VkPipelineStageFlags2 stageMask)
+VkSemaphoreTypeCreateInfo vkeUtils::semaphoreTypeCreateInfo(VkSemaphoreType type, uint64_t initialValue)
+{
+	VkSemaphoreTypeCreateInfo info = {};
+
+	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	info.pNext = nullptr;
+	info.semaphoreType = type;
+	info.initialValue = initialValue;
+
+	return info;
+}
+
+VkSemaphoreSubmitInfo vkeUtils::semaphoreSubmitInfo(VkSemaphore semaphore, VkPipelineStageFlags2 stageMask, uint64_t value)
 {
 	VkSemaphoreSubmitInfo info = {};
 
@@ -80,7 +95,7 @@ VkSemaphoreSubmitInfo vkeUtils::semaphoreSubmitInfo(VkSemaphore semaphore, VkPip
 	info.semaphore = semaphore;
 	info.stageMask = stageMask;
 	info.deviceIndex = 0;
-	info.value = 1;
+	info.value = value; // Ignored by binary semaphores.
 
 	return info;
 }
@@ -101,7 +116,23 @@ VkSubmitInfo2 vkeUtils::submitInfo(VkCommandBufferSubmitInfo* commandBufferInfo,
 	return info;
 }
 
-VkImageCreateInfo vkeUtils::imageCreateInfo(VkFormat format, VkExtent3D extent, VkImageUsageFlags usageFlags)
+VkSubmitInfo2 vkeUtils::submitInfo(VkCommandBufferSubmitInfo* commandBufferInfo, std::span<VkSemaphoreSubmitInfo> waitSemaphoreInfos, std::span<VkSemaphoreSubmitInfo> signalSemaphoreInfos)
+{
+	VkSubmitInfo2 info = {};
+
+	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+	info.pNext = nullptr;
+	info.commandBufferInfoCount = 1;
+	info.pCommandBufferInfos = commandBufferInfo;
+	info.waitSemaphoreInfoCount = (uint32_t)waitSemaphoreInfos.size();
+	info.pWaitSemaphoreInfos = waitSemaphoreInfos.data();
+	info.signalSemaphoreInfoCount = (uint32_t)signalSemaphoreInfos.size();
+	info.pSignalSemaphoreInfos = signalSemaphoreInfos.data();
+
+	return info;
+}
+
+VkImageCreateInfo vkeUtils::imageCreateInfo(VkFormat format, VkExtent3D extent, VkImageUsageFlags usageFlags, uint32_t mipLevels)
 {
 	VkImageCreateInfo info = {};
 
@@ -110,7 +141,7 @@ VkImageCreateInfo vkeUtils::imageCreateInfo(VkFormat format, VkExtent3D extent,
 	info.imageType = VK_IMAGE_TYPE_2D;
 	info.format = format;
 	info.extent = extent;
-	info.mipLevels = 1;
+	info.mipLevels = mipLevels;
 	info.arrayLayers = 1;
 	info.samples = VK_SAMPLE_COUNT_1_BIT;
 	info.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -119,7 +150,7 @@ VkImageCreateInfo vkeUtils::imageCreateInfo(VkFormat format, VkExtent3D extent,
 	return info;
 }
 
-VkImageViewCreateInfo vkeUtils::imageViewCreateInfo(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags)
+VkImageViewCreateInfo vkeUtils::imageViewCreateInfo(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel, uint32_t levelCount)
 {
 	VkImageViewCreateInfo info = {};
 
@@ -128,8 +159,8 @@ VkImageViewCreateInfo vkeUtils::imageViewCreateInfo(VkFormat format, VkImage ima
 	info.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	info.format = format;
 	info.image = image;
-	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.baseMipLevel = baseMipLevel;
+	info.subresourceRange.levelCount = levelCount;
 	info.subresourceRange.baseArrayLayer = 0;
 	info.subresourceRange.layerCount = 1;
 	info.subresourceRange.aspectMask = aspectFlags;
@@ -137,6 +168,11 @@ VkImageViewCreateInfo vkeUtils::imageViewCreateInfo(VkFormat format, VkImage ima
 	return info;
 }
 
+uint32_t vkeUtils::mipLevelCount(VkExtent2D extent)
+{
+	return (uint32_t)std::bit_width(std::max({ extent.width, extent.height, 1u }));
+}
+
 VkImageSubresourceRange vkeUtils::imageSubresourceRange(VkImageAspectFlags aspectMask)
 {
 	VkImageSubresourceRange imageSubresourceRange = {};
@@ -153,9 +189,12 @@ VkImageSubresourceRange vkeUtils::imageSubresourceRange(VkImageAspectFlags aspec
 void vkeUtils::transitionImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
 {
 	VkImageMemoryBarrier2 imageMemoryBarrier = {};
-	VkImageAspectFlags aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 	VkDependencyInfo info = {};
 
+	// Depth images leaving the attachment layout (to be sampled) are still depth images.
+	bool depthImage = newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || oldLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+	VkImageAspectFlags aspectMask = depthImage ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
 	imageMemoryBarrier.pNext = nullptr;
 	imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
@@ -175,6 +214,35 @@ void vkeUtils::transitionImageLayout(VkCommandBuffer cmd, VkImage image, VkImage
 	vkCmdPipelineBarrier2(cmd, &info);
 }
 
+void vkeUtils::transferImageOwnership(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t srcQueueFamily, uint32_t dstQueueFamily)
+{
+	// The same barrier has to be recorded on both queues: as a release on the source family and as an acquire on the destination one.
+	VkImageMemoryBarrier2 imageMemoryBarrier = {};
+	bool depthImage = newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || oldLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+	VkImageAspectFlags aspectMask = depthImage ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	VkDependencyInfo info = {};
+
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	imageMemoryBarrier.pNext = nullptr;
+	imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	imageMemoryBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+	imageMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	imageMemoryBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
+	imageMemoryBarrier.oldLayout = oldLayout;
+	imageMemoryBarrier.newLayout = newLayout;
+	imageMemoryBarrier.srcQueueFamilyIndex = srcQueueFamily;
+	imageMemoryBarrier.dstQueueFamilyIndex = dstQueueFamily;
+	imageMemoryBarrier.subresourceRange = vkeUtils::imageSubresourceRange(aspectMask);
+	imageMemoryBarrier.image = image;
+
+	info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	info.pNext = nullptr;
+	info.imageMemoryBarrierCount = 1;
+	info.pImageMemoryBarriers = &imageMemoryBarrier;
+
+	vkCmdPipelineBarrier2(cmd, &info);
+}
+
 void vkeUtils::copyImageToImage(VkCommandBuffer cmd, VkImage srcImage, VkImage dstImage, VkExtent2D srcSize, VkExtent2D dstSize)
 {
 	VkImageBlit2 blitRegion = {};
@@ -211,6 +279,13 @@ void vkeUtils::copyImageToImage(VkCommandBuffer cmd, VkImage srcImage, VkImage d
 }
 
 bool vkeUtils::loadShaderModule(const char* filePath, VkDevice device, VkShaderModule* outShaderModule)
+{
+	std::vector<uint32_t> code;
+
+	return loadShaderCode(filePath, code) && createShaderModule(code, device, outShaderModule);
+}
+
+bool vkeUtils::loadShaderCode(const char* filePath, std::vector<uint32_t>& outCode)
 {
 	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
 
@@ -225,19 +300,24 @@ bool vkeUtils::loadShaderModule(const char* filePath, VkDevice device, VkShaderM
 	size_t fileSize = (size_t)file.tellg();
 
 	// SpirV expects the buffer to be on uint32.
-	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+	outCode.resize(fileSize / sizeof(uint32_t));
 
 	file.seekg(0);
-	file.read((char*)buffer.data(), fileSize);
+	file.read((char*)outCode.data(), fileSize);
 	file.close();
 
+	return true;
+}
+
+bool vkeUtils::createShaderModule(std::span<const uint32_t> code, VkDevice device, VkShaderModule* outShaderModule)
+{
 	VkShaderModuleCreateInfo shaderModuleCreateinfo = {};
 	VkShaderModule shaderModule;
 
 	shaderModuleCreateinfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	shaderModuleCreateinfo.pNext = nullptr;
-	shaderModuleCreateinfo.codeSize = buffer.size() * sizeof(uint32_t); // It has to be in bytes.
-	shaderModuleCreateinfo.pCode = buffer.data();
+	shaderModuleCreateinfo.codeSize = code.size_bytes(); // It has to be in bytes.
+	shaderModuleCreateinfo.pCode = code.data();
 
 	if (vkCreateShaderModule(device, &shaderModuleCreateinfo, nullptr, &shaderModule) != VK_SUCCESS)
 	{
@@ -277,6 +357,21 @@ VkPipelineLayoutCreateInfo vkeUtils::pipelineLayoutCreateInfo()
 	return info;
 }
 
+VkExtent2D vkeUtils::computeWorkgroupSize(uint32_t subgroupSize, uint32_t maxInvocations)
+{
+	// Two subgroups per workgroup keep every subgroup full while leaving the groups small enough to spread a low
+	// resolution image over the whole device. Wide subgroups (64 lanes) get 16x8 groups, narrow ones (16 or 32) 8x8.
+	uint32_t invocations = std::min(std::max(std::bit_ceil(std::max(subgroupSize, 1u)) * 2, 64u), std::min(maxInvocations, 256u));
+	uint32_t width = 1;
+
+	while (width * width < invocations)
+	{
+		width *= 2;
+	}
+
+	return { width, invocations / width };
+}
+
 VkRenderingAttachmentInfo vkeUtils::colorAttachmentInfo(VkImageView imageView, VkImageLayout imageLayout, VkClearValue* clearValue)
 {
 	VkRenderingAttachmentInfo info = {};
@@ -319,7 +414,7 @@ VkRenderingInfo vkeUtils::renderingInfo(VkExtent2D renderExtent, VkRenderingAtta
 	info.pNext = nullptr;
 	info.renderArea = VkRect2D{ VkOffset2D { 0, 0 }, renderExtent };
 	info.layerCount = 1;
-	info.colorAttachmentCount = 1;
+	info.colorAttachmentCount = colorAttachment != nullptr ? 1 : 0;
 	info.pColorAttachments = colorAttachment;
 	info.pDepthAttachment = depthAttachment;
 	info.pStencilAttachment = nullptr;
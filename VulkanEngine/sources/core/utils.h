@@ -7,6 +7,7 @@
 
 #include <fmt/core.h>
 
+#include <span>
 #include <vector>
 #include <fstream>
 
@@ -28,21 +29,32 @@ namespace vkeUtils
 
 	VkFenceCreateInfo fenceCreateInfo(VkFenceCreateFlags flags = 0);
 	VkSemaphoreCreateInfo semaphoreCreateInfo(VkSemaphoreCreateFlags flags = 0);
-	VkSemaphoreSubmitInfo semaphoreSubmitInfo(VkSemaphore semaphore, VkPipelineStageFlags2 stageMask);
+	VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo(VkSemaphoreType type, uint64_t initialValue = 0);
+	VkSemaphoreSubmitInfo semaphoreSubmitInfo(VkSemaphore semaphore, VkPipelineStageFlags2 stageMask, uint64_t value = 1);
 	
 	VkSubmitInfo2 submitInfo(VkCommandBufferSubmitInfo* commandBufferInfo, VkSemaphoreSubmitInfo* waitSemaphoreInfo, VkSemaphoreSubmitInfo* signalSemaphoreInfo);
+	VkSubmitInfo2 submitInfo(VkCommandBufferSubmitInfo* commandBufferInfo, std::span<VkSemaphoreSubmitInfo> waitSemaphoreInfos, std::span<VkSemaphoreSubmitInfo> signalSemaphoreInfos);
 
-	VkImageCreateInfo imageCreateInfo(VkFormat format, VkExtent3D extent, VkImageUsageFlags usageFlags);
-	VkImageViewCreateInfo imageViewCreateInfo(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags);
+	VkImageCreateInfo imageCreateInfo(VkFormat format, VkExtent3D extent, VkImageUsageFlags usageFlags, uint32_t mipLevels = 1);
+	VkImageViewCreateInfo imageViewCreateInfo(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel = 0, uint32_t levelCount = 1);
+	// Number of levels of a full mip chain, down to 1x1.
+	uint32_t mipLevelCount(VkExtent2D extent);
 	VkImageSubresourceRange imageSubresourceRange(VkImageAspectFlags aspectMask);
 	void transitionImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
+	void transferImageOwnership(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t srcQueueFamily, uint32_t dstQueueFamily);
 	void copyImageToImage(VkCommandBuffer cmd, VkImage srcImage, VkImage dstImage, VkExtent2D srcSize, VkExtent2D dstSize);
 
+	bool loadShaderCode(const char* filePath, std::vector<uint32_t>& outCode);
 	bool loadShaderModule(const char* filePath, VkDevice device, VkShaderModule* outShaderModule);
+	bool createShaderModule(std::span<const uint32_t> code, VkDevice device, VkShaderModule* outShaderModule);
 	VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo(VkShaderStageFlagBits stageFlagBits, VkShaderModule shaderModule, const char* entry = "main");
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo();
 
+	// Workgroup size of the 2D compute kernels, a multiple of the subgroup size laid out as a square or twice as wide as tall.
+	VkExtent2D computeWorkgroupSize(uint32_t subgroupSize, uint32_t maxInvocations);
+
 	VkRenderingAttachmentInfo colorAttachmentInfo(VkImageView imageView, VkImageLayout imageLayout, VkClearValue* clearValue);
 	VkRenderingAttachmentInfo depthAttachmentInfo(VkImageView imageView, VkImageLayout imageLayout);
+	// Depth-only passes have no color attachment.
 	VkRenderingInfo renderingInfo(VkExtent2D renderExtent, VkRenderingAttachmentInfo* colorAttachment, VkRenderingAttachmentInfo* depthAttachment);
 }
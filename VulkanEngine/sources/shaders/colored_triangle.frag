@@ -1,10 +1,38 @@
 #version 460
+#extension GL_EXT_buffer_reference : require
+#extension GL_GOOGLE_include_directive : require
+
+// Forward shading of the meshes, the lighting itself lives in lighting.glsl.
 
 layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) in vec3 inNormal;
+layout (location = 3) in vec3 inWorldPosition;
 
 layout (location = 0) out vec4 outFragColor;
 
+layout (set = 0, binding = 0) uniform sampler2DShadow staticShadowAtlas;
+layout (set = 0, binding = 1) uniform sampler2DShadow dynamicShadowAtlas;
+
+#include "lighting.glsl"
+
+// Read by the vertex shader.
+layout(buffer_reference, std430) readonly buffer VertexBuffer
+{
+	vec4 data[];
+};
+
+layout (push_constant) uniform PushConstants
+{	
+	mat4 worldMatrix;
+	VertexBuffer vertexBuffer;
+	LightingBuffer lightingBuffer;
+	ClusterBuffer clusterBuffer;
+} pushConstants;
+
 void main() 
 {
-	outFragColor = vec4(inColor, 1.0);
+	vec3 radiance = getRadiance(pushConstants.lightingBuffer, pushConstants.clusterBuffer, gl_FragCoord.xy, inWorldPosition, normalize(inNormal));
+
+	outFragColor = vec4(inColor * radiance, 1.0);
 }
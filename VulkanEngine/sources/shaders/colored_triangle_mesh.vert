@@ -3,6 +3,11 @@
 
 layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 outUV;
+layout (location = 2) out vec3 outNormal;
+layout (location = 3) out vec3 outWorldPosition;
+
+// Has to match the depth of the pre-pass (shadow.vert) exactly.
+invariant gl_Position;
 
 struct Vertex
 {
@@ -18,10 +23,23 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer
 	Vertex vertices[];
 };
 
+// Read by the fragment shader.
+layout(buffer_reference, std430) readonly buffer LightingBuffer
+{
+	mat4 view;
+};
+
+layout(buffer_reference, std430) readonly buffer ClusterBuffer
+{
+	uint lightCount;
+};
+
 layout (push_constant) uniform PushConstants
 {	
 	mat4 worldMatrix;
 	VertexBuffer vertexBuffer;
+	LightingBuffer lightingBuffer;
+	ClusterBuffer clusterBuffer;
 } pushConstants;
 
 void main()
@@ -32,5 +50,9 @@ void main()
 	outUV.x = vertex.uvX;
 	outUV.y = vertex.uvY;
 
+	// Meshes have no transform of their own, their vertices are in world space already.
+	outNormal = vertex.normal;
+	outWorldPosition = vertex.position;
+
 	gl_Position = pushConstants.worldMatrix * vec4(vertex.position, 1.0f);
 }
@@ -0,0 +1,123 @@
+// Clustered forward shading, shared by colored_triangle.frag and visibility.comp: a surface point finds its froxel from its
+// screen position and view depth, and only loops over the lights binned into it by clusters.comp. The sun is shadowed by
+// the cascade covering the view depth, looked up in both the cached atlas of the static casters and the atlas of the
+// dynamic ones.
+//
+// The including shader enables GL_EXT_buffer_reference and declares the staticShadowAtlas and dynamicShadowAtlas samplers
+// before this file.
+
+// Has to match lighting.h and shadows.h.
+const uvec3 CLUSTER_GRID = uvec3(16, 9, 24);
+const uint MAX_LIGHTS_PER_CLUSTER = 64;
+const uint SHADOW_CASCADE_COUNT = 4;
+const uint SHADOW_CASCADE_RESOLUTION = 2048;
+
+struct Light
+{
+	vec4 positionRadius;
+	vec4 colorIntensity;
+};
+
+struct Cluster
+{
+	uint lightCount;
+	uint lightIndices[MAX_LIGHTS_PER_CLUSTER];
+};
+
+layout(buffer_reference, std430) readonly buffer LightingBuffer
+{
+	mat4 view;
+	mat4 inverseProjection;
+	vec4 screenSize;
+	vec4 depthSlicing;
+	vec4 ambient;
+	mat4 shadowMatrices[SHADOW_CASCADE_COUNT];
+	vec4 cascadeSplits;
+	vec4 cascadeTexelSizes;
+	vec4 sunDirection;
+	vec4 sunColor;
+	uint lightCount;
+	Light lights[];
+};
+
+layout(buffer_reference, std430) readonly buffer ClusterBuffer
+{
+	Cluster clusters[];
+};
+
+uint getClusterIndex(LightingBuffer lighting, vec2 fragCoord, float viewDepth)
+{
+	viewDepth = max(viewDepth, lighting.depthSlicing.x);
+
+	uvec2 tile = min(uvec2(fragCoord / lighting.screenSize.xy * vec2(CLUSTER_GRID.xy)), CLUSTER_GRID.xy - 1);
+	uint slice = uint(clamp(log(viewDepth) * lighting.depthSlicing.z + lighting.depthSlicing.w, 0.0, float(CLUSTER_GRID.z - 1)));
+
+	return tile.x + tile.y * CLUSTER_GRID.x + slice * CLUSTER_GRID.x * CLUSTER_GRID.y;
+}
+
+float getSunVisibility(LightingBuffer lighting, vec3 worldPosition, vec3 normal, float viewDepth)
+{
+	uint cascade = 0;
+
+	while (cascade < SHADOW_CASCADE_COUNT && viewDepth > lighting.cascadeSplits[cascade])
+	{
+		cascade++;
+	}
+
+	// Past the last cascade, nothing casts shadows.
+	if (cascade == SHADOW_CASCADE_COUNT)
+	{
+		return 1.0;
+	}
+
+	// Offsetting the position along the normal, by a few texels of the cascade, keeps surfaces from shadowing themselves.
+	vec3 position = worldPosition + normal * lighting.cascadeTexelSizes[cascade] * lighting.sunDirection.w;
+	vec4 shadowPosition = lighting.shadowMatrices[cascade] * vec4(position, 1.0);
+
+	// The bilinear comparison reads around the coordinate, so it's kept half a texel away from the other cascades.
+	float halfTexel = 0.5 / float(SHADOW_CASCADE_RESOLUTION);
+	vec2 cascadeUV = clamp(shadowPosition.xy * 0.5 + 0.5, halfTexel, 1.0 - halfTexel);
+	vec3 atlasCoordinate = vec3((cascadeUV + vec2(cascade % 2, cascade / 2)) * 0.5, shadowPosition.z);
+
+	// Explicit level, the lookups sit in non-uniform control flow.
+	return min(textureLod(staticShadowAtlas, atlasCoordinate, 0.0), textureLod(dynamicShadowAtlas, atlasCoordinate, 0.0));
+}
+
+// Light reaching the surface point seen through the given pixel position, the ambient term included.
+vec3 getRadiance(LightingBuffer lighting, ClusterBuffer clusterBuffer, vec2 fragCoord, vec3 worldPosition, vec3 normal)
+{
+	float viewDepth = -(lighting.view * vec4(worldPosition, 1.0)).z;
+
+	uint clusterIndex = getClusterIndex(lighting, fragCoord, viewDepth);
+	uint lightCount = clusterBuffer.clusters[clusterIndex].lightCount;
+
+	vec3 radiance = lighting.ambient.rgb;
+
+	if (lighting.sunColor.a > 0.0)
+	{
+		float lambert = max(dot(normal, -lighting.sunDirection.xyz), 0.0);
+
+		if (lambert > 0.0)
+		{
+			radiance += lighting.sunColor.rgb * lighting.sunColor.a * lambert * getSunVisibility(lighting, worldPosition, normal, viewDepth);
+		}
+	}
+
+	for (uint i = 0; i < lightCount; i++)
+	{
+		Light light = lighting.lights[clusterBuffer.clusters[clusterIndex].lightIndices[i]];
+
+		vec3 toLight = light.positionRadius.xyz - worldPosition;
+		float distanceSquared = dot(toLight, toLight);
+		float radius = light.positionRadius.w;
+
+		// Inverse square falloff, windowed to reach zero at the radius of the light.
+		float window = clamp(1.0 - (distanceSquared * distanceSquared) / (radius * radius * radius * radius), 0.0, 1.0);
+		float attenuation = window * window / (distanceSquared + 1.0);
+		float lambert = max(dot(normal, toLight * inversesqrt(max(distanceSquared, 1e-8))), 0.0);
+
+		radiance += light.colorIntensity.rgb * light.colorIntensity.w * lambert * attenuation;
+	}
+
+	return radiance;
+}
@@ -0,0 +1,20 @@
+#version 460
+
+// Soft round sprite, fading out towards the edge of the quad.
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in vec4 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	float falloff = 1.0 - dot(inUV, inUV);
+
+	if (falloff <= 0.0)
+	{
+		discard;
+	}
+
+	outFragColor = vec4(inColor.rgb, inColor.a * falloff * falloff);
+}
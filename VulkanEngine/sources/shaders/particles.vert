@@ -0,0 +1,66 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+// Draws the survivors of the frame as camera facing quads, one instance each, six vertices per quad. The instance count
+// was written by the compact pass, the CPU never knows how many particles there are.
+
+layout (location = 0) out vec2 outUV;
+layout (location = 1) out vec4 outColor;
+
+// Has to match particles.h.
+struct Particle
+{
+	vec4 positionLife;
+	vec4 velocityLifetime;
+};
+
+layout (buffer_reference, std430) readonly buffer ParticleBuffer
+{
+	Particle particles[];
+};
+
+// Either the survivor list, or the sort entries (key and particle) when sorted.
+layout (buffer_reference, std430) readonly buffer IndexBuffer
+{
+	uint indices[];
+};
+
+layout (push_constant) uniform PushConstants
+{
+	mat4 viewProjection;
+	vec4 cameraRightSize;
+	vec4 cameraUp;
+	ParticleBuffer particleBuffer;
+	IndexBuffer indexBuffer;
+	uint sorted;
+	uint padding;
+} pushConstants;
+
+const vec2 CORNERS[6] = vec2[](
+	vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+	vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+);
+
+void main()
+{
+	uint index = gl_InstanceIndex;
+	uint particleIndex = pushConstants.sorted != 0 ? pushConstants.indexBuffer.indices[index * 2 + 1] : pushConstants.indexBuffer.indices[index];
+
+	Particle particle = pushConstants.particleBuffer.particles[particleIndex];
+
+	// From zero at birth to one at death.
+	float age = 1.0 - clamp(particle.positionLife.w / particle.velocityLifetime.w, 0.0, 1.0);
+
+	vec2 corner = CORNERS[gl_VertexIndex];
+	float size = pushConstants.cameraRightSize.w * mix(0.5, 1.5, age);
+
+	vec3 position = particle.positionLife.xyz + (pushConstants.cameraRightSize.xyz * corner.x + pushConstants.cameraUp.xyz * corner.y) * size;
+
+	// Hot when spawned, cooling down and fading out.
+	vec3 color = mix(vec3(1.0, 0.8, 0.3), vec3(0.8, 0.2, 0.05), age);
+
+	outUV = corner;
+	outColor = vec4(color, 1.0 - age);
+
+	gl_Position = pushConstants.viewProjection * vec4(position, 1.0);
+}
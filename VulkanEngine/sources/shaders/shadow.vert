@@ -0,0 +1,35 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+// Depth-only pass of the shadow cascades, and of the camera's depth pre-pass. Like in colored_triangle_mesh.vert, the
+// vertices are in world space already.
+
+// The main pass tests for EQUAL depths after the pre-pass, so the position is computed the same way in both.
+invariant gl_Position;
+
+struct Vertex
+{
+	vec3 position;
+	float uvX;
+	vec3 normal;
+	float uvY;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer
+{ 
+	Vertex vertices[];
+};
+
+layout (push_constant) uniform PushConstants
+{	
+	mat4 viewProjection;
+	VertexBuffer vertexBuffer;
+} pushConstants;
+
+void main()
+{
+	Vertex vertex = pushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+	gl_Position = pushConstants.viewProjection * vec4(vertex.position, 1.0f);
+}
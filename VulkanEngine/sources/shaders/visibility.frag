@@ -0,0 +1,15 @@
+#version 460
+
+// Tags the pixel with the draw and the triangle it sees, the depth test keeps the closest one.
+
+layout (location = 0) flat in uint inDrawIndex;
+
+layout (location = 0) out uint outVisibility;
+
+// Has to match structures.h.
+const uint VISIBILITY_TRIANGLE_BITS = 19;
+
+void main()
+{
+	outVisibility = (inDrawIndex << VISIBILITY_TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,39 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+// Geometry pass of the visibility buffer. Only the position is fetched, the resolve interpolates the other attributes.
+// The engine draws the index of each draw as first instance.
+
+layout (location = 0) flat out uint outDrawIndex;
+
+// Has to match the depth of the pre-pass (shadow.vert) exactly.
+invariant gl_Position;
+
+struct Vertex
+{
+	vec3 position;
+	float uvX;
+	vec3 normal;
+	float uvY;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer
+{ 
+	Vertex vertices[];
+};
+
+layout (push_constant) uniform PushConstants
+{	
+	mat4 worldMatrix;
+	VertexBuffer vertexBuffer;
+} pushConstants;
+
+void main()
+{
+	Vertex vertex = pushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+	outDrawIndex = gl_InstanceIndex;
+
+	gl_Position = pushConstants.worldMatrix * vec4(vertex.position, 1.0f);
+}